@@ -34,6 +34,15 @@ const OptionInfoRec intel_options[] = {
 	{OPTION_VIRTUAL,	"VirtualHeads",	OPTV_INTEGER,	{0},	0},
 	{OPTION_TEAR_FREE,	"TearFree",	OPTV_BOOLEAN,	{0},	0},
 	{OPTION_CRTC_PIXMAPS,	"PerCrtcPixmaps", OPTV_BOOLEAN,	{0},	0},
+	{OPTION_STATS_INTERVAL,	"StatsInterval", OPTV_INTEGER,	{0},	0},
+	{OPTION_BATCH_OBJECTS,	"MaxBatchObjects", OPTV_INTEGER,	{0},	0},
+	{OPTION_BATCH_RELOCS,	"MaxBatchRelocations", OPTV_INTEGER,	{0},	0},
+	{OPTION_ASYNC_SUBMIT,	"AsyncSubmit",	OPTV_BOOLEAN,	{0},	0},
+	{OPTION_CACHE_BUDGET,	"CacheBudget",	OPTV_STRING,	{0},	0},
+	{OPTION_CACHE_PRESSURE,	"CachePressure", OPTV_INTEGER,	{0},	0},
+	{OPTION_UPLOAD_RING,	"UploadRing",	OPTV_INTEGER,	{0},	0},
+	{OPTION_BATCH_CAPTURE,	"BatchCapture",	OPTV_STRING,	{0},	0},
+	{OPTION_DAMAGE_CAPTURE,	"DamageCapture",	OPTV_STRING,	{0},	0},
 #endif
 #ifdef USE_UXA
 	{OPTION_FALLBACKDEBUG,	"FallbackDebug",OPTV_BOOLEAN,	{0},	0},
@@ -38,6 +38,15 @@ enum intel_options {
 	OPTION_VIRTUAL,
 	OPTION_TEAR_FREE,
 	OPTION_CRTC_PIXMAPS,
+	OPTION_STATS_INTERVAL,
+	OPTION_BATCH_OBJECTS,
+	OPTION_BATCH_RELOCS,
+	OPTION_ASYNC_SUBMIT,
+	OPTION_CACHE_BUDGET,
+	OPTION_CACHE_PRESSURE,
+	OPTION_UPLOAD_RING,
+	OPTION_BATCH_CAPTURE,
+	OPTION_DAMAGE_CAPTURE,
 #endif
 #ifdef USE_UXA
 	OPTION_FALLBACKDEBUG,
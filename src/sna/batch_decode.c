@@ -0,0 +1,409 @@
+/*
+ * Copyright © 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/* Offline decoder for the batches recorded with Option "BatchCapture".
+ *
+ * Every batch in the trace is run through the same decoders as a
+ * debug build of the driver (kgem_debug_gen*.c), with the contents of
+ * the other buffers replaced by zeroes, so no GPU is needed. Besides
+ * the optional full listing (-d), it reports how often each packet
+ * was emitted, how many state packets repeated the previous packet of
+ * the same kind within a batch, and how many bytes of commands each
+ * primitive cost.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "sna.h"
+#include "kgem_debug.h"
+#include "kgem_capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <ctype.h>
+
+static const char * const reason_names[NUM_SUBMIT_REASONS] = {
+	[SUBMIT_OTHER] = "other",
+	[SUBMIT_BATCH] = "batch",
+	[SUBMIT_EXEC] = "exec",
+	[SUBMIT_RELOC] = "reloc",
+	[SUBMIT_FENCE] = "fence",
+	[SUBMIT_APERTURE] = "aperture",
+	[SUBMIT_OPPORTUNISTIC] = "opportunistic",
+	[SUBMIT_DEPENDENCY] = "dependency",
+	[SUBMIT_RING] = "ring-switch",
+	[SUBMIT_IDLE] = "idle",
+	[SUBMIT_SCANOUT] = "scanout",
+	[SUBMIT_BO] = "bo-sync",
+};
+
+static struct packet {
+	char name[48];
+	uint64_t count, dwords;
+	uint64_t redundant, redundant_dwords;
+
+	/* the last emission within the current batch */
+	unsigned batch;
+	uint32_t offset;
+	int len;
+} *packets;
+static int npackets, max_packets;
+
+static struct {
+	unsigned batches;
+	uint64_t commands, state; /* dwords */
+	uint64_t primitives;
+	uint64_t reasons[NUM_SUBMIT_REASONS];
+	uint64_t modes[4];
+	uint64_t first, last; /* usec */
+} totals;
+
+static int verbose;
+static unsigned current_batch;
+static struct kgem kgem;
+static struct kgem_request rq;
+
+void ErrorF(const char *f, ...)
+{
+	va_list va;
+
+	if (!verbose)
+		return;
+
+	va_start(va, f);
+	vprintf(f, va);
+	va_end(va);
+}
+
+void LogF(const char *f, ...)
+{
+	(void)f;
+}
+
+/* We only have the batch; every other buffer reads back as zeroes */
+void *kgem_bo_map__debug(struct kgem *kgem, struct kgem_bo *bo)
+{
+	(void)kgem;
+
+	if (bo->map__gtt == NULL)
+		bo->map__gtt = calloc(1, kgem_bo_size(bo));
+	return bo->map__gtt;
+}
+
+static struct packet *lookup(const char *name)
+{
+	int i;
+
+	for (i = 0; i < npackets; i++)
+		if (strcmp(packets[i].name, name) == 0)
+			return &packets[i];
+
+	if (npackets == max_packets) {
+		struct packet *p;
+
+		max_packets = max_packets ? 2 * max_packets : 64;
+		p = realloc(packets, max_packets * sizeof(*p));
+		if (p == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+		packets = p;
+	}
+
+	memset(&packets[npackets], 0, sizeof(packets[npackets]));
+	snprintf(packets[npackets].name, sizeof(packets[npackets].name),
+		 "%s", name);
+	packets[npackets].batch = -1;
+	return &packets[npackets++];
+}
+
+static void packet(struct kgem *kgem, uint32_t offset, int len,
+		   const char *text)
+{
+	char name[48];
+	struct packet *p;
+	int n;
+
+	/* Keep just the command name from the first line of the decode */
+	for (n = 0; n < sizeof(name) - 1 &&
+	     (isalnum(text[n]) || text[n] == '_'); n++)
+		name[n] = text[n];
+	name[n] = '\0';
+	if (n == 0)
+		snprintf(name, sizeof(name), "[%d] 0x%04x",
+			 kgem->batch[offset] >> 29,
+			 kgem->batch[offset] >> 16);
+
+	p = lookup(name);
+	p->count++;
+	p->dwords += len;
+
+	if (strstr(name, "PRIM"))
+		totals.primitives++;
+
+	/* State that is identical to what the batch already set */
+	if (strstr(name, "STATE") &&
+	    p->batch == current_batch && p->len == len &&
+	    memcmp(kgem->batch + p->offset, kgem->batch + offset,
+		   len * sizeof(uint32_t)) == 0) {
+		p->redundant++;
+		p->redundant_dwords += len;
+	}
+
+	p->batch = current_batch;
+	p->offset = offset;
+	p->len = len;
+}
+
+static int cmp_dwords(const void *A, const void *B)
+{
+	const struct packet *a = A, *b = B;
+
+	if (a->dwords != b->dwords)
+		return a->dwords < b->dwords ? 1 : -1;
+	return strcmp(a->name, b->name);
+}
+
+static void *grow(void *ptr, size_t *size, size_t len)
+{
+	if (len > *size) {
+		ptr = realloc(ptr, len);
+		if (ptr == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+		*size = len;
+	}
+
+	return ptr;
+}
+
+static void *read_array(FILE *file, void *ptr, size_t *size, size_t len)
+{
+	ptr = grow(ptr, size, len);
+	if (len && fread(ptr, len, 1, file) != 1) {
+		fprintf(stderr, "truncated trace\n");
+		exit(1);
+	}
+
+	return ptr;
+}
+
+static void decode_batch(const struct kgem_capture_batch *batch,
+			 const struct kgem_capture_exec *exec)
+{
+	struct kgem_bo *bo;
+	unsigned i;
+
+	list_init(&rq.buffers);
+	for (i = 0; i < batch->nexec; i++) {
+		bo = calloc(1, sizeof(*bo));
+		if (bo == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+
+		bo->handle = exec[i].handle;
+		bo->target_handle = exec[i].target_handle;
+		bo->size.pages.count = (exec[i].size + PAGE_SIZE - 1) / PAGE_SIZE;
+		bo->pitch = exec[i].pitch;
+		bo->tiling = exec[i].tiling;
+		list_init(&bo->vma);
+		list_init(&bo->list);
+		list_add_tail(&bo->request, &rq.buffers);
+	}
+
+	if (verbose)
+		printf("batch %u: ring %d, mode %d, reason %s, %d dwords, %d exec, %d relocs, t=%lluus\n",
+		       current_batch, batch->ring, batch->mode,
+		       batch->reason < NUM_SUBMIT_REASONS ? reason_names[batch->reason] : "?",
+		       batch->nbatch, batch->nexec, batch->nreloc,
+		       (unsigned long long)(batch->timestamp - totals.first));
+
+	__kgem_batch_debug(&kgem, batch->nbatch);
+
+	while (!list_is_empty(&rq.buffers)) {
+		bo = list_first_entry(&rq.buffers, struct kgem_bo, request);
+		list_del(&bo->request);
+		free(bo->map__gtt);
+		free(bo);
+	}
+}
+
+static void report(void)
+{
+	uint64_t redundant = 0;
+	int i;
+
+	printf("%u batches over %.3fs\n", totals.batches,
+	       (totals.last - totals.first) / 1e6);
+	for (i = 0; i < NUM_SUBMIT_REASONS; i++)
+		if (totals.reasons[i])
+			printf("  submitted for %-13s %llu\n", reason_names[i],
+			       (unsigned long long)totals.reasons[i]);
+	for (i = 0; i < ARRAY_SIZE(totals.modes); i++)
+		if (totals.modes[i])
+			printf("  mode %d: %llu batches\n", i,
+			       (unsigned long long)totals.modes[i]);
+
+	qsort(packets, npackets, sizeof(*packets), cmp_dwords);
+
+	printf("\n%-40s %10s %12s %10s %12s\n",
+	       "packet", "count", "dwords", "redundant", "wasted");
+	for (i = 0; i < npackets; i++) {
+		const struct packet *p = &packets[i];
+
+		printf("%-40s %10llu %12llu %10llu %12llu\n",
+		       p->name,
+		       (unsigned long long)p->count,
+		       (unsigned long long)p->dwords,
+		       (unsigned long long)p->redundant,
+		       (unsigned long long)p->redundant_dwords);
+		redundant += p->redundant_dwords;
+	}
+
+	printf("\ncommands %llu bytes, surface state %llu bytes, %llu bytes of identical state re-emitted (%.1f%% of commands)\n",
+	       (unsigned long long)totals.commands * 4,
+	       (unsigned long long)totals.state * 4,
+	       (unsigned long long)redundant * 4,
+	       totals.commands ? 100. * redundant / totals.commands : 0.);
+	if (totals.primitives)
+		printf("%llu primitives: %.1f command bytes, %.1f surface state bytes per primitive\n",
+		       (unsigned long long)totals.primitives,
+		       4. * totals.commands / totals.primitives,
+		       4. * totals.state / totals.primitives);
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s [-d] trace\n", argv0);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct kgem_capture_header header;
+	struct kgem_capture_batch batch;
+	struct kgem_capture_exec *exec = NULL;
+	size_t batch_size = 0, exec_size = 0, reloc_size = 0, eo_size = 0;
+	FILE *file;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "d")) != -1) {
+		switch (c) {
+		case 'd': verbose = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind + 1 != argc)
+		usage(argv[0]);
+
+	file = fopen(argv[optind], "rb");
+	if (file == NULL) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	if (fread(&header, sizeof(header), 1, file) != 1 ||
+	    header.magic != KGEM_CAPTURE_MAGIC) {
+		fprintf(stderr, "%s: not a batch capture\n", argv[optind]);
+		return 1;
+	}
+	if (header.version != KGEM_CAPTURE_VERSION) {
+		fprintf(stderr, "%s: unsupported capture version %d\n",
+			argv[optind], header.version);
+		return 1;
+	}
+
+	printf("gen %d%d%s\n", header.gen >> 3, header.gen & 7,
+	       header.flags & KGEM_CAPTURE_HANDLE_LUT ? ", handle lut" : "");
+
+	kgem.gen = header.gen;
+	kgem.has_handle_lut = !!(header.flags & KGEM_CAPTURE_HANDLE_LUT);
+	kgem.next_request = &rq;
+	kgem_debug_packet = packet;
+
+	while (fread(&batch, sizeof(batch), 1, file) == 1) {
+		if (batch.nbatch > batch.surface ||
+		    batch.surface > batch.batch_size) {
+			fprintf(stderr, "corrupt batch %u\n", current_batch);
+			return 1;
+		}
+
+		/* the commands, then the state packed at the top */
+		kgem.batch = grow(kgem.batch, &batch_size,
+				  sizeof(uint32_t) * batch.batch_size);
+		read_array(file, kgem.batch, &batch_size,
+			   sizeof(uint32_t) * (batch.nbatch + batch.batch_size - batch.surface));
+		memmove(kgem.batch + batch.surface,
+			kgem.batch + batch.nbatch,
+			sizeof(uint32_t) * (batch.batch_size - batch.surface));
+		memset(kgem.batch + batch.nbatch, 0,
+		       sizeof(uint32_t) * (batch.surface - batch.nbatch));
+
+		exec = read_array(file, exec, &exec_size,
+				  sizeof(*exec) * batch.nexec);
+		kgem.reloc = read_array(file, kgem.reloc, &reloc_size,
+					sizeof(kgem.reloc[0]) * batch.nreloc);
+
+		kgem.exec = grow(kgem.exec, &eo_size,
+				 sizeof(kgem.exec[0]) * batch.nexec);
+		for (i = 0; i < batch.nexec; i++) {
+			memset(&kgem.exec[i], 0, sizeof(kgem.exec[i]));
+			kgem.exec[i].handle = exec[i].handle;
+			kgem.exec[i].flags = exec[i].flags;
+		}
+
+		kgem.nbatch = batch.nbatch;
+		kgem.surface = batch.surface;
+		kgem.batch_size = batch.batch_size;
+		kgem.nexec = batch.nexec;
+		kgem.nreloc = batch.nreloc;
+		kgem.mode = batch.mode;
+		kgem.ring = batch.ring;
+
+		if (totals.batches == 0)
+			totals.first = batch.timestamp;
+		totals.last = batch.timestamp;
+		totals.batches++;
+		totals.commands += batch.nbatch;
+		totals.state += batch.batch_size - batch.surface;
+		if (batch.reason < NUM_SUBMIT_REASONS)
+			totals.reasons[batch.reason]++;
+		if (batch.mode < ARRAY_SIZE(totals.modes))
+			totals.modes[batch.mode]++;
+
+		decode_batch(&batch, exec);
+		current_batch++;
+	}
+	fclose(file);
+
+	report();
+	return 0;
+}
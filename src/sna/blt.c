@@ -31,6 +31,7 @@
 
 #include "sna.h"
 #include <pixman.h>
+#include <math.h>
 
 #if __x86_64__
 #define USE_SSE2 1
@@ -38,6 +39,7 @@
 
 #if USE_SSE2
 #include <xmmintrin.h>
+#include <emmintrin.h>
 
 #if __x86_64__
 #define have_sse2() 1
@@ -139,12 +141,261 @@ xmm_save_128(__m128i *dst, __m128i data)
 }
 #endif
 
-fast void
-memcpy_blt(const void *src, void *dst, int bpp,
-	   int32_t src_stride, int32_t dst_stride,
-	   int16_t src_x, int16_t src_y,
-	   int16_t dst_x, int16_t dst_y,
-	   uint16_t width, uint16_t height)
+#if defined(avx2) && HAS_GCC(4, 9) && __x86_64__
+#define USE_AVX2 1
+#endif
+
+#if defined(avx512) && HAS_GCC(4, 9) && __x86_64__
+#define USE_AVX512 1
+#endif
+
+#if defined(sse4_1) && HAS_GCC(4, 9) && __x86_64__
+#define USE_SSE4_1 1
+#endif
+
+#if USE_AVX2 || USE_AVX512
+#include <immintrin.h>
+#elif USE_SSE4_1
+#include <smmintrin.h>
+#endif
+
+#if USE_AVX2
+avx2 static force_inline void
+copy_32__avx2(uint8_t *dst, const uint8_t *src)
+{
+	_mm256_storeu_si256((__m256i *)dst,
+			    _mm256_loadu_si256((const __m256i *)src));
+}
+
+avx2 static force_inline void
+copy_64__avx2(uint8_t *dst, const uint8_t *src)
+{
+	__m256i ymm0, ymm1;
+
+	ymm0 = _mm256_loadu_si256((const __m256i *)src + 0);
+	ymm1 = _mm256_loadu_si256((const __m256i *)src + 1);
+
+	_mm256_storeu_si256((__m256i *)dst + 0, ymm0);
+	_mm256_storeu_si256((__m256i *)dst + 1, ymm1);
+}
+
+/* Copy a row of at least 32 bytes, finishing with an overlapping store */
+avx2 static force_inline void
+copy_row__avx2(uint8_t *dst, const uint8_t *src, unsigned len)
+{
+	unsigned i = 0;
+
+	assert(len >= 32);
+
+	for (; i + 128 <= len; i += 128) {
+		copy_64__avx2(dst + i + 0, src + i + 0);
+		copy_64__avx2(dst + i + 64, src + i + 64);
+	}
+	for (; i + 32 <= len; i += 32)
+		copy_32__avx2(dst + i, src + i);
+	if (i < len)
+		copy_32__avx2(dst + len - 32, src + len - 32);
+}
+#endif
+
+#if USE_AVX512
+avx512 static force_inline void
+copy_64__avx512(uint8_t *dst, const uint8_t *src)
+{
+	_mm512_storeu_si512((void *)dst,
+			    _mm512_loadu_si512((const void *)src));
+}
+
+/* Copy a row of at least 64 bytes, finishing with an overlapping store */
+avx512 static force_inline void
+copy_row__avx512(uint8_t *dst, const uint8_t *src, unsigned len)
+{
+	unsigned i = 0;
+
+	assert(len >= 64);
+
+	for (; i + 256 <= len; i += 256) {
+		copy_64__avx512(dst + i + 0, src + i + 0);
+		copy_64__avx512(dst + i + 64, src + i + 64);
+		copy_64__avx512(dst + i + 128, src + i + 128);
+		copy_64__avx512(dst + i + 192, src + i + 192);
+	}
+	for (; i + 64 <= len; i += 64)
+		copy_64__avx512(dst + i, src + i);
+	if (i < len)
+		copy_64__avx512(dst + len - 64, src + len - 64);
+}
+#endif
+
+/* Apply (src & and) | or to a row of 32-bit pixels */
+static fast void
+xor_row_32__generic(uint32_t *d, const uint32_t *s, int w,
+		    uint32_t and, uint32_t or)
+{
+#if USE_SSE2
+	__m128i and_mask = xmm_create_mask_32(and);
+	__m128i or_mask = xmm_create_mask_32(or);
+
+	while (w && (uintptr_t)d & 15) {
+		*d++ = (*s++ & and) | or;
+		w--;
+	}
+
+	while (w >= 16) {
+		__m128i xmm1, xmm2, xmm3, xmm4;
+
+		xmm1 = xmm_load_128u((const __m128i*)s + 0);
+		xmm2 = xmm_load_128u((const __m128i*)s + 1);
+		xmm3 = xmm_load_128u((const __m128i*)s + 2);
+		xmm4 = xmm_load_128u((const __m128i*)s + 3);
+
+		xmm_save_128((__m128i*)d + 0,
+			     _mm_or_si128(_mm_and_si128(xmm1, and_mask), or_mask));
+		xmm_save_128((__m128i*)d + 1,
+			     _mm_or_si128(_mm_and_si128(xmm2, and_mask), or_mask));
+		xmm_save_128((__m128i*)d + 2,
+			     _mm_or_si128(_mm_and_si128(xmm3, and_mask), or_mask));
+		xmm_save_128((__m128i*)d + 3,
+			     _mm_or_si128(_mm_and_si128(xmm4, and_mask), or_mask));
+
+		d += 16;
+		s += 16;
+		w -= 16;
+	}
+
+	while (w >= 4) {
+		xmm_save_128((__m128i*)d,
+			     _mm_or_si128(_mm_and_si128(xmm_load_128u((const __m128i*)s),
+							and_mask),
+					  or_mask));
+
+		d += 4;
+		s += 4;
+		w -= 4;
+	}
+#endif
+
+	while (w) {
+		*d++ = (*s++ & and) | or;
+		w--;
+	}
+}
+
+#if USE_AVX2
+avx2 static void
+xor_row_32__avx2(uint32_t *d, const uint32_t *s, int w,
+		 uint32_t and, uint32_t or)
+{
+	__m256i and_mask = _mm256_set1_epi32(and);
+	__m256i or_mask = _mm256_set1_epi32(or);
+
+	while (w && (uintptr_t)d & 31) {
+		*d++ = (*s++ & and) | or;
+		w--;
+	}
+
+	while (w >= 32) {
+		__m256i ymm0, ymm1, ymm2, ymm3;
+
+		ymm0 = _mm256_loadu_si256((const __m256i *)s + 0);
+		ymm1 = _mm256_loadu_si256((const __m256i *)s + 1);
+		ymm2 = _mm256_loadu_si256((const __m256i *)s + 2);
+		ymm3 = _mm256_loadu_si256((const __m256i *)s + 3);
+
+		_mm256_store_si256((__m256i *)d + 0,
+				   _mm256_or_si256(_mm256_and_si256(ymm0, and_mask), or_mask));
+		_mm256_store_si256((__m256i *)d + 1,
+				   _mm256_or_si256(_mm256_and_si256(ymm1, and_mask), or_mask));
+		_mm256_store_si256((__m256i *)d + 2,
+				   _mm256_or_si256(_mm256_and_si256(ymm2, and_mask), or_mask));
+		_mm256_store_si256((__m256i *)d + 3,
+				   _mm256_or_si256(_mm256_and_si256(ymm3, and_mask), or_mask));
+
+		d += 32;
+		s += 32;
+		w -= 32;
+	}
+
+	while (w >= 8) {
+		_mm256_store_si256((__m256i *)d,
+				   _mm256_or_si256(_mm256_and_si256(_mm256_loadu_si256((const __m256i *)s),
+								    and_mask),
+						   or_mask));
+
+		d += 8;
+		s += 8;
+		w -= 8;
+	}
+
+	while (w) {
+		*d++ = (*s++ & and) | or;
+		w--;
+	}
+}
+#endif
+
+static void (*xor_row_32)(uint32_t *d, const uint32_t *s, int w,
+			  uint32_t and, uint32_t or) = xor_row_32__generic;
+
+/* Apply the replicated (and, or) masks to a run of bytes starting on a
+ * pixel boundary.
+ */
+static force_inline void
+xor_bytes(uint8_t *d, const uint8_t *s, unsigned len,
+	  uint32_t and, uint32_t or)
+{
+	unsigned i;
+
+	for (i = 0; i < len; i++) {
+		unsigned shift = 8 * (i & 3);
+		d[i] = (s[i] & (and >> shift)) | (or >> shift);
+	}
+}
+
+static force_inline void
+xor_64__generic(uint8_t *d, const uint8_t *s, uint32_t and, uint32_t or)
+{
+#if USE_SSE2
+	__m128i and_mask = xmm_create_mask_32(and);
+	__m128i or_mask = xmm_create_mask_32(or);
+	__m128i xmm0, xmm1, xmm2, xmm3;
+
+	xmm0 = xmm_load_128u((const __m128i *)s + 0);
+	xmm1 = xmm_load_128u((const __m128i *)s + 1);
+	xmm2 = xmm_load_128u((const __m128i *)s + 2);
+	xmm3 = xmm_load_128u((const __m128i *)s + 3);
+
+	_mm_storeu_si128((__m128i *)d + 0, _mm_or_si128(_mm_and_si128(xmm0, and_mask), or_mask));
+	_mm_storeu_si128((__m128i *)d + 1, _mm_or_si128(_mm_and_si128(xmm1, and_mask), or_mask));
+	_mm_storeu_si128((__m128i *)d + 2, _mm_or_si128(_mm_and_si128(xmm2, and_mask), or_mask));
+	_mm_storeu_si128((__m128i *)d + 3, _mm_or_si128(_mm_and_si128(xmm3, and_mask), or_mask));
+#else
+	xor_bytes(d, s, 64, and, or);
+#endif
+}
+
+#if USE_AVX2
+avx2 static force_inline void
+xor_64__avx2(uint8_t *d, const uint8_t *s, uint32_t and, uint32_t or)
+{
+	__m256i and_mask = _mm256_set1_epi32(and);
+	__m256i or_mask = _mm256_set1_epi32(or);
+	__m256i ymm0, ymm1;
+
+	ymm0 = _mm256_loadu_si256((const __m256i *)s + 0);
+	ymm1 = _mm256_loadu_si256((const __m256i *)s + 1);
+
+	_mm256_storeu_si256((__m256i *)d + 0, _mm256_or_si256(_mm256_and_si256(ymm0, and_mask), or_mask));
+	_mm256_storeu_si256((__m256i *)d + 1, _mm256_or_si256(_mm256_and_si256(ymm1, and_mask), or_mask));
+}
+#endif
+
+static fast void
+memcpy_blt__generic(const void *src, void *dst, int bpp,
+		    int32_t src_stride, int32_t dst_stride,
+		    int16_t src_x, int16_t src_y,
+		    int16_t dst_x, int16_t dst_y,
+		    uint16_t width, uint16_t height)
 {
 	const uint8_t *src_bytes;
 	uint8_t *dst_bytes;
@@ -222,6 +473,230 @@ memcpy_blt(const void *src, void *dst, int bpp,
 	}
 }
 
+#define memcpy_blt__simd(isa, min_width) \
+isa static void \
+memcpy_blt__##isa (const void *src, void *dst, int bpp, \
+		   int32_t src_stride, int32_t dst_stride, \
+		   int16_t src_x, int16_t src_y, \
+		   int16_t dst_x, int16_t dst_y, \
+		   uint16_t width, uint16_t height) \
+{ \
+	const uint8_t *src_bytes; \
+	uint8_t *dst_bytes; \
+	unsigned byte_width; \
+	assert(src); \
+	assert(dst); \
+	assert(width && height); \
+	assert(bpp >= 8); \
+	assert(width*bpp <= 8*src_stride); \
+	assert(width*bpp <= 8*dst_stride); \
+	byte_width = width * bpp / 8; \
+	if (byte_width < min_width) { \
+		memcpy_blt__generic(src, dst, bpp, \
+				    src_stride, dst_stride, \
+				    src_x, src_y, \
+				    dst_x, dst_y, \
+				    width, height); \
+		return; \
+	} \
+	DBG(("%s: src=(%d, %d), dst=(%d, %d), size=%dx%d, pitch=%d/%d\n", \
+	     __FUNCTION__, src_x, src_y, dst_x, dst_y, width, height, src_stride, dst_stride)); \
+	src_bytes = (const uint8_t *)src + src_stride * src_y + src_x * bpp / 8; \
+	dst_bytes = (uint8_t *)dst + dst_stride * dst_y + dst_x * bpp / 8; \
+	if (byte_width == src_stride && byte_width == dst_stride) { \
+		byte_width *= height; \
+		height = 1; \
+	} \
+	do { \
+		copy_row__##isa(dst_bytes, src_bytes, byte_width); \
+		src_bytes += src_stride; \
+		dst_bytes += dst_stride; \
+	} while (--height); \
+}
+
+#if USE_AVX2
+memcpy_blt__simd(avx2, 32)
+#endif
+
+#if USE_AVX512
+memcpy_blt__simd(avx512, 64)
+#endif
+
+static void (*__memcpy_blt)(const void *src, void *dst, int bpp,
+			    int32_t src_stride, int32_t dst_stride,
+			    int16_t src_x, int16_t src_y,
+			    int16_t dst_x, int16_t dst_y,
+			    uint16_t width, uint16_t height) = memcpy_blt__generic;
+
+void
+memcpy_blt(const void *src, void *dst, int bpp,
+	   int32_t src_stride, int32_t dst_stride,
+	   int16_t src_x, int16_t src_y,
+	   int16_t dst_x, int16_t dst_y,
+	   uint16_t width, uint16_t height)
+{
+	__memcpy_blt(src, dst, bpp,
+		     src_stride, dst_stride,
+		     src_x, src_y,
+		     dst_x, dst_y,
+		     width, height);
+}
+
+#if USE_SSE4_1
+/* Reads from WC (or GTT) mappings are uncached, and so each ordinary load
+ * stalls waiting on the memory bus. MOVNTDQA instead fetches a whole
+ * cacheline into a streaming buffer, and so we can pull the source in at
+ * full speed into a small (cacheable) bounce buffer, and then copy from
+ * there into the destination using normal loads and stores.
+ *
+ * The streaming loads must be 16-byte aligned, so we read the whole of
+ * each aligned block spanned by the row - which never crosses into the
+ * next page and so always remains inside the mapping.
+ */
+sse4_1 static void
+memcpy_blt__from_wc__sse4_1(const void *src, void *dst, int bpp,
+			    int32_t src_stride, int32_t dst_stride,
+			    int16_t src_x, int16_t src_y,
+			    int16_t dst_x, int16_t dst_y,
+			    uint16_t width, uint16_t height)
+{
+	uint8_t bounce[4096] __attribute__((aligned(64)));
+	const uint8_t *src_bytes;
+	uint8_t *dst_bytes;
+	unsigned byte_width;
+
+	assert(src);
+	assert(dst);
+	assert(width && height);
+	assert(bpp >= 8);
+	assert(width*bpp <= 8*src_stride);
+	assert(width*bpp <= 8*dst_stride);
+
+	byte_width = width * bpp / 8;
+	if (byte_width < 16) {
+		__memcpy_blt(src, dst, bpp,
+			     src_stride, dst_stride,
+			     src_x, src_y,
+			     dst_x, dst_y,
+			     width, height);
+		return;
+	}
+
+	DBG(("%s: src=(%d, %d), dst=(%d, %d), size=%dx%d, pitch=%d/%d\n",
+	     __FUNCTION__, src_x, src_y, dst_x, dst_y, width, height, src_stride, dst_stride));
+
+	src_bytes = (const uint8_t *)src + src_stride * src_y + src_x * bpp / 8;
+	dst_bytes = (uint8_t *)dst + dst_stride * dst_y + dst_x * bpp / 8;
+
+	if (byte_width == src_stride && byte_width == dst_stride) {
+		byte_width *= height;
+		height = 1;
+	}
+
+	do {
+		const uint8_t *s = src_bytes;
+		uint8_t *d = dst_bytes;
+		unsigned len = byte_width;
+
+		do {
+			const unsigned offset = (uintptr_t)s & 15;
+			const unsigned chunk = min(len, sizeof(bounce) - offset);
+			__m128i *in = (__m128i *)(s - offset);
+			__m128i *out = (__m128i *)bounce;
+			unsigned n = (offset + chunk + 15) / 16;
+
+			while (n >= 4) {
+				__m128i xmm0, xmm1, xmm2, xmm3;
+
+				xmm0 = _mm_stream_load_si128(in + 0);
+				xmm1 = _mm_stream_load_si128(in + 1);
+				xmm2 = _mm_stream_load_si128(in + 2);
+				xmm3 = _mm_stream_load_si128(in + 3);
+
+				_mm_store_si128(out + 0, xmm0);
+				_mm_store_si128(out + 1, xmm1);
+				_mm_store_si128(out + 2, xmm2);
+				_mm_store_si128(out + 3, xmm3);
+
+				in += 4;
+				out += 4;
+				n -= 4;
+			}
+			while (n--)
+				_mm_store_si128(out++, _mm_stream_load_si128(in++));
+
+			memcpy(d, bounce + offset, chunk);
+
+			s += chunk;
+			d += chunk;
+			len -= chunk;
+		} while (len);
+
+		src_bytes += src_stride;
+		dst_bytes += dst_stride;
+	} while (--height);
+}
+#endif
+
+static void (*__memcpy_blt__from_wc)(const void *src, void *dst, int bpp,
+				     int32_t src_stride, int32_t dst_stride,
+				     int16_t src_x, int16_t src_y,
+				     int16_t dst_x, int16_t dst_y,
+				     uint16_t width, uint16_t height) = memcpy_blt__generic;
+
+void
+memcpy_blt__from_wc(const void *src, void *dst, int bpp,
+		    int32_t src_stride, int32_t dst_stride,
+		    int16_t src_x, int16_t src_y,
+		    int16_t dst_x, int16_t dst_y,
+		    uint16_t width, uint16_t height)
+{
+	__memcpy_blt__from_wc(src, dst, bpp,
+			      src_stride, dst_stride,
+			      src_x, src_y,
+			      dst_x, dst_y,
+			      width, height);
+}
+
+static void choose_affine_blt(unsigned cpu);
+
+void choose_memcpy_blt(unsigned cpu)
+{
+#if USE_AVX512
+	if (cpu & AVX512F) {
+		DBG(("%s: avx512\n", __FUNCTION__));
+		__memcpy_blt = memcpy_blt__avx512;
+	} else
+#endif
+#if USE_AVX2
+	if (cpu & AVX2) {
+		DBG(("%s: avx2\n", __FUNCTION__));
+		__memcpy_blt = memcpy_blt__avx2;
+	} else
+#endif
+	{
+		DBG(("%s: generic\n", __FUNCTION__));
+		__memcpy_blt = memcpy_blt__generic;
+	}
+
+#if USE_SSE4_1
+	if (cpu & SSE4_1) {
+		DBG(("%s: streaming loads from WC\n", __FUNCTION__));
+		__memcpy_blt__from_wc = memcpy_blt__from_wc__sse4_1;
+	} else
+#endif
+		__memcpy_blt__from_wc = __memcpy_blt;
+
+#if USE_AVX2
+	if (cpu & AVX2)
+		xor_row_32 = xor_row_32__avx2;
+	else
+#endif
+		xor_row_32 = xor_row_32__generic;
+
+	choose_affine_blt(cpu);
+}
+
 static fast_memcpy void
 memcpy_to_tiled_x__swizzle_0(const void *src, void *dst, int bpp,
 			     int32_t src_stride, int32_t dst_stride,
@@ -454,57 +929,724 @@ memcpy_from_tiled_x__##swizzle (const void *src, void *dst, int bpp, \
 	} \
 }
 
-#define swizzle_9(X) ((X) ^ (((X) >> 3) & 64))
-memcpy_to_tiled_x(swizzle_9)
-memcpy_from_tiled_x(swizzle_9)
-#undef swizzle_9
-
-#define swizzle_9_10(X) ((X) ^ ((((X) ^ ((X) >> 1)) >> 3) & 64))
-memcpy_to_tiled_x(swizzle_9_10)
-memcpy_from_tiled_x(swizzle_9_10)
-#undef swizzle_9_10
-
-#define swizzle_9_11(X) ((X) ^ ((((X) ^ ((X) >> 2)) >> 3) & 64))
-memcpy_to_tiled_x(swizzle_9_11)
-memcpy_from_tiled_x(swizzle_9_11)
-#undef swizzle_9_11
-
-#define swizzle_9_10_11(X) ((X) ^ ((((X) ^ ((X) >> 1) ^ ((X) >> 2)) >> 3) & 64))
-memcpy_to_tiled_x(swizzle_9_10_11)
-memcpy_from_tiled_x(swizzle_9_10_11)
-#undef swizzle_9_10_11
-
-static fast_memcpy void
-memcpy_to_tiled_x__gen2(const void *src, void *dst, int bpp,
-			int32_t src_stride, int32_t dst_stride,
-			int16_t src_x, int16_t src_y,
-			int16_t dst_x, int16_t dst_y,
-			uint16_t width, uint16_t height)
-{
-	const unsigned tile_width = 128;
-	const unsigned tile_height = 16;
-	const unsigned tile_size = 2048;
-
-	const unsigned cpp = bpp / 8;
-	const unsigned tile_pixels = tile_width / cpp;
-	const unsigned tile_shift = ffs(tile_pixels) - 1;
-	const unsigned tile_mask = tile_pixels - 1;
-
-	DBG(("%s(bpp=%d): src=(%d, %d), dst=(%d, %d), size=%dx%d, pitch=%d/%d\n",
-	     __FUNCTION__, bpp, src_x, src_y, dst_x, dst_y, width, height, src_stride, dst_stride));
-	assert(src != dst);
-
-	if (src_x | src_y)
-		src = (const uint8_t *)src + src_y * src_stride + src_x * cpp;
-	assert(src_stride >= width * cpp);
-	src_stride -= width * cpp;
-
-	while (height--) {
-		unsigned w = width * cpp;
-		uint8_t *tile_row = dst;
+/* As memcpy_to_tiled_x(), but with the 64-byte swizzle-aligned spans
+ * copied using the vector unit rather than through memcpy().
+ */
+#define memcpy_to_tiled_x__simd(swizzle, isa) \
+isa static void \
+memcpy_to_tiled_x__##swizzle##__##isa (const void *src, void *dst, int bpp, \
+				       int32_t src_stride, int32_t dst_stride, \
+				       int16_t src_x, int16_t src_y, \
+				       int16_t dst_x, int16_t dst_y, \
+				       uint16_t width, uint16_t height) \
+{ \
+	const unsigned tile_width = 512; \
+	const unsigned tile_height = 8; \
+	const unsigned tile_size = 4096; \
+	const unsigned cpp = bpp / 8; \
+	const unsigned stride_tiles = dst_stride / tile_width; \
+	const unsigned swizzle_pixels = 64 / cpp; \
+	const unsigned tile_pixels = ffs(tile_width / cpp) - 1; \
+	const unsigned tile_mask = (1 << tile_pixels) - 1; \
+	unsigned x, y; \
+	DBG(("%s(bpp=%d): src=(%d, %d), dst=(%d, %d), size=%dx%d, pitch=%d/%d\n", \
+	     __FUNCTION__, bpp, src_x, src_y, dst_x, dst_y, width, height, src_stride, dst_stride)); \
+	src = (const uint8_t *)src + src_y * src_stride + src_x * cpp; \
+	for (y = 0; y < height; ++y) { \
+		const uint32_t dy = y + dst_y; \
+		const uint32_t tile_row = \
+			(dy / tile_height * stride_tiles * tile_size + \
+			 (dy & (tile_height-1)) * tile_width); \
+		const uint8_t *src_row = (const uint8_t *)src + src_stride * y; \
+		uint32_t dx = dst_x; \
+		x = width * cpp; \
+		if (dx & (swizzle_pixels - 1)) { \
+			const uint32_t swizzle_bound_pixels = ALIGN(dx + 1, swizzle_pixels); \
+			const uint32_t length = min(dst_x + width, swizzle_bound_pixels) - dx; \
+			uint32_t offset = \
+				tile_row + \
+				(dx >> tile_pixels) * tile_size + \
+				(dx & tile_mask) * cpp; \
+			memcpy((char *)dst + swizzle(offset), src_row, length * cpp); \
+			src_row += length * cpp; \
+			x -= length * cpp; \
+			dx += length; \
+		} \
+		while (x >= 64) { \
+			uint32_t offset = \
+				tile_row + \
+				(dx >> tile_pixels) * tile_size + \
+				(dx & tile_mask) * cpp; \
+			copy_64__##isa((uint8_t *)dst + swizzle(offset), src_row); \
+			src_row += 64; \
+			x -= 64; \
+			dx += swizzle_pixels; \
+		} \
+		if (x) { \
+			uint32_t offset = \
+				tile_row + \
+				(dx >> tile_pixels) * tile_size + \
+				(dx & tile_mask) * cpp; \
+			memcpy((char *)dst + swizzle(offset), src_row, x); \
+		} \
+	} \
+}
 
-		tile_row += dst_y / tile_height * dst_stride * tile_height;
-		tile_row += (dst_y & (tile_height-1)) * tile_width;
+#define memcpy_from_tiled_x__simd(swizzle, isa) \
+isa static void \
+memcpy_from_tiled_x__##swizzle##__##isa (const void *src, void *dst, int bpp, \
+					 int32_t src_stride, int32_t dst_stride, \
+					 int16_t src_x, int16_t src_y, \
+					 int16_t dst_x, int16_t dst_y, \
+					 uint16_t width, uint16_t height) \
+{ \
+	const unsigned tile_width = 512; \
+	const unsigned tile_height = 8; \
+	const unsigned tile_size = 4096; \
+	const unsigned cpp = bpp / 8; \
+	const unsigned stride_tiles = src_stride / tile_width; \
+	const unsigned swizzle_pixels = 64 / cpp; \
+	const unsigned tile_pixels = ffs(tile_width / cpp) - 1; \
+	const unsigned tile_mask = (1 << tile_pixels) - 1; \
+	unsigned x, y; \
+	DBG(("%s(bpp=%d): src=(%d, %d), dst=(%d, %d), size=%dx%d, pitch=%d/%d\n", \
+	     __FUNCTION__, bpp, src_x, src_y, dst_x, dst_y, width, height, src_stride, dst_stride)); \
+	dst = (uint8_t *)dst + dst_y * dst_stride + dst_x * cpp; \
+	for (y = 0; y < height; ++y) { \
+		const uint32_t sy = y + src_y; \
+		const uint32_t tile_row = \
+			(sy / tile_height * stride_tiles * tile_size + \
+			 (sy & (tile_height-1)) * tile_width); \
+		uint8_t *dst_row = (uint8_t *)dst + dst_stride * y; \
+		uint32_t sx = src_x; \
+		x = width * cpp; \
+		if (sx & (swizzle_pixels - 1)) { \
+			const uint32_t swizzle_bound_pixels = ALIGN(sx + 1, swizzle_pixels); \
+			const uint32_t length = min(src_x + width, swizzle_bound_pixels) - sx; \
+			uint32_t offset = \
+				tile_row + \
+				(sx >> tile_pixels) * tile_size + \
+				(sx & tile_mask) * cpp; \
+			memcpy(dst_row, (const char *)src + swizzle(offset), length * cpp); \
+			dst_row += length * cpp; \
+			x -= length * cpp; \
+			sx += length; \
+		} \
+		while (x >= 64) { \
+			uint32_t offset = \
+				tile_row + \
+				(sx >> tile_pixels) * tile_size + \
+				(sx & tile_mask) * cpp; \
+			copy_64__##isa(dst_row, (const uint8_t *)src + swizzle(offset)); \
+			dst_row += 64; \
+			x -= 64; \
+			sx += swizzle_pixels; \
+		} \
+		if (x) { \
+			uint32_t offset = \
+				tile_row + \
+				(sx >> tile_pixels) * tile_size + \
+				(sx & tile_mask) * cpp; \
+			memcpy(dst_row, (const char *)src + swizzle(offset), x); \
+		} \
+	} \
+}
+
+#if USE_AVX2
+#define memcpy_tiled_x__avx2(swizzle) \
+	memcpy_to_tiled_x__simd(swizzle, avx2) \
+	memcpy_from_tiled_x__simd(swizzle, avx2)
+#else
+#define memcpy_tiled_x__avx2(swizzle)
+#endif
+
+#if USE_AVX512
+#define memcpy_tiled_x__avx512(swizzle) \
+	memcpy_to_tiled_x__simd(swizzle, avx512) \
+	memcpy_from_tiled_x__simd(swizzle, avx512)
+#else
+#define memcpy_tiled_x__avx512(swizzle)
+#endif
+
+#define swizzle_0(X) (X)
+memcpy_tiled_x__avx2(swizzle_0)
+memcpy_tiled_x__avx512(swizzle_0)
+#undef swizzle_0
+
+#define swizzle_9(X) ((X) ^ (((X) >> 3) & 64))
+memcpy_to_tiled_x(swizzle_9)
+memcpy_from_tiled_x(swizzle_9)
+memcpy_tiled_x__avx2(swizzle_9)
+memcpy_tiled_x__avx512(swizzle_9)
+#undef swizzle_9
+
+#define swizzle_9_10(X) ((X) ^ ((((X) ^ ((X) >> 1)) >> 3) & 64))
+memcpy_to_tiled_x(swizzle_9_10)
+memcpy_from_tiled_x(swizzle_9_10)
+memcpy_tiled_x__avx2(swizzle_9_10)
+memcpy_tiled_x__avx512(swizzle_9_10)
+#undef swizzle_9_10
+
+#define swizzle_9_11(X) ((X) ^ ((((X) ^ ((X) >> 2)) >> 3) & 64))
+memcpy_to_tiled_x(swizzle_9_11)
+memcpy_from_tiled_x(swizzle_9_11)
+memcpy_tiled_x__avx2(swizzle_9_11)
+memcpy_tiled_x__avx512(swizzle_9_11)
+#undef swizzle_9_11
+
+#define swizzle_9_10_11(X) ((X) ^ ((((X) ^ ((X) >> 1) ^ ((X) >> 2)) >> 3) & 64))
+memcpy_to_tiled_x(swizzle_9_10_11)
+memcpy_from_tiled_x(swizzle_9_10_11)
+memcpy_tiled_x__avx2(swizzle_9_10_11)
+memcpy_tiled_x__avx512(swizzle_9_10_11)
+#undef swizzle_9_10_11
+
+/* Y-tiles are 128 bytes wide and 32 rows high, but are stored as a set
+ * of 8 columns of 16 bytes (an OWord) each 32 rows high. So consecutive
+ * rows within a column are 16 bytes apart, and the contiguous runs we can
+ * copy are at most 16 bytes long.
+ */
+#define memcpy_to_tiled_y(swizzle) \
+fast_memcpy static void \
+memcpy_to_tiled_y__##swizzle (const void *src, void *dst, int bpp, \
+			      int32_t src_stride, int32_t dst_stride, \
+			      int16_t src_x, int16_t src_y, \
+			      int16_t dst_x, int16_t dst_y, \
+			      uint16_t width, uint16_t height) \
+{ \
+	const unsigned tile_width = 128; \
+	const unsigned tile_height = 32; \
+	const unsigned tile_size = 4096; \
+	const unsigned column_width = 16; \
+	const unsigned column_size = column_width * tile_height; \
+	const unsigned cpp = bpp / 8; \
+	const unsigned stride_tiles = dst_stride / tile_width; \
+	unsigned x, y; \
+	DBG(("%s(bpp=%d): src=(%d, %d), dst=(%d, %d), size=%dx%d, pitch=%d/%d\n", \
+	     __FUNCTION__, bpp, src_x, src_y, dst_x, dst_y, width, height, src_stride, dst_stride)); \
+	src = (const uint8_t *)src + src_y * src_stride + src_x * cpp; \
+	for (y = 0; y < height; ++y) { \
+		const uint32_t dy = y + dst_y; \
+		const uint32_t tile_row = \
+			(dy / tile_height * stride_tiles * tile_size + \
+			 (dy & (tile_height-1)) * column_width); \
+		const uint8_t *src_row = (const uint8_t *)src + src_stride * y; \
+		uint32_t dx = dst_x * cpp; \
+		x = width * cpp; \
+		if (dx & (column_width - 1)) { \
+			const uint32_t length = min(column_width - (dx & (column_width - 1)), x); \
+			uint32_t offset = \
+				tile_row + \
+				dx / tile_width * tile_size + \
+				(dx & (tile_width-1)) / column_width * column_size + \
+				(dx & (column_width-1)); \
+			memcpy((char *)dst + swizzle(offset), src_row, length); \
+			src_row += length; \
+			x -= length; \
+			dx += length; \
+		} \
+		while (x >= column_width) { \
+			uint32_t offset = \
+				tile_row + \
+				dx / tile_width * tile_size + \
+				(dx & (tile_width-1)) / column_width * column_size; \
+			memcpy((char *)dst + swizzle(offset), src_row, column_width); \
+			src_row += column_width; \
+			x -= column_width; \
+			dx += column_width; \
+		} \
+		if (x) { \
+			uint32_t offset = \
+				tile_row + \
+				dx / tile_width * tile_size + \
+				(dx & (tile_width-1)) / column_width * column_size; \
+			memcpy((char *)dst + swizzle(offset), src_row, x); \
+		} \
+	} \
+}
+
+#define memcpy_from_tiled_y(swizzle) \
+fast_memcpy static void \
+memcpy_from_tiled_y__##swizzle (const void *src, void *dst, int bpp, \
+				int32_t src_stride, int32_t dst_stride, \
+				int16_t src_x, int16_t src_y, \
+				int16_t dst_x, int16_t dst_y, \
+				uint16_t width, uint16_t height) \
+{ \
+	const unsigned tile_width = 128; \
+	const unsigned tile_height = 32; \
+	const unsigned tile_size = 4096; \
+	const unsigned column_width = 16; \
+	const unsigned column_size = column_width * tile_height; \
+	const unsigned cpp = bpp / 8; \
+	const unsigned stride_tiles = src_stride / tile_width; \
+	unsigned x, y; \
+	DBG(("%s(bpp=%d): src=(%d, %d), dst=(%d, %d), size=%dx%d, pitch=%d/%d\n", \
+	     __FUNCTION__, bpp, src_x, src_y, dst_x, dst_y, width, height, src_stride, dst_stride)); \
+	dst = (uint8_t *)dst + dst_y * dst_stride + dst_x * cpp; \
+	for (y = 0; y < height; ++y) { \
+		const uint32_t sy = y + src_y; \
+		const uint32_t tile_row = \
+			(sy / tile_height * stride_tiles * tile_size + \
+			 (sy & (tile_height-1)) * column_width); \
+		uint8_t *dst_row = (uint8_t *)dst + dst_stride * y; \
+		uint32_t sx = src_x * cpp; \
+		x = width * cpp; \
+		if (sx & (column_width - 1)) { \
+			const uint32_t length = min(column_width - (sx & (column_width - 1)), x); \
+			uint32_t offset = \
+				tile_row + \
+				sx / tile_width * tile_size + \
+				(sx & (tile_width-1)) / column_width * column_size + \
+				(sx & (column_width-1)); \
+			memcpy(dst_row, (const char *)src + swizzle(offset), length); \
+			dst_row += length; \
+			x -= length; \
+			sx += length; \
+		} \
+		while (x >= column_width) { \
+			uint32_t offset = \
+				tile_row + \
+				sx / tile_width * tile_size + \
+				(sx & (tile_width-1)) / column_width * column_size; \
+			memcpy(dst_row, (const char *)src + swizzle(offset), column_width); \
+			dst_row += column_width; \
+			x -= column_width; \
+			sx += column_width; \
+		} \
+		if (x) { \
+			uint32_t offset = \
+				tile_row + \
+				sx / tile_width * tile_size + \
+				(sx & (tile_width-1)) / column_width * column_size; \
+			memcpy(dst_row, (const char *)src + swizzle(offset), x); \
+		} \
+	} \
+}
+
+#define swizzle_0(X) (X)
+memcpy_to_tiled_y(swizzle_0)
+memcpy_from_tiled_y(swizzle_0)
+#undef swizzle_0
+
+#define swizzle_9(X) ((X) ^ (((X) >> 3) & 64))
+memcpy_to_tiled_y(swizzle_9)
+memcpy_from_tiled_y(swizzle_9)
+#undef swizzle_9
+
+#define swizzle_9_10(X) ((X) ^ ((((X) ^ ((X) >> 1)) >> 3) & 64))
+memcpy_to_tiled_y(swizzle_9_10)
+memcpy_from_tiled_y(swizzle_9_10)
+#undef swizzle_9_10
+
+#define swizzle_9_11(X) ((X) ^ ((((X) ^ ((X) >> 2)) >> 3) & 64))
+memcpy_to_tiled_y(swizzle_9_11)
+memcpy_from_tiled_y(swizzle_9_11)
+#undef swizzle_9_11
+
+#define swizzle_9_10_11(X) ((X) ^ ((((X) ^ ((X) >> 1) ^ ((X) >> 2)) >> 3) & 64))
+memcpy_to_tiled_y(swizzle_9_10_11)
+memcpy_from_tiled_y(swizzle_9_10_11)
+#undef swizzle_9_10_11
+
+#if USE_SSE2
+/* Non-temporal variants for large uploads, that write around the CPU cache
+ * rather than fill it with data only the GPU is going to read. Partial
+ * spans are still written with ordinary stores, and we fence at the end so
+ * that the streaming stores are visible before we submit the batch.
+ */
+static force_inline void
+stream_16(uint8_t *dst, const uint8_t *src)
+{
+	_mm_stream_si128((__m128i *)dst, xmm_load_128u((const __m128i *)src));
+}
+
+static force_inline void
+stream_64(uint8_t *dst, const uint8_t *src)
+{
+	__m128i xmm0, xmm1, xmm2, xmm3;
+
+	xmm0 = xmm_load_128u((const __m128i *)src + 0);
+	xmm1 = xmm_load_128u((const __m128i *)src + 1);
+	xmm2 = xmm_load_128u((const __m128i *)src + 2);
+	xmm3 = xmm_load_128u((const __m128i *)src + 3);
+
+	_mm_stream_si128((__m128i *)dst + 0, xmm0);
+	_mm_stream_si128((__m128i *)dst + 1, xmm1);
+	_mm_stream_si128((__m128i *)dst + 2, xmm2);
+	_mm_stream_si128((__m128i *)dst + 3, xmm3);
+}
+
+void
+memcpy_blt__nt(const void *src, void *dst, int bpp,
+	       int32_t src_stride, int32_t dst_stride,
+	       int16_t src_x, int16_t src_y,
+	       int16_t dst_x, int16_t dst_y,
+	       uint16_t width, uint16_t height)
+{
+	const uint8_t *src_bytes;
+	uint8_t *dst_bytes;
+	unsigned byte_width;
+
+	assert(src);
+	assert(dst);
+	assert(width && height);
+	assert(bpp >= 8);
+	assert(width*bpp <= 8*src_stride);
+	assert(width*bpp <= 8*dst_stride);
+
+	byte_width = width * bpp / 8;
+	if (byte_width < 64) {
+		memcpy_blt(src, dst, bpp,
+			   src_stride, dst_stride,
+			   src_x, src_y,
+			   dst_x, dst_y,
+			   width, height);
+		return;
+	}
+
+	DBG(("%s: src=(%d, %d), dst=(%d, %d), size=%dx%d, pitch=%d/%d\n",
+	     __FUNCTION__, src_x, src_y, dst_x, dst_y, width, height, src_stride, dst_stride));
+
+	src_bytes = (const uint8_t *)src + src_stride * src_y + src_x * bpp / 8;
+	dst_bytes = (uint8_t *)dst + dst_stride * dst_y + dst_x * bpp / 8;
+
+	if (byte_width == src_stride && byte_width == dst_stride) {
+		byte_width *= height;
+		height = 1;
+	}
+
+	do {
+		const uint8_t *s = src_bytes;
+		uint8_t *d = dst_bytes;
+		unsigned len = byte_width;
+
+		if ((uintptr_t)d & 15) {
+			unsigned head = 16 - ((uintptr_t)d & 15);
+			memcpy(d, s, head);
+			s += head;
+			d += head;
+			len -= head;
+		}
+		while (len >= 64) {
+			stream_64(d, s);
+			s += 64;
+			d += 64;
+			len -= 64;
+		}
+		while (len >= 16) {
+			stream_16(d, s);
+			s += 16;
+			d += 16;
+			len -= 16;
+		}
+		if (len)
+			memcpy(d, s, len);
+
+		src_bytes += src_stride;
+		dst_bytes += dst_stride;
+	} while (--height);
+
+	_mm_sfence();
+}
+
+#define memcpy_to_tiled_x__nt(swizzle) \
+static void \
+memcpy_to_tiled_x__##swizzle##__nt (const void *src, void *dst, int bpp, \
+				    int32_t src_stride, int32_t dst_stride, \
+				    int16_t src_x, int16_t src_y, \
+				    int16_t dst_x, int16_t dst_y, \
+				    uint16_t width, uint16_t height) \
+{ \
+	const unsigned tile_width = 512; \
+	const unsigned tile_height = 8; \
+	const unsigned tile_size = 4096; \
+	const unsigned cpp = bpp / 8; \
+	const unsigned stride_tiles = dst_stride / tile_width; \
+	const unsigned swizzle_pixels = 64 / cpp; \
+	const unsigned tile_pixels = ffs(tile_width / cpp) - 1; \
+	const unsigned tile_mask = (1 << tile_pixels) - 1; \
+	unsigned x, y; \
+	DBG(("%s(bpp=%d): src=(%d, %d), dst=(%d, %d), size=%dx%d, pitch=%d/%d\n", \
+	     __FUNCTION__, bpp, src_x, src_y, dst_x, dst_y, width, height, src_stride, dst_stride)); \
+	src = (const uint8_t *)src + src_y * src_stride + src_x * cpp; \
+	for (y = 0; y < height; ++y) { \
+		const uint32_t dy = y + dst_y; \
+		const uint32_t tile_row = \
+			(dy / tile_height * stride_tiles * tile_size + \
+			 (dy & (tile_height-1)) * tile_width); \
+		const uint8_t *src_row = (const uint8_t *)src + src_stride * y; \
+		uint32_t dx = dst_x; \
+		x = width * cpp; \
+		if (dx & (swizzle_pixels - 1)) { \
+			const uint32_t swizzle_bound_pixels = ALIGN(dx + 1, swizzle_pixels); \
+			const uint32_t length = min(dst_x + width, swizzle_bound_pixels) - dx; \
+			uint32_t offset = \
+				tile_row + \
+				(dx >> tile_pixels) * tile_size + \
+				(dx & tile_mask) * cpp; \
+			memcpy((char *)dst + swizzle(offset), src_row, length * cpp); \
+			src_row += length * cpp; \
+			x -= length * cpp; \
+			dx += length; \
+		} \
+		while (x >= 64) { \
+			uint32_t offset = \
+				tile_row + \
+				(dx >> tile_pixels) * tile_size + \
+				(dx & tile_mask) * cpp; \
+			stream_64((uint8_t *)dst + swizzle(offset), src_row); \
+			src_row += 64; \
+			x -= 64; \
+			dx += swizzle_pixels; \
+		} \
+		if (x) { \
+			uint32_t offset = \
+				tile_row + \
+				(dx >> tile_pixels) * tile_size + \
+				(dx & tile_mask) * cpp; \
+			memcpy((char *)dst + swizzle(offset), src_row, x); \
+		} \
+	} \
+	_mm_sfence(); \
+}
+
+#define memcpy_to_tiled_y__nt(swizzle) \
+static void \
+memcpy_to_tiled_y__##swizzle##__nt (const void *src, void *dst, int bpp, \
+				    int32_t src_stride, int32_t dst_stride, \
+				    int16_t src_x, int16_t src_y, \
+				    int16_t dst_x, int16_t dst_y, \
+				    uint16_t width, uint16_t height) \
+{ \
+	const unsigned tile_width = 128; \
+	const unsigned tile_height = 32; \
+	const unsigned tile_size = 4096; \
+	const unsigned column_width = 16; \
+	const unsigned column_size = column_width * tile_height; \
+	const unsigned cpp = bpp / 8; \
+	const unsigned stride_tiles = dst_stride / tile_width; \
+	unsigned x, y; \
+	DBG(("%s(bpp=%d): src=(%d, %d), dst=(%d, %d), size=%dx%d, pitch=%d/%d\n", \
+	     __FUNCTION__, bpp, src_x, src_y, dst_x, dst_y, width, height, src_stride, dst_stride)); \
+	src = (const uint8_t *)src + src_y * src_stride + src_x * cpp; \
+	for (y = 0; y < height; ++y) { \
+		const uint32_t dy = y + dst_y; \
+		const uint32_t tile_row = \
+			(dy / tile_height * stride_tiles * tile_size + \
+			 (dy & (tile_height-1)) * column_width); \
+		const uint8_t *src_row = (const uint8_t *)src + src_stride * y; \
+		uint32_t dx = dst_x * cpp; \
+		x = width * cpp; \
+		if (dx & (column_width - 1)) { \
+			const uint32_t length = min(column_width - (dx & (column_width - 1)), x); \
+			uint32_t offset = \
+				tile_row + \
+				dx / tile_width * tile_size + \
+				(dx & (tile_width-1)) / column_width * column_size + \
+				(dx & (column_width-1)); \
+			memcpy((char *)dst + swizzle(offset), src_row, length); \
+			src_row += length; \
+			x -= length; \
+			dx += length; \
+		} \
+		while (x >= column_width) { \
+			uint32_t offset = \
+				tile_row + \
+				dx / tile_width * tile_size + \
+				(dx & (tile_width-1)) / column_width * column_size; \
+			stream_16((uint8_t *)dst + swizzle(offset), src_row); \
+			src_row += column_width; \
+			x -= column_width; \
+			dx += column_width; \
+		} \
+		if (x) { \
+			uint32_t offset = \
+				tile_row + \
+				dx / tile_width * tile_size + \
+				(dx & (tile_width-1)) / column_width * column_size; \
+			memcpy((char *)dst + swizzle(offset), src_row, x); \
+		} \
+	} \
+	_mm_sfence(); \
+}
+
+#define swizzle_0(X) (X)
+memcpy_to_tiled_x__nt(swizzle_0)
+memcpy_to_tiled_y__nt(swizzle_0)
+#undef swizzle_0
+
+#define swizzle_9(X) ((X) ^ (((X) >> 3) & 64))
+memcpy_to_tiled_x__nt(swizzle_9)
+memcpy_to_tiled_y__nt(swizzle_9)
+#undef swizzle_9
+
+#define swizzle_9_10(X) ((X) ^ ((((X) ^ ((X) >> 1)) >> 3) & 64))
+memcpy_to_tiled_x__nt(swizzle_9_10)
+memcpy_to_tiled_y__nt(swizzle_9_10)
+#undef swizzle_9_10
+
+#define swizzle_9_11(X) ((X) ^ ((((X) ^ ((X) >> 2)) >> 3) & 64))
+memcpy_to_tiled_x__nt(swizzle_9_11)
+memcpy_to_tiled_y__nt(swizzle_9_11)
+#undef swizzle_9_11
+
+#define swizzle_9_10_11(X) ((X) ^ ((((X) ^ ((X) >> 1) ^ ((X) >> 2)) >> 3) & 64))
+memcpy_to_tiled_x__nt(swizzle_9_10_11)
+memcpy_to_tiled_y__nt(swizzle_9_10_11)
+#undef swizzle_9_10_11
+#else
+void
+memcpy_blt__nt(const void *src, void *dst, int bpp,
+	       int32_t src_stride, int32_t dst_stride,
+	       int16_t src_x, int16_t src_y,
+	       int16_t dst_x, int16_t dst_y,
+	       uint16_t width, uint16_t height)
+{
+	memcpy_blt(src, dst, bpp,
+		   src_stride, dst_stride,
+		   src_x, src_y,
+		   dst_x, dst_y,
+		   width, height);
+}
+#endif
+
+/* As memcpy_to_tiled_x, but applying (src & and) | or to every pixel as
+ * it is written, for uploading x8r8g8b8 into a8r8g8b8 and friends.
+ */
+#define memcpy_xor_to_tiled_x(swizzle, isa, attr) \
+attr static void \
+memcpy_xor_to_tiled_x__##swizzle##__##isa (const void *src, void *dst, int bpp, \
+					   int32_t src_stride, int32_t dst_stride, \
+					   int16_t src_x, int16_t src_y, \
+					   int16_t dst_x, int16_t dst_y, \
+					   uint16_t width, uint16_t height, \
+					   uint32_t and, uint32_t or) \
+{ \
+	const unsigned tile_width = 512; \
+	const unsigned tile_height = 8; \
+	const unsigned tile_size = 4096; \
+	const unsigned cpp = bpp / 8; \
+	const unsigned stride_tiles = dst_stride / tile_width; \
+	const unsigned swizzle_pixels = 64 / cpp; \
+	const unsigned tile_pixels = ffs(tile_width / cpp) - 1; \
+	const unsigned tile_mask = (1 << tile_pixels) - 1; \
+	unsigned x, y; \
+	DBG(("%s(bpp=%d): src=(%d, %d), dst=(%d, %d), size=%dx%d, pitch=%d/%d, and=%x, or=%x\n", \
+	     __FUNCTION__, bpp, src_x, src_y, dst_x, dst_y, width, height, src_stride, dst_stride, and, or)); \
+	switch (cpp) { \
+	case 1: \
+		and = (and & 0xff) * 0x01010101; \
+		or = (or & 0xff) * 0x01010101; \
+		break; \
+	case 2: \
+		and = (and & 0xffff) * 0x00010001; \
+		or = (or & 0xffff) * 0x00010001; \
+		break; \
+	} \
+	src = (const uint8_t *)src + src_y * src_stride + src_x * cpp; \
+	for (y = 0; y < height; ++y) { \
+		const uint32_t dy = y + dst_y; \
+		const uint32_t tile_row = \
+			(dy / tile_height * stride_tiles * tile_size + \
+			 (dy & (tile_height-1)) * tile_width); \
+		const uint8_t *src_row = (const uint8_t *)src + src_stride * y; \
+		uint32_t dx = dst_x; \
+		x = width * cpp; \
+		if (dx & (swizzle_pixels - 1)) { \
+			const uint32_t swizzle_bound_pixels = ALIGN(dx + 1, swizzle_pixels); \
+			const uint32_t length = min(dst_x + width, swizzle_bound_pixels) - dx; \
+			uint32_t offset = \
+				tile_row + \
+				(dx >> tile_pixels) * tile_size + \
+				(dx & tile_mask) * cpp; \
+			xor_bytes((uint8_t *)dst + swizzle(offset), src_row, length * cpp, and, or); \
+			src_row += length * cpp; \
+			x -= length * cpp; \
+			dx += length; \
+		} \
+		while (x >= 64) { \
+			uint32_t offset = \
+				tile_row + \
+				(dx >> tile_pixels) * tile_size + \
+				(dx & tile_mask) * cpp; \
+			xor_64__##isa((uint8_t *)dst + swizzle(offset), src_row, and, or); \
+			src_row += 64; \
+			x -= 64; \
+			dx += swizzle_pixels; \
+		} \
+		if (x) { \
+			uint32_t offset = \
+				tile_row + \
+				(dx >> tile_pixels) * tile_size + \
+				(dx & tile_mask) * cpp; \
+			xor_bytes((uint8_t *)dst + swizzle(offset), src_row, x, and, or); \
+		} \
+	} \
+}
+
+#if USE_AVX2
+#define memcpy_xor_to_tiled_x__avx2(swizzle) memcpy_xor_to_tiled_x(swizzle, avx2, avx2)
+#else
+#define memcpy_xor_to_tiled_x__avx2(swizzle)
+#endif
+
+#define swizzle_0(X) (X)
+memcpy_xor_to_tiled_x(swizzle_0, generic, fast_memcpy)
+memcpy_xor_to_tiled_x__avx2(swizzle_0)
+#undef swizzle_0
+
+#define swizzle_9(X) ((X) ^ (((X) >> 3) & 64))
+memcpy_xor_to_tiled_x(swizzle_9, generic, fast_memcpy)
+memcpy_xor_to_tiled_x__avx2(swizzle_9)
+#undef swizzle_9
+
+#define swizzle_9_10(X) ((X) ^ ((((X) ^ ((X) >> 1)) >> 3) & 64))
+memcpy_xor_to_tiled_x(swizzle_9_10, generic, fast_memcpy)
+memcpy_xor_to_tiled_x__avx2(swizzle_9_10)
+#undef swizzle_9_10
+
+#define swizzle_9_11(X) ((X) ^ ((((X) ^ ((X) >> 2)) >> 3) & 64))
+memcpy_xor_to_tiled_x(swizzle_9_11, generic, fast_memcpy)
+memcpy_xor_to_tiled_x__avx2(swizzle_9_11)
+#undef swizzle_9_11
+
+#define swizzle_9_10_11(X) ((X) ^ ((((X) ^ ((X) >> 1) ^ ((X) >> 2)) >> 3) & 64))
+memcpy_xor_to_tiled_x(swizzle_9_10_11, generic, fast_memcpy)
+memcpy_xor_to_tiled_x__avx2(swizzle_9_10_11)
+#undef swizzle_9_10_11
+
+static fast_memcpy void
+memcpy_to_tiled_x__gen2(const void *src, void *dst, int bpp,
+			int32_t src_stride, int32_t dst_stride,
+			int16_t src_x, int16_t src_y,
+			int16_t dst_x, int16_t dst_y,
+			uint16_t width, uint16_t height)
+{
+	const unsigned tile_width = 128;
+	const unsigned tile_height = 16;
+	const unsigned tile_size = 2048;
+
+	const unsigned cpp = bpp / 8;
+	const unsigned tile_pixels = tile_width / cpp;
+	const unsigned tile_shift = ffs(tile_pixels) - 1;
+	const unsigned tile_mask = tile_pixels - 1;
+
+	DBG(("%s(bpp=%d): src=(%d, %d), dst=(%d, %d), size=%dx%d, pitch=%d/%d\n",
+	     __FUNCTION__, bpp, src_x, src_y, dst_x, dst_y, width, height, src_stride, dst_stride));
+	assert(src != dst);
+
+	if (src_x | src_y)
+		src = (const uint8_t *)src + src_y * src_stride + src_x * cpp;
+	assert(src_stride >= width * cpp);
+	src_stride -= width * cpp;
+
+	while (height--) {
+		unsigned w = width * cpp;
+		uint8_t *tile_row = dst;
+
+		tile_row += dst_y / tile_height * dst_stride * tile_height;
+		tile_row += (dst_y & (tile_height-1)) * tile_width;
 		if (dst_x) {
 			tile_row += (dst_x >> tile_shift) * tile_size;
 			if (dst_x & tile_mask) {
@@ -573,28 +1715,734 @@ memcpy_from_tiled_x__gen2(const void *src, void *dst, int bpp,
 				w -= len;
 			}
 		}
-		while (w >= tile_width) {
-			memcpy(dst, tile_row, tile_width);
+		while (w >= tile_width) {
+			memcpy(dst, tile_row, tile_width);
+
+			tile_row += tile_size;
+			dst = (uint8_t *)dst + tile_width;
+			w -= tile_width;
+		}
+		memcpy(dst, tile_row, w);
+		dst = (uint8_t *)dst + dst_stride + w;
+		src_y++;
+	}
+}
+
+/* Convert between any pair of tiling layouts in a single pass, rather than
+ * detiling into a linear temporary and then retiling that. The swizzle is
+ * described by the set of address bits that are folded into bit 6 (see
+ * swizzle_bits()), so that any combination of source and destination
+ * swizzles can be handled by the same code.
+ */
+static unsigned swizzle_bits(int swizzling)
+{
+	switch (swizzling) {
+	case I915_BIT_6_SWIZZLE_9: return 1 << 9;
+	case I915_BIT_6_SWIZZLE_9_10: return 1 << 9 | 1 << 10;
+	case I915_BIT_6_SWIZZLE_9_11: return 1 << 9 | 1 << 11;
+	case I915_BIT_6_SWIZZLE_9_10_11: return 1 << 9 | 1 << 10 | 1 << 11;
+	default: return 0;
+	}
+}
+
+static force_inline uint32_t
+tiled_offset(int tiling, unsigned swizzle, int32_t stride,
+	     uint32_t x, uint32_t y)
+{
+	uint32_t offset;
+
+	switch (tiling) {
+	default:
+	case I915_TILING_NONE:
+		return y * stride + x;
+	case I915_TILING_X:
+		offset = (y >> 3) * (stride << 3);
+		offset += (x >> 9) << 12;
+		offset += (y & 7) << 9;
+		offset += x & 511;
+		break;
+	case I915_TILING_Y:
+		offset = (y >> 5) * (stride << 5);
+		offset += (x >> 7) << 12;
+		offset += ((x & 127) >> 4) << 9;
+		offset += (y & 31) << 4;
+		offset += x & 15;
+		break;
+	}
+
+	return offset ^ (__builtin_parity(offset & swizzle) << 6);
+}
+
+/* Bytes remaining before the layout stops being contiguous */
+static force_inline uint32_t
+tiled_span(int tiling, uint32_t x)
+{
+	switch (tiling) {
+	default:
+	case I915_TILING_NONE: return ~0u;
+	case I915_TILING_X: return 64 - (x & 63);
+	case I915_TILING_Y: return 16 - (x & 15);
+	}
+}
+
+static force_inline void
+__memcpy_retile(const uint8_t *src, uint8_t *dst,
+		const int src_tiling, unsigned src_swizzle,
+		int32_t src_stride,
+		const int dst_tiling, unsigned dst_swizzle,
+		int32_t dst_stride,
+		uint32_t src_x, uint32_t src_y,
+		uint32_t dst_x, uint32_t dst_y,
+		uint32_t width, uint32_t height)
+{
+	while (height--) {
+		uint32_t x = 0;
+
+		while (x < width) {
+			uint32_t len = width - x;
+			const uint8_t *s;
+			uint8_t *d;
+
+			len = min(len, tiled_span(src_tiling, src_x + x));
+			len = min(len, tiled_span(dst_tiling, dst_x + x));
+
+			d = dst + tiled_offset(dst_tiling, dst_swizzle,
+					       dst_stride, dst_x + x, dst_y);
+			s = src + tiled_offset(src_tiling, src_swizzle,
+					       src_stride, src_x + x, src_y);
+
+			/* let the compiler inline the common whole spans */
+			if (len == 16)
+				memcpy(d, s, 16);
+			else if (len == 64)
+				memcpy(d, s, 64);
+			else
+				memcpy(d, s, len);
+			x += len;
+		}
+
+		src_y++;
+		dst_y++;
+	}
+}
+
+fast_memcpy void
+memcpy_retile(const void *src, void *dst, int bpp,
+	      int src_tiling, int src_swizzling, int32_t src_stride,
+	      int dst_tiling, int dst_swizzling, int32_t dst_stride,
+	      int16_t src_x, int16_t src_y,
+	      int16_t dst_x, int16_t dst_y,
+	      uint16_t width, uint16_t height)
+{
+	const unsigned cpp = bpp / 8;
+	const unsigned src_swizzle = swizzle_bits(src_swizzling);
+	const unsigned dst_swizzle = swizzle_bits(dst_swizzling);
+
+	DBG(("%s: tiling %d/%d -> %d/%d, (%d, %d) -> (%d, %d) x (%d, %d), bpp=%d\n",
+	     __FUNCTION__,
+	     src_tiling, src_swizzling, dst_tiling, dst_swizzling,
+	     src_x, src_y, dst_x, dst_y, width, height, bpp));
+	assert(src != dst);
+	assert(bpp >= 8);
+
+	/* Expand each pairing so that the address calculations are inlined */
+#define RETILE(S, D) \
+	case 3*(S) + (D): \
+		__memcpy_retile(src, dst, \
+				S, src_swizzle, src_stride, \
+				D, dst_swizzle, dst_stride, \
+				src_x * cpp, src_y, \
+				dst_x * cpp, dst_y, \
+				width * cpp, height); \
+		break
+
+	switch (3*src_tiling + dst_tiling) {
+	RETILE(I915_TILING_NONE, I915_TILING_NONE);
+	RETILE(I915_TILING_NONE, I915_TILING_X);
+	RETILE(I915_TILING_NONE, I915_TILING_Y);
+	RETILE(I915_TILING_X, I915_TILING_NONE);
+	RETILE(I915_TILING_X, I915_TILING_X);
+	RETILE(I915_TILING_X, I915_TILING_Y);
+	RETILE(I915_TILING_Y, I915_TILING_NONE);
+	RETILE(I915_TILING_Y, I915_TILING_X);
+	RETILE(I915_TILING_Y, I915_TILING_Y);
+	default:
+		assert(0);
+		break;
+	}
+#undef RETILE
+}
+
+/* Fused format conversion and copy, expanding each pixel into
+ * a8r8g8b8 (or x8r8g8b8) as it is written to the destination. The
+ * expansion replicates the high bits into the low bits, to match pixman.
+ */
+typedef void (*convert_row_func)(const uint8_t *src, uint8_t *dst, int width);
+
+static force_inline uint32_t expand_5(uint32_t v)
+{
+	return v << 3 | v >> 2;
+}
+
+static force_inline uint32_t expand_6(uint32_t v)
+{
+	return v << 2 | v >> 4;
+}
+
+static force_inline uint32_t expand_2(uint32_t v)
+{
+	v |= v << 2;
+	return v | v << 4;
+}
+
+static fast void
+convert_row__r5g6b5(const uint8_t *src, uint8_t *dst, int width)
+{
+	const uint16_t *s = (const uint16_t *)src;
+	uint32_t *d = (uint32_t *)dst;
+
+#if USE_SSE2
+	while (width >= 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)s);
+		__m128i r, g, b;
+
+		r = _mm_srli_epi16(v, 11);
+		g = _mm_and_si128(_mm_srli_epi16(v, 5), _mm_set1_epi16(0x3f));
+		b = _mm_and_si128(v, _mm_set1_epi16(0x1f));
+
+		r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+		g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+		b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+
+		g = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+		r = _mm_or_si128(r, _mm_set1_epi16(0xff00));
+
+		_mm_storeu_si128((__m128i *)d + 0, _mm_unpacklo_epi16(g, r));
+		_mm_storeu_si128((__m128i *)d + 1, _mm_unpackhi_epi16(g, r));
+
+		s += 8;
+		d += 8;
+		width -= 8;
+	}
+#endif
+
+	while (width--) {
+		uint32_t p = *s++;
+		*d++ = 0xff000000 |
+			expand_5(p >> 11) << 16 |
+			expand_6((p >> 5) & 0x3f) << 8 |
+			expand_5(p & 0x1f);
+	}
+}
+
+static force_inline void
+__convert_row__x1r5g5b5(const uint8_t *src, uint8_t *dst, int width,
+			const bool has_alpha)
+{
+	const uint16_t *s = (const uint16_t *)src;
+	uint32_t *d = (uint32_t *)dst;
+
+#if USE_SSE2
+	while (width >= 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)s);
+		__m128i r, g, b, a;
+
+		r = _mm_and_si128(_mm_srli_epi16(v, 10), _mm_set1_epi16(0x1f));
+		g = _mm_and_si128(_mm_srli_epi16(v, 5), _mm_set1_epi16(0x1f));
+		b = _mm_and_si128(v, _mm_set1_epi16(0x1f));
+
+		r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+		g = _mm_or_si128(_mm_slli_epi16(g, 3), _mm_srli_epi16(g, 2));
+		b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+
+		if (has_alpha)
+			a = _mm_and_si128(_mm_srai_epi16(v, 15), _mm_set1_epi16(0xff00));
+		else
+			a = _mm_set1_epi16(0xff00);
+
+		g = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+		r = _mm_or_si128(r, a);
+
+		_mm_storeu_si128((__m128i *)d + 0, _mm_unpacklo_epi16(g, r));
+		_mm_storeu_si128((__m128i *)d + 1, _mm_unpackhi_epi16(g, r));
+
+		s += 8;
+		d += 8;
+		width -= 8;
+	}
+#endif
+
+	while (width--) {
+		uint32_t p = *s++;
+		uint32_t a = has_alpha ? (p & 0x8000 ? 0xff : 0) : 0xff;
+		*d++ = a << 24 |
+			expand_5((p >> 10) & 0x1f) << 16 |
+			expand_5((p >> 5) & 0x1f) << 8 |
+			expand_5(p & 0x1f);
+	}
+}
+
+static fast void
+convert_row__x1r5g5b5(const uint8_t *src, uint8_t *dst, int width)
+{
+	__convert_row__x1r5g5b5(src, dst, width, false);
+}
+
+static fast void
+convert_row__a1r5g5b5(const uint8_t *src, uint8_t *dst, int width)
+{
+	__convert_row__x1r5g5b5(src, dst, width, true);
+}
+
+static force_inline void
+__convert_row__x2r10g10b10(const uint8_t *src, uint8_t *dst, int width,
+			   const bool has_alpha)
+{
+	const uint32_t *s = (const uint32_t *)src;
+	uint32_t *d = (uint32_t *)dst;
+
+#if USE_SSE2
+	while (width >= 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)s);
+		__m128i c, a;
+
+		/* keep the top 8 bits of each 10-bit channel */
+		c = _mm_and_si128(_mm_srli_epi32(v, 6), _mm_set1_epi32(0xff0000));
+		c = _mm_or_si128(c, _mm_and_si128(_mm_srli_epi32(v, 4), _mm_set1_epi32(0xff00)));
+		c = _mm_or_si128(c, _mm_and_si128(_mm_srli_epi32(v, 2), _mm_set1_epi32(0xff)));
+
+		if (has_alpha) {
+			a = _mm_srli_epi32(v, 30);
+			a = _mm_or_si128(a, _mm_slli_epi32(a, 2));
+			a = _mm_or_si128(a, _mm_slli_epi32(a, 4));
+			a = _mm_slli_epi32(a, 24);
+		} else
+			a = _mm_set1_epi32(0xff000000);
+
+		_mm_storeu_si128((__m128i *)d, _mm_or_si128(c, a));
+
+		s += 4;
+		d += 4;
+		width -= 4;
+	}
+#endif
+
+	while (width--) {
+		uint32_t p = *s++;
+		uint32_t a = has_alpha ? expand_2(p >> 30) : 0xff;
+		*d++ = a << 24 |
+			(p >> 6 & 0xff0000) |
+			(p >> 4 & 0xff00) |
+			(p >> 2 & 0xff);
+	}
+}
+
+static fast void
+convert_row__x2r10g10b10(const uint8_t *src, uint8_t *dst, int width)
+{
+	__convert_row__x2r10g10b10(src, dst, width, false);
+}
+
+static fast void
+convert_row__a2r10g10b10(const uint8_t *src, uint8_t *dst, int width)
+{
+	__convert_row__x2r10g10b10(src, dst, width, true);
+}
+
+static force_inline void
+__convert_row__x8b8g8r8(const uint8_t *src, uint8_t *dst, int width,
+			const bool has_alpha)
+{
+	const uint32_t *s = (const uint32_t *)src;
+	uint32_t *d = (uint32_t *)dst;
+	const uint32_t or = has_alpha ? 0 : 0xff000000;
+
+#if USE_SSE2
+	while (width >= 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)s);
+		__m128i c;
+
+		c = _mm_and_si128(v, _mm_set1_epi32(0xff00ff00));
+		c = _mm_or_si128(c, _mm_and_si128(_mm_srli_epi32(v, 16), _mm_set1_epi32(0xff)));
+		c = _mm_or_si128(c, _mm_and_si128(_mm_slli_epi32(v, 16), _mm_set1_epi32(0xff0000)));
+		c = _mm_or_si128(c, _mm_set1_epi32(or));
+
+		_mm_storeu_si128((__m128i *)d, c);
+
+		s += 4;
+		d += 4;
+		width -= 4;
+	}
+#endif
+
+	while (width--) {
+		uint32_t p = *s++;
+		*d++ = or | (p & 0xff00ff00) | (p >> 16 & 0xff) | (p & 0xff) << 16;
+	}
+}
+
+static fast void
+convert_row__x8b8g8r8(const uint8_t *src, uint8_t *dst, int width)
+{
+	__convert_row__x8b8g8r8(src, dst, width, false);
+}
+
+static fast void
+convert_row__a8b8g8r8(const uint8_t *src, uint8_t *dst, int width)
+{
+	__convert_row__x8b8g8r8(src, dst, width, true);
+}
+
+static fast void
+convert_row__a8(const uint8_t *src, uint8_t *dst, int width)
+{
+	uint32_t *d = (uint32_t *)dst;
+
+#if USE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+
+	while (width >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)src);
+		__m128i lo = _mm_unpacklo_epi8(zero, v);
+		__m128i hi = _mm_unpackhi_epi8(zero, v);
+
+		_mm_storeu_si128((__m128i *)d + 0, _mm_unpacklo_epi16(zero, lo));
+		_mm_storeu_si128((__m128i *)d + 1, _mm_unpackhi_epi16(zero, lo));
+		_mm_storeu_si128((__m128i *)d + 2, _mm_unpacklo_epi16(zero, hi));
+		_mm_storeu_si128((__m128i *)d + 3, _mm_unpackhi_epi16(zero, hi));
+
+		src += 16;
+		d += 16;
+		width -= 16;
+	}
+#endif
+
+	while (width--)
+		*d++ = (uint32_t)*src++ << 24;
+}
+
+static convert_row_func choose_convert_row(uint32_t src_format,
+					   uint32_t dst_format)
+{
+	if (dst_format != PICT_a8r8g8b8 && dst_format != PICT_x8r8g8b8)
+		return NULL;
+
+	switch (src_format) {
+	case PICT_r5g6b5: return convert_row__r5g6b5;
+	case PICT_x1r5g5b5: return convert_row__x1r5g5b5;
+	case PICT_a1r5g5b5: return convert_row__a1r5g5b5;
+	case PICT_x2r10g10b10: return convert_row__x2r10g10b10;
+	case PICT_a2r10g10b10: return convert_row__a2r10g10b10;
+	case PICT_x8b8g8r8: return convert_row__x8b8g8r8;
+	case PICT_a8b8g8r8: return convert_row__a8b8g8r8;
+	case PICT_a8:
+		if (dst_format != PICT_a8r8g8b8)
+			return NULL;
+		return convert_row__a8;
+	default: return NULL;
+	}
+}
+
+bool memcpy_convert_supported(uint32_t src_format, uint32_t dst_format)
+{
+	return choose_convert_row(src_format, dst_format) != NULL;
+}
+
+static force_inline void
+__memcpy_convert(convert_row_func convert,
+		 const uint8_t *src, uint8_t *dst,
+		 int src_cpp, const int dst_tiling, unsigned dst_swizzle,
+		 int32_t src_stride, int32_t dst_stride,
+		 int src_x, int src_y,
+		 int dst_x, int dst_y,
+		 int width, int height)
+{
+	src += src_y * src_stride + src_x * src_cpp;
+
+	if (dst_tiling == I915_TILING_NONE) {
+		dst += dst_y * dst_stride + dst_x * 4;
+		do {
+			convert(src, dst, width);
+			src += src_stride;
+			dst += dst_stride;
+		} while (--height);
+		return;
+	}
+
+	/* Walk each row in the destination's contiguous spans, so that we
+	 * write each tile exactly once without an intermediate row buffer.
+	 */
+	do {
+		int x = 0;
+
+		while (x < width) {
+			int len = width - x;
+
+			len = min(len, (int)tiled_span(dst_tiling, 4*(dst_x + x)) / 4);
+			convert(src + x * src_cpp,
+				dst + tiled_offset(dst_tiling, dst_swizzle,
+						   dst_stride, 4*(dst_x + x), dst_y),
+				len);
+			x += len;
+		}
+
+		src += src_stride;
+		dst_y++;
+	} while (--height);
+}
+
+fast bool
+memcpy_convert(const void *src, void *dst,
+	       uint32_t src_format, uint32_t dst_format,
+	       int dst_tiling, int dst_swizzling,
+	       int32_t src_stride, int32_t dst_stride,
+	       int16_t src_x, int16_t src_y,
+	       int16_t dst_x, int16_t dst_y,
+	       uint16_t width, uint16_t height)
+{
+	convert_row_func convert;
+	unsigned dst_swizzle;
+	int src_cpp;
+
+	DBG(("%s: format %08x -> %08x, tiling=%d, (%d, %d) -> (%d, %d) x (%d, %d)\n",
+	     __FUNCTION__, src_format, dst_format, dst_tiling,
+	     src_x, src_y, dst_x, dst_y, width, height));
+
+	convert = choose_convert_row(src_format, dst_format);
+	if (convert == NULL)
+		return false;
+
+	if (width == 0 || height == 0)
+		return true;
+
+	src_cpp = PICT_FORMAT_BPP(src_format) / 8;
+	dst_swizzle = swizzle_bits(dst_swizzling);
+
+	switch (dst_tiling) {
+	case I915_TILING_NONE:
+		__memcpy_convert(convert, src, dst, src_cpp,
+				 I915_TILING_NONE, 0,
+				 src_stride, dst_stride,
+				 src_x, src_y, dst_x, dst_y,
+				 width, height);
+		break;
+	case I915_TILING_X:
+		__memcpy_convert(convert, src, dst, src_cpp,
+				 I915_TILING_X, dst_swizzle,
+				 src_stride, dst_stride,
+				 src_x, src_y, dst_x, dst_y,
+				 width, height);
+		break;
+	case I915_TILING_Y:
+		__memcpy_convert(convert, src, dst, src_cpp,
+				 I915_TILING_Y, dst_swizzle,
+				 src_stride, dst_stride,
+				 src_x, src_y, dst_x, dst_y,
+				 width, height);
+		break;
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+void choose_memcpy_tiled_x(struct kgem *kgem, int swizzling, unsigned cpu)
+{
+	if (kgem->gen < 030) {
+		if (swizzling == I915_BIT_6_SWIZZLE_NONE) {
+			DBG(("%s: gen2, no swizzling\n", __FUNCTION__));
+			kgem->memcpy_to_tiled_x = memcpy_to_tiled_x__gen2;
+			kgem->memcpy_from_tiled_x = memcpy_from_tiled_x__gen2;
+			kgem->memcpy_to_tiled_x__nt = memcpy_to_tiled_x__gen2;
+		} else
+			DBG(("%s: no detiling with swizzle functions for gen2\n", __FUNCTION__));
+		return;
+	}
+
+	switch (swizzling) {
+	default:
+		DBG(("%s: unknown swizzling, %d\n", __FUNCTION__, swizzling));
+		break;
+	case I915_BIT_6_SWIZZLE_NONE:
+#if USE_AVX512
+		if (cpu & AVX512F) {
+			DBG(("%s: no swizzling (avx512)\n", __FUNCTION__));
+			kgem->memcpy_to_tiled_x = memcpy_to_tiled_x__swizzle_0__avx512;
+			kgem->memcpy_from_tiled_x = memcpy_from_tiled_x__swizzle_0__avx512;
+			break;
+		}
+#endif
+#if USE_AVX2
+		if (cpu & AVX2) {
+			DBG(("%s: no swizzling (avx2)\n", __FUNCTION__));
+			kgem->memcpy_to_tiled_x = memcpy_to_tiled_x__swizzle_0__avx2;
+			kgem->memcpy_from_tiled_x = memcpy_from_tiled_x__swizzle_0__avx2;
+			break;
+		}
+#endif
+		DBG(("%s: no swizzling\n", __FUNCTION__));
+		kgem->memcpy_to_tiled_x = memcpy_to_tiled_x__swizzle_0;
+		kgem->memcpy_from_tiled_x = memcpy_from_tiled_x__swizzle_0;
+		break;
+	case I915_BIT_6_SWIZZLE_9:
+#if USE_AVX512
+		if (cpu & AVX512F) {
+			DBG(("%s: 6^9 swizzling (avx512)\n", __FUNCTION__));
+			kgem->memcpy_to_tiled_x = memcpy_to_tiled_x__swizzle_9__avx512;
+			kgem->memcpy_from_tiled_x = memcpy_from_tiled_x__swizzle_9__avx512;
+			break;
+		}
+#endif
+#if USE_AVX2
+		if (cpu & AVX2) {
+			DBG(("%s: 6^9 swizzling (avx2)\n", __FUNCTION__));
+			kgem->memcpy_to_tiled_x = memcpy_to_tiled_x__swizzle_9__avx2;
+			kgem->memcpy_from_tiled_x = memcpy_from_tiled_x__swizzle_9__avx2;
+			break;
+		}
+#endif
+		DBG(("%s: 6^9 swizzling\n", __FUNCTION__));
+		kgem->memcpy_to_tiled_x = memcpy_to_tiled_x__swizzle_9;
+		kgem->memcpy_from_tiled_x = memcpy_from_tiled_x__swizzle_9;
+		break;
+	case I915_BIT_6_SWIZZLE_9_10:
+#if USE_AVX512
+		if (cpu & AVX512F) {
+			DBG(("%s: 6^9^10 swizzling (avx512)\n", __FUNCTION__));
+			kgem->memcpy_to_tiled_x = memcpy_to_tiled_x__swizzle_9_10__avx512;
+			kgem->memcpy_from_tiled_x = memcpy_from_tiled_x__swizzle_9_10__avx512;
+			break;
+		}
+#endif
+#if USE_AVX2
+		if (cpu & AVX2) {
+			DBG(("%s: 6^9^10 swizzling (avx2)\n", __FUNCTION__));
+			kgem->memcpy_to_tiled_x = memcpy_to_tiled_x__swizzle_9_10__avx2;
+			kgem->memcpy_from_tiled_x = memcpy_from_tiled_x__swizzle_9_10__avx2;
+			break;
+		}
+#endif
+		DBG(("%s: 6^9^10 swizzling\n", __FUNCTION__));
+		kgem->memcpy_to_tiled_x = memcpy_to_tiled_x__swizzle_9_10;
+		kgem->memcpy_from_tiled_x = memcpy_from_tiled_x__swizzle_9_10;
+		break;
+	case I915_BIT_6_SWIZZLE_9_11:
+#if USE_AVX512
+		if (cpu & AVX512F) {
+			DBG(("%s: 6^9^11 swizzling (avx512)\n", __FUNCTION__));
+			kgem->memcpy_to_tiled_x = memcpy_to_tiled_x__swizzle_9_11__avx512;
+			kgem->memcpy_from_tiled_x = memcpy_from_tiled_x__swizzle_9_11__avx512;
+			break;
+		}
+#endif
+#if USE_AVX2
+		if (cpu & AVX2) {
+			DBG(("%s: 6^9^11 swizzling (avx2)\n", __FUNCTION__));
+			kgem->memcpy_to_tiled_x = memcpy_to_tiled_x__swizzle_9_11__avx2;
+			kgem->memcpy_from_tiled_x = memcpy_from_tiled_x__swizzle_9_11__avx2;
+			break;
+		}
+#endif
+		DBG(("%s: 6^9^11 swizzling\n", __FUNCTION__));
+		kgem->memcpy_to_tiled_x = memcpy_to_tiled_x__swizzle_9_11;
+		kgem->memcpy_from_tiled_x = memcpy_from_tiled_x__swizzle_9_11;
+		break;
+	case I915_BIT_6_SWIZZLE_9_10_11:
+#if USE_AVX512
+		if (cpu & AVX512F) {
+			DBG(("%s: 6^9^10^11 swizzling (avx512)\n", __FUNCTION__));
+			kgem->memcpy_to_tiled_x = memcpy_to_tiled_x__swizzle_9_10_11__avx512;
+			kgem->memcpy_from_tiled_x = memcpy_from_tiled_x__swizzle_9_10_11__avx512;
+			break;
+		}
+#endif
+#if USE_AVX2
+		if (cpu & AVX2) {
+			DBG(("%s: 6^9^10^11 swizzling (avx2)\n", __FUNCTION__));
+			kgem->memcpy_to_tiled_x = memcpy_to_tiled_x__swizzle_9_10_11__avx2;
+			kgem->memcpy_from_tiled_x = memcpy_from_tiled_x__swizzle_9_10_11__avx2;
+			break;
+		}
+#endif
+		DBG(("%s: 6^9^10^11 swizzling\n", __FUNCTION__));
+		kgem->memcpy_to_tiled_x = memcpy_to_tiled_x__swizzle_9_10_11;
+		kgem->memcpy_from_tiled_x = memcpy_from_tiled_x__swizzle_9_10_11;
+		break;
+	}
 
-			tile_row += tile_size;
-			dst = (uint8_t *)dst + tile_width;
-			w -= tile_width;
-		}
-		memcpy(dst, tile_row, w);
-		dst = (uint8_t *)dst + dst_stride + w;
-		src_y++;
+	if (kgem->memcpy_to_tiled_x)
+		kgem->swizzling[I915_TILING_X] = swizzling;
+
+	kgem->memcpy_to_tiled_x__nt = kgem->memcpy_to_tiled_x;
+#if USE_SSE2
+	switch (swizzling) {
+	case I915_BIT_6_SWIZZLE_NONE:
+		kgem->memcpy_to_tiled_x__nt = memcpy_to_tiled_x__swizzle_0__nt;
+		break;
+	case I915_BIT_6_SWIZZLE_9:
+		kgem->memcpy_to_tiled_x__nt = memcpy_to_tiled_x__swizzle_9__nt;
+		break;
+	case I915_BIT_6_SWIZZLE_9_10:
+		kgem->memcpy_to_tiled_x__nt = memcpy_to_tiled_x__swizzle_9_10__nt;
+		break;
+	case I915_BIT_6_SWIZZLE_9_11:
+		kgem->memcpy_to_tiled_x__nt = memcpy_to_tiled_x__swizzle_9_11__nt;
+		break;
+	case I915_BIT_6_SWIZZLE_9_10_11:
+		kgem->memcpy_to_tiled_x__nt = memcpy_to_tiled_x__swizzle_9_10_11__nt;
+		break;
+	}
+#endif
+
+	switch (swizzling) {
+	case I915_BIT_6_SWIZZLE_NONE:
+#if USE_AVX2
+		if (cpu & AVX2)
+			kgem->memcpy_xor_to_tiled_x = memcpy_xor_to_tiled_x__swizzle_0__avx2;
+		else
+#endif
+			kgem->memcpy_xor_to_tiled_x = memcpy_xor_to_tiled_x__swizzle_0__generic;
+		break;
+	case I915_BIT_6_SWIZZLE_9:
+#if USE_AVX2
+		if (cpu & AVX2)
+			kgem->memcpy_xor_to_tiled_x = memcpy_xor_to_tiled_x__swizzle_9__avx2;
+		else
+#endif
+			kgem->memcpy_xor_to_tiled_x = memcpy_xor_to_tiled_x__swizzle_9__generic;
+		break;
+	case I915_BIT_6_SWIZZLE_9_10:
+#if USE_AVX2
+		if (cpu & AVX2)
+			kgem->memcpy_xor_to_tiled_x = memcpy_xor_to_tiled_x__swizzle_9_10__avx2;
+		else
+#endif
+			kgem->memcpy_xor_to_tiled_x = memcpy_xor_to_tiled_x__swizzle_9_10__generic;
+		break;
+	case I915_BIT_6_SWIZZLE_9_11:
+#if USE_AVX2
+		if (cpu & AVX2)
+			kgem->memcpy_xor_to_tiled_x = memcpy_xor_to_tiled_x__swizzle_9_11__avx2;
+		else
+#endif
+			kgem->memcpy_xor_to_tiled_x = memcpy_xor_to_tiled_x__swizzle_9_11__generic;
+		break;
+	case I915_BIT_6_SWIZZLE_9_10_11:
+#if USE_AVX2
+		if (cpu & AVX2)
+			kgem->memcpy_xor_to_tiled_x = memcpy_xor_to_tiled_x__swizzle_9_10_11__avx2;
+		else
+#endif
+			kgem->memcpy_xor_to_tiled_x = memcpy_xor_to_tiled_x__swizzle_9_10_11__generic;
+		break;
 	}
 }
 
-void choose_memcpy_tiled_x(struct kgem *kgem, int swizzling)
+void choose_memcpy_tiled_y(struct kgem *kgem, int swizzling)
 {
-	if (kgem->gen < 030) {
-		if (swizzling == I915_BIT_6_SWIZZLE_NONE) {
-			DBG(("%s: gen2, no swizzling\n", __FUNCTION__));
-			kgem->memcpy_to_tiled_x = memcpy_to_tiled_x__gen2;
-			kgem->memcpy_from_tiled_x = memcpy_from_tiled_x__gen2;
-		} else
-			DBG(("%s: no detiling with swizzle functions for gen2\n", __FUNCTION__));
+	if (kgem->gen <= 030) {
+		DBG(("%s: no detiling for Y-tiles before gen3.1\n", __FUNCTION__));
 		return;
 	}
 
@@ -604,30 +2452,54 @@ void choose_memcpy_tiled_x(struct kgem *kgem, int swizzling)
 		break;
 	case I915_BIT_6_SWIZZLE_NONE:
 		DBG(("%s: no swizzling\n", __FUNCTION__));
-		kgem->memcpy_to_tiled_x = memcpy_to_tiled_x__swizzle_0;
-		kgem->memcpy_from_tiled_x = memcpy_from_tiled_x__swizzle_0;
+		kgem->memcpy_to_tiled_y = memcpy_to_tiled_y__swizzle_0;
+		kgem->memcpy_from_tiled_y = memcpy_from_tiled_y__swizzle_0;
 		break;
 	case I915_BIT_6_SWIZZLE_9:
 		DBG(("%s: 6^9 swizzling\n", __FUNCTION__));
-		kgem->memcpy_to_tiled_x = memcpy_to_tiled_x__swizzle_9;
-		kgem->memcpy_from_tiled_x = memcpy_from_tiled_x__swizzle_9;
+		kgem->memcpy_to_tiled_y = memcpy_to_tiled_y__swizzle_9;
+		kgem->memcpy_from_tiled_y = memcpy_from_tiled_y__swizzle_9;
 		break;
 	case I915_BIT_6_SWIZZLE_9_10:
 		DBG(("%s: 6^9^10 swizzling\n", __FUNCTION__));
-		kgem->memcpy_to_tiled_x = memcpy_to_tiled_x__swizzle_9_10;
-		kgem->memcpy_from_tiled_x = memcpy_from_tiled_x__swizzle_9_10;
+		kgem->memcpy_to_tiled_y = memcpy_to_tiled_y__swizzle_9_10;
+		kgem->memcpy_from_tiled_y = memcpy_from_tiled_y__swizzle_9_10;
 		break;
 	case I915_BIT_6_SWIZZLE_9_11:
 		DBG(("%s: 6^9^11 swizzling\n", __FUNCTION__));
-		kgem->memcpy_to_tiled_x = memcpy_to_tiled_x__swizzle_9_11;
-		kgem->memcpy_from_tiled_x = memcpy_from_tiled_x__swizzle_9_11;
+		kgem->memcpy_to_tiled_y = memcpy_to_tiled_y__swizzle_9_11;
+		kgem->memcpy_from_tiled_y = memcpy_from_tiled_y__swizzle_9_11;
 		break;
 	case I915_BIT_6_SWIZZLE_9_10_11:
 		DBG(("%s: 6^9^10^11 swizzling\n", __FUNCTION__));
-		kgem->memcpy_to_tiled_x = memcpy_to_tiled_x__swizzle_9_10_11;
-		kgem->memcpy_from_tiled_x = memcpy_from_tiled_x__swizzle_9_10_11;
+		kgem->memcpy_to_tiled_y = memcpy_to_tiled_y__swizzle_9_10_11;
+		kgem->memcpy_from_tiled_y = memcpy_from_tiled_y__swizzle_9_10_11;
+		break;
+	}
+
+	if (kgem->memcpy_to_tiled_y)
+		kgem->swizzling[I915_TILING_Y] = swizzling;
+
+	kgem->memcpy_to_tiled_y__nt = kgem->memcpy_to_tiled_y;
+#if USE_SSE2
+	switch (swizzling) {
+	case I915_BIT_6_SWIZZLE_NONE:
+		kgem->memcpy_to_tiled_y__nt = memcpy_to_tiled_y__swizzle_0__nt;
+		break;
+	case I915_BIT_6_SWIZZLE_9:
+		kgem->memcpy_to_tiled_y__nt = memcpy_to_tiled_y__swizzle_9__nt;
+		break;
+	case I915_BIT_6_SWIZZLE_9_10:
+		kgem->memcpy_to_tiled_y__nt = memcpy_to_tiled_y__swizzle_9_10__nt;
+		break;
+	case I915_BIT_6_SWIZZLE_9_11:
+		kgem->memcpy_to_tiled_y__nt = memcpy_to_tiled_y__swizzle_9_11__nt;
+		break;
+	case I915_BIT_6_SWIZZLE_9_10_11:
+		kgem->memcpy_to_tiled_y__nt = memcpy_to_tiled_y__swizzle_9_10_11__nt;
 		break;
 	}
+#endif
 }
 
 void
@@ -851,87 +2723,14 @@ memcpy_xor(const void *src, void *dst, int bpp,
 				height = 1;
 			}
 
-#if USE_SSE2
-			if (have_sse2()) {
-				do {
-					uint32_t *d = (uint32_t *)dst_bytes;
-					const uint32_t *s = (const uint32_t *)src_bytes;
-					__m128i mask = xmm_create_mask_32(or);
-
-					i = w;
-					while (i && (uintptr_t)d & 15) {
-						*d++ = *s++ | or;
-						i--;
-					}
-
-					while (i >= 16) {
-						__m128i xmm1, xmm2, xmm3, xmm4;
-
-						xmm1 = xmm_load_128u((const __m128i*)s + 0);
-						xmm2 = xmm_load_128u((const __m128i*)s + 1);
-						xmm3 = xmm_load_128u((const __m128i*)s + 2);
-						xmm4 = xmm_load_128u((const __m128i*)s + 3);
-
-						xmm_save_128((__m128i*)d + 0,
-							     _mm_or_si128(xmm1, mask));
-						xmm_save_128((__m128i*)d + 1,
-							     _mm_or_si128(xmm2, mask));
-						xmm_save_128((__m128i*)d + 2,
-							     _mm_or_si128(xmm3, mask));
-						xmm_save_128((__m128i*)d + 3,
-							     _mm_or_si128(xmm4, mask));
-
-						d += 16;
-						s += 16;
-						i -= 16;
-					}
-
-					if (i & 8) {
-						__m128i xmm1, xmm2;
-
-						xmm1 = xmm_load_128u((const __m128i*)s + 0);
-						xmm2 = xmm_load_128u((const __m128i*)s + 1);
-
-						xmm_save_128((__m128i*)d + 0,
-							     _mm_or_si128(xmm1, mask));
-						xmm_save_128((__m128i*)d + 1,
-							     _mm_or_si128(xmm2, mask));
-						d += 8;
-						s += 8;
-						i -= 8;
-					}
-
-					if (i & 4) {
-						xmm_save_128((__m128i*)d,
-							     _mm_or_si128(xmm_load_128u((const __m128i*)s),
-									  mask));
-
-						d += 4;
-						s += 4;
-						i -= 4;
-					}
-
-					while (i) {
-						*d++ = *s++ | or;
-						i--;
-					}
-
-					src_bytes += src_stride;
-					dst_bytes += dst_stride;
-				} while (--height);
-			} else
-#else
-				do {
-					uint32_t *d = (uint32_t *)dst_bytes;
-					uint32_t *s = (uint32_t *)src_bytes;
-
-					for (i = 0; i < w; i++)
-						d[i] = s[i] | or;
+			do {
+				xor_row_32((uint32_t *)dst_bytes,
+					   (const uint32_t *)src_bytes,
+					   w, 0xffffffff, or);
 
-					src_bytes += src_stride;
-					dst_bytes += dst_stride;
-				} while (--height);
-#endif
+				src_bytes += src_stride;
+				dst_bytes += dst_stride;
+			} while (--height);
 			break;
 		}
 	} else {
@@ -961,11 +2760,9 @@ memcpy_xor(const void *src, void *dst, int bpp,
 
 		case 4:
 			do {
-				uint32_t *d = (uint32_t *)dst_bytes;
-				const uint32_t *s = (const uint32_t *)src_bytes;
-
-				for (i = 0; i < width; i++)
-					d[i] = (s[i] & and) | or;
+				xor_row_32((uint32_t *)dst_bytes,
+					   (const uint32_t *)src_bytes,
+					   width, and, or);
 
 				src_bytes += src_stride;
 				dst_bytes += dst_stride;
@@ -1115,23 +2912,534 @@ static inline uint32_t convert_pixel(const uint8_t *p, int x)
 	return ((uint32_t *)p)[x];
 }
 
-fast void
-affine_blt(const void *src, void *dst, int bpp,
-	   int16_t src_x, int16_t src_y,
-	   int16_t src_width, int16_t src_height,
-	   int32_t src_stride,
-	   int16_t dst_x, int16_t dst_y,
-	   uint16_t dst_width, uint16_t dst_height,
-	   int32_t dst_stride,
-	   const struct pixman_f_transform *t)
+/* Sample a single pixel, treating everything outside the source as
+ * transparent (i.e. RepeatNone).
+ */
+static force_inline uint32_t
+affine_pixel__bilinear(const uint8_t *src, int32_t src_stride,
+		       int src_width, int src_height,
+		       pixman_fixed_t x, pixman_fixed_t y)
 {
 	static const uint8_t zero[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+	const uint8_t *row1;
+	const uint8_t *row2;
+	int x1, y1, x2, y2;
+	uint32_t tl, tr, bl, br;
+	int32_t fx, fy;
+
+	x1 = x - pixman_fixed_1/2;
+	y1 = y - pixman_fixed_1/2;
+
+	fx = bilinear_weight(x1);
+	fy = bilinear_weight(y1);
+
+	x1 = pixman_fixed_to_int(x1);
+	x2 = x1 + 1;
+	y1 = pixman_fixed_to_int(y1);
+	y2 = y1 + 1;
+
+	if (x1 >= src_width  || x2 < 0 ||
+	    y1 >= src_height || y2 < 0)
+		return 0;
+
+	if (y2 == 0) {
+		row1 = zero;
+	} else {
+		row1 = src + src_stride * y1;
+		row1 += 4 * x1;
+	}
+
+	if (y1 == src_height - 1) {
+		row2 = zero;
+	} else {
+		row2 = src + src_stride * y2;
+		row2 += 4 * x1;
+	}
+
+	if (x2 == 0) {
+		tl = 0;
+		bl = 0;
+	} else {
+		tl = convert_pixel(row1, 0);
+		bl = convert_pixel(row2, 0);
+	}
+
+	if (x1 == src_width - 1) {
+		tr = 0;
+		br = 0;
+	} else {
+		tr = convert_pixel(row1, 1);
+		br = convert_pixel(row2, 1);
+	}
+
+	return bilinear_interpolation(tl, tr, bl, br, fx, fy);
+}
+
+static force_inline uint32_t
+affine_pixel__nearest(const uint8_t *src, int32_t src_stride,
+		      int src_width, int src_height,
+		      pixman_fixed_t x, pixman_fixed_t y)
+{
+	int x1 = pixman_fixed_to_int(x - pixman_fixed_e);
+	int y1 = pixman_fixed_to_int(y - pixman_fixed_e);
+
+	if ((unsigned)x1 >= src_width || (unsigned)y1 >= src_height)
+		return 0;
+
+	return convert_pixel(src + src_stride * y1, x1);
+}
+
+typedef void (*affine_row_func)(uint32_t *b,
+				const uint8_t *src, int32_t src_stride,
+				int src_width, int src_height,
+				pixman_fixed_t x, pixman_fixed_t y,
+				pixman_fixed_t ux, pixman_fixed_t uy,
+				int width);
+
+static fast void
+affine_row__nearest(uint32_t *b,
+		    const uint8_t *src, int32_t src_stride,
+		    int src_width, int src_height,
+		    pixman_fixed_t x, pixman_fixed_t y,
+		    pixman_fixed_t ux, pixman_fixed_t uy,
+		    int width)
+{
+	while (width--) {
+		*b++ = affine_pixel__nearest(src, src_stride,
+					     src_width, src_height,
+					     x, y);
+		x += ux;
+		y += uy;
+	}
+}
+
+/* Rows where every sample lands exactly on a source pixel: identity,
+ * integer translations, the 90/180/270 rotations and reflections. Here
+ * bilinear filtering reduces to a straight copy of the source pixels.
+ */
+static fast void
+affine_row__exact(uint32_t *b,
+		  const uint8_t *src, int32_t src_stride,
+		  int src_width, int src_height,
+		  pixman_fixed_t x, pixman_fixed_t y,
+		  pixman_fixed_t ux, pixman_fixed_t uy,
+		  int width)
+{
+	int x1 = pixman_fixed_to_int(x - pixman_fixed_1/2);
+	int y1 = pixman_fixed_to_int(y - pixman_fixed_1/2);
+	int dx = pixman_fixed_to_int(ux);
+	int dy = pixman_fixed_to_int(uy);
+
+	if (dy == 0) {
+		const uint32_t *row;
+
+		if ((unsigned)y1 >= src_height) {
+			memset(b, 0, 4*width);
+			return;
+		}
+
+		row = (const uint32_t *)(src + src_stride * y1);
+		if (dx == 1 && x1 >= 0 && x1 + width <= src_width) {
+			memcpy(b, row + x1, 4*width);
+			return;
+		}
+
+		while (width--) {
+			*b++ = (unsigned)x1 < src_width ? row[x1] : 0;
+			x1 += dx;
+		}
+	} else {
+		while (width--) {
+			if ((unsigned)x1 < src_width && (unsigned)y1 < src_height)
+				*b = convert_pixel(src + src_stride * y1, x1);
+			else
+				*b = 0;
+			b++;
+			x1 += dx;
+			y1 += dy;
+		}
+	}
+}
+
+static fast void
+affine_row__bilinear__generic(uint32_t *b,
+			      const uint8_t *src, int32_t src_stride,
+			      int src_width, int src_height,
+			      pixman_fixed_t x, pixman_fixed_t y,
+			      pixman_fixed_t ux, pixman_fixed_t uy,
+			      int width)
+{
+	while (width--) {
+		*b++ = affine_pixel__bilinear(src, src_stride,
+					      src_width, src_height,
+					      x, y);
+		x += ux;
+		y += uy;
+	}
+}
+
+#if USE_SSE4_1
+/* Vector form of the 4-bit bilinear_interpolation() above, so that the
+ * results are bit-for-bit identical to the generic path. With weights
+ * summing to 256, each 16-bit half of the 0x00ff00ff-masked lanes cannot
+ * overflow, so we can use 32-bit multiplies on two channels at a time.
+ */
+sse4_1 static force_inline __m128i
+bilinear_4__sse4_1(__m128i tl, __m128i tr, __m128i bl, __m128i br,
+		   __m128i fx, __m128i fy)
+{
+	const __m128i mask = _mm_set1_epi32(0xff00ff);
+	__m128i distxy, distxiy, distixy, distixiy;
+	__m128i lo, hi;
+
+	distxy = _mm_mullo_epi32(fx, fy);
+	distxiy = _mm_sub_epi32(_mm_slli_epi32(fx, 4), distxy);
+	distixy = _mm_sub_epi32(_mm_slli_epi32(fy, 4), distxy);
+	distixiy = _mm_add_epi32(_mm_sub_epi32(_mm_set1_epi32(256),
+					       _mm_slli_epi32(_mm_add_epi32(fx, fy), 4)),
+				 distxy);
+
+	lo = _mm_mullo_epi32(_mm_and_si128(tl, mask), distixiy);
+	hi = _mm_mullo_epi32(_mm_and_si128(_mm_srli_epi32(tl, 8), mask), distixiy);
+
+	lo = _mm_add_epi32(lo, _mm_mullo_epi32(_mm_and_si128(tr, mask), distxiy));
+	hi = _mm_add_epi32(hi, _mm_mullo_epi32(_mm_and_si128(_mm_srli_epi32(tr, 8), mask), distxiy));
+
+	lo = _mm_add_epi32(lo, _mm_mullo_epi32(_mm_and_si128(bl, mask), distixy));
+	hi = _mm_add_epi32(hi, _mm_mullo_epi32(_mm_and_si128(_mm_srli_epi32(bl, 8), mask), distixy));
+
+	lo = _mm_add_epi32(lo, _mm_mullo_epi32(_mm_and_si128(br, mask), distxy));
+	hi = _mm_add_epi32(hi, _mm_mullo_epi32(_mm_and_si128(_mm_srli_epi32(br, 8), mask), distxy));
+
+	return _mm_or_si128(_mm_and_si128(_mm_srli_epi32(lo, 8), mask),
+			    _mm_andnot_si128(mask, hi));
+}
+
+/* With scale set (uy == 0), every sample in the row shares the same
+ * pair of source rows and vertical weight, so only x varies.
+ */
+sse4_1 static force_inline void
+affine_row__bilinear__sse4_1(uint32_t *b,
+			     const uint8_t *src, int32_t src_stride,
+			     int src_width, int src_height,
+			     pixman_fixed_t x, pixman_fixed_t y,
+			     pixman_fixed_t ux, pixman_fixed_t uy,
+			     int width, const bool scale)
+{
+	const __m128i step = _mm_setr_epi32(0, 1, 2, 3);
+	const __m128i weight = _mm_set1_epi32((1 << BILINEAR_INTERPOLATION_BITS) - 1);
+	const __m128i xmax = _mm_set1_epi32(src_width - 2);
+	const __m128i ymax = _mm_set1_epi32(src_height - 2);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ux4 = _mm_set1_epi32(4*ux), uy4 = _mm_set1_epi32(4*uy);
+	__m128i vx, vy;
+
+	vx = _mm_add_epi32(_mm_set1_epi32(x - pixman_fixed_1/2),
+			   _mm_mullo_epi32(step, _mm_set1_epi32(ux)));
+	vy = _mm_add_epi32(_mm_set1_epi32(y - pixman_fixed_1/2),
+			   _mm_mullo_epi32(step, _mm_set1_epi32(uy)));
+
+	while (width >= 4) {
+		__m128i x1 = _mm_srai_epi32(vx, 16);
+		__m128i y1 = _mm_srai_epi32(vy, 16);
+		__m128i outside;
+
+		/* both x1 and x1+1 (and y1, y1+1) must lie inside the source */
+		outside = _mm_or_si128(_mm_cmpgt_epi32(x1, xmax),
+				       _mm_cmpgt_epi32(zero, x1));
+		outside = _mm_or_si128(outside, _mm_cmpgt_epi32(y1, ymax));
+		outside = _mm_or_si128(outside, _mm_cmpgt_epi32(zero, y1));
+
+		if (_mm_movemask_epi8(outside)) {
+			int n;
+
+			for (n = 0; n < 4; n++) {
+				*b++ = affine_pixel__bilinear(src, src_stride,
+							      src_width, src_height,
+							      x, y);
+				x += ux;
+				y += uy;
+			}
+		} else {
+			int32_t off[4] __attribute__((aligned(16)));
+			const uint8_t *row1 = src, *row2 = src + src_stride;
+			__m128i tl, tr, bl, br, fx, fy;
+
+			if (scale) {
+				row1 += _mm_extract_epi32(y1, 0) * src_stride;
+				row2 += _mm_extract_epi32(y1, 0) * src_stride;
+				_mm_store_si128((__m128i *)off, _mm_slli_epi32(x1, 2));
+			} else
+				_mm_store_si128((__m128i *)off,
+						_mm_add_epi32(_mm_mullo_epi32(y1, _mm_set1_epi32(src_stride)),
+							      _mm_slli_epi32(x1, 2)));
+
+#define P(row, n) *(const uint32_t *)(row + off[n])
+			tl = _mm_setr_epi32(P(row1, 0), P(row1, 1), P(row1, 2), P(row1, 3));
+			tr = _mm_setr_epi32(P(row1 + 4, 0), P(row1 + 4, 1), P(row1 + 4, 2), P(row1 + 4, 3));
+			bl = _mm_setr_epi32(P(row2, 0), P(row2, 1), P(row2, 2), P(row2, 3));
+			br = _mm_setr_epi32(P(row2 + 4, 0), P(row2 + 4, 1), P(row2 + 4, 2), P(row2 + 4, 3));
+#undef P
+
+			fx = _mm_and_si128(_mm_srli_epi32(vx, 16 - BILINEAR_INTERPOLATION_BITS), weight);
+			fy = _mm_and_si128(_mm_srli_epi32(vy, 16 - BILINEAR_INTERPOLATION_BITS), weight);
+
+			_mm_storeu_si128((__m128i *)b,
+					 bilinear_4__sse4_1(tl, tr, bl, br, fx, fy));
+			b += 4;
+			x += 4*ux;
+			y += 4*uy;
+		}
+
+		vx = _mm_add_epi32(vx, ux4);
+		if (!scale)
+			vy = _mm_add_epi32(vy, uy4);
+		width -= 4;
+	}
+
+	while (width--) {
+		*b++ = affine_pixel__bilinear(src, src_stride,
+					      src_width, src_height,
+					      x, y);
+		x += ux;
+		y += uy;
+	}
+}
+
+sse4_1 static void
+affine_row__bilinear__sse4_1__affine(uint32_t *b,
+				     const uint8_t *src, int32_t src_stride,
+				     int src_width, int src_height,
+				     pixman_fixed_t x, pixman_fixed_t y,
+				     pixman_fixed_t ux, pixman_fixed_t uy,
+				     int width)
+{
+	affine_row__bilinear__sse4_1(b, src, src_stride,
+				     src_width, src_height,
+				     x, y, ux, uy, width,
+				     false);
+}
+
+sse4_1 static void
+affine_row__bilinear__sse4_1__scale(uint32_t *b,
+				    const uint8_t *src, int32_t src_stride,
+				    int src_width, int src_height,
+				    pixman_fixed_t x, pixman_fixed_t y,
+				    pixman_fixed_t ux, pixman_fixed_t uy,
+				    int width)
+{
+	affine_row__bilinear__sse4_1(b, src, src_stride,
+				     src_width, src_height,
+				     x, y, ux, uy, width,
+				     true);
+}
+#endif
+
+#if USE_AVX2
+avx2 static force_inline __m256i
+bilinear_8__avx2(__m256i tl, __m256i tr, __m256i bl, __m256i br,
+		 __m256i fx, __m256i fy)
+{
+	const __m256i mask = _mm256_set1_epi32(0xff00ff);
+	__m256i distxy, distxiy, distixy, distixiy;
+	__m256i lo, hi;
+
+	distxy = _mm256_mullo_epi32(fx, fy);
+	distxiy = _mm256_sub_epi32(_mm256_slli_epi32(fx, 4), distxy);
+	distixy = _mm256_sub_epi32(_mm256_slli_epi32(fy, 4), distxy);
+	distixiy = _mm256_add_epi32(_mm256_sub_epi32(_mm256_set1_epi32(256),
+						     _mm256_slli_epi32(_mm256_add_epi32(fx, fy), 4)),
+				    distxy);
+
+	lo = _mm256_mullo_epi32(_mm256_and_si256(tl, mask), distixiy);
+	hi = _mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(tl, 8), mask), distixiy);
+
+	lo = _mm256_add_epi32(lo, _mm256_mullo_epi32(_mm256_and_si256(tr, mask), distxiy));
+	hi = _mm256_add_epi32(hi, _mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(tr, 8), mask), distxiy));
+
+	lo = _mm256_add_epi32(lo, _mm256_mullo_epi32(_mm256_and_si256(bl, mask), distixy));
+	hi = _mm256_add_epi32(hi, _mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(bl, 8), mask), distixy));
+
+	lo = _mm256_add_epi32(lo, _mm256_mullo_epi32(_mm256_and_si256(br, mask), distxy));
+	hi = _mm256_add_epi32(hi, _mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(br, 8), mask), distxy));
+
+	return _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(lo, 8), mask),
+			       _mm256_andnot_si256(mask, hi));
+}
+
+avx2 static force_inline void
+affine_row__bilinear__avx2(uint32_t *b,
+			   const uint8_t *src, int32_t src_stride,
+			   int src_width, int src_height,
+			   pixman_fixed_t x, pixman_fixed_t y,
+			   pixman_fixed_t ux, pixman_fixed_t uy,
+			   int width, const bool scale)
+{
+	const __m256i step = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i weight = _mm256_set1_epi32((1 << BILINEAR_INTERPOLATION_BITS) - 1);
+	const __m256i xmax = _mm256_set1_epi32(src_width - 2);
+	const __m256i ymax = _mm256_set1_epi32(src_height - 2);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i ux8 = _mm256_set1_epi32(8*ux), uy8 = _mm256_set1_epi32(8*uy);
+	const __m256i four = _mm256_set1_epi32(4);
+	const __m256i stride = _mm256_set1_epi32(src_stride);
+	__m256i vx, vy;
+
+	vx = _mm256_add_epi32(_mm256_set1_epi32(x - pixman_fixed_1/2),
+			      _mm256_mullo_epi32(step, _mm256_set1_epi32(ux)));
+	vy = _mm256_add_epi32(_mm256_set1_epi32(y - pixman_fixed_1/2),
+			      _mm256_mullo_epi32(step, _mm256_set1_epi32(uy)));
+
+	while (width >= 8) {
+		__m256i x1 = _mm256_srai_epi32(vx, 16);
+		__m256i y1 = _mm256_srai_epi32(vy, 16);
+		__m256i outside;
+
+		outside = _mm256_or_si256(_mm256_cmpgt_epi32(x1, xmax),
+					  _mm256_cmpgt_epi32(zero, x1));
+		outside = _mm256_or_si256(outside, _mm256_cmpgt_epi32(y1, ymax));
+		outside = _mm256_or_si256(outside, _mm256_cmpgt_epi32(zero, y1));
+
+		if (_mm256_movemask_epi8(outside)) {
+			int n;
+
+			for (n = 0; n < 8; n++) {
+				*b++ = affine_pixel__bilinear(src, src_stride,
+							      src_width, src_height,
+							      x, y);
+				x += ux;
+				y += uy;
+			}
+		} else {
+			__m256i off, tl, tr, bl, br, fx, fy;
+			const int *row1 = (const int *)src;
+			const int *row2 = (const int *)(src + src_stride);
+
+			if (scale)
+				off = _mm256_add_epi32(_mm256_set1_epi32(_mm256_extract_epi32(y1, 0) * src_stride),
+						       _mm256_slli_epi32(x1, 2));
+			else
+				off = _mm256_add_epi32(_mm256_mullo_epi32(y1, stride),
+						       _mm256_slli_epi32(x1, 2));
+
+			tl = _mm256_i32gather_epi32(row1, off, 1);
+			tr = _mm256_i32gather_epi32(row1, _mm256_add_epi32(off, four), 1);
+			bl = _mm256_i32gather_epi32(row2, off, 1);
+			br = _mm256_i32gather_epi32(row2, _mm256_add_epi32(off, four), 1);
+
+			fx = _mm256_and_si256(_mm256_srli_epi32(vx, 16 - BILINEAR_INTERPOLATION_BITS), weight);
+			fy = _mm256_and_si256(_mm256_srli_epi32(vy, 16 - BILINEAR_INTERPOLATION_BITS), weight);
+
+			_mm256_storeu_si256((__m256i *)b,
+					    bilinear_8__avx2(tl, tr, bl, br, fx, fy));
+			b += 8;
+			x += 8*ux;
+			y += 8*uy;
+		}
+
+		vx = _mm256_add_epi32(vx, ux8);
+		if (!scale)
+			vy = _mm256_add_epi32(vy, uy8);
+		width -= 8;
+	}
+
+	while (width--) {
+		*b++ = affine_pixel__bilinear(src, src_stride,
+					      src_width, src_height,
+					      x, y);
+		x += ux;
+		y += uy;
+	}
+}
+
+avx2 static void
+affine_row__bilinear__avx2__affine(uint32_t *b,
+				   const uint8_t *src, int32_t src_stride,
+				   int src_width, int src_height,
+				   pixman_fixed_t x, pixman_fixed_t y,
+				   pixman_fixed_t ux, pixman_fixed_t uy,
+				   int width)
+{
+	affine_row__bilinear__avx2(b, src, src_stride,
+				   src_width, src_height,
+				   x, y, ux, uy, width,
+				   false);
+}
+
+avx2 static void
+affine_row__bilinear__avx2__scale(uint32_t *b,
+				  const uint8_t *src, int32_t src_stride,
+				  int src_width, int src_height,
+				  pixman_fixed_t x, pixman_fixed_t y,
+				  pixman_fixed_t ux, pixman_fixed_t uy,
+				  int width)
+{
+	affine_row__bilinear__avx2(b, src, src_stride,
+				   src_width, src_height,
+				   x, y, ux, uy, width,
+				   true);
+}
+#endif
+
+static affine_row_func affine_row__bilinear__affine = affine_row__bilinear__generic;
+static affine_row_func affine_row__bilinear__scale = affine_row__bilinear__generic;
+
+static void choose_affine_blt(unsigned cpu)
+{
+#if USE_AVX2
+	if (cpu & AVX2) {
+		affine_row__bilinear__affine = affine_row__bilinear__avx2__affine;
+		affine_row__bilinear__scale = affine_row__bilinear__avx2__scale;
+	} else
+#endif
+#if USE_SSE4_1
+	if (cpu & SSE4_1) {
+		affine_row__bilinear__affine = affine_row__bilinear__sse4_1__affine;
+		affine_row__bilinear__scale = affine_row__bilinear__sse4_1__scale;
+	} else
+#endif
+	{
+		affine_row__bilinear__affine = affine_row__bilinear__generic;
+		affine_row__bilinear__scale = affine_row__bilinear__generic;
+	}
+}
+
+/* Matches is_affine() in sna_display.c, so that anything the display
+ * accepts as an affine transform is also accepted here.
+ */
+#define SCALING_EPSILON (1./256)
+
+static void
+__transform_blt(const void *src, void *dst, int bpp,
+		int16_t src_x, int16_t src_y,
+		int16_t src_width, int16_t src_height,
+		int32_t src_stride,
+		int16_t dst_x, int16_t dst_y,
+		uint16_t dst_width, uint16_t dst_height,
+		int32_t dst_stride,
+		const struct pixman_f_transform *t,
+		bool bilinear)
+{
 	const pixman_fixed_t ux = pixman_double_to_fixed(t->m[0][0]);
 	const pixman_fixed_t uy = pixman_double_to_fixed(t->m[1][0]);
-	int i, j;
+	affine_row_func row;
+	int j;
+
+	DBG(("%s: src=(%d, %d)x(%d, %d), dst=(%d, %d)x(%d, %d), bilinear=%d, ux=%x, uy=%x\n",
+	     __FUNCTION__,
+	     src_x, src_y, src_width, src_height,
+	     dst_x, dst_y, dst_width, dst_height,
+	     bilinear, ux, uy));
 
 	assert(bpp == 32);
 
+	if (!bilinear)
+		row = affine_row__nearest;
+	else if (uy == 0)
+		row = affine_row__bilinear__scale;
+	else
+		row = affine_row__bilinear__affine;
+
 	for (j = 0; j < dst_height; j++) {
 		pixman_fixed_t x, y;
 		struct pixman_f_vector v;
@@ -1150,65 +3458,88 @@ affine_blt(const void *src, void *dst, int bpp,
 		y +=  pixman_int_to_fixed(src_y - dst_y);
 
 		b = (uint32_t*)((uint8_t *)dst + (dst_y + j) * dst_stride + dst_x * bpp / 8);
-		for (i = 0; i < dst_width; i++) {
-			const uint8_t *row1;
-			const uint8_t *row2;
-			int x1, y1, x2, y2;
-			uint32_t tl, tr, bl, br;
-			int32_t fx, fy;
-
-			x1 = x - pixman_fixed_1/2;
-			y1 = y - pixman_fixed_1/2;
-
-			fx = bilinear_weight(x1);
-			fy = bilinear_weight(y1);
-
-			x1 = pixman_fixed_to_int(x1);
-			x2 = x1 + 1;
-			y1 = pixman_fixed_to_int(y1);
-			y2 = y1 + 1;
-
-			if (x1 >= src_width  || x2 < 0 ||
-			    y1 >= src_height || y2 < 0) {
-				b[i] = 0;
-				goto next;
-			}
+		if (bilinear &&
+		    pixman_fixed_frac(x - pixman_fixed_1/2) == 0 &&
+		    pixman_fixed_frac(y - pixman_fixed_1/2) == 0 &&
+		    pixman_fixed_frac(ux) == 0 &&
+		    pixman_fixed_frac(uy) == 0)
+			affine_row__exact(b, src, src_stride,
+					  src_width, src_height,
+					  x, y, ux, uy,
+					  dst_width);
+		else
+			row(b, src, src_stride,
+			    src_width, src_height,
+			    x, y, ux, uy,
+			    dst_width);
+	}
+}
 
-			if (y2 == 0) {
-				row1 = zero;
-			} else {
-				row1 = (uint8_t *)src + src_stride * y1;
-				row1 += bpp / 8 * x1;
-			}
+bool
+transform_blt(const void *src, void *dst, int bpp,
+	      int16_t src_x, int16_t src_y,
+	      int16_t src_width, int16_t src_height,
+	      int32_t src_stride,
+	      int16_t dst_x, int16_t dst_y,
+	      uint16_t dst_width, uint16_t dst_height,
+	      int32_t dst_stride,
+	      const struct pixman_f_transform *t,
+	      int filter)
+{
+	bool bilinear;
 
-			if (y1 == src_height - 1) {
-				row2 = zero;
-			} else {
-				row2 = (uint8_t *)src + src_stride * y2;
-				row2 += bpp / 8 * x1;
-			}
+	if (bpp != 32)
+		return false;
 
-			if (x2 == 0) {
-				tl = 0;
-				bl = 0;
-			} else {
-				tl = convert_pixel(row1, 0);
-				bl = convert_pixel(row2, 0);
-			}
+	if (fabs(t->m[2][0]) >= SCALING_EPSILON ||
+	    fabs(t->m[2][1]) >= SCALING_EPSILON ||
+	    fabs(t->m[2][2] - 1) >= SCALING_EPSILON)
+		return false;
 
-			if (x1 == src_width - 1) {
-				tr = 0;
-				br = 0;
-			} else {
-				tr = convert_pixel(row1, 1);
-				br = convert_pixel(row2, 1);
-			}
+	switch (filter) {
+	case PictFilterNearest:
+	case PictFilterFast:
+		bilinear = false;
+		break;
+	case PictFilterBilinear:
+	case PictFilterGood:
+		bilinear = true;
+		break;
+	default:
+		return false;
+	}
 
-			b[i] = bilinear_interpolation(tl, tr, bl, br, fx, fy);
+	__transform_blt(src, dst, bpp,
+			src_x, src_y,
+			src_width, src_height,
+			src_stride,
+			dst_x, dst_y,
+			dst_width, dst_height,
+			dst_stride,
+			t, bilinear);
+	return true;
+}
 
-next:
-			x += ux;
-			y += uy;
-		}
-	}
+/* The caller has already decided the transform is affine (the cursor
+ * transform is checked by sna_display), so always draw rather than
+ * second-guess it with our own test and lose the image.
+ */
+void
+affine_blt(const void *src, void *dst, int bpp,
+	   int16_t src_x, int16_t src_y,
+	   int16_t src_width, int16_t src_height,
+	   int32_t src_stride,
+	   int16_t dst_x, int16_t dst_y,
+	   uint16_t dst_width, uint16_t dst_height,
+	   int32_t dst_stride,
+	   const struct pixman_f_transform *t)
+{
+	__transform_blt(src, dst, bpp,
+			src_x, src_y,
+			src_width, src_height,
+			src_stride,
+			dst_x, dst_y,
+			dst_width, dst_height,
+			dst_stride,
+			t, true);
 }
@@ -0,0 +1,537 @@
+/*
+ * Copyright © 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/* Microbenchmark for the CPU copy kernels in blt.c.
+ *
+ * This links blt.c directly and so needs neither a GPU nor an X server.
+ * Each kernel is run over a matrix of bpp, row width, alignment, swizzle
+ * and box count, and the result is written as one whitespace separated
+ * line per test:
+ *
+ *   kernel bpp width height align swizzle boxes GB/s cycles/byte
+ *
+ * The output can be saved and passed back in with -b, in which case the
+ * baseline rate and the ratio against it are appended to every line.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "sna.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <stddef.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#define has_tsc() 1
+#define read_tsc() __rdtsc()
+#else
+#define has_tsc() 0
+#define read_tsc() 0
+#endif
+
+#define MAX_BYTES (16 << 20)
+
+static const int bpps[] = { 8, 16, 32 };
+static const int widths[] = { 64, 256, 1024, 4096, 15360 }; /* in bytes */
+static const int aligns[] = { 0, 4, 60 }; /* in bytes */
+static const int boxes[] = { 1, 16, 256 };
+static const char * const swizzles[] = { "0", "9", "9_10", "9_11", "9_10_11" };
+
+static struct {
+	double min_time;
+	const char *filter;
+	const char *baseline;
+	unsigned cpu;
+	int quick;
+} options = {
+	.min_time = 0.05,
+};
+
+/* Normally provided by the X server, needed by DBG() in debug builds */
+void ErrorF(const char *f, ...)
+{
+	va_list va;
+
+	va_start(va, f);
+	vfprintf(stderr, f, va);
+	va_end(va);
+}
+
+void LogF(const char *f, ...)
+{
+	(void)f;
+}
+
+struct baseline {
+	char key[128];
+	double rate;
+};
+static struct baseline *baseline;
+static int baseline_count;
+
+static uint8_t *src_buf, *dst_buf;
+static struct kgem kgem;
+
+static double elapsed(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + 1e-9 * (end->tv_nsec - start->tv_nsec);
+}
+
+struct test {
+	const char *kernel;
+	int bpp, width, height, align, swizzle, boxes;
+	int32_t src_stride, dst_stride;
+	int tiled; /* -1 source tiled, 0 linear, 1 destination tiled */
+	size_t hook; /* offset of the tiling function within struct kgem */
+
+	void (*copy)(const void *src, void *dst, int bpp,
+		     int32_t src_stride, int32_t dst_stride,
+		     int16_t src_x, int16_t src_y,
+		     int16_t dst_x, int16_t dst_y,
+		     uint16_t width, uint16_t height);
+	void (*run)(const struct test *t);
+};
+
+static void run_copy(const struct test *t)
+{
+	int cpp = t->bpp / 8;
+	int x = t->align / cpp;
+	int h = t->height / t->boxes;
+	int n, y;
+
+	for (n = y = 0; n < t->boxes; n++, y += h)
+		t->copy(src_buf, dst_buf, t->bpp,
+			t->src_stride, t->dst_stride,
+			x, y, x, y,
+			t->width, h);
+}
+
+static void run_memmove(const struct test *t)
+{
+	int cpp = t->bpp / 8;
+	int h = t->height / t->boxes;
+	BoxRec box;
+	int n;
+
+	box.x1 = t->align / cpp;
+	box.x2 = box.x1 + t->width;
+	for (n = box.y1 = 0; n < t->boxes; n++, box.y1 += h) {
+		box.y2 = box.y1 + h;
+		memmove_box(dst_buf + t->dst_stride, dst_buf,
+			    t->bpp, t->dst_stride,
+			    &box, 0, 1);
+	}
+}
+
+static void run_xor(const struct test *t)
+{
+	int cpp = t->bpp / 8;
+	int x = t->align / cpp;
+	int h = t->height / t->boxes;
+	int n, y;
+
+	for (n = y = 0; n < t->boxes; n++, y += h)
+		memcpy_xor(src_buf, dst_buf, t->bpp,
+			   t->src_stride, t->dst_stride,
+			   x, y, x, y,
+			   t->width, h,
+			   0xffffffff, 0xff000000);
+}
+
+static void run_xor_tiled(const struct test *t)
+{
+	int cpp = t->bpp / 8;
+	int x = t->align / cpp;
+	int h = t->height / t->boxes;
+	int n, y;
+
+	for (n = y = 0; n < t->boxes; n++, y += h)
+		kgem.memcpy_xor_to_tiled_x(src_buf, dst_buf, t->bpp,
+					   t->src_stride, t->dst_stride,
+					   x, y, x, y,
+					   t->width, h,
+					   0xffffffff, 0xff000000);
+}
+
+static void run_retile(const struct test *t)
+{
+	int cpp = t->bpp / 8;
+	int x = t->align / cpp;
+	int h = t->height / t->boxes;
+	int n, y;
+
+	for (n = y = 0; n < t->boxes; n++, y += h)
+		memcpy_retile(src_buf, dst_buf, t->bpp,
+			      I915_TILING_X, t->swizzle, t->src_stride,
+			      I915_TILING_Y, t->swizzle, t->dst_stride,
+			      x, y, x, y,
+			      t->width, h);
+}
+
+static void run_affine(const struct test *t)
+{
+	struct pixman_f_transform f;
+	int x = t->align / 4;
+	int h = t->height / t->boxes;
+	int n, y;
+
+	/* a mild upscale, so that every sample lies within the source */
+	pixman_f_transform_init_scale(&f, 0.8, 0.8);
+	for (n = y = 0; n < t->boxes; n++, y += h)
+		affine_blt(src_buf, dst_buf, t->bpp,
+			   0, 0, t->width, t->height,
+			   t->src_stride,
+			   x, y, t->width, h,
+			   t->dst_stride,
+			   &f);
+}
+
+static void run_rotate(const struct test *t)
+{
+	struct pixman_f_transform f;
+	int x = t->align / 4;
+	int h = t->height / t->boxes;
+	int n, y;
+
+	/* 90 degrees, every sample lands on a pixel centre */
+	memset(&f, 0, sizeof(f));
+	f.m[0][1] = 1;
+	f.m[1][0] = -1;
+	f.m[1][2] = t->height;
+	f.m[2][2] = 1;
+	for (n = y = 0; n < t->boxes; n++, y += h)
+		transform_blt(src_buf, dst_buf, t->bpp,
+			      0, 0, t->width, t->height,
+			      t->src_stride,
+			      x, y, t->width, h,
+			      t->dst_stride,
+			      &f, PictFilterBilinear);
+}
+
+static int find_baseline(const char *key)
+{
+	int n;
+
+	for (n = 0; n < baseline_count; n++)
+		if (strcmp(baseline[n].key, key) == 0)
+			return n;
+
+	return -1;
+}
+
+static void load_baseline(const char *path)
+{
+	char line[512];
+	FILE *file;
+	int size = 0;
+
+	file = fopen(path, "r");
+	if (file == NULL) {
+		fprintf(stderr, "Unable to open baseline '%s'\n", path);
+		exit(1);
+	}
+
+	while (fgets(line, sizeof(line), file)) {
+		char kernel[64], swizzle[16];
+		int bpp, width, height, align, boxes;
+		double rate;
+
+		if (line[0] == '#')
+			continue;
+
+		if (sscanf(line, "%63s %d %d %d %d %15s %d %lf",
+			   kernel, &bpp, &width, &height, &align,
+			   swizzle, &boxes, &rate) != 8)
+			continue;
+
+		if (baseline_count == size) {
+			size = size ? 2 * size : 256;
+			baseline = realloc(baseline, size * sizeof(*baseline));
+			if (baseline == NULL)
+				exit(1);
+		}
+
+		snprintf(baseline[baseline_count].key,
+			 sizeof(baseline[baseline_count].key),
+			 "%s %d %d %d %d %s %d",
+			 kernel, bpp, width, height, align, swizzle, boxes);
+		baseline[baseline_count].rate = rate;
+		baseline_count++;
+	}
+
+	fclose(file);
+}
+
+static void run_test(const struct test *t)
+{
+	struct timespec start, end;
+	uint64_t bytes, tsc;
+	double secs, rate;
+	char key[128];
+	int iterations, n;
+
+	if (options.filter && strstr(t->kernel, options.filter) == NULL)
+		return;
+
+	/* warm up, and make sure the pages are faulted in */
+	t->run(t);
+
+	iterations = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	tsc = read_tsc();
+	do {
+		t->run(t);
+		iterations++;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		secs = elapsed(&start, &end);
+	} while (secs < options.min_time);
+	tsc = read_tsc() - tsc;
+
+	bytes = (uint64_t)iterations * t->boxes *
+		(t->height / t->boxes) * t->width * t->bpp / 8;
+	rate = bytes / secs / 1e9;
+
+	snprintf(key, sizeof(key), "%s %d %d %d %d %s %d",
+		 t->kernel, t->bpp, t->width, t->height, t->align,
+		 t->tiled ? swizzles[t->swizzle] : "-", t->boxes);
+	printf("%s %.3f", key, rate);
+	if (has_tsc())
+		printf(" %.3f", (double)tsc / bytes);
+	else
+		printf(" -");
+
+	n = find_baseline(key);
+	if (n >= 0)
+		printf(" %.3f %.3f", baseline[n].rate, rate / baseline[n].rate);
+	printf("\n");
+	fflush(stdout);
+}
+
+static void run_matrix(struct test *t, int tile_width, int max_swizzle)
+{
+	int b, w, a, s, n;
+
+	for (b = 0; b < ARRAY_SIZE(bpps); b++) {
+		t->bpp = bpps[b];
+		if ((t->run == run_affine || t->run == run_rotate) && t->bpp != 32)
+			continue;
+
+		for (w = 0; w < ARRAY_SIZE(widths); w++) {
+			int pitch;
+
+			t->width = widths[w] / (t->bpp / 8);
+			for (a = 0; a < ARRAY_SIZE(aligns); a++) {
+				t->align = aligns[a] & -(t->bpp / 8);
+
+				pitch = ALIGN(widths[w] + t->align, tile_width);
+				t->src_stride = t->dst_stride = pitch;
+				t->height = MAX_BYTES / 2 / pitch;
+				if (t->height > 2160)
+					t->height = 2160;
+				if ((t->run == run_affine || t->run == run_rotate) && t->height > 512)
+					t->height = 512;
+				t->height &= ~255;
+				if (t->height == 0)
+					t->height = 256;
+
+				for (s = 0; s <= max_swizzle; s++) {
+					t->swizzle = s;
+					if (t->tiled) {
+						choose_memcpy_tiled_x(&kgem, s, options.cpu);
+						choose_memcpy_tiled_y(&kgem, s);
+					}
+					if (t->hook) {
+						memcpy(&t->copy, (char *)&kgem + t->hook, sizeof(t->copy));
+						if (t->copy == NULL)
+							return;
+					}
+
+					for (n = 0; n < ARRAY_SIZE(boxes); n++) {
+						t->boxes = boxes[n];
+						run_test(t);
+						if (options.quick)
+							break;
+					}
+				}
+
+				if (options.quick)
+					break;
+			}
+		}
+	}
+}
+
+static void run_tiled(const char *kernel, size_t hook, int tiled, int tile_width)
+{
+	struct test t;
+
+	memset(&t, 0, sizeof(t));
+	t.kernel = kernel;
+	t.tiled = tiled;
+	t.run = run_copy;
+	t.hook = hook;
+
+	/* run_matrix() looks up the kernel for each swizzle mode */
+	run_matrix(&t, tile_width, options.quick ? 0 : ARRAY_SIZE(swizzles) - 1);
+}
+
+static void run_linear(const char *kernel,
+		       void (*run)(const struct test *t),
+		       void (*copy)(const void *src, void *dst, int bpp,
+				    int32_t src_stride, int32_t dst_stride,
+				    int16_t src_x, int16_t src_y,
+				    int16_t dst_x, int16_t dst_y,
+				    uint16_t width, uint16_t height))
+{
+	struct test t;
+
+	memset(&t, 0, sizeof(t));
+	t.kernel = kernel;
+	t.run = run;
+	t.copy = copy;
+
+	run_matrix(&t, 64, 0);
+}
+
+static void run_xor_matrix(const char *kernel,
+			   void (*run)(const struct test *t),
+			   int tile_width)
+{
+	struct test t;
+
+	memset(&t, 0, sizeof(t));
+	t.kernel = kernel;
+	t.run = run;
+	t.tiled = tile_width != 0;
+
+	run_matrix(&t, tile_width ?: 64,
+		   tile_width && !options.quick ? ARRAY_SIZE(swizzles) - 1 : 0);
+}
+
+#define HOOK(x) offsetof(struct kgem, x)
+
+/* Only memcpy_blt, memcpy_xor and the X-tiling kernels have per-ISA
+ * variants, the remainder are just run once along with the generic set.
+ */
+static void run_isa(const char *isa, unsigned cpu, bool all)
+{
+	char name[64];
+
+	options.cpu = cpu;
+	choose_memcpy_blt(cpu);
+
+#define NAME(x) (snprintf(name, sizeof(name), "%s/%s", x, isa), name)
+	run_linear(NAME("memcpy_blt"), run_copy, memcpy_blt);
+	run_tiled(NAME("memcpy_to_tiled_x"), HOOK(memcpy_to_tiled_x), 1, 512);
+	run_tiled(NAME("memcpy_from_tiled_x"), HOOK(memcpy_from_tiled_x), -1, 512);
+	run_xor_matrix(NAME("memcpy_xor"), run_xor, 0);
+	run_xor_matrix(NAME("memcpy_xor_to_tiled_x"), run_xor_tiled, 512);
+	run_linear(NAME("affine_blt"), run_affine, NULL);
+	if (!all)
+		return;
+
+	run_linear(NAME("memcpy_blt__from_wc"), run_copy, memcpy_blt__from_wc);
+	run_linear(NAME("memcpy_blt__nt"), run_copy, memcpy_blt__nt);
+	run_tiled(NAME("memcpy_to_tiled_x__nt"), HOOK(memcpy_to_tiled_x__nt), 1, 512);
+	run_tiled(NAME("memcpy_to_tiled_y"), HOOK(memcpy_to_tiled_y), 1, 128);
+	run_tiled(NAME("memcpy_from_tiled_y"), HOOK(memcpy_from_tiled_y), -1, 128);
+	run_tiled(NAME("memcpy_to_tiled_y__nt"), HOOK(memcpy_to_tiled_y__nt), 1, 128);
+	run_xor_matrix(NAME("memcpy_retile/x-to-y"), run_retile, 512);
+
+	run_linear(NAME("memmove_box"), run_memmove, NULL);
+	run_linear(NAME("transform_blt/rotate"), run_rotate, NULL);
+#undef NAME
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-q] [-t seconds] [-k kernel] [-b baseline]\n"
+		"  -q  quick run, only the first alignment, swizzle and box count\n"
+		"  -t  minimum time to spend on each test [default %.2f]\n"
+		"  -k  only run kernels whose name contains the string\n"
+		"  -b  compare against the output of a previous run\n",
+		prog, options.min_time);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	char buf[1024];
+	unsigned cpu;
+	int c;
+
+	while ((c = getopt(argc, argv, "qt:k:b:h")) != -1) {
+		switch (c) {
+		case 'q':
+			options.quick = 1;
+			break;
+		case 't':
+			options.min_time = atof(optarg);
+			break;
+		case 'k':
+			options.filter = optarg;
+			break;
+		case 'b':
+			options.baseline = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (options.baseline)
+		load_baseline(options.baseline);
+
+	src_buf = aligned_alloc(4096, MAX_BYTES);
+	dst_buf = aligned_alloc(4096, MAX_BYTES);
+	if (src_buf == NULL || dst_buf == NULL)
+		return 1;
+
+	memset(src_buf, 0x55, MAX_BYTES);
+	memset(dst_buf, 0xaa, MAX_BYTES);
+
+	kgem.gen = 070;
+
+	cpu = sna_cpu_detect();
+	printf("# cpu: %s\n", sna_cpu_features_to_string(cpu, buf));
+	printf("# kernel bpp width height align swizzle boxes GB/s cycles/byte%s\n",
+	       baseline_count ? " baseline-GB/s ratio" : "");
+
+	run_isa("generic", cpu & ~(AVX2 | AVX512F), true);
+	if (cpu & AVX2)
+		run_isa("avx2", cpu & ~AVX512F, false);
+	if (cpu & AVX512F)
+		run_isa("avx512", cpu, false);
+
+	return 0;
+}
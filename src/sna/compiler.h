@@ -60,6 +60,7 @@
 
 #if HAS_GCC(4, 5)
 #define sse2 __attribute__((target("sse2,fpmath=sse")))
+#define sse4_1 __attribute__((target("sse4.1,sse2,fpmath=sse")))
 #define sse4_2 __attribute__((target("sse4.2,sse2,fpmath=sse")))
 #endif
 
@@ -67,6 +68,10 @@
 #define avx2 __attribute__((target("avx2,sse4.2,sse2,fpmath=sse")))
 #endif
 
+#if HAS_GCC(4, 9)
+#define avx512 __attribute__((target("avx512f,avx2,sse4.2,sse2,fpmath=sse")))
+#endif
+
 #if HAS_GCC(4, 6) && defined(__OPTIMIZE__)
 #define fast __attribute__((optimize("Ofast")))
 #else
@@ -0,0 +1,831 @@
+/*
+ * Copyright © 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/* Benchmark and fuzzer for the damage tracking in sna_damage.c.
+ *
+ * This links sna_damage.c directly and so needs neither a GPU nor an X
+ * server. A stream of damage operations, either one of the built-in
+ * synthetic workloads or a trace recorded by a running server with
+ * Option "DamageCapture", is replayed through the same entry points the
+ * driver uses, and for each stream one line is written:
+ *
+ *   stream ops ns/op peak-boxes peak-reduced mismatches
+ *
+ * where peak-boxes is the most rectangles held in any reduced region,
+ * peak-reduced the most returned by a single get_boxes, and mismatches
+ * counts the queries in a recorded trace that now give a different
+ * answer. With -v the time is also broken down by operation, along with
+ * a bound on its 99th percentile.
+ *
+ * -f instead runs random operations against a reference pixman region,
+ * checking every query, and exits with failure on the first divergence.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "sna.h"
+#include "sna_damage_capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <time.h>
+
+static const char * const op_names[NUM_DAMAGE_OPS] = {
+	[DAMAGE_OP_ADD] = "add",
+	[DAMAGE_OP_SUBTRACT] = "subtract",
+	[DAMAGE_OP_ALL] = "all",
+	[DAMAGE_OP_CONTAINS] = "contains",
+	[DAMAGE_OP_INTERSECT] = "intersect",
+	[DAMAGE_OP_GET_BOXES] = "get_boxes",
+	[DAMAGE_OP_REDUCE] = "reduce",
+	[DAMAGE_OP_DESTROY] = "destroy",
+};
+
+static struct {
+	double min_time;
+	int width, height;
+	int frames;
+	unsigned seed;
+	int verbose;
+} options = {
+	.min_time = 0.5,
+	.width = 1920,
+	.height = 1080,
+	.frames = 1000,
+	.seed = 1,
+};
+
+void ErrorF(const char *f, ...)
+{
+	va_list va;
+
+	va_start(va, f);
+	vfprintf(stderr, f, va);
+	va_end(va);
+}
+
+void LogF(const char *f, ...)
+{
+	(void)f;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* A stream is held in memory in the same format as a recorded trace */
+struct stream {
+	const char *name;
+	char *data;
+	size_t len, size;
+};
+
+static void stream_write(struct stream *s, const void *ptr, size_t len)
+{
+	if (s->len + len > s->size) {
+		s->size = 2 * s->size + len;
+		s->data = realloc(s->data, s->size);
+		if (s->data == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+	memcpy(s->data + s->len, ptr, len);
+	s->len += len;
+}
+
+/* Synthetic streams name their damage by small integers */
+enum { GPU = 1, CPU = 2 };
+
+static void emit(struct stream *s, unsigned type, unsigned id,
+		 const BoxRec *box, int n)
+{
+	struct sna_damage_capture_op op;
+
+	op.damage = id;
+	op.result = id;
+	op.type = type;
+	op.nbox = n;
+	stream_write(s, &op, sizeof(op));
+	stream_write(s, box, n * sizeof(BoxRec));
+}
+
+static void emit_box(struct stream *s, unsigned type, unsigned id,
+		     int x, int y, int w, int h)
+{
+	BoxRec box;
+
+	box.x1 = x;
+	box.y1 = y;
+	box.x2 = x + w;
+	box.y2 = y + h;
+	emit(s, type, id, &box, 1);
+}
+
+static void emit_region(struct stream *s, unsigned type, unsigned id,
+			const RegionRec *region)
+{
+	int n;
+	const BoxRec *box = pixman_region_rectangles((RegionPtr)region, &n);
+
+	if (n)
+		emit(s, type, id, box, n);
+}
+
+/* A terminal scrolling a line at a time: the bulk of the window is a
+ * copy on the GPU, the new line is rendered glyph by glyph.
+ */
+static void gen_scroll(struct stream *s)
+{
+	const int x = 64, y = 64, cols = 100, rows = 50, cw = 8, ch = 16;
+	BoxRec glyphs[100];
+	int frame, i, n;
+
+	for (frame = 0; frame < options.frames; frame++) {
+		emit_box(s, DAMAGE_OP_CONTAINS, CPU, x, y, cols*cw, rows*ch);
+		emit_box(s, DAMAGE_OP_ADD, GPU, x, y, cols*cw, (rows-1)*ch);
+
+		for (i = n = 0; i < cols; i++) {
+			if (rand() % 4 == 0)
+				continue;
+
+			glyphs[n].x1 = x + i*cw;
+			glyphs[n].x2 = glyphs[n].x1 + cw;
+			glyphs[n].y1 = y + (rows-1)*ch;
+			glyphs[n].y2 = glyphs[n].y1 + ch;
+			n++;
+		}
+		if (n) {
+			emit(s, DAMAGE_OP_ADD, GPU, glyphs, n);
+			emit(s, DAMAGE_OP_SUBTRACT, CPU, glyphs, n);
+		}
+
+		if (frame % 8 == 7) {
+			emit(s, DAMAGE_OP_GET_BOXES, GPU, NULL, 0);
+			emit_box(s, DAMAGE_OP_ADD, CPU, x, y, cols*cw, ch);
+			emit_box(s, DAMAGE_OP_SUBTRACT, GPU, x, y, cols*cw, ch);
+		}
+	}
+}
+
+/* A blinking text cursor, alternately drawn by the CPU and the GPU */
+static void gen_cursor(struct stream *s)
+{
+	int frame, x = 200, y = 300;
+
+	for (frame = 0; frame < options.frames; frame++) {
+		unsigned draw = frame & 1 ? CPU : GPU;
+		unsigned other = frame & 1 ? GPU : CPU;
+
+		emit_box(s, DAMAGE_OP_CONTAINS, other, x, y, 2, 16);
+		emit_box(s, DAMAGE_OP_ADD, draw, x, y, 2, 16);
+		emit_box(s, DAMAGE_OP_SUBTRACT, other, x, y, 2, 16);
+		if (frame % 64 == 63) {
+			x += 8;
+			emit(s, DAMAGE_OP_REDUCE, draw, NULL, 0);
+		}
+	}
+}
+
+/* A browser repainting some of the 256x256 tiles of its page on the
+ * CPU, a line of text at a time, and then uploading them.
+ */
+static void gen_browser(struct stream *s)
+{
+	const int x = 100, y = 50, w = 1280, h = 960, tile = 256;
+	BoxRec lines[32];
+	int frame, t, i, n;
+
+	for (frame = 0; frame < options.frames; frame++) {
+		int count = 1 + rand() % 8;
+
+		for (t = 0; t < count; t++) {
+			int tx = x + rand() % (w / tile) * tile;
+			int ty = y + rand() % (h / tile) * tile;
+
+			for (i = n = 0; i < tile / 8; i++) {
+				int len = 16 + rand() % (tile - 16);
+
+				if (rand() % 3 == 0)
+					continue;
+
+				lines[n].x1 = tx;
+				lines[n].x2 = tx + len;
+				lines[n].y1 = ty + i * 8;
+				lines[n].y2 = lines[n].y1 + 7;
+				n++;
+			}
+
+			emit_box(s, DAMAGE_OP_CONTAINS, GPU, tx, ty, tile, tile);
+			if (n)
+				emit(s, DAMAGE_OP_ADD, CPU, lines, n);
+		}
+
+		emit(s, DAMAGE_OP_GET_BOXES, CPU, NULL, 0);
+		emit_box(s, DAMAGE_OP_ADD, GPU, x, y, w, h);
+		emit_box(s, DAMAGE_OP_SUBTRACT, CPU, x, y, w, h);
+	}
+}
+
+/* Full-screen video with subtitles rendered on the CPU over each frame */
+static void gen_video(struct stream *s)
+{
+	int frame, i;
+
+	for (frame = 0; frame < options.frames; frame++) {
+		emit_box(s, DAMAGE_OP_SUBTRACT, CPU,
+			 0, 0, options.width, options.height);
+		emit_box(s, DAMAGE_OP_ALL, GPU,
+			 0, 0, options.width, options.height);
+
+		if (frame % 3 == 0)
+			continue;
+
+		for (i = 0; i < 24; i++) {
+			int gx = options.width / 4 + i * 20;
+			int gy = options.height - 80;
+
+			emit_box(s, DAMAGE_OP_CONTAINS, GPU, gx, gy, 16, 24);
+			emit_box(s, DAMAGE_OP_ADD, CPU, gx, gy, 16, 24);
+			emit_box(s, DAMAGE_OP_SUBTRACT, GPU, gx, gy, 16, 24);
+		}
+		emit(s, DAMAGE_OP_GET_BOXES, CPU, NULL, 0);
+	}
+}
+
+/* A window dragged across a desktop littered with smaller windows, so
+ * that each move exposes a heavily fragmented region.
+ */
+static void gen_move(struct stream *s)
+{
+	const int w = 640, h = 480;
+	RegionRec obscured, region, old;
+	int frame, i, x = 0, y = 0, dx = 4, dy = 3;
+
+	pixman_region_init(&obscured);
+	for (i = 0; i < 96; i++) {
+		RegionRec r;
+
+		pixman_region_init_rect(&r,
+					rand() % options.width,
+					rand() % options.height,
+					16 + rand() % 160,
+					16 + rand() % 120);
+		pixman_region_union(&obscured, &obscured, &r);
+		pixman_region_fini(&r);
+	}
+
+	pixman_region_init(&old);
+	for (frame = 0; frame < options.frames; frame++) {
+		BoxRec box;
+
+		if (x + dx < 0 || x + dx + w > options.width)
+			dx = -dx;
+		if (y + dy < 0 || y + dy + h > options.height)
+			dy = -dy;
+		x += dx;
+		y += dy;
+
+		pixman_region_init_rect(&region, x, y, w, h);
+		pixman_region_subtract(&region, &region, &obscured);
+
+		box.x1 = x; box.y1 = y;
+		box.x2 = x + w; box.y2 = y + h;
+		emit(s, DAMAGE_OP_CONTAINS, CPU, &box, 1);
+		emit_region(s, DAMAGE_OP_ADD, GPU, &region);
+		emit_region(s, DAMAGE_OP_SUBTRACT, CPU, &region);
+
+		/* the background repainted where the window was */
+		pixman_region_subtract(&old, &old, &region);
+		emit_region(s, DAMAGE_OP_ADD, CPU, &old);
+		emit_region(s, DAMAGE_OP_SUBTRACT, GPU, &old);
+		emit_region(s, DAMAGE_OP_INTERSECT, GPU, &region);
+
+		pixman_region_fini(&old);
+		old = region;
+		if (frame % 16 == 15)
+			emit(s, DAMAGE_OP_REDUCE, GPU, NULL, 0);
+	}
+	pixman_region_fini(&old);
+	pixman_region_fini(&obscured);
+}
+
+static const struct generator {
+	const char *name;
+	void (*func)(struct stream *s);
+} generators[] = {
+	{ "scroll", gen_scroll },
+	{ "cursor", gen_cursor },
+	{ "browser", gen_browser },
+	{ "video", gen_video },
+	{ "move", gen_move },
+};
+
+static bool load_trace(struct stream *s, const char *path)
+{
+	struct sna_damage_capture_header header;
+	char buf[65536];
+	size_t len;
+	FILE *file;
+
+	file = fopen(path, "r");
+	if (file == NULL)
+		return false;
+
+	if (fread(&header, sizeof(header), 1, file) != 1 ||
+	    header.magic != SNA_DAMAGE_CAPTURE_MAGIC ||
+	    header.version != SNA_DAMAGE_CAPTURE_VERSION) {
+		fprintf(stderr, "%s: not a damage capture\n", path);
+		fclose(file);
+		return false;
+	}
+
+	while ((len = fread(buf, 1, sizeof(buf), file)))
+		stream_write(s, buf, len);
+	fclose(file);
+
+	s->name = path;
+	return true;
+}
+
+/* The live damage standing in for each one named by the stream */
+#define HASH_BITS 12
+static struct slot {
+	struct slot *next;
+	uint64_t id;
+	struct sna_damage *damage;
+} *slots[1 << HASH_BITS];
+
+static struct slot *lookup(uint64_t id)
+{
+	struct slot **head = &slots[(id * 0x9e3779b97f4a7c15ull) >> (64 - HASH_BITS)];
+	struct slot *slot;
+
+	for (slot = *head; slot; slot = slot->next)
+		if (slot->id == id)
+			return slot;
+
+	slot = calloc(1, sizeof(*slot));
+	if (slot == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	slot->id = id;
+	slot->next = *head;
+	*head = slot;
+	return slot;
+}
+
+static void rebind(struct slot *slot, uint64_t id)
+{
+	struct slot *dst;
+
+	if (id == slot->id || id == 0)
+		return;
+
+	/* a recorded mutator created or moved the damage */
+	dst = lookup(id);
+	sna_damage_destroy(&dst->damage);
+	dst->damage = slot->damage;
+	slot->damage = NULL;
+}
+
+static void reset_slots(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(slots); i++) {
+		while (slots[i]) {
+			struct slot *slot = slots[i];
+
+			slots[i] = slot->next;
+			sna_damage_destroy(&slot->damage);
+			free(slot);
+		}
+	}
+}
+
+static inline int num_rects(const struct sna_damage *damage)
+{
+	if (damage == NULL || DAMAGE_IS_ALL(damage))
+		return damage ? 1 : 0;
+
+	return region_num_rects(&damage->region);
+}
+
+struct result {
+	uint64_t count[NUM_DAMAGE_OPS];
+	uint64_t ns[NUM_DAMAGE_OPS];
+	uint64_t hist[NUM_DAMAGE_OPS][64]; /* by log2 of ns */
+	int peak_boxes, peak_reduced;
+	uint64_t mismatches;
+};
+
+static void replay(const struct stream *s, struct result *r)
+{
+	const char *ptr = s->data, *end = s->data + s->len;
+
+	while (ptr + sizeof(struct sna_damage_capture_op) <= end) {
+		struct sna_damage_capture_op op;
+		const BoxRec *box;
+		struct slot *slot;
+		struct sna_damage **d;
+		int64_t answer = -1;
+		uint64_t start, elapsed;
+
+		memcpy(&op, ptr, sizeof(op));
+		box = (const BoxRec *)(ptr + sizeof(op));
+		ptr += sizeof(op) + op.nbox * sizeof(BoxRec);
+		if (ptr > end || op.type >= NUM_DAMAGE_OPS)
+			break;
+
+		slot = lookup(op.damage);
+		d = &slot->damage;
+
+		start = now_ns();
+		switch (op.type) {
+		case DAMAGE_OP_ADD:
+			if (op.nbox == 0 || DAMAGE_IS_ALL(*d))
+				break;
+			if (op.nbox == 1)
+				sna_damage_add_box(d, box);
+			else
+				sna_damage_add_boxes(d, box, op.nbox, 0, 0);
+			break;
+
+		case DAMAGE_OP_SUBTRACT:
+			if (op.nbox == 0)
+				break;
+			if (op.nbox == 1)
+				sna_damage_subtract_box(d, box);
+			else
+				sna_damage_subtract_boxes(d, box, op.nbox, 0, 0);
+			break;
+
+		case DAMAGE_OP_ALL:
+			if (op.nbox && !DAMAGE_IS_ALL(*d))
+				*d = _sna_damage_all(*d, box->x2, box->y2);
+			break;
+
+		case DAMAGE_OP_CONTAINS:
+			if (op.nbox)
+				answer = sna_damage_contains_box(d, box);
+			break;
+
+		case DAMAGE_OP_INTERSECT:
+			if (op.nbox && *d && !DAMAGE_IS_ALL(*d)) {
+				RegionRec region, result;
+
+				pixman_region_init_rects(&region, box, op.nbox);
+				answer = sna_damage_intersect(*d, &region, &result);
+				if (answer)
+					pixman_region_fini(&result);
+				pixman_region_fini(&region);
+			}
+			break;
+
+		case DAMAGE_OP_GET_BOXES:
+			if (*d) {
+				const BoxRec *boxes;
+
+				answer = sna_damage_get_boxes(*d, &boxes);
+				if (answer > r->peak_reduced)
+					r->peak_reduced = answer;
+			}
+			break;
+
+		case DAMAGE_OP_REDUCE:
+			if (*d && !DAMAGE_IS_ALL(*d))
+				*d = _sna_damage_reduce(*d);
+			break;
+
+		case DAMAGE_OP_DESTROY:
+			sna_damage_destroy(d);
+			break;
+		}
+		elapsed = now_ns() - start;
+		r->ns[op.type] += elapsed;
+		r->hist[op.type][elapsed ? 64 - __builtin_clzll(elapsed) : 0]++;
+		r->count[op.type]++;
+
+		if (num_rects(*d) > r->peak_boxes)
+			r->peak_boxes = num_rects(*d);
+
+		switch (op.type) {
+		case DAMAGE_OP_CONTAINS:
+		case DAMAGE_OP_INTERSECT:
+		case DAMAGE_OP_GET_BOXES:
+			/* synthetic streams carry no answers to check */
+			if (op.result != op.damage && answer >= 0 &&
+			    (uint64_t)answer != op.result)
+				r->mismatches++;
+			break;
+		case DAMAGE_OP_DESTROY:
+			break;
+		default:
+			if (*d)
+				rebind(slot, op.result);
+			break;
+		}
+	}
+}
+
+/* The first log2 bucket below which pct% of the samples fall */
+static int percentile(const uint64_t *hist, uint64_t count, int pct)
+{
+	uint64_t sum = 0;
+	int i;
+
+	for (i = 0; i < 63; i++) {
+		sum += hist[i];
+		if (100 * sum >= pct * count)
+			break;
+	}
+
+	return i;
+}
+
+static void run(const struct stream *s)
+{
+	struct result r;
+	uint64_t ops, ns, runs = 0;
+	uint64_t start = now_ns();
+	int i;
+
+	memset(&r, 0, sizeof(r));
+	do {
+		replay(s, &r);
+		reset_slots();
+		runs++;
+	} while (now_ns() - start < options.min_time * 1e9);
+
+	ops = ns = 0;
+	for (i = 0; i < NUM_DAMAGE_OPS; i++) {
+		ops += r.count[i];
+		ns += r.ns[i];
+	}
+
+	printf("%s %llu %.1f %d %d %llu\n",
+	       s->name, (unsigned long long)(ops / runs),
+	       ops ? (double)ns / ops : 0.,
+	       r.peak_boxes, r.peak_reduced,
+	       (unsigned long long)(r.mismatches / runs));
+
+	if (options.verbose) {
+		for (i = 0; i < NUM_DAMAGE_OPS; i++) {
+			if (r.count[i] == 0)
+				continue;
+			printf("  %-10s %10llu %10.1f ns/op, p99 < %llu ns\n",
+			       op_names[i],
+			       (unsigned long long)(r.count[i] / runs),
+			       (double)r.ns[i] / r.count[i],
+			       1ull << percentile(r.hist[i], r.count[i], 99));
+		}
+	}
+}
+
+static void random_box(int width, int height, int max, BoxRec *box)
+{
+	int w = 1 + rand() % MIN(width, max);
+	int h = 1 + rand() % MIN(height, max);
+
+	box->x1 = rand() % (width - w + 1);
+	box->y1 = rand() % (height - h + 1);
+	box->x2 = box->x1 + w;
+	box->y2 = box->y1 + h;
+}
+
+static bool check_boxes(struct sna_damage *damage, RegionRec *ref)
+{
+	const BoxRec *boxes = NULL;
+	BoxRec *ref_boxes;
+	int n, ref_n;
+
+	n = damage ? sna_damage_get_boxes(damage, &boxes) : 0;
+	ref_boxes = pixman_region_rectangles(ref, &ref_n);
+
+	return n == ref_n && memcmp(boxes, ref_boxes, n * sizeof(BoxRec)) == 0;
+}
+
+/* Random operations checked against a plain pixman region. Small boxes
+ * over a large pixmap build up enough rectangles for the tile index.
+ */
+static int fuzz(int passes)
+{
+	int pass;
+
+	for (pass = 0; pass < passes; pass++) {
+		struct sna_damage *damage = NULL;
+		int width = 1 + rand() % 4096;
+		int height = 1 + rand() % 2304;
+		int max = 1 + rand() % 512;
+		int iter = 1 + rand() % 2000;
+		RegionRec ref;
+		int i;
+
+		pixman_region_init(&ref);
+		for (i = 0; i < iter; i++) {
+			BoxRec box[16];
+			RegionRec r;
+			int n = 1 + rand() % ARRAY_SIZE(box);
+			int op = rand() % 17, k;
+			int expected, got;
+
+			for (k = 0; k < n; k++)
+				random_box(width, height, max, &box[k]);
+			pixman_region_init_rects(&r, box, n);
+
+			switch (op) {
+			case 0: case 1: case 2: case 3: case 4:
+				if (!DAMAGE_IS_ALL(damage))
+					sna_damage_add_boxes(&damage, box, n, 0, 0);
+				pixman_region_union(&ref, &ref, &r);
+				break;
+			case 5: case 6:
+				if (!DAMAGE_IS_ALL(damage))
+					sna_damage_add_box(&damage, box);
+				pixman_region_union_rect(&ref, &ref,
+							 box->x1, box->y1,
+							 box->x2 - box->x1,
+							 box->y2 - box->y1);
+				break;
+			case 7: case 8: case 9:
+				sna_damage_subtract_boxes(&damage, box, n, 0, 0);
+				pixman_region_subtract(&ref, &ref, &r);
+				break;
+			case 10:
+				if (!DAMAGE_IS_ALL(damage))
+					damage = _sna_damage_all(damage, width, height);
+				pixman_region_fini(&ref);
+				pixman_region_init_rect(&ref, 0, 0, width, height);
+				break;
+			case 11: case 12: case 13:
+				expected = pixman_region_contains_rectangle(&ref, box);
+				got = sna_damage_contains_box(&damage, box);
+				if (got != expected) {
+					fprintf(stderr,
+						"pass %d, op %d: contains (%d, %d), (%d, %d) = %d, expected %d\n",
+						pass, i, box->x1, box->y1, box->x2, box->y2,
+						got, expected);
+					return 1;
+				}
+				break;
+			case 14:
+				if (damage && !DAMAGE_IS_ALL(damage)) {
+					RegionRec result, tmp;
+					bool ret;
+
+					pixman_region_init(&tmp);
+					pixman_region_intersect(&tmp, &ref, &r);
+					ret = sna_damage_intersect(damage, &r, &result);
+					if (ret != pixman_region_not_empty(&tmp) ||
+					    (ret && !pixman_region_equal(&result, &tmp))) {
+						fprintf(stderr, "pass %d, op %d: intersect differs\n",
+							pass, i);
+						return 1;
+					}
+					if (ret)
+						pixman_region_fini(&result);
+					pixman_region_fini(&tmp);
+				}
+				break;
+			case 15:
+				if (!check_boxes(damage, &ref)) {
+					fprintf(stderr, "pass %d, op %d: boxes differ\n",
+						pass, i);
+					return 1;
+				}
+				break;
+			case 16:
+				/* as from the block handler */
+				sna_damage_reduce_idle(1 + rand() % 4096);
+				break;
+			}
+			pixman_region_fini(&r);
+		}
+
+		if (!check_boxes(damage, &ref)) {
+			fprintf(stderr, "pass %d: final boxes differ\n", pass);
+			return 1;
+		}
+
+		sna_damage_destroy(&damage);
+		pixman_region_fini(&ref);
+	}
+
+	printf("fuzz: %d passes ok (seed %u)\n", passes, options.seed);
+	return 0;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"usage: %s [-t seconds] [-s WxH] [-n frames] [-S seed] [-v] [-f passes] [stream|trace...]\n"
+		"streams: scroll cursor browser video move (default all)\n",
+		argv0);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int fuzz_passes = 0;
+	int c, i, j;
+
+	while ((c = getopt(argc, argv, "t:s:n:S:vf:")) != -1) {
+		switch (c) {
+		case 't':
+			options.min_time = atof(optarg);
+			break;
+		case 's':
+			if (sscanf(optarg, "%dx%d",
+				   &options.width, &options.height) != 2)
+				usage(argv[0]);
+			break;
+		case 'n':
+			options.frames = atoi(optarg);
+			break;
+		case 'S':
+			options.seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			options.verbose++;
+			break;
+		case 'f':
+			fuzz_passes = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (options.width < 800 || options.height < 600 ||
+	    options.width > MAXSHORT || options.height > MAXSHORT ||
+	    options.frames <= 0)
+		usage(argv[0]);
+
+	srand(options.seed);
+	if (fuzz_passes)
+		return fuzz(fuzz_passes);
+
+	printf("# stream ops ns/op peak-boxes peak-reduced mismatches\n");
+	if (optind == argc) {
+		for (i = 0; i < ARRAY_SIZE(generators); i++) {
+			struct stream s = { generators[i].name };
+
+			generators[i].func(&s);
+			run(&s);
+			free(s.data);
+		}
+		return 0;
+	}
+
+	for (i = optind; i < argc; i++) {
+		struct stream s = { argv[i] };
+
+		for (j = 0; j < ARRAY_SIZE(generators); j++) {
+			if (strcmp(argv[i], generators[j].name) == 0) {
+				generators[j].func(&s);
+				break;
+			}
+		}
+		if (j == ARRAY_SIZE(generators) && !load_trace(&s, argv[i])) {
+			fprintf(stderr, "%s: neither a stream nor a trace\n",
+				argv[i]);
+			return 1;
+		}
+
+		run(&s);
+		free(s.data);
+	}
+
+	return 0;
+}
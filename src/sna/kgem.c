@@ -36,10 +36,13 @@
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <sched.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 
 #include <xf86drm.h>
 
@@ -53,6 +56,7 @@
 #endif
 
 #include "sna_cpuid.h"
+#include "kgem_capture.h"
 
 static struct kgem_bo *
 search_linear_cache(struct kgem *kgem, unsigned int num_pages, unsigned flags);
@@ -60,6 +64,11 @@ search_linear_cache(struct kgem *kgem, unsigned int num_pages, unsigned flags);
 static struct kgem_bo *
 search_snoop_cache(struct kgem *kgem, unsigned int num_pages, unsigned flags);
 
+static struct kgem_bo *
+search_cache_index__2d(struct kgem *kgem,
+		       int num_pages, int tiling, int pitch,
+		       unsigned flags);
+
 #define DBG_NO_HW 0
 #define DBG_NO_EXEC 0
 #define DBG_NO_TILING 0
@@ -82,6 +91,7 @@ search_snoop_cache(struct kgem *kgem, unsigned int num_pages, unsigned flags);
 #define DBG_NO_SHRINK_BATCHES 0
 #define DBG_NO_FAST_RELOC 0
 #define DBG_NO_HANDLE_LUT 0
+#define DBG_NO_SOFTPIN 0
 #define DBG_NO_WT 0
 #define DBG_NO_WC_MMAP 0
 #define DBG_NO_SCANOUT_Y 0
@@ -121,9 +131,13 @@ search_snoop_cache(struct kgem *kgem, unsigned int num_pages, unsigned flags);
 #define NUM_PAGES(x) (((x) + PAGE_SIZE-1) / PAGE_SIZE)
 
 #define MAX_GTT_VMA_CACHE 512
-#define MAX_CPU_VMA_CACHE INT16_MAX
+#define MAX_VMA_CACHE INT16_MAX
 #define MAP_PRESERVE_TIME 10
 
+/* Upper limits for the growable exec[] and reloc[] arrays */
+#define DEFAULT_MAX_EXEC 4096
+#define DEFAULT_MAX_RELOC 32768
+
 #define MAKE_USER_MAP(ptr) ((void*)((uintptr_t)(ptr) | 1))
 #define IS_USER_MAP(ptr) ((uintptr_t)(ptr) & 1)
 
@@ -131,6 +145,7 @@ search_snoop_cache(struct kgem *kgem, unsigned int num_pages, unsigned flags);
 #define LOCAL_I915_PARAM_HAS_RELAXED_FENCING	12
 #define LOCAL_I915_PARAM_HAS_RELAXED_DELTA	15
 #define LOCAL_I915_PARAM_HAS_LLC		17
+#define LOCAL_I915_PARAM_HAS_ALIASING_PPGTT	18
 #define LOCAL_I915_PARAM_HAS_SEMAPHORES		20
 #define LOCAL_I915_PARAM_HAS_SECURE_BATCHES	23
 #define LOCAL_I915_PARAM_HAS_PINNED_BATCHES	24
@@ -138,11 +153,22 @@ search_snoop_cache(struct kgem *kgem, unsigned int num_pages, unsigned flags);
 #define LOCAL_I915_PARAM_HAS_HANDLE_LUT		26
 #define LOCAL_I915_PARAM_HAS_WT			27
 #define LOCAL_I915_PARAM_MMAP_VERSION		30
+#define LOCAL_I915_PARAM_HAS_EXEC_SOFTPIN	37
 
 #define LOCAL_I915_EXEC_IS_PINNED		(1<<10)
 #define LOCAL_I915_EXEC_NO_RELOC		(1<<11)
 #define LOCAL_I915_EXEC_HANDLE_LUT		(1<<12)
 
+#define LOCAL_EXEC_OBJECT_PINNED		(1<<4)
+
+/* Softpinned addresses are kept below 4GiB so that the upper dword
+ * written by kgem_add_reloc64() and the 32-bit self-relocation fixups
+ * remain valid. The first MiB is left unused so that an offset of 0
+ * always means "unknown".
+ */
+#define KGEM_VA_START (1ull << 20)
+#define KGEM_VA_END (1ull << 32)
+
 #define LOCAL_I915_GEM_CREATE2       0x34
 #define LOCAL_IOCTL_I915_GEM_CREATE2 DRM_IOWR (DRM_COMMAND_BASE + LOCAL_I915_GEM_CREATE2, struct local_i915_gem_create2)
 struct local_i915_gem_create2 {
@@ -218,6 +244,24 @@ enum {
 	MMAPPED_CPU
 };
 
+/* A persistently mapped snoopable buffer that small uploads are carved
+ * from in order. Each span covers the uploads made whilst building one
+ * batch, and is only reused once every proxy into it has been destroyed
+ * and every batch that could have read it has retired.
+ */
+#define UPLOAD_RING_SPANS 256
+struct kgem_upload_ring {
+	struct kgem_buffer *buffer; /* buffer->used is the head */
+	uint32_t size;
+	unsigned first, count;
+	struct kgem_upload_span {
+		uint32_t start, end;
+		uint32_t live; /* proxies not yet destroyed */
+		uint32_t opened; /* kgem->seqno when first used */
+		uint32_t fence; /* last request that may read it */
+	} span[UPLOAD_RING_SPANS];
+};
+
 static struct kgem_bo *__kgem_freed_bo;
 static struct kgem_request *__kgem_freed_request;
 static struct drm_i915_gem_exec_object2 _kgem_dummy_exec;
@@ -230,7 +274,30 @@ static inline int bytes(struct kgem_bo *bo)
 #define bucket(B) (B)->size.pages.bucket
 #define num_pages(B) (B)->size.pages.count
 
-static int do_ioctl(int fd, unsigned long req, void *arg)
+/* With AsyncSubmit, a single thread performs the execbuf for every kgem
+ * whilst the main thread carries on building the next batch. At most one
+ * batch is ever in flight, and any ioctl that may observe the results of
+ * that batch first waits for it to be submitted, see do_ioctl().
+ */
+static struct kgem_submit_thread {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	struct kgem *kgem; /* owner of the batch in flight, main thread only */
+	struct drm_i915_gem_execbuffer2 execbuf;
+	uint16_t nreloc;
+	int fd;
+
+	unsigned users; /* kgem with async_submit enabled */
+	bool queued;
+	bool quit;
+	int ret;
+} *submit_thread;
+
+static void kgem_submit_collect(void);
+
+static int __do_ioctl(int fd, unsigned long req, void *arg)
 {
 	int err;
 
@@ -251,19 +318,54 @@ restart:
 	return -err;
 }
 
+static bool ioctl_is_ordered(unsigned long req)
+{
+	/* These neither read nor write the contents of any bo in flight */
+	switch (req) {
+	case DRM_IOCTL_I915_GEM_CREATE:
+	case DRM_IOCTL_I915_GEM_MADVISE:
+	case DRM_IOCTL_I915_GEM_MMAP:
+	case DRM_IOCTL_I915_GEM_MMAP_GTT:
+	case DRM_IOCTL_I915_GETPARAM:
+	case DRM_IOCTL_I915_GEM_GET_APERTURE:
+		return false;
+	default:
+		return true;
+	}
+}
+
+static int do_ioctl(int fd, unsigned long req, void *arg)
+{
+	if (submit_thread && submit_thread->kgem && ioctl_is_ordered(req))
+		kgem_submit_collect();
+
+	return __do_ioctl(fd, req, arg);
+}
+
+static bool kgem_submit_in_flight(struct kgem *kgem)
+{
+	return submit_thread && submit_thread->kgem == kgem;
+}
+
 #ifdef DEBUG_MEMORY
 static void debug_alloc(struct kgem *kgem, size_t size)
 {
 	kgem->debug_memory.bo_allocs++;
 	kgem->debug_memory.bo_bytes += size;
 }
+#else
+#define debug_alloc(k, s)
+#endif
+
 static void debug_alloc__bo(struct kgem *kgem, struct kgem_bo *bo)
 {
+	kgem->stats.bo_allocs++;
+	kgem->stats.bo_bytes += bytes(bo);
+	if (kgem->stats.bo_bytes > kgem->stats.bo_bytes_max)
+		kgem->stats.bo_bytes_max = kgem->stats.bo_bytes;
+
 	debug_alloc(kgem, bytes(bo));
 }
-#else
-#define debug_alloc__bo(k, b)
-#endif
 
 #ifndef NDEBUG
 static void assert_tiling(struct kgem *kgem, struct kgem_bo *bo)
@@ -342,6 +444,9 @@ static bool gem_set_tiling(int fd, uint32_t handle, int tiling, int stride)
 	if (DBG_NO_TILING)
 		return false;
 
+	if (submit_thread && submit_thread->kgem)
+		kgem_submit_collect();
+
 	VG_CLEAR(set_tiling);
 restart:
 	set_tiling.handle = handle;
@@ -485,6 +590,8 @@ retry_mmap:
 	 * issue with compositing managers which need to
 	 * frequently flush CPU damage to their GPU bo.
 	 */
+	if (ptr)
+		kgem->stats.mmaps++;
 	return bo->map__gtt = ptr;
 }
 
@@ -521,6 +628,7 @@ retry_wc:
 	VG(VALGRIND_MAKE_MEM_DEFINED(wc.addr_ptr, bytes(bo)));
 
 	DBG(("%s: caching CPU(wc) vma for %d\n", __FUNCTION__, bo->handle));
+	kgem->stats.mmaps++;
 	return bo->map__wc = (void *)(uintptr_t)wc.addr_ptr;
 }
 
@@ -551,6 +659,7 @@ retry:
 	VG(VALGRIND_MAKE_MEM_DEFINED(arg.addr_ptr, bytes(bo)));
 
 	DBG(("%s: caching CPU vma for %d\n", __FUNCTION__, bo->handle));
+	kgem->stats.mmaps++;
 	return bo->map__cpu = (void *)(uintptr_t)arg.addr_ptr;
 }
 
@@ -844,6 +953,7 @@ static struct kgem_bo *__kgem_bo_init(struct kgem_bo *bo,
 	list_init(&bo->request);
 	list_init(&bo->list);
 	list_init(&bo->vma);
+	list_init(&bo->lookup);
 
 	return bo;
 }
@@ -880,6 +990,7 @@ static struct kgem_request *__kgem_request_alloc(struct kgem *kgem)
 	list_init(&rq->buffers);
 	rq->bo = NULL;
 	rq->ring = 0;
+	rq->reason = SUBMIT_OTHER;
 
 	return rq;
 }
@@ -934,6 +1045,72 @@ total_ram_size(void)
 	return 0;
 }
 
+static uint64_t
+read_cgroup_limit(const char *dir, const char *path, const char *file)
+{
+	char name[4096], buf[64];
+	uint64_t limit = 0;
+	int fd, len;
+
+	snprintf(name, sizeof(name), "%s%s/%s", dir, path, file);
+	fd = open(name, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return 0;
+
+	/* "max", or an absurd value for v1, means unlimited */
+	buf[len] = '\0';
+	if (sscanf(buf, "%llu", (unsigned long long *)&limit) != 1)
+		return 0;
+
+	return limit;
+}
+
+/* Memory that we may actually use: total ram, clamped to the limit
+ * of the memory cgroup we are running in (if any).
+ */
+static uint64_t
+memory_limit(void)
+{
+	uint64_t limit = total_ram_size();
+	char buf[4096];
+	FILE *file;
+
+	file = fopen("/proc/self/cgroup", "r");
+	if (file == NULL)
+		return limit;
+
+	while (fgets(buf, sizeof(buf), file)) {
+		uint64_t cgroup = 0;
+		char *path;
+
+		buf[strcspn(buf, "\n")] = '\0';
+		path = strrchr(buf, ':');
+		if (path == NULL)
+			continue;
+		*path++ = '\0';
+
+		if (strcmp(buf, "0:") == 0)
+			cgroup = read_cgroup_limit("/sys/fs/cgroup", path,
+						   "memory.max");
+		else if (strstr(buf, ":memory"))
+			cgroup = read_cgroup_limit("/sys/fs/cgroup/memory", path,
+						   "memory.limit_in_bytes");
+
+		DBG(("%s: cgroup '%s' limit=%lld\n",
+		     __FUNCTION__, path, (long long)cgroup));
+		if (cgroup && (limit == 0 || cgroup < limit))
+			limit = cgroup;
+	}
+	fclose(file);
+
+	return limit;
+}
+
 static unsigned
 cpu_cache_size__cpuid4(void)
 {
@@ -1054,6 +1231,22 @@ static bool test_has_handle_lut(struct kgem *kgem)
 	return gem_param(kgem, LOCAL_I915_PARAM_HAS_HANDLE_LUT) > 0;
 }
 
+static bool test_has_softpin(struct kgem *kgem)
+{
+	if (DBG_NO_SOFTPIN)
+		return false;
+
+	/* Only gen8+ emits every address through kgem_add_reloc64() */
+	if (kgem->gen < 0100)
+		return false;
+
+	/* and we must own the address space, i.e. a full ppgtt */
+	if (gem_param(kgem, LOCAL_I915_PARAM_HAS_ALIASING_PPGTT) < 2)
+		return false;
+
+	return gem_param(kgem, LOCAL_I915_PARAM_HAS_EXEC_SOFTPIN) > 0;
+}
+
 static bool test_has_wt(struct kgem *kgem)
 {
 	if (DBG_NO_WT)
@@ -1397,6 +1590,10 @@ static void kgem_init_swizzling(struct kgem *kgem)
 	} tiling;
 #define LOCAL_IOCTL_I915_GEM_GET_TILING DRM_IOWR (DRM_COMMAND_BASE + DRM_I915_GEM_GET_TILING, struct local_i915_gem_get_tiling_v2)
 
+	kgem->swizzling[I915_TILING_NONE] = I915_BIT_6_SWIZZLE_NONE;
+	kgem->swizzling[I915_TILING_X] = -1;
+	kgem->swizzling[I915_TILING_Y] = -1;
+
 	VG_CLEAR(tiling);
 	tiling.handle = gem_create(kgem->fd, 1);
 	if (!tiling.handle)
@@ -1412,16 +1609,183 @@ static void kgem_init_swizzling(struct kgem *kgem)
 		goto out;
 
 	if (!DBG_NO_DETILING)
-		choose_memcpy_tiled_x(kgem, tiling.swizzle_mode);
+		choose_memcpy_tiled_x(kgem, tiling.swizzle_mode,
+				      container_of(kgem, struct sna, kgem)->cpu_features);
+
+	/* The swizzle applied to Y-tiles differs from X, so ask again */
+	if (!gem_set_tiling(kgem->fd, tiling.handle, I915_TILING_Y, 512))
+		goto out;
+
+	if (do_ioctl(kgem->fd, LOCAL_IOCTL_I915_GEM_GET_TILING, &tiling))
+		goto out;
+
+	if (kgem->gen < 50 && tiling.phys_swizzle_mode != tiling.swizzle_mode)
+		goto out;
+
+	if (!DBG_NO_DETILING)
+		choose_memcpy_tiled_y(kgem, tiling.swizzle_mode);
 out:
 	gem_close(kgem->fd, tiling.handle);
 }
 
+struct kgem_va_hole {
+	struct list link;
+	uint64_t start, end;
+};
+
+static bool kgem_va_init(struct kgem *kgem)
+{
+	struct kgem_va_hole *hole;
+
+	list_init(&kgem->va.holes);
+	kgem->va.cursor = KGEM_VA_START;
+	kgem->va.used = 0;
+
+	hole = malloc(sizeof(*hole));
+	if (hole == NULL)
+		return false;
+
+	hole->start = KGEM_VA_START;
+	hole->end = KGEM_VA_END;
+	list_add(&hole->link, &kgem->va.holes);
+	return true;
+}
+
+static uint64_t kgem_va_alloc(struct kgem *kgem, uint64_t size)
+{
+	struct kgem_va_hole *hole;
+	int pass;
+
+	/* Next-fit rather than first-fit, so that the range of a bo that
+	 * was just released is not immediately reused whilst the GPU may
+	 * still be reading from it, which would force the kernel to wait
+	 * for the old binding before it can place the new one.
+	 */
+	for (pass = 0; pass < 2; pass++) {
+		list_for_each_entry(hole, &kgem->va.holes, link) {
+			uint64_t start = hole->start;
+
+			if (pass == 0) {
+				if (hole->end <= kgem->va.cursor)
+					continue;
+				if (start < kgem->va.cursor)
+					start = kgem->va.cursor;
+			}
+			if (hole->end - start < size)
+				continue;
+
+			if (start == hole->start) {
+				hole->start += size;
+				if (hole->start == hole->end) {
+					list_del(&hole->link);
+					free(hole);
+				}
+			} else if (start + size == hole->end) {
+				hole->end = start;
+			} else {
+				struct kgem_va_hole *tail;
+
+				tail = malloc(sizeof(*tail));
+				if (tail == NULL)
+					return 0;
+
+				tail->start = start + size;
+				tail->end = hole->end;
+				hole->end = start;
+				list_add(&tail->link, &hole->link);
+			}
+
+			kgem->va.cursor = start + size;
+			kgem->va.used += size;
+			return start;
+		}
+	}
+
+	return 0;
+}
+
+static void kgem_va_free(struct kgem *kgem, uint64_t start, uint64_t size)
+{
+	struct kgem_va_hole *hole, *prev = NULL;
+	uint64_t end = start + size;
+
+	assert(start >= KGEM_VA_START && end <= KGEM_VA_END);
+	kgem->va.used -= size;
+
+	list_for_each_entry(hole, &kgem->va.holes, link) {
+		if (hole->start >= end)
+			break;
+		prev = hole;
+	}
+	assert(prev == NULL || prev->end <= start);
+
+	if (&hole->link == &kgem->va.holes)
+		hole = NULL;
+
+	if (prev && prev->end == start) {
+		prev->end = end;
+		if (hole && hole->start == end) {
+			prev->end = hole->end;
+			list_del(&hole->link);
+			free(hole);
+		}
+		return;
+	}
+
+	if (hole && hole->start == end) {
+		hole->start = start;
+		return;
+	}
+
+	prev = malloc(sizeof(*prev));
+	if (prev == NULL)
+		return; /* leak the range rather than fail */
+
+	prev->start = start;
+	prev->end = end;
+	list_add_tail(&prev->link, hole ? &hole->link : &kgem->va.holes);
+}
+
+/* Returns the exec flags required to pin the bo at its address, assigning
+ * it one if necessary, or 0 if it should be relocated as normal.
+ */
+static unsigned kgem_bo_softpin(struct kgem *kgem, struct kgem_bo *bo)
+{
+	uint64_t offset;
+
+	if (!kgem->has_softpin)
+		return 0;
+
+	if (bo->softpin)
+		return LOCAL_EXEC_OBJECT_PINNED;
+
+	offset = kgem_va_alloc(kgem, bytes(bo));
+	if (offset == 0) {
+		DBG(("%s: address space exhausted, relocating handle=%d\n",
+		     __FUNCTION__, bo->handle));
+		return 0;
+	}
+
+	DBG(("%s: handle=%d, size=%d -> offset=%llx\n",
+	     __FUNCTION__, bo->handle, bytes(bo), (long long)offset));
+	bo->presumed_offset = offset;
+	bo->softpin = true;
+	return LOCAL_EXEC_OBJECT_PINNED;
+}
+
+static void kgem_bo_unpin(struct kgem *kgem, struct kgem_bo *bo)
+{
+	assert(bo->softpin);
+	kgem_va_free(kgem, bo->presumed_offset, bytes(bo));
+	bo->softpin = false;
+}
+
 static void kgem_fixup_relocs(struct kgem *kgem, struct kgem_bo *bo, int shrink)
 {
 	int n;
 
 	bo->target_handle = kgem->has_handle_lut ? kgem->nexec : bo->handle;
+	(void)kgem_bo_softpin(kgem, bo);
 
 	assert(kgem->nreloc__self <= 256);
 	if (kgem->nreloc__self == 0)
@@ -1540,6 +1904,14 @@ void kgem_init(struct kgem *kgem, int fd, struct pci_device *dev, unsigned gen)
 
 	kgem->fd = fd;
 	kgem->gen = gen;
+	kgem->pressure_fd = -1;
+	kgem->capture_fd = -1;
+
+	kgem->exec = kgem->exec__inline;
+	kgem->size_exec = ARRAY_SIZE(kgem->exec__inline);
+	kgem->reloc = kgem->reloc__inline;
+	kgem->size_reloc = ARRAY_SIZE(kgem->reloc__inline);
+	kgem_set_batch_limits(kgem, DEFAULT_MAX_EXEC, DEFAULT_MAX_RELOC);
 
 	list_init(&kgem->requests[0]);
 	list_init(&kgem->requests[1]);
@@ -1554,6 +1926,8 @@ void kgem_init(struct kgem *kgem, int fd, struct pci_device *dev, unsigned gen)
 		list_init(&kgem->pinned_batches[i]);
 	for (i = 0; i < ARRAY_SIZE(kgem->inactive); i++)
 		list_init(&kgem->inactive[i]);
+	for (i = 0; i < ARRAY_SIZE(kgem->cache_index); i++)
+		list_init(&kgem->cache_index[i]);
 	for (i = 0; i < ARRAY_SIZE(kgem->active); i++) {
 		for (j = 0; j < ARRAY_SIZE(kgem->active[i]); j++)
 			list_init(&kgem->active[i][j]);
@@ -1562,8 +1936,7 @@ void kgem_init(struct kgem *kgem, int fd, struct pci_device *dev, unsigned gen)
 		for (j = 0; j < ARRAY_SIZE(kgem->vma[i].inactive); j++)
 			list_init(&kgem->vma[i].inactive[j]);
 	}
-	kgem->vma[MAP_GTT].count = -MAX_GTT_VMA_CACHE;
-	kgem->vma[MAP_CPU].count = -MAX_CPU_VMA_CACHE;
+	kgem->vma_cache.max_count = MAX_VMA_CACHE;
 
 	kgem->has_blt = gem_param(kgem, LOCAL_I915_PARAM_HAS_BLT) > 0;
 	DBG(("%s: has BLT ring? %d\n", __FUNCTION__,
@@ -1610,6 +1983,10 @@ void kgem_init(struct kgem *kgem, int fd, struct pci_device *dev, unsigned gen)
 	DBG(("%s: has handle-lut? %d\n", __FUNCTION__,
 	     kgem->has_handle_lut));
 
+	kgem->has_softpin = test_has_softpin(kgem) && kgem_va_init(kgem);
+	DBG(("%s: has softpin? %d\n", __FUNCTION__,
+	     kgem->has_softpin));
+
 	kgem->has_semaphores = false;
 	if (kgem->has_blt && test_has_semaphores_enabled(kgem))
 		kgem->has_semaphores = true;
@@ -1744,6 +2121,15 @@ void kgem_init(struct kgem *kgem, int fd, struct pci_device *dev, unsigned gen)
 	if (kgem->max_gpu_size > totalram / 4)
 		kgem->max_gpu_size = totalram / 4;
 
+	/* Idle mappings pin page tables and, on 32-bit, scarce address space */
+	if (sizeof(void *) < 8)
+		kgem->vma_cache.max_bytes = 512 << 20;
+	else
+		kgem->vma_cache.max_bytes = totalram / 2;
+	DBG(("%s: vma cache limited to %d maps, %lldMiB\n", __FUNCTION__,
+	     kgem->vma_cache.max_count,
+	     (long long)kgem->vma_cache.max_bytes >> 20));
+
 	if (kgem->aperture_high > totalram / 2) {
 		kgem->aperture_high = totalram / 2;
 		kgem->aperture_low = kgem->aperture_high / 4;
@@ -2049,6 +2435,94 @@ static uint32_t kgem_aligned_height(struct kgem *kgem,
 	return ALIGN(height, tile_height);
 }
 
+void kgem_set_batch_limits(struct kgem *kgem, int max_exec, int max_reloc)
+{
+	if (max_exec < kgem->size_exec)
+		max_exec = kgem->size_exec;
+	if (max_exec > UINT16_MAX)
+		max_exec = UINT16_MAX;
+	kgem->max_exec = max_exec;
+
+	if (max_reloc < kgem->size_reloc)
+		max_reloc = kgem->size_reloc;
+	if (max_reloc > UINT16_MAX)
+		max_reloc = UINT16_MAX;
+	kgem->max_reloc = max_reloc;
+
+	DBG(("%s: exec <= %d, reloc <= %d\n",
+	     __FUNCTION__, kgem->max_exec, kgem->max_reloc));
+}
+
+static unsigned grow_size(unsigned size, unsigned want, unsigned max)
+{
+	/* Double to amortise the copy over the following batches */
+	if (want < 2 * size)
+		want = 2 * size;
+	if (want > max)
+		want = max;
+	return want;
+}
+
+bool __kgem_grow_exec(struct kgem *kgem, int n)
+{
+	struct drm_i915_gem_exec_object2 *exec;
+	struct kgem_bo *bo;
+	unsigned size;
+
+	size = kgem->nexec + n + KGEM_EXEC_RESERVED;
+	if (size > kgem->max_exec)
+		return false;
+
+	size = grow_size(kgem->size_exec, size, kgem->max_exec);
+	DBG(("%s: exec[%d] -> exec[%d]\n",
+	     __FUNCTION__, kgem->size_exec, size));
+
+	exec = malloc(size * sizeof(*exec));
+	if (exec == NULL)
+		return false;
+
+	memcpy(exec, kgem->exec, kgem->nexec * sizeof(*exec));
+
+	/* Every bo in the batch holds a pointer to its exec entry */
+	list_for_each_entry(bo, &kgem->next_request->buffers, request) {
+		if (bo->exec >= kgem->exec &&
+		    bo->exec < kgem->exec + kgem->nexec)
+			bo->exec = exec + (bo->exec - kgem->exec);
+	}
+
+	if (kgem->exec != kgem->exec__inline)
+		free(kgem->exec);
+	kgem->exec = exec;
+	kgem->size_exec = size;
+	return true;
+}
+
+bool __kgem_grow_reloc(struct kgem *kgem, int n)
+{
+	struct drm_i915_gem_relocation_entry *reloc;
+	unsigned size;
+
+	size = kgem->nreloc + n + KGEM_RELOC_RESERVED;
+	if (size > kgem->max_reloc)
+		return false;
+
+	size = grow_size(kgem->size_reloc, size, kgem->max_reloc);
+	DBG(("%s: reloc[%d] -> reloc[%d]\n",
+	     __FUNCTION__, kgem->size_reloc, size));
+
+	reloc = malloc(size * sizeof(*reloc));
+	if (reloc == NULL)
+		return false;
+
+	memcpy(reloc, kgem->reloc, kgem->nreloc * sizeof(*reloc));
+
+	if (kgem->reloc != kgem->reloc__inline)
+		free(kgem->reloc);
+	kgem->reloc = reloc;
+	kgem->size_reloc = size;
+	return true;
+}
+
 static struct drm_i915_gem_exec_object2 *
 kgem_add_handle(struct kgem *kgem, struct kgem_bo *bo)
 {
@@ -2057,10 +2531,11 @@ kgem_add_handle(struct kgem *kgem, struct kgem_bo *bo)
 	DBG(("%s: handle=%d, index=%d\n",
 	     __FUNCTION__, bo->handle, kgem->nexec));
 
-	assert(kgem->nexec < ARRAY_SIZE(kgem->exec));
+	assert(kgem->nexec < kgem->size_exec);
 	bo->target_handle = kgem->has_handle_lut ? kgem->nexec : bo->handle;
 	exec = memset(&kgem->exec[kgem->nexec++], 0, sizeof(*exec));
 	exec->handle = bo->handle;
+	exec->flags = kgem_bo_softpin(kgem, bo);
 	exec->offset = bo->presumed_offset;
 
 	kgem->aperture += num_pages(bo);
@@ -2116,14 +2591,174 @@ static void kgem_bo_rmfb(struct kgem *kgem, struct kgem_bo *bo)
 	}
 }
 
+static uint32_t kgem_stats_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+struct kgem_reap {
+	uint32_t handle;
+	uint32_t size;
+	void *map__gtt, *map__wc, *map__cpu;
+	uint64_t offset; /* softpinned address to return, or 0 */
+};
+
+static void kgem_reap_entry(struct kgem *kgem, const struct kgem_reap *r)
+{
+	if (r->map__gtt)
+		munmap(r->map__gtt, r->size);
+	if (r->map__wc)
+		munmap(r->map__wc, r->size);
+	if (r->map__cpu)
+		munmap(r->map__cpu, r->size);
+
+	gem_close(kgem->fd, r->handle);
+
+	/* Only reuse the address once nothing can be bound there */
+	if (r->offset)
+		kgem_va_free(kgem, r->offset, r->size);
+}
+
+static struct kgem_reap *kgem_reap_alloc(struct kgem *kgem)
+{
+	if (kgem->reap.count == kgem->reap.size) {
+		if (kgem->reap.head) {
+			memmove(kgem->reap.entries,
+				kgem->reap.entries + kgem->reap.head,
+				(kgem->reap.count - kgem->reap.head) * sizeof(struct kgem_reap));
+			kgem->reap.count -= kgem->reap.head;
+			kgem->reap.head = 0;
+		} else {
+			unsigned size = kgem->reap.size ? 2 * kgem->reap.size : 256;
+			struct kgem_reap *entries;
+
+			entries = realloc(kgem->reap.entries,
+					  size * sizeof(struct kgem_reap));
+			if (entries == NULL)
+				return NULL;
+
+			kgem->reap.entries = entries;
+			kgem->reap.size = size;
+		}
+	}
+
+	return &kgem->reap.entries[kgem->reap.count++];
+}
+
+/* Closing a bo and tearing down its mmaps is cheap for one, but not for
+ * the hundreds released at once by kgem_expire_cache(). Those are queued
+ * and finished in bounded chunks from the block handler, see kgem_reap().
+ */
+static void kgem_bo_release(struct kgem *kgem, struct kgem_bo *bo, bool defer)
+{
+	struct kgem_reap now, *r = NULL;
+
+	/* A prime handle, imported or exported, may be handed straight
+	 * back to us by a later import of the same dma-buf, so it must
+	 * not outlive the bo.
+	 */
+	if (defer && !bo->prime)
+		r = kgem_reap_alloc(kgem);
+	if (r == NULL)
+		r = &now;
+
+	r->handle = bo->handle;
+	r->size = bytes(bo);
+	r->map__gtt = bo->map__gtt;
+	r->map__wc = bo->map__wc;
+	r->map__cpu = MAP(bo->map__cpu);
+	r->offset = bo->softpin ? bo->presumed_offset : 0;
+	bo->softpin = false;
+
+	if (r == &now) {
+		kgem_reap_entry(kgem, r);
+		return;
+	}
+
+	kgem->stats.reap_queued++;
+	if (kgem->reap.count - kgem->reap.head > kgem->stats.reap_depth_max)
+		kgem->stats.reap_depth_max = kgem->reap.count - kgem->reap.head;
+}
+
+bool kgem_reap(struct kgem *kgem, unsigned budget_us)
+{
+	uint32_t start, elapsed;
+	unsigned count = 0;
+
+	if (kgem->reap.head == kgem->reap.count)
+		return false;
+
+	start = kgem_stats_time();
+	do {
+		kgem_reap_entry(kgem, &kgem->reap.entries[kgem->reap.head++]);
+		count++;
+		elapsed = kgem_stats_time() - start;
+	} while (kgem->reap.head < kgem->reap.count &&
+		 (budget_us == 0 || elapsed < budget_us));
+
+	DBG(("%s: released %d, %d remaining, in %dus\n", __FUNCTION__,
+	     count, kgem->reap.count - kgem->reap.head, elapsed));
+
+	kgem->stats.reap_runs++;
+	kgem->stats.reaped += count;
+	kgem->stats.reap_us += elapsed;
+	if (elapsed > kgem->stats.reap_us_max)
+		kgem->stats.reap_us_max = elapsed;
+
+	if (kgem->reap.head < kgem->reap.count)
+		return true;
+
+	kgem->reap.head = kgem->reap.count = 0;
+	return false;
+}
+
+/* Address space held by the mappings of an inactive bo */
+static inline uint64_t vma_bytes(struct kgem_bo *bo)
+{
+	assert(!IS_USER_MAP(bo->map__cpu));
+	return (uint64_t)bytes(bo) *
+		(!!bo->map__gtt + !!bo->map__wc + !!bo->map__cpu);
+}
+
+static void kgem_vma_cache_add(struct kgem *kgem, struct kgem_bo *bo, int type)
+{
+	assert(list_is_empty(&bo->vma));
+
+	list_add(&bo->vma, &kgem->vma[type].inactive[bucket(bo)]);
+	bo->vma_type = type;
+	bo->vma_stamp = ++kgem->vma_cache.clock;
+
+	kgem->vma[type].count++;
+	kgem->vma_cache.count++;
+	kgem->vma_cache.bytes += vma_bytes(bo);
+}
+
+static void kgem_vma_cache_del(struct kgem *kgem, struct kgem_bo *bo)
+{
+	assert(!list_is_empty(&bo->vma));
+	assert(kgem->vma[bo->vma_type].count > 0);
+
+	list_del(&bo->vma);
+	kgem->vma[bo->vma_type].count--;
+	kgem->vma_cache.count--;
+	kgem->vma_cache.bytes -= vma_bytes(bo);
+}
+
 static void kgem_bo_free(struct kgem *kgem, struct kgem_bo *bo)
 {
+	bool defer;
+
 	DBG(("%s: handle=%d, size=%d\n", __FUNCTION__, bo->handle, bytes(bo)));
 	assert(bo->refcnt == 0);
 	assert(bo->proxy == NULL);
 	assert(bo->exec == NULL);
 	assert(!bo->snoop || bo->rq == NULL);
 
+	kgem->stats.bo_frees++;
+	kgem->stats.bo_bytes -= bytes(bo);
 #ifdef DEBUG_MEMORY
 	kgem->debug_memory.bo_allocs--;
 	kgem->debug_memory.bo_bytes -= bytes(bo);
@@ -2132,6 +2767,14 @@ static void kgem_bo_free(struct kgem *kgem, struct kgem_bo *bo)
 	kgem_bo_binding_free(kgem, bo);
 	kgem_bo_rmfb(kgem, bo);
 
+	DBG(("%s: releasing %p:%p:%p vma for handle=%d, cached? %d\n",
+	     __FUNCTION__, bo->map__gtt, bo->map__wc, bo->map__cpu,
+	     bo->handle, !list_is_empty(&bo->vma)));
+	if (!list_is_empty(&bo->vma))
+		kgem_vma_cache_del(kgem, bo);
+
+	/* Close userptr at once, as its pages may be freed below */
+	defer = !IS_USER_MAP(bo->map__cpu);
 	if (IS_USER_MAP(bo->map__cpu)) {
 		assert(bo->rq == NULL);
 		assert(!__kgem_busy(kgem, bo->handle));
@@ -2144,29 +2787,17 @@ static void kgem_bo_free(struct kgem *kgem, struct kgem_bo *bo)
 		bo->map__cpu = NULL;
 	}
 
-	DBG(("%s: releasing %p:%p vma for handle=%d, count=%d\n",
-	     __FUNCTION__, bo->map__gtt, bo->map__cpu,
-	     bo->handle, list_is_empty(&bo->vma) ? 0 : kgem->vma[bo->map__gtt == NULL && bo->map__wc == NULL].count));
+#ifdef HAVE_VALGRIND
+	if (bo->map__wc)
+		VALGRIND_MAKE_MEM_NOACCESS(bo->map__wc, bytes(bo));
+	if (bo->map__cpu)
+		VALGRIND_MAKE_MEM_NOACCESS(MAP(bo->map__cpu), bytes(bo));
+#endif
 
-	if (!list_is_empty(&bo->vma)) {
-		_list_del(&bo->vma);
-		kgem->vma[bo->map__gtt == NULL && bo->map__wc == NULL].count--;
-	}
-
-	if (bo->map__gtt)
-		munmap(bo->map__gtt, bytes(bo));
-	if (bo->map__wc) {
-		VG(VALGRIND_MAKE_MEM_NOACCESS(bo->map__wc, bytes(bo)));
-		munmap(bo->map__wc, bytes(bo));
-	}
-	if (bo->map__cpu) {
-		VG(VALGRIND_MAKE_MEM_NOACCESS(MAP(bo->map__cpu), bytes(bo)));
-		munmap(MAP(bo->map__cpu), bytes(bo));
-	}
-
-	_list_del(&bo->list);
-	_list_del(&bo->request);
-	gem_close(kgem->fd, bo->handle);
+	_list_del(&bo->list);
+	_list_del(&bo->request);
+	_list_del(&bo->lookup);
+	kgem_bo_release(kgem, bo, defer);
 
 	if (!bo->io && !DBG_NO_MALLOC_CACHE) {
 		*(struct kgem_bo **)bo = __kgem_freed_bo;
@@ -2175,6 +2806,80 @@ static void kgem_bo_free(struct kgem *kgem, struct kgem_bo *bo)
 		free(bo);
 }
 
+static inline struct list *
+cache_index(struct kgem *kgem, int bucket, int tiling, int pitch, bool active)
+{
+	uint32_t key = pitch | tiling << 18 | bucket << 20 | active << 25;
+	return &kgem->cache_index[(key * 0x9e3779b1) >> (32 - CACHE_INDEX_BITS)];
+}
+
+/* Linear bo are all filed under a pitch of 0, as any linear bo is a match
+ * for a linear request. The index is a hint: a bo whose tiling is changed
+ * whilst in the cache is simply skipped until it is next moved between
+ * caches.
+ */
+static inline void kgem_bo_index(struct kgem *kgem, struct kgem_bo *bo)
+{
+	list_move(&bo->lookup,
+		  cache_index(kgem, bucket(bo), bo->tiling,
+			      bo->tiling ? bo->pitch : 0,
+			      bo->rq != NULL));
+}
+
+static struct kgem_bo *
+search_cache_index(struct kgem *kgem, int bucket, int tiling, int pitch,
+		   int num_pages, bool active)
+{
+	struct kgem_bo *bo, *best = NULL;
+
+	assert(tiling != I915_TILING_NONE || pitch == 0);
+	list_for_each_entry(bo, cache_index(kgem, bucket, tiling, pitch, active), lookup) {
+		assert(bo->refcnt == 0);
+		assert(bo->reusable);
+		assert(!bo->scanout);
+
+		if (bucket(bo) != bucket ||
+		    bo->tiling != tiling ||
+		    !!bo->rq != active)
+			continue;
+
+		if (tiling != I915_TILING_NONE) {
+			if (bo->pitch != pitch)
+				continue;
+		} else {
+			/* Keep the mappings for those that ask for one,
+			 * as search_linear_cache() does.
+			 */
+			if (bo->map__gtt || bo->map__wc || bo->map__cpu)
+				continue;
+		}
+
+		if (num_pages(bo) < num_pages)
+			continue;
+
+		if (best == NULL || num_pages(bo) < num_pages(best)) {
+			best = bo;
+			if (num_pages(bo) == num_pages)
+				break;
+		}
+	}
+
+	DBG(("%s: bucket=%d, tiling=%d, pitch=%d, num_pages=%d, active=%d: found handle=%d\n",
+	     __FUNCTION__, bucket, tiling, pitch, num_pages, active,
+	     best ? best->handle : 0));
+	return best;
+}
+
+static bool
+cache_set_tiling(struct kgem *kgem, struct kgem_bo *bo, int tiling, int pitch)
+{
+	if (!gem_set_tiling(kgem->fd, bo->handle, tiling, pitch))
+		return false;
+
+	kgem->stats.retiles++;
+	return true;
+}
+
 inline static void kgem_bo_move_to_inactive(struct kgem *kgem,
 					    struct kgem_bo *bo)
 {
@@ -2203,22 +2908,20 @@ inline static void kgem_bo_move_to_inactive(struct kgem *kgem,
 		}
 
 		list_move(&bo->list, &kgem->large_inactive);
+		kgem_bo_index(kgem, bo);
 	} else {
 		assert(bo->flush == false);
 		assert(list_is_empty(&bo->vma));
 		list_move(&bo->list, &kgem->inactive[bucket(bo)]);
+		kgem_bo_index(kgem, bo);
 		if (bo->map__gtt && !kgem_bo_can_map(kgem, bo)) {
 			munmap(bo->map__gtt, bytes(bo));
 			bo->map__gtt = NULL;
 		}
-		if (bo->map__gtt || (bo->map__wc && !bo->tiling)) {
-			list_add(&bo->vma, &kgem->vma[0].inactive[bucket(bo)]);
-			kgem->vma[0].count++;
-		}
-		if (bo->map__cpu && list_is_empty(&bo->vma)) {
-			list_add(&bo->vma, &kgem->vma[1].inactive[bucket(bo)]);
-			kgem->vma[1].count++;
-		}
+		if (bo->map__gtt || (bo->map__wc && !bo->tiling))
+			kgem_vma_cache_add(kgem, bo, MAP_GTT);
+		else if (bo->map__cpu)
+			kgem_vma_cache_add(kgem, bo, MAP_CPU);
 	}
 
 	kgem->need_expire = true;
@@ -2244,6 +2947,7 @@ static struct kgem_bo *kgem_bo_replace_io(struct kgem_bo *bo)
 		memcpy(base, bo, sizeof(*base));
 		base->io = false;
 		list_init(&base->list);
+		list_init(&base->lookup);
 		list_replace(&bo->request, &base->request);
 		list_replace(&bo->vma, &base->vma);
 		free(bo);
@@ -2260,12 +2964,13 @@ inline static void kgem_bo_remove_from_inactive(struct kgem *kgem,
 	DBG(("%s: removing handle=%d from inactive\n", __FUNCTION__, bo->handle));
 
 	list_del(&bo->list);
+	list_del(&bo->lookup);
 	assert(bo->rq == NULL);
 	assert(bo->exec == NULL);
 	if (!list_is_empty(&bo->vma)) {
 		assert(bo->map__gtt || bo->map__wc || bo->map__cpu);
-		list_del(&bo->vma);
-		kgem->vma[bo->map__gtt == NULL && bo->map__wc == NULL].count--;
+		kgem_vma_cache_del(kgem, bo);
+		kgem->stats.vma_reused++;
 	}
 }
 
@@ -2275,6 +2980,7 @@ inline static void kgem_bo_remove_from_active(struct kgem *kgem,
 	DBG(("%s: removing handle=%d from active\n", __FUNCTION__, bo->handle));
 
 	list_del(&bo->list);
+	list_del(&bo->lookup);
 	assert(bo->rq != NULL);
 	if (RQ(bo->rq) == (void *)kgem) {
 		assert(bo->exec == NULL);
@@ -2283,6 +2989,39 @@ inline static void kgem_bo_remove_from_active(struct kgem *kgem,
 	assert(list_is_empty(&bo->vma));
 }
 
+static struct kgem_upload_span *
+upload_ring_find(struct kgem_upload_ring *ring, uint32_t offset)
+{
+	unsigned n;
+
+	for (n = 0; n < ring->count; n++) {
+		struct kgem_upload_span *span =
+			&ring->span[(ring->first + n) % UPLOAD_RING_SPANS];
+		if (offset >= span->start && offset < span->end)
+			return span;
+	}
+
+	return NULL;
+}
+
+static void upload_ring_put(struct kgem *kgem, uint32_t offset)
+{
+	struct kgem_upload_span *span;
+
+	span = upload_ring_find(kgem->upload, offset);
+	assert(span && span->live);
+	if (span == NULL || --span->live)
+		return;
+
+	/* The batch under construction may still refer to it */
+	span->fence = kgem->seqno;
+	if (kgem->upload->buffer->base.exec || kgem->nbatch)
+		span->fence++;
+
+	DBG(("%s: span [%d, %d) idle after request %d\n",
+	     __FUNCTION__, span->start, span->end, span->fence));
+}
+
 static void _kgem_bo_delete_buffer(struct kgem *kgem, struct kgem_bo *bo)
 {
 	struct kgem_buffer *io = (struct kgem_buffer *)bo->proxy;
@@ -2385,7 +3124,7 @@ static bool kgem_bo_move_to_cache(struct kgem *kgem, struct kgem_bo *bo)
 	DBG(("%s: release handle=%d\n", __FUNCTION__, bo->handle));
 
 	if (bo->prime) {
-		DBG(("%s: discarding imported prime handle=%d\n",
+		DBG(("%s: discarding prime handle=%d\n",
 		     __FUNCTION__, bo->handle));
 		kgem_bo_free(kgem, bo);
 	} else if (bo->snoop) {
@@ -2590,6 +3329,7 @@ static void __kgem_bo_destroy(struct kgem *kgem, struct kgem_bo *bo)
 		else
 			cache = &kgem->large;
 		list_add(&bo->list, cache);
+		kgem_bo_index(kgem, bo);
 		return;
 	}
 
@@ -2725,6 +3465,21 @@ static bool __kgem_bo_flush(struct kgem *kgem, struct kgem_bo *bo)
 	return true;
 }
 
+static void kgem_stats_retire(struct kgem *kgem, struct kgem_request *rq)
+{
+	uint32_t elapsed;
+	int bin;
+
+	/* We only notice completion when we next poll, so this is an
+	 * upper bound on the time the GPU took to execute the batch.
+	 */
+	elapsed = kgem_stats_time() - rq->submitted;
+	bin = elapsed ? __fls(elapsed) : 0;
+	if (bin >= KGEM_STATS_HIST)
+		bin = KGEM_STATS_HIST - 1;
+	kgem->stats.submit[rq->reason].latency[bin]++;
+}
+
 static bool __kgem_retire_rq(struct kgem *kgem, struct kgem_request *rq)
 {
 	bool retired = false;
@@ -2733,6 +3488,8 @@ static bool __kgem_retire_rq(struct kgem *kgem, struct kgem_request *rq)
 	     __FUNCTION__, rq->bo->handle));
 	assert(RQ(rq->bo->rq) == rq);
 
+	kgem_stats_retire(kgem, rq);
+
 	if (rq == kgem->fence[rq->ring])
 		kgem->fence[rq->ring] = NULL;
 
@@ -2977,6 +3734,7 @@ static void kgem_commit(struct kgem *kgem)
 	struct kgem_bo *bo, *next;
 
 	kgem_commit__check_reloc(kgem);
+	rq->seqno = ++kgem->seqno;
 
 	list_for_each_entry_safe(bo, next, &rq->buffers, request) {
 		assert(next->request.prev == &bo->request);
@@ -2990,7 +3748,13 @@ static void kgem_commit(struct kgem *kgem)
 		assert(bo->proxy == NULL || bo->exec == &_kgem_dummy_exec);
 		assert(RQ(bo->rq) == rq || (RQ(bo->proxy->rq) == rq));
 
-		bo->presumed_offset = bo->exec->offset;
+		/* Still being written by the kernel if the batch is in flight */
+		if (!kgem_submit_in_flight(kgem)) {
+			/* Moved by a batch resubmitted with relocations */
+			if (bo->softpin && bo->exec->offset != bo->presumed_offset)
+				kgem_bo_unpin(kgem, bo);
+			bo->presumed_offset = bo->exec->offset;
+		}
 		bo->exec = NULL;
 		bo->target_handle = -1;
 
@@ -3033,6 +3797,8 @@ static void kgem_commit(struct kgem *kgem)
 		assert(rq->bo->map__gtt == NULL);
 		assert(rq->bo->map__wc == NULL);
 		assert(rq->bo->map__cpu == NULL);
+		if (rq->bo->softpin)
+			kgem_bo_unpin(kgem, rq->bo);
 		gem_close(kgem->fd, rq->bo->handle);
 		kgem_cleanup_cache(kgem);
 	} else {
@@ -3041,7 +3807,8 @@ static void kgem_commit(struct kgem *kgem)
 		kgem->need_throttle = kgem->need_retire = 1;
 
 		if (kgem->fence[rq->ring] == NULL &&
-		    __kgem_busy(kgem, rq->bo->handle))
+		    (kgem_submit_in_flight(kgem) ||
+		     __kgem_busy(kgem, rq->bo->handle)))
 			kgem->fence[rq->ring] = rq;
 	}
 
@@ -3146,6 +3913,8 @@ static void kgem_finish_buffers(struct kgem *kgem)
 				if (map) {
 					kgem_bo_sync__cpu(kgem, shrink);
 					memcpy(map, bo->mem, bo->used);
+					bo->base.exec->flags &= ~LOCAL_EXEC_OBJECT_PINNED;
+					bo->base.exec->flags |= kgem_bo_softpin(kgem, shrink);
 
 					shrink->target_handle =
 						kgem->has_handle_lut ? bo->base.target_handle : shrink->handle;
@@ -3192,6 +3961,9 @@ static void kgem_finish_buffers(struct kgem *kgem)
 				assert(bo->used <= bytes(shrink));
 				if (gem_write__cachealigned(kgem->fd, shrink->handle,
 							    0, bo->used, bo->mem) == 0) {
+					bo->base.exec->flags &= ~LOCAL_EXEC_OBJECT_PINNED;
+					bo->base.exec->flags |= kgem_bo_softpin(kgem, shrink);
+
 					shrink->target_handle =
 						kgem->has_handle_lut ? bo->base.target_handle : shrink->handle;
 					for (n = 0; n < kgem->nreloc; n++) {
@@ -3644,6 +4416,405 @@ retry:
 	return ret;
 }
 
+static bool kgem_exec_pinned(struct kgem *kgem)
+{
+	int n;
+
+	for (n = 0; n < kgem->nexec; n++) {
+		if ((kgem->exec[n].flags & LOCAL_EXEC_OBJECT_PINNED) == 0)
+			return false;
+	}
+
+	return true;
+}
+
+static void kgem_softpin_fallback(struct kgem *kgem,
+				  struct drm_i915_gem_execbuffer2 *execbuf,
+				  int nreloc)
+{
+	struct drm_i915_gem_exec_object2 *exec =
+		(struct drm_i915_gem_exec_object2 *)(uintptr_t)execbuf->buffers_ptr;
+	unsigned n;
+
+	/* Only if the kernel refuses our very first softpinned batch do we
+	 * assume it cannot softpin at all; afterwards an EINVAL is more
+	 * likely to be about something else, so just retry this batch.
+	 */
+	if (!kgem->softpin_probed) {
+		xf86DrvMsg(kgem_get_screen_index(kgem), X_WARNING,
+			   "Kernel rejected the first softpinned batch, falling back to relocations.\n");
+		kgem->has_softpin = false;
+	} else
+		DBG(("%s: softpinned batch rejected, retrying with relocations\n",
+		     __FUNCTION__));
+
+	/* The batch already holds our chosen addresses and every
+	 * relocation was recorded with them as the presumed offsets, so
+	 * the kernel need only move whatever it cannot place there.
+	 */
+	for (n = 0; n < execbuf->buffer_count; n++)
+		exec[n].flags &= ~LOCAL_EXEC_OBJECT_PINNED;
+	exec[execbuf->buffer_count-1].relocation_count = nreloc;
+}
+
+static void *kgem_submit_thread_run(void *arg)
+{
+	struct kgem_submit_thread *t = arg;
+	sigset_t signals;
+
+	/* Disable all signals in the slave threads as X uses them for IO */
+	sigfillset(&signals);
+	sigdelset(&signals, SIGBUS);
+	sigdelset(&signals, SIGSEGV);
+	pthread_sigmask(SIG_SETMASK, &signals, NULL);
+
+	pthread_mutex_lock(&t->mutex);
+	while (1) {
+		while (!t->queued && !t->quit)
+			pthread_cond_wait(&t->cond, &t->mutex);
+		if (t->quit)
+			break;
+		pthread_mutex_unlock(&t->mutex);
+
+		t->ret = __do_ioctl(t->fd, DRM_IOCTL_I915_GEM_EXECBUFFER2, &t->execbuf);
+
+		pthread_mutex_lock(&t->mutex);
+		t->queued = false;
+		pthread_cond_signal(&t->cond);
+	}
+	pthread_mutex_unlock(&t->mutex);
+
+	return NULL;
+}
+
+bool kgem_init_submit_thread(struct kgem *kgem)
+{
+	struct kgem_submit_thread *t = submit_thread;
+
+	if (kgem->async_submit)
+		return true;
+
+	if (t == NULL) {
+		t = calloc(1, sizeof(*t));
+		if (t == NULL)
+			return false;
+
+		pthread_mutex_init(&t->mutex, NULL);
+		pthread_cond_init(&t->cond, NULL);
+		if (pthread_create(&t->thread, NULL, kgem_submit_thread_run, t)) {
+			pthread_cond_destroy(&t->cond);
+			pthread_mutex_destroy(&t->mutex);
+			free(t);
+			return false;
+		}
+
+		submit_thread = t;
+	}
+
+	/* The second pair of exec/reloc arrays, which the main thread
+	 * builds into whilst the other is being submitted.
+	 */
+	kgem->exec__spare = malloc(kgem->size_exec * sizeof(kgem->exec[0]));
+	kgem->reloc__spare = malloc(kgem->size_reloc * sizeof(kgem->reloc[0]));
+	if (kgem->exec__spare == NULL || kgem->reloc__spare == NULL) {
+		free(kgem->exec__spare);
+		free(kgem->reloc__spare);
+		kgem->exec__spare = NULL;
+		kgem->reloc__spare = NULL;
+		return false;
+	}
+	kgem->size_exec__spare = kgem->size_exec;
+	kgem->size_reloc__spare = kgem->size_reloc;
+
+	t->users++;
+	kgem->async_submit = true;
+	return true;
+}
+
+void kgem_fini_submit_thread(struct kgem *kgem)
+{
+	struct kgem_submit_thread *t = submit_thread;
+
+	if (!kgem->async_submit)
+		return;
+
+	assert(t && t->users);
+	if (t->kgem == kgem)
+		kgem_submit_collect();
+	assert(t->kgem != kgem);
+
+	if (kgem->exec__spare != kgem->exec__inline)
+		free(kgem->exec__spare);
+	if (kgem->reloc__spare != kgem->reloc__inline)
+		free(kgem->reloc__spare);
+	kgem->exec__spare = NULL;
+	kgem->reloc__spare = NULL;
+	kgem->async_submit = false;
+
+	if (--t->users)
+		return;
+
+	assert(t->kgem == NULL);
+	pthread_mutex_lock(&t->mutex);
+	t->quit = true;
+	pthread_cond_signal(&t->cond);
+	pthread_mutex_unlock(&t->mutex);
+	pthread_join(t->thread, NULL);
+
+	pthread_cond_destroy(&t->cond);
+	pthread_mutex_destroy(&t->mutex);
+	free(t);
+	submit_thread = NULL;
+}
+
+static void kgem_submit_collect(void)
+{
+	struct kgem_submit_thread *t = submit_thread;
+	struct kgem *kgem = t->kgem;
+	int ret;
+
+	assert(kgem);
+
+	pthread_mutex_lock(&t->mutex);
+	if (t->queued) {
+		uint32_t start = kgem_stats_time();
+
+		do
+			pthread_cond_wait(&t->cond, &t->mutex);
+		while (t->queued);
+
+		kgem->stats.async_stalls++;
+		kgem->stats.async_stall_us += kgem_stats_time() - start;
+	}
+	pthread_mutex_unlock(&t->mutex);
+
+	t->kgem = NULL;
+	ret = t->ret;
+	if (ret == 0) {
+		if (kgem->has_softpin)
+			kgem->softpin_probed = true;
+		return;
+	}
+
+	/* We may be called from within any ioctl, so we cannot purge the
+	 * caches as do_execbuf() would. Instead just let the GPU catch up
+	 * and try again, before giving up as the synchronous path does.
+	 */
+	DBG(("%s: queued execbuf failed ret=%d\n", __FUNCTION__, ret));
+	if (ret == -EINVAL && kgem->has_softpin) {
+		kgem_softpin_fallback(kgem, &t->execbuf, t->nreloc);
+		ret = __do_ioctl(kgem->fd, DRM_IOCTL_I915_GEM_EXECBUFFER2, &t->execbuf);
+	}
+	if (ret) {
+		(void)__kgem_throttle(kgem, false);
+		ret = __do_ioctl(kgem->fd, DRM_IOCTL_I915_GEM_EXECBUFFER2, &t->execbuf);
+	}
+	if (ret && !kgem->wedged) {
+		xf86DrvMsg(kgem_get_screen_index(kgem), X_ERROR,
+			   "Failed to submit rendering commands, disabling acceleration.\n");
+		__kgem_set_wedged(kgem);
+	}
+}
+
+void kgem_submit_wait(struct kgem *kgem)
+{
+	if (submit_thread && submit_thread->kgem)
+		kgem_submit_collect();
+}
+
+static bool kgem_submit_async(struct kgem *kgem,
+			      struct drm_i915_gem_execbuffer2 *execbuf)
+{
+	struct kgem_submit_thread *t = submit_thread;
+	void *ptr;
+	uint16_t size;
+
+	if (!kgem->async_submit)
+		return false;
+
+	/* Only hand over batches that were flushed because they were full;
+	 * everything else was submitted so that someone outside of kgem
+	 * (the display engine, a client, the CPU) could see the results.
+	 */
+	switch (kgem->next_request->reason) {
+	case SUBMIT_BATCH:
+	case SUBMIT_EXEC:
+	case SUBMIT_RELOC:
+	case SUBMIT_FENCE:
+	case SUBMIT_APERTURE:
+	case SUBMIT_OPPORTUNISTIC:
+	case SUBMIT_DEPENDENCY:
+	case SUBMIT_RING:
+		break;
+	default:
+		return false;
+	}
+
+	/* Keep the batches in order, and only one in flight */
+	if (t->kgem)
+		kgem_submit_collect();
+
+	t->kgem = kgem;
+	t->fd = kgem->fd;
+	t->execbuf = *execbuf;
+	t->nreloc = kgem->nreloc;
+
+	/* The thread now owns exec[] and reloc[], carry on in the spares */
+	ptr = kgem->exec;
+	kgem->exec = kgem->exec__spare;
+	kgem->exec__spare = ptr;
+	size = kgem->size_exec;
+	kgem->size_exec = kgem->size_exec__spare;
+	kgem->size_exec__spare = size;
+
+	ptr = kgem->reloc;
+	kgem->reloc = kgem->reloc__spare;
+	kgem->reloc__spare = ptr;
+	size = kgem->size_reloc;
+	kgem->size_reloc = kgem->size_reloc__spare;
+	kgem->size_reloc__spare = size;
+
+	pthread_mutex_lock(&t->mutex);
+	t->queued = true;
+	pthread_cond_signal(&t->cond);
+	pthread_mutex_unlock(&t->mutex);
+
+	kgem->stats.async++;
+	return true;
+}
+
+static void kgem_stats_submit(struct kgem *kgem, uint32_t batch_end)
+{
+	struct kgem_stats *stats = &kgem->stats;
+	struct kgem_request *rq = kgem->next_request;
+	int bin;
+
+	assert(kgem->submit_reason < NUM_SUBMIT_REASONS);
+	rq->reason = kgem->submit_reason;
+	rq->submitted = kgem_stats_time();
+	kgem->submit_reason = SUBMIT_OTHER;
+
+	/* Surface state is packed down from the end of the batch */
+	stats->submit[rq->reason].count++;
+	stats->submit[rq->reason].fill +=
+		1000 * (kgem->nbatch + kgem->batch_size - kgem->surface) / kgem->batch_size;
+
+	stats->batches[kgem->mode]++;
+
+	bin = __fls(batch_end);
+	if (bin >= KGEM_STATS_HIST)
+		bin = KGEM_STATS_HIST - 1;
+	stats->batch_hist[bin]++;
+
+	if (kgem->aperture + kgem->aperture_fenced > stats->aperture_max)
+		stats->aperture_max = kgem->aperture + kgem->aperture_fenced;
+	if (kgem->nexec > stats->nexec_max)
+		stats->nexec_max = kgem->nexec;
+	if (kgem->nreloc > stats->nreloc_max)
+		stats->nreloc_max = kgem->nreloc;
+}
+
+bool kgem_init_capture(struct kgem *kgem, const char *path)
+{
+	struct kgem_capture_header header;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return false;
+
+	header.magic = KGEM_CAPTURE_MAGIC;
+	header.version = KGEM_CAPTURE_VERSION;
+	header.gen = kgem->gen;
+	header.flags = kgem->has_handle_lut ? KGEM_CAPTURE_HANDLE_LUT : 0;
+	if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+		close(fd);
+		return false;
+	}
+
+	kgem->capture_fd = fd;
+	return true;
+}
+
+void kgem_fini_capture(struct kgem *kgem)
+{
+	if (kgem->capture_fd < 0)
+		return;
+
+	close(kgem->capture_fd);
+	kgem->capture_fd = -1;
+}
+
+/* Record the batch as it is about to be handed to the kernel */
+static void kgem_capture(struct kgem *kgem, uint32_t batch_end)
+{
+	struct kgem_capture_exec *exec;
+	struct kgem_capture_batch batch;
+	struct timespec ts;
+	struct kgem_bo *bo;
+	struct iovec iov[5];
+	ssize_t len;
+	int i;
+
+	exec = calloc(kgem->nexec, sizeof(*exec));
+	if (kgem->nexec && exec == NULL)
+		return;
+
+	for (i = 0; i < kgem->nexec; i++) {
+		exec[i].handle = kgem->exec[i].handle;
+		exec[i].flags = kgem->exec[i].flags;
+	}
+	list_for_each_entry(bo, &kgem->next_request->buffers, request) {
+		if (bo->proxy || bo->exec == NULL)
+			continue;
+
+		i = bo->exec - kgem->exec;
+		assert(i >= 0 && i < kgem->nexec);
+		exec[i].target_handle = bo->target_handle;
+		exec[i].size = bytes(bo);
+		exec[i].pitch = bo->pitch;
+		exec[i].tiling = bo->tiling;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	batch.timestamp = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	batch.nbatch = batch_end;
+	batch.surface = kgem->surface;
+	batch.batch_size = kgem->batch_size;
+	batch.nexec = kgem->nexec;
+	batch.nreloc = kgem->nreloc;
+	batch.batch_flags = kgem->batch_flags;
+	batch.ring = kgem->ring;
+	batch.mode = kgem->mode;
+	batch.reason = kgem->next_request->reason;
+	batch.pad = 0;
+
+	iov[0].iov_base = &batch;
+	iov[0].iov_len = sizeof(batch);
+	iov[1].iov_base = kgem->batch;
+	iov[1].iov_len = sizeof(uint32_t) * batch_end;
+	iov[2].iov_base = kgem->batch + kgem->surface;
+	iov[2].iov_len = sizeof(uint32_t) * (kgem->batch_size - kgem->surface);
+	iov[3].iov_base = exec;
+	iov[3].iov_len = sizeof(*exec) * kgem->nexec;
+	iov[4].iov_base = kgem->reloc;
+	iov[4].iov_len = sizeof(kgem->reloc[0]) * kgem->nreloc;
+
+	len = 0;
+	for (i = 0; i < ARRAY_SIZE(iov); i++)
+		len += iov[i].iov_len;
+
+	if (writev(kgem->capture_fd, iov, ARRAY_SIZE(iov)) != len) {
+		xf86DrvMsg(kgem_get_screen_index(kgem), X_ERROR,
+			   "Failed to write batch capture, errno=%d; capture stopped\n",
+			   errno);
+		close(kgem->capture_fd);
+		kgem->capture_fd = -1;
+	}
+
+	free(exec);
+}
+
 void _kgem_submit(struct kgem *kgem)
 {
 	struct kgem_request *rq;
@@ -3666,12 +4837,16 @@ void _kgem_submit(struct kgem *kgem)
 
 	assert(kgem->nbatch <= kgem->batch_size);
 	assert(kgem->nbatch <= kgem->surface);
-	assert(kgem->nreloc <= ARRAY_SIZE(kgem->reloc));
-	assert(kgem->nexec < ARRAY_SIZE(kgem->exec));
+	assert(kgem->nreloc <= kgem->size_reloc);
+	assert(kgem->nexec < kgem->size_exec);
 	assert(kgem->nfence <= kgem->fence_max);
 
+	kgem_stats_submit(kgem, batch_end);
 	kgem_finish_buffers(kgem);
 
+	if (kgem->capture_fd >= 0)
+		kgem_capture(kgem, batch_end);
+
 #if SHOW_BATCH_BEFORE
 	__kgem_batch_debug(kgem, batch_end);
 #endif
@@ -3694,9 +4869,19 @@ void _kgem_submit(struct kgem *kgem)
 		kgem->exec[i].offset = rq->bo->presumed_offset;
 		/* Make sure the kernel releases any fence, ignored if gen4+ */
 		kgem->exec[i].flags = EXEC_OBJECT_NEEDS_FENCE;
+		if (kgem->has_softpin && rq->bo->softpin)
+			kgem->exec[i].flags |= LOCAL_EXEC_OBJECT_PINNED;
 		kgem->exec[i].rsvd1 = 0;
 		kgem->exec[i].rsvd2 = 0;
 
+		/* With everything at a fixed address, the batch is complete
+		 * as written and the kernel need not look at the relocations.
+		 */
+		if (kgem->has_softpin && kgem_exec_pinned(kgem)) {
+			kgem->exec[i].relocation_count = 0;
+			kgem->stats.norelocs++;
+		}
+
 		rq->bo->exec = &kgem->exec[i];
 		rq->bo->rq = MAKE_REQUEST(rq, kgem->ring); /* useful sanity check */
 		list_add(&rq->bo->request, &rq->buffers);
@@ -3719,7 +4904,16 @@ void _kgem_submit(struct kgem *kgem)
 			}
 		}
 
-		ret = do_execbuf(kgem, &execbuf);
+		if (kgem_submit_async(kgem, &execbuf)) {
+			ret = 0;
+		} else {
+			ret = do_execbuf(kgem, &execbuf);
+			if (ret == -EINVAL && kgem->has_softpin) {
+				kgem_softpin_fallback(kgem, &execbuf, kgem->nreloc);
+				ret = do_execbuf(kgem, &execbuf);
+			} else if (ret == 0 && kgem->has_softpin)
+				kgem->softpin_probed = true;
+		}
 		if (DEBUG_SYNC && ret == 0) {
 			struct drm_i915_gem_set_domain set_domain;
 
@@ -3927,6 +5121,137 @@ void kgem_clean_large_cache(struct kgem *kgem)
 	}
 }
 
+bool kgem_set_cache_budget(struct kgem *kgem, uint64_t size, unsigned percent)
+{
+	if (percent) {
+		uint64_t limit = memory_limit();
+		if (limit == 0)
+			return false;
+
+		size = limit / 100 * percent;
+	}
+
+	DBG(("%s: %lld bytes\n", __FUNCTION__, (long long)size));
+	kgem->cache_budget = size;
+	return true;
+}
+
+bool kgem_init_pressure(struct kgem *kgem, unsigned threshold)
+{
+	int fd;
+
+	fd = open("/proc/pressure/memory", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	kgem->pressure_fd = fd;
+	kgem->pressure_threshold = threshold;
+	return true;
+}
+
+void kgem_fini_pressure(struct kgem *kgem)
+{
+	if (kgem->pressure_fd < 0)
+		return;
+
+	close(kgem->pressure_fd);
+	kgem->pressure_fd = -1;
+}
+
+/* Percentage (x100) of the last 10s some task stalled waiting on memory */
+static int kgem_memory_pressure(struct kgem *kgem)
+{
+	char buf[256];
+	int len, pct, frac;
+
+	len = pread(kgem->pressure_fd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0)
+		return 0;
+	buf[len] = '\0';
+
+	/* "some avg10=1.23 avg60=0.45 avg300=0.06 total=123456" */
+	if (sscanf(buf, "some avg10=%d.%d", &pct, &frac) != 2)
+		return 0;
+
+	return 100 * pct + frac;
+}
+
+static uint64_t kgem_cache_size(struct kgem *kgem)
+{
+	struct kgem_bo *bo;
+	uint64_t size = 0;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(kgem->inactive); i++)
+		list_for_each_entry(bo, &kgem->inactive[i], list)
+			size += bytes(bo);
+	list_for_each_entry(bo, &kgem->snoop, list)
+		size += bytes(bo);
+	list_for_each_entry(bo, &kgem->large_inactive, list)
+		size += bytes(bo);
+
+	return size;
+}
+
+static uint64_t kgem_free_oldest(struct kgem *kgem, struct list *cache,
+				 uint64_t excess)
+{
+	uint64_t freed = 0;
+
+	while (freed < excess && !list_is_empty(cache)) {
+		struct kgem_bo *bo = list_last_entry(cache, struct kgem_bo, list);
+
+		DBG(("%s: trimming %d\n", __FUNCTION__, bo->handle));
+		kgem->stats.trimmed++;
+		freed += bytes(bo);
+		kgem_bo_free(kgem, bo);
+	}
+
+	return freed;
+}
+
+/* Rather than wait for the kernel to purge our idle bo from under us,
+ * keep the caches within the configured budget, and shrink them by
+ * half for every pass whilst the system is stalling on memory.
+ */
+static void kgem_trim_cache(struct kgem *kgem)
+{
+	uint64_t size, target, freed;
+	int i;
+
+	if (kgem->cache_budget == 0 && kgem->pressure_fd < 0)
+		return;
+
+	size = kgem_cache_size(kgem);
+	target = kgem->cache_budget ?: size;
+
+	if (kgem->pressure_fd >= 0 &&
+	    kgem_memory_pressure(kgem) > 100 * kgem->pressure_threshold) {
+		DBG(("%s: under memory pressure\n", __FUNCTION__));
+		kgem->stats.pressure_trims++;
+		if (target > size)
+			target = size;
+		target /= 2;
+	}
+
+	DBG(("%s: cached %lld, target %lld\n",
+	     __FUNCTION__, (long long)size, (long long)target));
+	if (size <= target)
+		return;
+
+	/* Largest and least likely to be reused first */
+	freed = kgem_free_oldest(kgem, &kgem->large_inactive, size - target);
+	if (freed < size - target)
+		freed += kgem_free_oldest(kgem, &kgem->snoop,
+					  size - target - freed);
+	for (i = ARRAY_SIZE(kgem->inactive); freed < size - target && i--; )
+		freed += kgem_free_oldest(kgem, &kgem->inactive[i],
+					  size - target - freed);
+
+	kgem->stats.trim_runs++;
+	kgem->stats.trimmed_bytes += freed;
+}
+
 bool kgem_expire_cache(struct kgem *kgem)
 {
 	time_t now, expire;
@@ -3969,6 +5294,8 @@ bool kgem_expire_cache(struct kgem *kgem)
 			if (bo->delta > expire)
 				break;
 
+			kgem->stats.snoop_expired++;
+			kgem->stats.snoop_expired_bytes += bytes(bo);
 			kgem_bo_free(kgem, bo);
 		}
 	}
@@ -3992,6 +5319,8 @@ bool kgem_expire_cache(struct kgem *kgem)
 	if (kgem->need_purge)
 		kgem_purge_cache(kgem);
 
+	kgem_trim_cache(kgem);
+
 	if (kgem->need_retire)
 		kgem_retire(kgem);
 
@@ -4062,10 +5391,189 @@ bool kgem_expire_cache(struct kgem *kgem)
 	DBG(("%s: expired %d objects, %d bytes, idle? %d\n",
 	     __FUNCTION__, count, size, idle));
 
+	kgem->stats.expire_runs++;
+	kgem->stats.expired += count;
+	kgem->stats.expired_bytes += size;
+
 	kgem->need_expire = !idle;
 	return count;
-	(void)count;
-	(void)size;
+}
+
+static const char * const submit_reason_names[NUM_SUBMIT_REASONS] = {
+	[SUBMIT_OTHER] = "other",
+	[SUBMIT_BATCH] = "batch",
+	[SUBMIT_EXEC] = "exec",
+	[SUBMIT_RELOC] = "reloc",
+	[SUBMIT_FENCE] = "fence",
+	[SUBMIT_APERTURE] = "aperture",
+	[SUBMIT_OPPORTUNISTIC] = "opportunistic",
+	[SUBMIT_DEPENDENCY] = "dependency",
+	[SUBMIT_RING] = "ring-switch",
+	[SUBMIT_IDLE] = "idle",
+	[SUBMIT_SCANOUT] = "scanout",
+	[SUBMIT_BO] = "bo-sync",
+};
+
+static void list_size(struct list *head, int *count, uint64_t *size)
+{
+	struct kgem_bo *bo;
+
+	*count = 0;
+	*size = 0;
+	list_for_each_entry(bo, head, list)
+		++*count, *size += bytes(bo);
+}
+
+void kgem_dump_stats(struct kgem *kgem)
+{
+	const struct kgem_stats *stats = &kgem->stats;
+	int scrn = kgem_get_screen_index(kgem);
+	uint64_t lookups, batches, size, active_size;
+	int count, active_count, i, j;
+	char hist[KGEM_STATS_HIST * 20], *h;
+
+	lookups = stats->hits + stats->retiles + stats->misses;
+	xf86DrvMsg(scrn, X_INFO,
+		   "kgem: bo allocated %lld, freed %lld, live %lldKiB (max %lldKiB)\n",
+		   (long long)stats->bo_allocs, (long long)stats->bo_frees,
+		   (long long)stats->bo_bytes >> 10,
+		   (long long)stats->bo_bytes_max >> 10);
+	xf86DrvMsg(scrn, X_INFO,
+		   "kgem: cache hits %lld, retiled %lld, misses %lld (%d%% reuse)\n",
+		   (long long)stats->hits, (long long)stats->retiles,
+		   (long long)stats->misses,
+		   lookups ? (int)(100 * (lookups - stats->misses) / lookups) : 0);
+	xf86DrvMsg(scrn, X_INFO,
+		   "kgem: expired %lld bo, %lldKiB over %lld passes; snoop %lld bo, %lldKiB\n",
+		   (long long)stats->expired, (long long)stats->expired_bytes >> 10,
+		   (long long)stats->expire_runs,
+		   (long long)stats->snoop_expired,
+		   (long long)stats->snoop_expired_bytes >> 10);
+
+	for (i = 0; i < NUM_CACHE_BUCKETS; i++) {
+		uint64_t s;
+		int c;
+
+		active_count = 0;
+		active_size = 0;
+		for (j = 0; j < ARRAY_SIZE(kgem->active[i]); j++) {
+			list_size(&kgem->active[i][j], &c, &s);
+			active_count += c;
+			active_size += s;
+		}
+		list_size(&kgem->inactive[i], &count, &size);
+		if (active_count + count == 0)
+			continue;
+
+		xf86DrvMsg(scrn, X_INFO,
+			   "kgem: bucket %2d [%6dKiB]: active %d bo, %lldKiB; inactive %d bo, %lldKiB\n",
+			   i, PAGE_SIZE << i >> 10,
+			   active_count, (long long)active_size >> 10,
+			   count, (long long)size >> 10);
+	}
+
+	list_size(&kgem->large, &active_count, &active_size);
+	list_size(&kgem->large_inactive, &count, &size);
+	xf86DrvMsg(scrn, X_INFO,
+		   "kgem: large: active %d bo, %lldKiB; inactive %d bo, %lldKiB\n",
+		   active_count, (long long)active_size >> 10,
+		   count, (long long)size >> 10);
+	list_size(&kgem->snoop, &active_count, &active_size);
+	list_size(&kgem->scanout, &count, &size);
+	xf86DrvMsg(scrn, X_INFO,
+		   "kgem: snoop %d bo, %lldKiB; scanout %d bo, %lldKiB\n",
+		   active_count, (long long)active_size >> 10,
+		   count, (long long)size >> 10);
+	xf86DrvMsg(scrn, X_INFO,
+		   "kgem: vma cache: gtt %d, cpu %d, %lldKiB of %lldKiB; %lld mmaps, %lld munmaps; avoided %lld mmaps, %lld munmaps\n",
+		   kgem->vma[MAP_GTT].count, kgem->vma[MAP_CPU].count,
+		   (long long)kgem->vma_cache.bytes >> 10,
+		   (long long)kgem->vma_cache.max_bytes >> 10,
+		   (long long)stats->mmaps,
+		   (long long)stats->munmaps,
+		   (long long)stats->map_hits,
+		   (long long)stats->vma_reused);
+
+	xf86DrvMsg(scrn, X_INFO,
+		   "kgem: batches render %lld, bsd %lld, blt %lld; max exec %d, reloc %d, aperture %dKiB of %dKiB\n",
+		   (long long)stats->batches[KGEM_RENDER],
+		   (long long)stats->batches[KGEM_BSD],
+		   (long long)stats->batches[KGEM_BLT],
+		   stats->nexec_max, stats->nreloc_max,
+		   stats->aperture_max * (PAGE_SIZE >> 10),
+		   kgem->aperture_high * (PAGE_SIZE >> 10));
+
+	h = hist;
+	*h = '\0';
+	for (i = 0; i < KGEM_STATS_HIST; i++) {
+		if (stats->batch_hist[i] == 0)
+			continue;
+		h += sprintf(h, " %d:%u", 1 << i, stats->batch_hist[i]);
+	}
+	xf86DrvMsg(scrn, X_INFO, "kgem: batch dwords (log2):%s\n", hist);
+
+	if (kgem->has_softpin)
+		xf86DrvMsg(scrn, X_INFO,
+			   "kgem: softpin: %lld batches without relocations, %lldKiB of address space assigned\n",
+			   (long long)stats->norelocs,
+			   (long long)kgem->va.used >> 10);
+	if (kgem->async_submit)
+		xf86DrvMsg(scrn, X_INFO,
+			   "kgem: async submit: %lld batches, waited on %lld for %lldus\n",
+			   (long long)stats->async,
+			   (long long)stats->async_stalls,
+			   (long long)stats->async_stall_us);
+	if (kgem->cache_budget || kgem->pressure_fd >= 0)
+		xf86DrvMsg(scrn, X_INFO,
+			   "kgem: cache budget %lldKiB: trimmed %lld bo, %lldKiB over %lld passes, %lld under memory pressure\n",
+			   (long long)kgem->cache_budget >> 10,
+			   (long long)stats->trimmed,
+			   (long long)stats->trimmed_bytes >> 10,
+			   (long long)stats->trim_runs,
+			   (long long)stats->pressure_trims);
+	if (kgem->upload)
+		xf86DrvMsg(scrn, X_INFO,
+			   "kgem: upload ring %dKiB: %lld uploads, %lldKiB; %lld fell back when full, %lld cached uploads dropped\n",
+			   kgem->upload->size >> 10,
+			   (long long)stats->upload_allocs,
+			   (long long)stats->upload_bytes >> 10,
+			   (long long)stats->upload_full,
+			   (long long)stats->upload_released);
+	if (stats->reap_queued)
+		xf86DrvMsg(scrn, X_INFO,
+			   "kgem: deferred release: %lld queued (max depth %d), %lld closed over %lld passes in %lldus (max %dus)\n",
+			   (long long)stats->reap_queued,
+			   stats->reap_depth_max,
+			   (long long)stats->reaped,
+			   (long long)stats->reap_runs,
+			   (long long)stats->reap_us,
+			   stats->reap_us_max);
+
+	batches = 0;
+	for (i = 0; i < ARRAY_SIZE(stats->batches); i++)
+		batches += stats->batches[i];
+	for (i = 0; i < NUM_SUBMIT_REASONS; i++) {
+		uint64_t n = stats->submit[i].count;
+
+		if (n == 0)
+			continue;
+
+		h = hist;
+		*h = '\0';
+		for (j = 0; j < KGEM_STATS_HIST; j++) {
+			if (stats->submit[i].latency[j] == 0)
+				continue;
+			h += sprintf(h, " %d:%u", 1 << j,
+				     stats->submit[i].latency[j]);
+		}
+		xf86DrvMsg(scrn, X_INFO,
+			   "kgem: submit %-13s %lld (%d%%), fill %d.%d%%, retire usec (log2):%s\n",
+			   submit_reason_names[i], (long long)n,
+			   (int)(100 * n / batches),
+			   (int)(stats->submit[i].fill / n / 10),
+			   (int)(stats->submit[i].fill / n % 10),
+			   hist);
+	}
 }
 
 bool kgem_cleanup_cache(struct kgem *kgem)
@@ -4098,8 +5606,12 @@ bool kgem_cleanup_cache(struct kgem *kgem)
 	kgem_retire(kgem);
 	kgem_cleanup(kgem);
 
-	if (!kgem->need_expire)
-		return false;
+	/* Give back everything still queued for release */
+	if (!kgem->need_expire) {
+		bool reaped = kgem->reap.head != kgem->reap.count;
+		kgem_reap(kgem, 0);
+		return reaped;
+	}
 
 	for (i = 0; i < ARRAY_SIZE(kgem->inactive); i++) {
 		while (!list_is_empty(&kgem->inactive[i]))
@@ -4122,6 +5634,8 @@ bool kgem_cleanup_cache(struct kgem *kgem)
 		free(bo);
 	}
 
+	kgem_reap(kgem, 0);
+
 	kgem->need_purge = false;
 	kgem->need_expire = false;
 	return true;
@@ -4143,6 +5657,21 @@ search_linear_cache(struct kgem *kgem, unsigned int num_pages, unsigned flags)
 
 	if (num_pages >= MAX_CACHE_SIZE / PAGE_SIZE) {
 		DBG(("%s: searching large buffers\n", __FUNCTION__));
+
+		/* The large caches are unsorted and a walk frees every idle
+		 * bo that is too small, so first try for the best fit.
+		 */
+		bo = search_cache_index__2d(kgem, num_pages,
+					    I915_TILING_NONE, 0, flags);
+		if (bo) {
+			bo->pitch = 0;
+			bo->delta = 0;
+			DBG(("  %s: found handle=%d (num_pages=%d) in large index\n",
+			     __FUNCTION__, bo->handle, num_pages(bo)));
+			assert_tiling(kgem, bo);
+			return bo;
+		}
+
 retry_large:
 		cache = use_active ? &kgem->large : &kgem->large_inactive;
 		list_for_each_entry_safe(bo, first, cache, list) {
@@ -4157,8 +5686,8 @@ retry_large:
 				if (use_active)
 					goto discard;
 
-				if (!gem_set_tiling(kgem->fd, bo->handle,
-						    I915_TILING_NONE, 0))
+				if (!cache_set_tiling(kgem, bo,
+						      I915_TILING_NONE, 0))
 					goto discard;
 
 				bo->tiling = I915_TILING_NONE;
@@ -4169,6 +5698,7 @@ retry_large:
 				goto discard;
 
 			list_del(&bo->list);
+			list_del(&bo->lookup);
 			if (RQ(bo->rq) == (void *)kgem) {
 				assert(bo->exec == NULL);
 				list_del(&bo->request);
@@ -4245,8 +5775,8 @@ discard:
 			}
 
 			if (I915_TILING_NONE != bo->tiling &&
-			    !gem_set_tiling(kgem->fd, bo->handle,
-					    I915_TILING_NONE, 0))
+			    !cache_set_tiling(kgem, bo,
+					      I915_TILING_NONE, 0))
 				continue;
 
 			kgem_bo_remove_from_inactive(kgem, bo);
@@ -4272,6 +5802,36 @@ discard:
 			return NULL;
 	}
 
+	/* The smallest unmapped linear bo will do, without having to pass
+	 * over the tiled bo that share the inactive list.
+	 */
+	if ((flags & (CREATE_CPU_MAP | CREATE_GTT_MAP)) == 0) {
+		bo = search_cache_index(kgem, cache_bucket(num_pages),
+					I915_TILING_NONE, 0,
+					num_pages, use_active);
+		if (bo && bo->purged && !kgem_bo_clear_purgeable(kgem, bo)) {
+			kgem_bo_free(kgem, bo);
+			bo = NULL;
+		}
+		if (bo) {
+			if (use_active)
+				kgem_bo_remove_from_active(kgem, bo);
+			else
+				kgem_bo_remove_from_inactive(kgem, bo);
+
+			bo->pitch = 0;
+			bo->delta = 0;
+			DBG(("  %s: found handle=%d (num_pages=%d) in linear %s index\n",
+			     __FUNCTION__, bo->handle, num_pages(bo),
+			     use_active ? "active" : "inactive"));
+			assert(use_active || bo->domain != DOMAIN_GPU);
+			assert(!bo->needs_flush || use_active);
+			assert_tiling(kgem, bo);
+			ASSERT_MAYBE_IDLE(kgem, bo->handle, !use_active);
+			return bo;
+		}
+	}
+
 	cache = use_active ? active(kgem, num_pages, I915_TILING_NONE) : inactive(kgem, num_pages);
 	list_for_each_entry(bo, cache, list) {
 		assert(bo->refcnt == 0);
@@ -4300,8 +5860,8 @@ discard:
 			if (first)
 				continue;
 
-			if (!gem_set_tiling(kgem->fd, bo->handle,
-					    I915_TILING_NONE, 0))
+			if (!cache_set_tiling(kgem, bo,
+					      I915_TILING_NONE, 0))
 				continue;
 
 			bo->tiling = I915_TILING_NONE;
@@ -4482,7 +6042,7 @@ struct kgem_bo *kgem_create_for_prime(struct kgem *kgem, int name, uint32_t size
 	VG_CLEAR(caching);
 	caching.handle = args.handle;
 	caching.caching = kgem->has_llc;
-	(void)drmIoctl(kgem->fd, LOCAL_IOCTL_I915_GEM_GET_CACHING, &caching);
+	(void)do_ioctl(kgem->fd, LOCAL_IOCTL_I915_GEM_GET_CACHING, &caching);
 	DBG(("%s: imported handle=%d has caching %d\n", __FUNCTION__, args.handle, caching.caching));
 	switch (caching.caching) {
 	case 0:
@@ -4531,6 +6091,7 @@ int kgem_bo_export_to_prime(struct kgem *kgem, struct kgem_bo *bo)
 		return -1;
 
 	bo->reusable = false;
+	bo->prime = true;
 	return args.fd;
 #else
 	return -1;
@@ -4560,6 +6121,7 @@ struct kgem_bo *kgem_create_linear(struct kgem *kgem, int size, unsigned flags)
 			return bo;
 		}
 
+		kgem->stats.misses++;
 		if (flags & CREATE_CACHED)
 			return NULL;
 	}
@@ -4877,11 +6439,56 @@ static void __kgem_bo_make_scanout(struct kgem *kgem,
 		bo->domain = DOMAIN_GTT;
 	}
 
-	if (do_ioctl(kgem->fd, DRM_IOCTL_MODE_ADDFB, &arg) == 0) {
-		DBG(("%s: attached fb=%d to handle=%d\n",
-		     __FUNCTION__, arg.fb_id, arg.handle));
-		bo->delta = arg.fb_id;
-	}
+	if (do_ioctl(kgem->fd, DRM_IOCTL_MODE_ADDFB, &arg) == 0) {
+		DBG(("%s: attached fb=%d to handle=%d\n",
+		     __FUNCTION__, arg.fb_id, arg.handle));
+		bo->delta = arg.fb_id;
+	}
+}
+
+/* Look for an idle or active bo that already has the requested tiling
+ * and pitch (any unmapped bo for a linear request), and so can be reused
+ * without a set-tiling.
+ */
+static struct kgem_bo *
+search_cache_index__2d(struct kgem *kgem,
+		       int num_pages, int tiling, int pitch,
+		       unsigned flags)
+{
+	int first = cache_bucket(num_pages);
+	int last = MIN(first + 3, 1 << 5);
+	struct kgem_bo *bo;
+	int bucket;
+
+	if ((flags & CREATE_INACTIVE) == 0) {
+		for (bucket = first; bucket < last; bucket++) {
+			bo = search_cache_index(kgem, bucket, tiling, pitch,
+						num_pages, true);
+			if (bo) {
+				assert(!bo->purged);
+				kgem_bo_remove_from_active(kgem, bo);
+				return bo;
+			}
+		}
+	}
+
+	for (bucket = first; bucket < last; bucket++) {
+		bo = search_cache_index(kgem, bucket, tiling, pitch,
+					num_pages, false);
+		if (bo == NULL)
+			continue;
+
+		if (bo->purged && !kgem_bo_clear_purgeable(kgem, bo)) {
+			kgem_bo_free(kgem, bo);
+			break;
+		}
+
+		kgem_bo_remove_from_inactive(kgem, bo);
+		assert(bo->domain != DOMAIN_GPU);
+		return bo;
+	}
+
+	return NULL;
 }
 
 struct kgem_bo *kgem_create_2d(struct kgem *kgem,
@@ -4990,8 +6597,8 @@ struct kgem_bo *kgem_create_2d(struct kgem *kgem,
 						bo->delta = 0;
 					}
 
-					if (gem_set_tiling(kgem->fd, bo->handle,
-							   tiling, pitch)) {
+					if (cache_set_tiling(kgem, bo,
+							     tiling, pitch)) {
 						bo->tiling = tiling;
 						bo->pitch = pitch;
 					} else {
@@ -5035,6 +6642,27 @@ struct kgem_bo *kgem_create_2d(struct kgem *kgem,
 		flags |= CREATE_INACTIVE;
 	}
 
+	/* Prefer an exact match over reusing a bo of the wrong pitch */
+	if (tiling != I915_TILING_NONE &&
+	    (flags & (CREATE_CPU_MAP | CREATE_GTT_MAP)) == 0) {
+		bo = search_cache_index__2d(kgem, size, tiling, pitch, flags);
+		if (bo) {
+			kgem->stats.hits++;
+			bo->unique_id = kgem_get_unique_id(kgem);
+			bo->delta = 0;
+			DBG(("  from cache index: pitch=%d, tiling=%d, handle=%d, id=%d\n",
+			     bo->pitch, bo->tiling, bo->handle, bo->unique_id));
+			assert(bo->pitch*kgem_aligned_height(kgem, height, bo->tiling) <= kgem_bo_size(bo));
+			assert_tiling(kgem, bo);
+			bo->refcnt = 1;
+
+			if (flags & CREATE_SCANOUT)
+				__kgem_bo_make_scanout(kgem, bo, width, height);
+
+			return bo;
+		}
+	}
+
 	if (bucket >= NUM_CACHE_BUCKETS) {
 		DBG(("%s: large bo num pages=%d, bucket=%d\n",
 		     __FUNCTION__, size, bucket));
@@ -5066,8 +6694,8 @@ struct kgem_bo *kgem_create_2d(struct kgem *kgem,
 					continue;
 
 				if (bo->pitch != pitch || bo->tiling != tiling) {
-					if (!gem_set_tiling(kgem->fd, bo->handle,
-							    tiling, pitch))
+					if (!cache_set_tiling(kgem, bo,
+							      tiling, pitch))
 						continue;
 
 					bo->pitch = pitch;
@@ -5100,8 +6728,8 @@ large_inactive:
 
 			if (bo->tiling != tiling ||
 			    (tiling != I915_TILING_NONE && bo->pitch != pitch)) {
-				if (!gem_set_tiling(kgem->fd, bo->handle,
-						    tiling, pitch))
+				if (!cache_set_tiling(kgem, bo,
+						      tiling, pitch))
 					continue;
 
 				bo->tiling = tiling;
@@ -5114,6 +6742,7 @@ large_inactive:
 			}
 
 			list_del(&bo->list);
+			list_del(&bo->lookup);
 
 			assert(bo->domain != DOMAIN_GPU);
 			bo->unique_id = kgem_get_unique_id(kgem);
@@ -5166,8 +6795,8 @@ large_inactive:
 				if (bo->tiling != tiling ||
 				    (tiling != I915_TILING_NONE && bo->pitch != pitch)) {
 					if (bo->map__gtt ||
-					    !gem_set_tiling(kgem->fd, bo->handle,
-							    tiling, pitch)) {
+					    !cache_set_tiling(kgem, bo,
+							      tiling, pitch)) {
 						DBG(("inactive GTT vma with wrong tiling: %d < %d\n",
 						     bo->tiling, tiling));
 						continue;
@@ -5249,9 +6878,8 @@ search_active:
 					continue;
 
 				if (bo->pitch != pitch) {
-					if (!gem_set_tiling(kgem->fd,
-							    bo->handle,
-							    tiling, pitch))
+					if (!cache_set_tiling(kgem, bo,
+							      tiling, pitch))
 						continue;
 
 					bo->pitch = pitch;
@@ -5313,9 +6941,8 @@ search_active:
 
 				if (bo->tiling != tiling ||
 				    (tiling != I915_TILING_NONE && bo->pitch != pitch)) {
-					if (!gem_set_tiling(kgem->fd,
-							    bo->handle,
-							    tiling, pitch))
+					if (!cache_set_tiling(kgem, bo,
+							      tiling, pitch))
 						continue;
 				}
 
@@ -5403,8 +7030,8 @@ search_inactive:
 
 		if (bo->tiling != tiling ||
 		    (tiling != I915_TILING_NONE && bo->pitch != pitch)) {
-			if (!gem_set_tiling(kgem->fd, bo->handle,
-					    tiling, pitch))
+			if (!cache_set_tiling(kgem, bo,
+					      tiling, pitch))
 				continue;
 		}
 
@@ -5467,7 +7094,7 @@ search_inactive:
 			__kgem_bo_clear_busy(bo);
 
 			if (tiling != I915_TILING_NONE && bo->pitch != pitch) {
-				if (!gem_set_tiling(kgem->fd, bo->handle, tiling, pitch)) {
+				if (!cache_set_tiling(kgem, bo, tiling, pitch)) {
 					kgem_bo_free(kgem, bo);
 					goto no_retire;
 				}
@@ -5497,6 +7124,7 @@ no_retire:
 	}
 
 create:
+	kgem->stats.misses++;
 	if (flags & CREATE_CACHED) {
 		DBG(("%s: no cached bo found, requested not to create a new bo\n", __FUNCTION__));
 		return NULL;
@@ -5655,7 +7283,10 @@ void _kgem_bo_destroy(struct kgem *kgem, struct kgem_bo *bo)
 		_list_del(&bo->vma);
 		_list_del(&bo->request);
 
-		if (bo->io && bo->domain == DOMAIN_CPU)
+		if (kgem->upload &&
+		    bo->proxy == &kgem->upload->buffer->base)
+			upload_ring_put(kgem, bo->delta);
+		else if (bo->io && bo->domain == DOMAIN_CPU)
 			_kgem_bo_delete_buffer(kgem, bo);
 
 		kgem_bo_unref(kgem, bo->proxy);
@@ -5689,7 +7320,11 @@ void kgem_scanout_flush(struct kgem *kgem, struct kgem_bo *bo)
 	if (!bo->needs_flush)
 		return;
 
-	kgem_bo_submit(kgem, bo);
+	if (bo->exec) {
+		assert(bo->refcnt);
+		kgem->submit_reason = SUBMIT_SCANOUT;
+		_kgem_submit(kgem);
+	}
 
 	/* If the kernel fails to emit the flush, then it will be forced when
 	 * we assume direct access. And as the usual failure is EIO, we do
@@ -5758,13 +7393,19 @@ inline static bool needs_batch_flush(struct kgem *kgem, struct kgem_bo *bo)
 	return kgem->nreloc ? flush : false;
 }
 
+static bool submit_for(struct kgem *kgem, enum kgem_submit_reason reason)
+{
+	kgem->submit_reason = reason;
+	return false;
+}
+
 static bool aperture_check(struct kgem *kgem, unsigned num_pages)
 {
 	struct drm_i915_gem_get_aperture aperture;
 	int reserve;
 
 	if (kgem->aperture)
-		return false;
+		return submit_for(kgem, SUBMIT_APERTURE);
 
 	/* Leave some space in case of alignment issues */
 	reserve = kgem->aperture_mappable / 2;
@@ -5787,7 +7428,10 @@ static bool aperture_check(struct kgem *kgem, unsigned num_pages)
 	     (long)num_pages * PAGE_SIZE,
 	     (long)aperture.aper_available_size));
 
-	return num_pages <= aperture.aper_available_size / PAGE_SIZE;
+	if (num_pages <= aperture.aper_available_size / PAGE_SIZE)
+		return true;
+
+	return submit_for(kgem, SUBMIT_APERTURE);
 }
 
 static inline bool kgem_flush(struct kgem *kgem, bool flush)
@@ -5806,7 +7450,10 @@ static inline bool kgem_flush(struct kgem *kgem, bool flush)
 
 	DBG(("%s: opportunistic flushing? flush=%d,%d, aperture=%d/%d, idle?=%d\n",
 	     __FUNCTION__, kgem->flush, flush, kgem->aperture, kgem->aperture_low, kgem_ring_is_idle(kgem, kgem->ring)));
-	return !kgem_ring_is_idle(kgem, kgem->ring);
+	if (!kgem_ring_is_idle(kgem, kgem->ring))
+		return true;
+
+	return submit_for(kgem, SUBMIT_OPPORTUNISTIC);
 }
 
 bool kgem_check_bo(struct kgem *kgem, ...)
@@ -5818,6 +7465,8 @@ bool kgem_check_bo(struct kgem *kgem, ...)
 	bool flush = false;
 	bool busy = true;
 
+	kgem->submit_reason = SUBMIT_OTHER;
+
 	va_start(ap, kgem);
 	while ((bo = va_arg(ap, struct kgem_bo *))) {
 		while (bo->proxy)
@@ -5827,7 +7476,7 @@ bool kgem_check_bo(struct kgem *kgem, ...)
 
 		if (needs_batch_flush(kgem, bo)) {
 			va_end(ap);
-			return false;
+			return submit_for(kgem, SUBMIT_DEPENDENCY);
 		}
 
 		num_pages += num_pages(bo);
@@ -5844,10 +7493,11 @@ bool kgem_check_bo(struct kgem *kgem, ...)
 	if (!num_pages)
 		return true;
 
-	if (kgem->nexec + num_exec >= KGEM_EXEC_SIZE(kgem)) {
+	if (kgem->nexec + num_exec >= KGEM_EXEC_SIZE(kgem) &&
+	    !__kgem_grow_exec(kgem, num_exec + 1)) {
 		DBG(("%s: out of exec slots (%d + %d / %d)\n", __FUNCTION__,
 		     kgem->nexec, num_exec, KGEM_EXEC_SIZE(kgem)));
-		return false;
+		return submit_for(kgem, SUBMIT_EXEC);
 	}
 
 	if (num_pages + kgem->aperture > kgem->aperture_high) {
@@ -5864,6 +7514,8 @@ bool kgem_check_bo(struct kgem *kgem, ...)
 
 bool kgem_check_bo_fenced(struct kgem *kgem, struct kgem_bo *bo)
 {
+	kgem->submit_reason = SUBMIT_OTHER;
+
 	assert(bo->refcnt);
 	while (bo->proxy)
 		bo = bo->proxy;
@@ -5878,7 +7530,7 @@ bool kgem_check_bo_fenced(struct kgem *kgem, struct kgem_bo *bo)
 			assert(bo->tiling == I915_TILING_X);
 
 			if (kgem->nfence >= kgem->fence_max)
-				return false;
+				return submit_for(kgem, SUBMIT_FENCE);
 
 			if (kgem->aperture_fenced) {
 				size = 3*kgem->aperture_fenced;
@@ -5887,7 +7539,7 @@ bool kgem_check_bo_fenced(struct kgem *kgem, struct kgem_bo *bo)
 				if (size > kgem->aperture_fenceable &&
 				    kgem_ring_is_idle(kgem, kgem->ring)) {
 					DBG(("%s: opportunistic fence flush\n", __FUNCTION__));
-					return false;
+					return submit_for(kgem, SUBMIT_FENCE);
 				}
 			}
 
@@ -5902,18 +7554,19 @@ bool kgem_check_bo_fenced(struct kgem *kgem, struct kgem_bo *bo)
 			if (size > kgem->aperture_fenceable) {
 				DBG(("%s: estimated fence space required %d (fenced=%d, max_fence=%d, aperture=%d) exceeds fenceable aperture %d\n",
 				     __FUNCTION__, size, kgem->aperture_fenced, kgem->aperture_max_fence, kgem->aperture, kgem->aperture_fenceable));
-				return false;
+				return submit_for(kgem, SUBMIT_FENCE);
 			}
 		}
 
 		return true;
 	}
 
-	if (kgem->nexec >= KGEM_EXEC_SIZE(kgem) - 1)
-		return false;
+	if (kgem->nexec >= KGEM_EXEC_SIZE(kgem) - 1 &&
+	    !__kgem_grow_exec(kgem, 2))
+		return submit_for(kgem, SUBMIT_EXEC);
 
 	if (needs_batch_flush(kgem, bo))
-		return false;
+		return submit_for(kgem, SUBMIT_DEPENDENCY);
 
 	assert_tiling(kgem, bo);
 	if (kgem->gen < 040 && bo->tiling != I915_TILING_NONE) {
@@ -5922,7 +7575,7 @@ bool kgem_check_bo_fenced(struct kgem *kgem, struct kgem_bo *bo)
 		assert(bo->tiling == I915_TILING_X);
 
 		if (kgem->nfence >= kgem->fence_max)
-			return false;
+			return submit_for(kgem, SUBMIT_FENCE);
 
 		if (kgem->aperture_fenced) {
 			size = 3*kgem->aperture_fenced;
@@ -5931,7 +7584,7 @@ bool kgem_check_bo_fenced(struct kgem *kgem, struct kgem_bo *bo)
 			if (size > kgem->aperture_fenceable &&
 			    kgem_ring_is_idle(kgem, kgem->ring)) {
 				DBG(("%s: opportunistic fence flush\n", __FUNCTION__));
-				return false;
+				return submit_for(kgem, SUBMIT_FENCE);
 			}
 		}
 
@@ -5946,7 +7599,7 @@ bool kgem_check_bo_fenced(struct kgem *kgem, struct kgem_bo *bo)
 		if (size > kgem->aperture_fenceable) {
 			DBG(("%s: estimated fence space required %d (fenced=%d, max_fence=%d, aperture=%d) exceeds fenceable aperture %d\n",
 			     __FUNCTION__, size, kgem->aperture_fenced, kgem->aperture_max_fence, kgem->aperture, kgem->aperture_fenceable));
-			return false;
+			return submit_for(kgem, SUBMIT_FENCE);
 		}
 	}
 
@@ -5973,6 +7626,8 @@ bool kgem_check_many_bo_fenced(struct kgem *kgem, ...)
 	bool flush = false;
 	bool busy = true;
 
+	kgem->submit_reason = SUBMIT_OTHER;
+
 	va_start(ap, kgem);
 	while ((bo = va_arg(ap, struct kgem_bo *))) {
 		assert(bo->refcnt);
@@ -5993,7 +7648,7 @@ bool kgem_check_many_bo_fenced(struct kgem *kgem, ...)
 
 		if (needs_batch_flush(kgem, bo)) {
 			va_end(ap);
-			return false;
+			return submit_for(kgem, SUBMIT_DEPENDENCY);
 		}
 
 		assert_tiling(kgem, bo);
@@ -6016,7 +7671,7 @@ bool kgem_check_many_bo_fenced(struct kgem *kgem, ...)
 		uint32_t size;
 
 		if (kgem->nfence + num_fence > kgem->fence_max)
-			return false;
+			return submit_for(kgem, SUBMIT_FENCE);
 
 		if (kgem->aperture_fenced) {
 			size = 3*kgem->aperture_fenced;
@@ -6025,7 +7680,7 @@ bool kgem_check_many_bo_fenced(struct kgem *kgem, ...)
 			if (size > kgem->aperture_fenceable &&
 			    kgem_ring_is_idle(kgem, kgem->ring)) {
 				DBG(("%s: opportunistic fence flush\n", __FUNCTION__));
-				return false;
+				return submit_for(kgem, SUBMIT_FENCE);
 			}
 		}
 
@@ -6038,15 +7693,16 @@ bool kgem_check_many_bo_fenced(struct kgem *kgem, ...)
 		if (size > kgem->aperture_fenceable) {
 			DBG(("%s: estimated fence space required %d (fenced=%d, max_fence=%d, aperture=%d) exceeds fenceable aperture %d\n",
 			     __FUNCTION__, size, kgem->aperture_fenced, kgem->aperture_max_fence, kgem->aperture, kgem->aperture_fenceable));
-			return false;
+			return submit_for(kgem, SUBMIT_FENCE);
 		}
 	}
 
 	if (num_pages == 0)
 		return true;
 
-	if (kgem->nexec + num_exec >= KGEM_EXEC_SIZE(kgem))
-		return false;
+	if (kgem->nexec + num_exec >= KGEM_EXEC_SIZE(kgem) &&
+	    !__kgem_grow_exec(kgem, num_exec + 1))
+		return submit_for(kgem, SUBMIT_EXEC);
 
 	if (num_pages + kgem->aperture > kgem->aperture_high - kgem->aperture_fenced) {
 		DBG(("%s: final aperture usage (%d + %d + %d) is greater than high water mark (%d)\n",
@@ -6075,7 +7731,7 @@ uint32_t kgem_add_reloc(struct kgem *kgem,
 	assert((read_write_domain & 0x7fff) == 0 || bo != NULL);
 
 	index = kgem->nreloc++;
-	assert(index < ARRAY_SIZE(kgem->reloc));
+	assert(index < kgem->size_reloc);
 	kgem->reloc[index].offset = pos * sizeof(kgem->batch[0]);
 	if (bo) {
 		assert(kgem->mode != KGEM_NONE);
@@ -6108,6 +7764,12 @@ uint32_t kgem_add_reloc(struct kgem *kgem,
 		assert(bo->rq == MAKE_REQUEST(kgem->next_request, kgem->ring));
 		assert(RQ_RING(bo->rq) == kgem->ring);
 
+		/* A softpinned batch is sent without its relocations, so
+		 * the exec flags are all the kernel sees of our writes.
+		 */
+		if (read_write_domain & 0x7fff)
+			bo->exec->flags |= LOCAL_EXEC_OBJECT_WRITE;
+
 		if (kgem->gen < 040 && read_write_domain & KGEM_RELOC_FENCED) {
 			if (bo->tiling &&
 			    (bo->exec->flags & EXEC_OBJECT_NEEDS_FENCE) == 0) {
@@ -6158,7 +7820,7 @@ uint64_t kgem_add_reloc64(struct kgem *kgem,
 	assert((read_write_domain & 0x7fff) == 0 || bo != NULL);
 
 	index = kgem->nreloc++;
-	assert(index < ARRAY_SIZE(kgem->reloc));
+	assert(index < kgem->size_reloc);
 	kgem->reloc[index].offset = pos * sizeof(kgem->batch[0]);
 	if (bo) {
 		assert(kgem->mode != KGEM_NONE);
@@ -6191,6 +7853,12 @@ uint64_t kgem_add_reloc64(struct kgem *kgem,
 		assert(bo->rq == MAKE_REQUEST(kgem->next_request, kgem->ring));
 		assert(RQ_RING(bo->rq) == kgem->ring);
 
+		/* A softpinned batch is sent without its relocations, so
+		 * the exec flags are all the kernel sees of our writes.
+		 */
+		if (read_write_domain & 0x7fff)
+			bo->exec->flags |= LOCAL_EXEC_OBJECT_WRITE;
+
 		DBG(("%s[%d] = (delta=%d, target handle=%d, presumed=%llx)\n",
 					__FUNCTION__, index, delta, bo->target_handle, (long long)bo->presumed_offset));
 		kgem->reloc[index].delta = delta;
@@ -6218,14 +7886,79 @@ uint64_t kgem_add_reloc64(struct kgem *kgem,
 	return delta;
 }
 
-static void kgem_trim_vma_cache(struct kgem *kgem, int type, int bucket)
+/* The oldest cached mapping, of the given type or of any type if -1.
+ * Each list is kept in order of use, so only the tails need comparing.
+ */
+static struct kgem_bo *kgem_vma_lru(struct kgem *kgem, int type)
 {
+	struct kgem_bo *lru = NULL;
 	int i, j;
 
-	DBG(("%s: type=%d, count=%d (bucket: %d)\n",
-	     __FUNCTION__, type, kgem->vma[type].count, bucket));
-	if (kgem->vma[type].count <= 0)
-	       return;
+	for (i = 0; i < ARRAY_SIZE(kgem->vma); i++) {
+		if (type >= 0 && i != type)
+			continue;
+
+		for (j = 0; j < ARRAY_SIZE(kgem->vma[i].inactive); j++) {
+			struct list *head = &kgem->vma[i].inactive[j];
+			struct kgem_bo *bo;
+
+			if (list_is_empty(head))
+				continue;
+
+			bo = list_last_entry(head, struct kgem_bo, vma);
+			if (lru == NULL ||
+			    (int32_t)(bo->vma_stamp - lru->vma_stamp) < 0)
+				lru = bo;
+		}
+	}
+
+	return lru;
+}
+
+static void kgem_vma_evict(struct kgem *kgem, struct kgem_bo *bo)
+{
+	DBG(("%s: discarding inactive vma cache for %d: %p:%p:%p\n",
+	     __FUNCTION__, bo->handle, bo->map__gtt, bo->map__wc, bo->map__cpu));
+
+	assert(bo->rq == NULL);
+	kgem_vma_cache_del(kgem, bo);
+
+	if (bo->map__cpu) {
+		VG(VALGRIND_MAKE_MEM_NOACCESS(MAP(bo->map__cpu), bytes(bo)));
+		munmap(MAP(bo->map__cpu), bytes(bo));
+		bo->map__cpu = NULL;
+		kgem->stats.munmaps++;
+	}
+	if (bo->map__wc) {
+		VG(VALGRIND_MAKE_MEM_NOACCESS(bo->map__wc, bytes(bo)));
+		munmap(bo->map__wc, bytes(bo));
+		bo->map__wc = NULL;
+		kgem->stats.munmaps++;
+	}
+	if (bo->map__gtt) {
+		munmap(bo->map__gtt, bytes(bo));
+		bo->map__gtt = NULL;
+		kgem->stats.munmaps++;
+	}
+
+	if (!bo->purged && !kgem_bo_set_purgeable(kgem, bo)) {
+		DBG(("%s: freeing unpurgeable old mapping\n",
+		     __FUNCTION__));
+		kgem_bo_free(kgem, bo);
+	}
+}
+
+static void kgem_trim_vma_cache(struct kgem *kgem, int type, int bucket)
+{
+	struct kgem_bo *bo;
+
+	DBG(("%s: type=%d, count=%d [%d], %lldKiB (bucket: %d)\n",
+	     __FUNCTION__, type, kgem->vma_cache.count, kgem->vma[type].count,
+	     (long long)kgem->vma_cache.bytes >> 10, bucket));
+	if (kgem->vma_cache.count <= kgem->vma_cache.max_count &&
+	    kgem->vma_cache.bytes <= kgem->vma_cache.max_bytes &&
+	    (type != MAP_GTT || kgem->vma[MAP_GTT].count <= MAX_GTT_VMA_CACHE))
+		return;
 
 	if (kgem->need_purge)
 		kgem_purge_cache(kgem);
@@ -6235,51 +7968,23 @@ static void kgem_trim_vma_cache(struct kgem *kgem, int type, int bucket)
 	 * mappings. In order to be fair and not hog the cache,
 	 * and more importantly not to exhaust that limit and to
 	 * start failing mappings, we keep our own number of open
-	 * vma to within a conservative value.
+	 * vma and the address space they cover to within a
+	 * conservative value. Whichever mapping was least recently
+	 * used goes first, whatever its type, and takes all of the
+	 * bo's other mappings with it.
+	 *
+	 * GTT mappings in addition consume the scarce mappable
+	 * aperture, and so are kept to a much smaller number.
 	 */
-	i = 0;
-	while (kgem->vma[type].count > 0) {
-		struct kgem_bo *bo = NULL;
-
-		for (j = 0;
-		     bo == NULL && j < ARRAY_SIZE(kgem->vma[type].inactive);
-		     j++) {
-			struct list *head = &kgem->vma[type].inactive[i++%ARRAY_SIZE(kgem->vma[type].inactive)];
-			if (!list_is_empty(head))
-				bo = list_last_entry(head, struct kgem_bo, vma);
-		}
-		if (bo == NULL)
-			break;
-
-		DBG(("%s: discarding inactive %s vma cache for %d\n",
-		     __FUNCTION__, type ? "CPU" : "GTT", bo->handle));
-
-		assert(bo->rq == NULL);
-		if (type) {
-			VG(VALGRIND_MAKE_MEM_NOACCESS(MAP(bo->map__cpu), bytes(bo)));
-			munmap(MAP(bo->map__cpu), bytes(bo));
-			bo->map__cpu = NULL;
-		} else {
-			if (bo->map__wc) {
-				VG(VALGRIND_MAKE_MEM_NOACCESS(bo->map__wc, bytes(bo)));
-				munmap(bo->map__wc, bytes(bo));
-				bo->map__wc = NULL;
-			}
-			if (bo->map__gtt) {
-				munmap(bo->map__gtt, bytes(bo));
-				bo->map__gtt = NULL;
-			}
-		}
-
-		list_del(&bo->vma);
-		kgem->vma[type].count--;
+	while (type == MAP_GTT &&
+	       kgem->vma[MAP_GTT].count > MAX_GTT_VMA_CACHE &&
+	       (bo = kgem_vma_lru(kgem, MAP_GTT)))
+		kgem_vma_evict(kgem, bo);
 
-		if (!bo->purged && !kgem_bo_set_purgeable(kgem, bo)) {
-			DBG(("%s: freeing unpurgeable old mapping\n",
-			     __FUNCTION__));
-			kgem_bo_free(kgem, bo);
-		}
-	}
+	while ((kgem->vma_cache.count > kgem->vma_cache.max_count ||
+		kgem->vma_cache.bytes > kgem->vma_cache.max_bytes) &&
+	       (bo = kgem_vma_lru(kgem, -1)))
+		kgem_vma_evict(kgem, bo);
 }
 
 static void *__kgem_bo_map__gtt_or_wc(struct kgem *kgem, struct kgem_bo *bo)
@@ -6300,10 +8005,14 @@ static void *__kgem_bo_map__gtt_or_wc(struct kgem *kgem, struct kgem_bo *bo)
 		ptr = bo->map__gtt;
 		if (ptr == NULL)
 			ptr = __kgem_bo_map__gtt(kgem, bo);
+		else
+			kgem->stats.map_hits++;
 	} else {
 		ptr = bo->map__wc;
 		if (ptr == NULL)
 			ptr = __kgem_bo_map__wc(kgem, bo);
+		else
+			kgem->stats.map_hits++;
 	}
 
 	return ptr;
@@ -6401,8 +8110,10 @@ void *kgem_bo_map__wc(struct kgem *kgem, struct kgem_bo *bo)
 	assert_tiling(kgem, bo);
 	assert(!bo->purged || bo->reusable);
 
-	if (bo->map__wc)
+	if (bo->map__wc) {
+		kgem->stats.map_hits++;
 		return bo->map__wc;
+	}
 	if (!kgem->has_wc_mmap)
 		return NULL;
 
@@ -6419,8 +8130,10 @@ void *kgem_bo_map__cpu(struct kgem *kgem, struct kgem_bo *bo)
 	assert(bo->proxy == NULL);
 	assert_tiling(kgem, bo);
 
-	if (bo->map__cpu)
+	if (bo->map__cpu) {
+		kgem->stats.map_hits++;
 		return MAP(bo->map__cpu);
+	}
 
 	kgem_trim_vma_cache(kgem, MAP_CPU, bucket(bo));
 
@@ -6753,6 +8466,7 @@ init_buffer_from_bo(struct kgem_buffer *bo, struct kgem_bo *old)
 		list_init(&bo->base.request);
 	list_replace(&old->vma, &bo->base.vma);
 	list_init(&bo->base.list);
+	list_init(&bo->base.lookup);
 	free(old);
 
 	assert(bo->base.tiling == I915_TILING_NONE);
@@ -6924,6 +8638,194 @@ free_caching:
 	return NULL;
 }
 
+bool kgem_init_upload_ring(struct kgem *kgem, uint32_t size)
+{
+	struct kgem_upload_ring *ring;
+
+	ring = calloc(1, sizeof(*ring));
+	if (ring == NULL)
+		return false;
+
+	ring->buffer = create_snoopable_buffer(kgem, NUM_PAGES(size));
+	if (ring->buffer == NULL) {
+		free(ring);
+		return false;
+	}
+
+	kgem_bo_sync__cpu(kgem, &ring->buffer->base);
+	ring->buffer->base.io = true;
+	ring->buffer->base.reusable = false;
+	ring->buffer->write = KGEM_BUFFER_WRITE_INPLACE;
+	ring->buffer->used = 0;
+	ring->size = bytes(&ring->buffer->base);
+
+	DBG(("%s: handle=%d, size=%d, snoop? %d\n", __FUNCTION__,
+	     ring->buffer->base.handle, ring->size, ring->buffer->base.snoop));
+
+	kgem->upload = ring;
+	return true;
+}
+
+/* Have all requests up to and including seqno been retired? */
+static bool upload_ring_retired(struct kgem *kgem, uint32_t seqno)
+{
+	unsigned n;
+
+	for (n = 0; n < ARRAY_SIZE(kgem->requests); n++) {
+		struct kgem_request *rq;
+
+		if (list_is_empty(&kgem->requests[n]))
+			continue;
+
+		rq = list_first_entry(&kgem->requests[n],
+				      struct kgem_request, list);
+		if ((int32_t)(rq->seqno - seqno) <= 0)
+			return false;
+	}
+
+	return (int32_t)(kgem->seqno - seqno) >= 0;
+}
+
+/* Drop the uploads cached on pixmaps, see kgem_proxy_bo_attach() */
+static void upload_ring_release(struct kgem *kgem,
+				struct kgem_upload_ring *ring,
+				const struct kgem_upload_span *span)
+{
+	struct kgem_bo *cached, *next;
+
+	list_for_each_entry_safe(cached, next, &ring->buffer->base.vma, vma) {
+		if (cached->delta < span->start || cached->delta >= span->end)
+			continue;
+
+		assert(cached->proxy == &ring->buffer->base);
+		list_del(&cached->vma);
+
+		assert(*(struct kgem_bo **)cached->map__gtt == cached);
+		*(struct kgem_bo **)cached->map__gtt = NULL;
+		cached->map__gtt = NULL;
+
+		kgem->stats.upload_released++;
+		kgem_bo_destroy(kgem, cached);
+	}
+}
+
+static void upload_ring_reclaim(struct kgem *kgem,
+				struct kgem_upload_ring *ring,
+				bool force)
+{
+	while (ring->count) {
+		struct kgem_upload_span *span = &ring->span[ring->first];
+
+		if (span->live && force)
+			upload_ring_release(kgem, ring, span);
+		if (span->live || !upload_ring_retired(kgem, span->fence))
+			break;
+
+		DBG(("%s: reusing [%d, %d)\n",
+		     __FUNCTION__, span->start, span->end));
+		ring->first = (ring->first + 1) % UPLOAD_RING_SPANS;
+		ring->count--;
+	}
+
+	if (ring->count == 0)
+		ring->buffer->used = 0;
+}
+
+static int upload_ring_fit(struct kgem *kgem,
+			   struct kgem_upload_ring *ring,
+			   uint32_t size)
+{
+	struct kgem_upload_span *span = NULL;
+	uint32_t head = ring->buffer->used, limit = ring->size;
+	bool wrap = false;
+
+	if (ring->count) {
+		struct kgem_upload_span *first = &ring->span[ring->first];
+
+		span = &ring->span[(ring->first + ring->count - 1) % UPLOAD_RING_SPANS];
+		if (span->start < first->start) {
+			limit = first->start;
+		} else if (head + size > limit) {
+			head = 0;
+			limit = first->start;
+			wrap = true;
+		}
+	}
+	if (head + size > limit)
+		return -1;
+
+	if (span == NULL || wrap || span->opened != kgem->seqno) {
+		if (ring->count == UPLOAD_RING_SPANS)
+			return -1;
+
+		span = &ring->span[(ring->first + ring->count++) % UPLOAD_RING_SPANS];
+		span->start = head;
+		span->live = 0;
+		span->opened = kgem->seqno;
+	}
+
+	span->live++;
+	span->end = head + size;
+	ring->buffer->used = head + size;
+	return head;
+}
+
+/* Return the unused tail of the most recent allocation to the ring. The
+ * span must shrink with the head, or the next span would start inside it
+ * and upload_ring_find() would charge its proxies to the wrong span.
+ */
+static void upload_ring_trim(struct kgem_upload_ring *ring, uint32_t used)
+{
+	struct kgem_upload_span *span;
+
+	assert(ring->count);
+	span = &ring->span[(ring->first + ring->count - 1) % UPLOAD_RING_SPANS];
+	assert(span->end == ring->buffer->used);
+	assert(used > span->start && used <= span->end);
+
+	span->end = used;
+	ring->buffer->used = used;
+}
+
+static struct kgem_bo *
+upload_ring_alloc(struct kgem *kgem, uint32_t size, void **ret)
+{
+	struct kgem_upload_ring *ring = kgem->upload;
+	struct kgem_bo *bo;
+	int offset;
+
+	if (size > ring->size / 4)
+		return NULL;
+
+	size = ALIGN(size, UPLOAD_ALIGNMENT);
+
+	upload_ring_reclaim(kgem, ring, false);
+	offset = upload_ring_fit(kgem, ring, size);
+	if (offset < 0) {
+		kgem_retire(kgem);
+		upload_ring_reclaim(kgem, ring, true);
+		offset = upload_ring_fit(kgem, ring, size);
+		if (offset < 0) {
+			DBG(("%s: ring full\n", __FUNCTION__));
+			kgem->stats.upload_full++;
+			return NULL;
+		}
+	}
+
+	bo = kgem_create_proxy(kgem, &ring->buffer->base, offset, size);
+	if (bo == NULL) {
+		upload_ring_put(kgem, offset);
+		return NULL;
+	}
+
+	DBG(("%s: offset=%d, size=%d\n", __FUNCTION__, offset, size));
+	kgem->stats.upload_allocs++;
+	kgem->stats.upload_bytes += size;
+
+	*ret = (char *)ring->buffer->mem + offset;
+	return bo;
+}
+
 struct kgem_bo *kgem_create_buffer(struct kgem *kgem,
 				   uint32_t size, uint32_t flags,
 				   void **ret)
@@ -6941,6 +8843,12 @@ struct kgem_bo *kgem_create_buffer(struct kgem *kgem,
 	/* we should never be asked to create anything TOO large */
 	assert(size <= kgem->max_object_size);
 
+	if (kgem->upload && flags & KGEM_BUFFER_WRITE) {
+		struct kgem_bo *proxy = upload_ring_alloc(kgem, size, ret);
+		if (proxy)
+			return proxy;
+	}
+
 #if !DBG_NO_UPLOAD_CACHE
 	list_for_each_entry(bo, &kgem->batch_buffers, base.list) {
 		assert(bo->base.io);
@@ -7349,7 +9257,10 @@ struct kgem_bo *kgem_create_buffer_2d(struct kgem *kgem,
 		if (io->used != min) {
 			DBG(("%s: trimming buffer from %d to %d\n",
 			     __FUNCTION__, io->used, min));
-			io->used = min;
+			if (kgem->upload && io == kgem->upload->buffer)
+				upload_ring_trim(kgem->upload, min);
+			else
+				io->used = min;
 		}
 		bo->size.bytes -= stride;
 	}
@@ -7506,6 +9417,93 @@ void kgem_bo_set_binding(struct kgem_bo *bo, uint32_t format, uint16_t offset)
 	}
 }
 
+static void *kgem_bo_map__retile(struct kgem *kgem,
+				 struct kgem_bo *bo,
+				 bool write)
+{
+	void *ptr;
+
+	assert(bo->proxy == NULL);
+
+	if (kgem_bo_can_map__cpu(kgem, bo, write)) {
+		ptr = kgem_bo_map__cpu(kgem, bo);
+		if (ptr)
+			kgem_bo_sync__cpu_full(kgem, bo, write);
+	} else {
+		ptr = kgem_bo_map__wc(kgem, bo);
+		if (ptr)
+			kgem_bo_sync__gtt(kgem, bo);
+	}
+
+	return ptr;
+}
+
+bool kgem_prefer_retile__cpu(struct kgem *kgem, struct kgem_bo *src)
+{
+	if (kgem->wedged)
+		return true;
+
+	/* Only worth skipping the queue for something that fits in cache,
+	 * and only if we do not then have to wait for the source anyway.
+	 */
+	if (num_pages(src) > kgem->half_cpu_cache_pages)
+		return false;
+
+	if (__kgem_bo_is_busy(kgem, src))
+		return false;
+
+	return !kgem_ring_is_idle(kgem, KGEM_BLT);
+}
+
+/* Copy the contents of src into dst, converting between their tiling
+ * layouts (and swizzling) on the CPU in a single pass.
+ */
+bool kgem_bo_retile__cpu(struct kgem *kgem,
+			 struct kgem_bo *src,
+			 struct kgem_bo *dst,
+			 uint32_t width,
+			 uint32_t height,
+			 uint32_t bpp)
+{
+	void *s, *d;
+
+	DBG(("%s: handle=%d (tiling=%d, pitch=%d) -> handle=%d (tiling=%d, pitch=%d), %dx%d bpp=%d\n",
+	     __FUNCTION__,
+	     src->handle, src->tiling, src->pitch,
+	     dst->handle, dst->tiling, dst->pitch,
+	     width, height, bpp));
+
+	if (src->proxy || dst->proxy)
+		return false;
+
+	if (!kgem_can_retile(kgem, src->tiling) ||
+	    !kgem_can_retile(kgem, dst->tiling)) {
+		DBG(("%s: unknown swizzling\n", __FUNCTION__));
+		return false;
+	}
+
+	s = kgem_bo_map__retile(kgem, src, false);
+	if (s == NULL)
+		return false;
+
+	d = kgem_bo_map__retile(kgem, dst, true);
+	if (d == NULL)
+		return false;
+
+	if (sigtrap_get())
+		return false;
+
+	memcpy_between_tiled(kgem, s, d, bpp,
+			     src->tiling, dst->tiling,
+			     src->pitch, dst->pitch,
+			     0, 0,
+			     0, 0,
+			     width, height);
+
+	sigtrap_put();
+	return true;
+}
+
 struct kgem_bo *
 kgem_replace_bo(struct kgem *kgem,
 		struct kgem_bo *src,
@@ -7526,8 +9524,7 @@ kgem_replace_bo(struct kgem *kgem,
 	/* We only expect to be called to fixup small buffers, hence why
 	 * we only attempt to allocate a linear bo.
 	 */
-	assert(src->tiling == I915_TILING_NONE);
-	assert(kgem_bo_can_blt(kgem, src));
+	assert(src->tiling == I915_TILING_NONE || kgem_can_retile(kgem, src->tiling));
 
 	size = height * pitch;
 	size = NUM_PAGES(size);
@@ -7552,6 +9549,17 @@ kgem_replace_bo(struct kgem *kgem,
 	dst->unique_id = kgem_get_unique_id(kgem);
 	dst->refcnt = 1;
 	assert(dst->tiling == I915_TILING_NONE);
+
+	if (!kgem_bo_can_blt(kgem, src) ||
+	    kgem_prefer_retile__cpu(kgem, src)) {
+		if (kgem_bo_retile__cpu(kgem, src, dst, width, height, bpp))
+			return dst;
+
+		if (kgem->wedged || !kgem_bo_can_blt(kgem, src)) {
+			kgem_bo_destroy(kgem, dst);
+			return NULL;
+		}
+	}
 	assert(kgem_bo_can_blt(kgem, dst));
 
 	kgem_set_mode(kgem, KGEM_BLT, dst);
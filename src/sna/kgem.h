@@ -52,6 +52,7 @@ struct kgem_bo {
 	struct list list;
 	struct list request;
 	struct list vma;
+	struct list lookup;
 
 	void *map__cpu;
 	void *map__gtt;
@@ -94,6 +95,9 @@ struct kgem_bo {
 	uint32_t scanout : 1;
 	uint32_t prime : 1;
 	uint32_t purged : 1;
+	uint32_t softpin : 1; /* presumed_offset is ours, see kgem->va */
+	uint32_t vma_type : 1; /* which kgem->vma[] list holds us */
+	uint32_t vma_stamp; /* last use of the cached mapping, for LRU */
 };
 #define DOMAIN_NONE 0
 #define DOMAIN_CPU 1
@@ -105,6 +109,30 @@ struct kgem_request {
 	struct kgem_bo *bo;
 	struct list buffers;
 	int ring;
+	uint8_t reason;
+	uint32_t submitted; /* usec, only for the latency statistics */
+	uint32_t seqno; /* order of commit, across all rings */
+};
+
+/* Why _kgem_submit() was called, recorded in kgem->stats.submit[] */
+/* Every kgem_check_*() resets the reason and sets it again only if it fails,
+ * so that a check which failed without a submit following does not
+ * mislabel a later, unrelated submit.
+ */
+enum kgem_submit_reason {
+	SUBMIT_OTHER = 0, /* explicit flush, or an untagged call site */
+	SUBMIT_BATCH, /* out of batch or surface space */
+	SUBMIT_EXEC, /* out of exec slots */
+	SUBMIT_RELOC, /* out of relocation slots */
+	SUBMIT_FENCE, /* out of fence registers or fenceable aperture */
+	SUBMIT_APERTURE, /* aperture_check() failed */
+	SUBMIT_OPPORTUNISTIC, /* kgem_flush(): ring idle with pending work */
+	SUBMIT_DEPENDENCY, /* semaphore or new reservation required */
+	SUBMIT_RING, /* context_switch() to another ring */
+	SUBMIT_IDLE, /* GPU idle, flushed from the block handler */
+	SUBMIT_SCANOUT, /* kgem_scanout_flush() */
+	SUBMIT_BO, /* kgem_bo_submit(): caller needs the bo results */
+	NUM_SUBMIT_REASONS
 };
 
 enum {
@@ -127,6 +155,7 @@ struct kgem {
 	uint16_t nreloc__self;
 	uint16_t nfence;
 	uint16_t batch_size;
+	uint8_t submit_reason;
 
 	uint32_t *batch;
 
@@ -143,6 +172,9 @@ struct kgem {
 	struct list large_inactive;
 	struct list active[NUM_CACHE_BUCKETS][3];
 	struct list inactive[NUM_CACHE_BUCKETS];
+	/* Reusable tiled bo, hashed by (bucket, tiling, pitch, active) */
+#define CACHE_INDEX_BITS 8
+	struct list cache_index[1 << CACHE_INDEX_BITS];
 	struct list pinned_batches[2];
 	struct list snoop;
 	struct list scanout;
@@ -153,10 +185,18 @@ struct kgem {
 	struct kgem_request *next_request;
 	struct kgem_request static_request;
 
+	/* Inactive bo that retain a mapping, indexed by the kind of map
+	 * for reuse but evicted in LRU order across all of them.
+	 */
 	struct {
 		struct list inactive[NUM_CACHE_BUCKETS];
-		int16_t count;
+		int count;
 	} vma[NUM_MAP_TYPES];
+	struct {
+		uint32_t count, max_count;
+		uint64_t bytes, max_bytes; /* of address space */
+		uint32_t clock;
+	} vma_cache;
 
 	uint32_t batch_flags;
 	uint32_t batch_flags_base;
@@ -186,7 +226,10 @@ struct kgem {
 	uint32_t has_wt :1;
 	uint32_t has_no_reloc :1;
 	uint32_t has_handle_lut :1;
+	uint32_t has_softpin :1;
+	uint32_t softpin_probed :1; /* a softpinned batch has been accepted */
 	uint32_t has_wc_mmap :1;
+	uint32_t async_submit :1;
 
 	uint32_t can_blt_cpu :1;
 	uint32_t can_render_y :1;
@@ -215,12 +258,124 @@ struct kgem {
 				    int16_t src_x, int16_t src_y,
 				    int16_t dst_x, int16_t dst_y,
 				    uint16_t width, uint16_t height);
+	void (*memcpy_to_tiled_y)(const void *src, void *dst, int bpp,
+				  int32_t src_stride, int32_t dst_stride,
+				  int16_t src_x, int16_t src_y,
+				  int16_t dst_x, int16_t dst_y,
+				  uint16_t width, uint16_t height);
+	void (*memcpy_from_tiled_y)(const void *src, void *dst, int bpp,
+				    int32_t src_stride, int32_t dst_stride,
+				    int16_t src_x, int16_t src_y,
+				    int16_t dst_x, int16_t dst_y,
+				    uint16_t width, uint16_t height);
+	/* As memcpy_to_tiled_x/y, but writing around the cache if possible */
+	void (*memcpy_to_tiled_x__nt)(const void *src, void *dst, int bpp,
+				      int32_t src_stride, int32_t dst_stride,
+				      int16_t src_x, int16_t src_y,
+				      int16_t dst_x, int16_t dst_y,
+				      uint16_t width, uint16_t height);
+	void (*memcpy_to_tiled_y__nt)(const void *src, void *dst, int bpp,
+				      int32_t src_stride, int32_t dst_stride,
+				      int16_t src_x, int16_t src_y,
+				      int16_t dst_x, int16_t dst_y,
+				      uint16_t width, uint16_t height);
+	void (*memcpy_xor_to_tiled_x)(const void *src, void *dst, int bpp,
+				      int32_t src_stride, int32_t dst_stride,
+				      int16_t src_x, int16_t src_y,
+				      int16_t dst_x, int16_t dst_y,
+				      uint16_t width, uint16_t height,
+				      uint32_t and, uint32_t or);
+	/* Bit-6 swizzling for each tiling mode, or -1 if unknown */
+	int8_t swizzling[3];
 
 	struct kgem_bo *batch_bo;
 
 	uint16_t reloc__self[256];
-	struct drm_i915_gem_exec_object2 exec[384] page_aligned;
-	struct drm_i915_gem_relocation_entry reloc[8192] page_aligned;
+
+	/* exec[] and reloc[] start out pointing at the inline arrays and
+	 * are doubled on demand, up to max_exec/max_reloc entries, rather
+	 * than forcing a submit whilst the batch still has room.
+	 */
+	struct drm_i915_gem_exec_object2 *exec;
+	struct drm_i915_gem_relocation_entry *reloc;
+	uint16_t size_exec, size_reloc;
+	uint16_t max_exec, max_reloc;
+	/* With AsyncSubmit, the pair swapped in whilst the submission
+	 * thread owns the other.
+	 */
+	struct drm_i915_gem_exec_object2 *exec__spare;
+	struct drm_i915_gem_relocation_entry *reloc__spare;
+	uint16_t size_exec__spare, size_reloc__spare;
+	struct drm_i915_gem_exec_object2 exec__inline[384] page_aligned;
+	struct drm_i915_gem_relocation_entry reloc__inline[8192] page_aligned;
+
+	/* With softpin, every bo is assigned a fixed address in our ppgtt
+	 * when it is first added to a batch, and keeps it until freed.
+	 * The free ranges are kept sorted by address.
+	 */
+	struct kgem_va {
+		struct list holes;
+		uint64_t cursor;
+		uint64_t used;
+	} va;
+
+	/* Upper bound on the idle caches, 0 for none, and the PSI file
+	 * used to shrink them further under memory pressure.
+	 */
+	uint64_t cache_budget;
+	int pressure_fd;
+	unsigned pressure_threshold;
+
+	int capture_fd; /* trace of every batch submitted, or -1 */
+
+	/* Optional ring that small uploads are sub-allocated from */
+	struct kgem_upload_ring *upload;
+	uint32_t seqno; /* of the last request committed */
+
+	/* Freed bo waiting to be closed and unmapped, see kgem_reap() */
+	struct {
+		struct kgem_reap *entries;
+		unsigned head, count, size;
+	} reap;
+
+	/* Always compiled; plain increments on paths we already take */
+#define KGEM_STATS_HIST 16
+	struct kgem_stats {
+		uint64_t hits; /* exact tiling and pitch, from the index */
+		uint64_t retiles; /* reused after changing tiling or pitch */
+		uint64_t misses; /* nothing suitable, allocated a new bo */
+
+		uint64_t bo_allocs, bo_frees;
+		uint64_t bo_bytes, bo_bytes_max; /* live, and its high-water */
+
+		uint64_t expire_runs;
+		uint64_t expired, expired_bytes; /* reclaimed from inactive */
+		uint64_t snoop_expired, snoop_expired_bytes;
+
+		uint64_t batches[4]; /* indexed by kgem_mode */
+		uint32_t batch_hist[KGEM_STATS_HIST]; /* log2 dwords emitted */
+		uint32_t aperture_max; /* pages referenced by one batch */
+		uint16_t nexec_max, nreloc_max;
+		uint64_t norelocs; /* batches with every bo softpinned */
+		uint64_t async; /* batches handed to the submission thread */
+		uint64_t async_stalls, async_stall_us; /* waits for it */
+		uint64_t reap_queued, reaped; /* deferred gem_close */
+		uint64_t reap_runs, reap_us;
+		uint32_t reap_depth_max, reap_us_max;
+		uint64_t trim_runs, trimmed, trimmed_bytes; /* over budget */
+		uint64_t pressure_trims; /* passes that found PSI stalls */
+		uint64_t upload_allocs, upload_bytes; /* from the upload ring */
+		uint64_t upload_full, upload_released;
+		uint64_t mmaps, munmaps; /* mappings created and evicted */
+		uint64_t map_hits; /* mmap avoided, the bo was still mapped */
+		uint64_t vma_reused; /* munmap avoided, reused while mapped */
+
+		struct {
+			uint64_t count;
+			uint64_t fill; /* sum of per-mille batch usage */
+			uint32_t latency[KGEM_STATS_HIST]; /* log2 usec to retire */
+		} submit[NUM_SUBMIT_REASONS];
+	} stats;
 
 #ifdef DEBUG_MEMORY
 	struct {
@@ -241,11 +396,24 @@ struct kgem {
 #endif
 
 #define KGEM_BATCH_SIZE(K) ((K)->batch_size-KGEM_BATCH_RESERVED)
-#define KGEM_EXEC_SIZE(K) (int)(ARRAY_SIZE((K)->exec)-KGEM_EXEC_RESERVED)
-#define KGEM_RELOC_SIZE(K) (int)(ARRAY_SIZE((K)->reloc)-KGEM_RELOC_RESERVED)
+#define KGEM_EXEC_SIZE(K) (int)((K)->size_exec-KGEM_EXEC_RESERVED)
+#define KGEM_RELOC_SIZE(K) (int)((K)->size_reloc-KGEM_RELOC_RESERVED)
 
 void kgem_init(struct kgem *kgem, int fd, struct pci_device *dev, unsigned gen);
 void kgem_reset(struct kgem *kgem);
+void kgem_set_batch_limits(struct kgem *kgem, int max_exec, int max_reloc);
+bool __kgem_grow_exec(struct kgem *kgem, int n);
+bool __kgem_grow_reloc(struct kgem *kgem, int n);
+bool kgem_init_submit_thread(struct kgem *kgem);
+void kgem_fini_submit_thread(struct kgem *kgem);
+void kgem_submit_wait(struct kgem *kgem);
+bool kgem_reap(struct kgem *kgem, unsigned budget_us);
+bool kgem_set_cache_budget(struct kgem *kgem, uint64_t size, unsigned percent);
+bool kgem_init_pressure(struct kgem *kgem, unsigned threshold);
+void kgem_fini_pressure(struct kgem *kgem);
+bool kgem_init_upload_ring(struct kgem *kgem, uint32_t size);
+bool kgem_init_capture(struct kgem *kgem, const char *path);
+void kgem_fini_capture(struct kgem *kgem);
 
 struct kgem_bo *kgem_create_map(struct kgem *kgem,
 				void *ptr, uint32_t size,
@@ -290,6 +458,13 @@ kgem_replace_bo(struct kgem *kgem,
 		uint32_t height,
 		uint32_t pitch,
 		uint32_t bpp);
+bool kgem_prefer_retile__cpu(struct kgem *kgem, struct kgem_bo *src);
+bool kgem_bo_retile__cpu(struct kgem *kgem,
+			 struct kgem_bo *src,
+			 struct kgem_bo *dst,
+			 uint32_t width,
+			 uint32_t height,
+			 uint32_t bpp);
 enum {
 	CREATE_EXACT = 0x1,
 	CREATE_INACTIVE = 0x2,
@@ -381,6 +556,7 @@ static inline void kgem_bo_submit(struct kgem *kgem, struct kgem_bo *bo)
 		return;
 
 	assert(bo->refcnt);
+	kgem->submit_reason = SUBMIT_BO;
 	_kgem_submit(kgem);
 }
 
@@ -415,13 +591,16 @@ static inline void kgem_set_mode(struct kgem *kgem,
 
 	if (kgem->nreloc && bo->exec == NULL && kgem_ring_is_idle(kgem, kgem->ring)) {
 		DBG(("%s: flushing before new bo\n", __FUNCTION__));
+		kgem->submit_reason = SUBMIT_DEPENDENCY;
 		_kgem_submit(kgem);
 	}
 
 	if (kgem->mode == mode)
 		return;
 
+	kgem->submit_reason = SUBMIT_RING;
 	kgem->context_switch(kgem, mode);
+	kgem->submit_reason = SUBMIT_OTHER;
 	kgem->mode = mode;
 }
 
@@ -446,19 +625,56 @@ static inline bool kgem_check_batch(struct kgem *kgem, int num_dwords)
 	assert(num_dwords > 0);
 	assert(kgem->nbatch < kgem->surface);
 	assert(kgem->surface <= kgem->batch_size);
-	return likely(kgem->nbatch + num_dwords + KGEM_BATCH_RESERVED <= kgem->surface);
+	kgem->submit_reason = SUBMIT_OTHER;
+	if (likely(kgem->nbatch + num_dwords + KGEM_BATCH_RESERVED <= kgem->surface))
+		return true;
+
+	kgem->submit_reason = SUBMIT_BATCH;
+	return false;
 }
 
 static inline bool kgem_check_reloc(struct kgem *kgem, int n)
 {
 	assert(kgem->nreloc <= KGEM_RELOC_SIZE(kgem));
-	return likely(kgem->nreloc + n <= KGEM_RELOC_SIZE(kgem));
+	kgem->submit_reason = SUBMIT_OTHER;
+	if (likely(kgem->nreloc + n <= KGEM_RELOC_SIZE(kgem)))
+		return true;
+
+	if (__kgem_grow_reloc(kgem, n))
+		return true;
+
+	kgem->submit_reason = SUBMIT_RELOC;
+	return false;
+}
+
+/* Room for up to n more relocations, growing reloc[] if allowed */
+static inline int kgem_reloc_space(struct kgem *kgem, int n)
+{
+	int rem = KGEM_RELOC_SIZE(kgem) - kgem->nreloc;
+
+	if (n > rem) {
+		int max = kgem->max_reloc - KGEM_RELOC_RESERVED - kgem->nreloc;
+		if (n > max)
+			n = max;
+		if (n > rem && __kgem_grow_reloc(kgem, n))
+			rem = KGEM_RELOC_SIZE(kgem) - kgem->nreloc;
+	}
+
+	return rem;
 }
 
 static inline bool kgem_check_exec(struct kgem *kgem, int n)
 {
 	assert(kgem->nexec <= KGEM_EXEC_SIZE(kgem));
-	return likely(kgem->nexec + n <= KGEM_EXEC_SIZE(kgem));
+	kgem->submit_reason = SUBMIT_OTHER;
+	if (likely(kgem->nexec + n <= KGEM_EXEC_SIZE(kgem)))
+		return true;
+
+	if (__kgem_grow_exec(kgem, n))
+		return true;
+
+	kgem->submit_reason = SUBMIT_EXEC;
+	return false;
 }
 
 static inline bool kgem_check_reloc_and_exec(struct kgem *kgem, int n)
@@ -470,8 +686,12 @@ static inline bool kgem_check_batch_with_surfaces(struct kgem *kgem,
 						  int num_dwords,
 						  int num_surfaces)
 {
-	return (int)(kgem->nbatch + num_dwords + KGEM_BATCH_RESERVED) <= (int)(kgem->surface - num_surfaces*8) &&
-		kgem_check_reloc(kgem, num_surfaces) &&
+	if ((int)(kgem->nbatch + num_dwords + KGEM_BATCH_RESERVED) > (int)(kgem->surface - num_surfaces*8)) {
+		kgem->submit_reason = SUBMIT_BATCH;
+		return false;
+	}
+
+	return kgem_check_reloc(kgem, num_surfaces) &&
 		kgem_check_exec(kgem, num_surfaces);
 }
 
@@ -815,6 +1035,7 @@ bool kgem_cleanup_cache(struct kgem *kgem);
 
 void kgem_clean_scanout_cache(struct kgem *kgem);
 void kgem_clean_large_cache(struct kgem *kgem);
+void kgem_dump_stats(struct kgem *kgem);
 
 #if HAS_DEBUG_FULL
 void __kgem_batch_debug(struct kgem *kgem, uint32_t nbatch);
@@ -866,6 +1087,104 @@ memcpy_from_tiled_x(struct kgem *kgem,
 					 width, height);
 }
 
-void choose_memcpy_tiled_x(struct kgem *kgem, int swizzling);
+static inline void
+memcpy_to_tiled_y(struct kgem *kgem,
+		  const void *src, void *dst, int bpp,
+		  int32_t src_stride, int32_t dst_stride,
+		  int16_t src_x, int16_t src_y,
+		  int16_t dst_x, int16_t dst_y,
+		  uint16_t width, uint16_t height)
+{
+	assert(kgem->memcpy_to_tiled_y);
+	assert(src_x >= 0 && src_y >= 0);
+	assert(dst_x >= 0 && dst_y >= 0);
+	assert(8*src_stride >= (src_x+width) * bpp);
+	assert(8*dst_stride >= (dst_x+width) * bpp);
+	return kgem->memcpy_to_tiled_y(src, dst, bpp,
+				       src_stride, dst_stride,
+				       src_x, src_y,
+				       dst_x, dst_y,
+				       width, height);
+}
+
+static inline void
+memcpy_from_tiled_y(struct kgem *kgem,
+		    const void *src, void *dst, int bpp,
+		    int32_t src_stride, int32_t dst_stride,
+		    int16_t src_x, int16_t src_y,
+		    int16_t dst_x, int16_t dst_y,
+		    uint16_t width, uint16_t height)
+{
+	assert(kgem->memcpy_from_tiled_y);
+	assert(src_x >= 0 && src_y >= 0);
+	assert(dst_x >= 0 && dst_y >= 0);
+	assert(8*src_stride >= (src_x+width) * bpp);
+	assert(8*dst_stride >= (dst_x+width) * bpp);
+	return kgem->memcpy_from_tiled_y(src, dst, bpp,
+					 src_stride, dst_stride,
+					 src_x, src_y,
+					 dst_x, dst_y,
+					 width, height);
+}
+
+static inline void
+memcpy_xor_to_tiled_x(struct kgem *kgem,
+		      const void *src, void *dst, int bpp,
+		      int32_t src_stride, int32_t dst_stride,
+		      int16_t src_x, int16_t src_y,
+		      int16_t dst_x, int16_t dst_y,
+		      uint16_t width, uint16_t height,
+		      uint32_t and, uint32_t or)
+{
+	assert(kgem->memcpy_xor_to_tiled_x);
+	assert(src_x >= 0 && src_y >= 0);
+	assert(dst_x >= 0 && dst_y >= 0);
+	assert(8*src_stride >= (src_x+width) * bpp);
+	assert(8*dst_stride >= (dst_x+width) * bpp);
+	return kgem->memcpy_xor_to_tiled_x(src, dst, bpp,
+					   src_stride, dst_stride,
+					   src_x, src_y,
+					   dst_x, dst_y,
+					   width, height,
+					   and, or);
+}
+
+void memcpy_retile(const void *src, void *dst, int bpp,
+		   int src_tiling, int src_swizzling, int32_t src_stride,
+		   int dst_tiling, int dst_swizzling, int32_t dst_stride,
+		   int16_t src_x, int16_t src_y,
+		   int16_t dst_x, int16_t dst_y,
+		   uint16_t width, uint16_t height);
+
+static inline bool kgem_can_retile(struct kgem *kgem, int tiling)
+{
+	return kgem->swizzling[tiling] >= 0;
+}
+
+static inline void
+memcpy_between_tiled(struct kgem *kgem,
+		     const void *src, void *dst, int bpp,
+		     int src_tiling, int dst_tiling,
+		     int32_t src_stride, int32_t dst_stride,
+		     int16_t src_x, int16_t src_y,
+		     int16_t dst_x, int16_t dst_y,
+		     uint16_t width, uint16_t height)
+{
+	assert(kgem_can_retile(kgem, src_tiling));
+	assert(kgem_can_retile(kgem, dst_tiling));
+	assert(src_x >= 0 && src_y >= 0);
+	assert(dst_x >= 0 && dst_y >= 0);
+	assert(8*src_stride >= (src_x+width) * bpp);
+	assert(8*dst_stride >= (dst_x+width) * bpp);
+	return memcpy_retile(src, dst, bpp,
+			     src_tiling, kgem->swizzling[src_tiling], src_stride,
+			     dst_tiling, kgem->swizzling[dst_tiling], dst_stride,
+			     src_x, src_y,
+			     dst_x, dst_y,
+			     width, height);
+}
+
+void choose_memcpy_tiled_x(struct kgem *kgem, int swizzling, unsigned cpu);
+void choose_memcpy_tiled_y(struct kgem *kgem, int swizzling);
 
 #endif /* KGEM_H */
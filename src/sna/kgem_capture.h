@@ -0,0 +1,73 @@
+/*
+ * Copyright © 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef KGEM_CAPTURE_H
+#define KGEM_CAPTURE_H
+
+#include <stdint.h>
+
+/* With Option "BatchCapture", every batch is appended to a trace file
+ * just before it is submitted. The trace is in host byte order:
+ *
+ *   struct kgem_capture_header
+ *   for each batch:
+ *     struct kgem_capture_batch
+ *     uint32_t commands[nbatch]
+ *     uint32_t state[batch_size - surface]   (the top of the batch)
+ *     struct kgem_capture_exec exec[nexec]   (excluding the batch)
+ *     struct drm_i915_gem_relocation_entry reloc[nreloc]
+ *
+ * and is decoded offline by batch-decode, see batch_decode.c.
+ */
+
+#define KGEM_CAPTURE_MAGIC 0x424e5321 /* "!SNB" */
+#define KGEM_CAPTURE_VERSION 1
+
+struct kgem_capture_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t gen;
+	uint32_t flags;
+#define KGEM_CAPTURE_HANDLE_LUT 0x1
+};
+
+struct kgem_capture_batch {
+	uint64_t timestamp; /* usec, CLOCK_MONOTONIC */
+	uint32_t nbatch; /* dwords of commands */
+	uint32_t surface, batch_size; /* dwords, state fills the gap */
+	uint32_t nexec, nreloc;
+	uint32_t batch_flags;
+	uint8_t ring, mode, reason, pad;
+};
+
+struct kgem_capture_exec {
+	uint32_t handle;
+	uint32_t target_handle;
+	uint32_t size; /* bytes */
+	uint32_t pitch;
+	uint32_t flags; /* as passed to execbuffer */
+	uint32_t tiling;
+};
+
+#endif /* KGEM_CAPTURE_H */
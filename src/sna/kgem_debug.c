@@ -95,6 +95,15 @@ static int kgem_debug_handle_tiling(struct kgem *kgem, uint32_t handle)
 	return 0;
 }
 
+/* The first line printed for the packet being decoded, and an optional
+ * callback for each packet for tools that want more than the text, see
+ * batch_decode.c.
+ */
+static char kgem_debug_name[80];
+void (*kgem_debug_packet)(struct kgem *kgem,
+			  uint32_t offset, int len,
+			  const char *name);
+
 void
 kgem_debug_print(const uint32_t *data,
 		 uint32_t offset, unsigned int index,
@@ -114,6 +123,10 @@ kgem_debug_print(const uint32_t *data,
 	vsnprintf(buf + len, sizeof(buf) - len, fmt, va);
 	va_end(va);
 
+	if (index == 0 && kgem_debug_name[0] == '\0')
+		snprintf(kgem_debug_name, sizeof(kgem_debug_name),
+			 "%s", buf + len);
+
 	ErrorF("%s", buf);
 }
 
@@ -610,8 +623,14 @@ void __kgem_batch_debug(struct kgem *kgem, uint32_t nbatch)
 
 	while (offset < nbatch) {
 		int class = (kgem->batch[offset] & 0xe0000000) >> 29;
+		int len;
+
 		assert(class < ARRAY_SIZE(decode));
-		offset += decode[class](kgem, offset);
+		kgem_debug_name[0] = '\0';
+		len = decode[class](kgem, offset);
+		if (kgem_debug_packet)
+			kgem_debug_packet(kgem, offset, len, kgem_debug_name);
+		offset += len;
 	}
 
 	finish_state(kgem->gen)(kgem);
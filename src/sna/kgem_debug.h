@@ -6,6 +6,10 @@ kgem_debug_print(const uint32_t *data,
 		 uint32_t offset, unsigned int index,
 		 const char *fmt, ...);
 
+extern void (*kgem_debug_packet)(struct kgem *kgem,
+				 uint32_t offset, int len,
+				 const char *name);
+
 struct drm_i915_gem_relocation_entry *
 kgem_debug_get_reloc_entry(struct kgem *kgem, uint32_t offset);
 
@@ -0,0 +1,800 @@
+/*
+ * Copyright © 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/* A software implementation of the i915 GEM ioctls used by kgem.
+ *
+ * This is not built into the driver. kgem_fake_open() returns a stand-in
+ * device fd whose ioctls are served by kgem_fake_ioctl(), so that tools
+ * can exercise the GEM interface without a GPU; see kgem_fake_test.c.
+ * Nothing is ever executed: an execbuffer applies its relocations and then
+ * just marks its objects busy for a simulated amount of time on the
+ * chosen ring.
+ *
+ * Objects are backed by ranges of a single memfd, which doubles as the fake
+ * device fd so that kgem can mmap() its GTT offsets directly.
+ *
+ * kgem_fake_open() takes an optional comma separated list of options:
+ *   latency=<us>   GPU time consumed by each batch (default 50)
+ *   aperture=<MiB> reported GTT size (default 256)
+ *   llc=<0|1>      report a shared last-level cache (default 1)
+ *   wc=<0|1>       support write-combining mmaps (default 1)
+ *   userptr=<0|1>  support userptr objects (default 1)
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "sna.h"
+#include "kgem_fake.h"
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <linux/falloc.h>
+#endif
+
+#define FAKE_PAGE_SIZE 4096
+
+#define LOCAL_I915_PARAM_HAS_BLT		11
+#define LOCAL_I915_PARAM_HAS_RELAXED_FENCING	12
+#define LOCAL_I915_PARAM_HAS_RELAXED_DELTA	15
+#define LOCAL_I915_PARAM_HAS_LLC		17
+#define LOCAL_I915_PARAM_HAS_SEMAPHORES		20
+#define LOCAL_I915_PARAM_HAS_SECURE_BATCHES	23
+#define LOCAL_I915_PARAM_HAS_PINNED_BATCHES	24
+#define LOCAL_I915_PARAM_HAS_NO_RELOC		25
+#define LOCAL_I915_PARAM_HAS_HANDLE_LUT		26
+#define LOCAL_I915_PARAM_HAS_WT			27
+#define LOCAL_I915_PARAM_MMAP_VERSION		30
+
+#define LOCAL_I915_EXEC_NO_RELOC		(1<<11)
+#define LOCAL_I915_EXEC_HANDLE_LUT		(1<<12)
+
+#define LOCAL_I915_GEM_USERPTR		0x33
+#define LOCAL_I915_GEM_CREATE2		0x34
+#define LOCAL_I915_GEM_SET_CACHING	0x2f
+#define LOCAL_I915_GEM_GET_CACHING	0x30
+
+struct local_i915_gem_create2 {
+	uint64_t size;
+	uint32_t placement;
+	uint32_t domain;
+	uint32_t caching;
+	uint32_t tiling_mode;
+	uint32_t stride;
+	uint32_t flags;
+	uint32_t pad;
+	uint32_t handle;
+};
+
+struct local_i915_gem_userptr {
+	uint64_t user_ptr;
+	uint64_t user_size;
+	uint32_t flags;
+	uint32_t handle;
+};
+
+struct local_i915_gem_caching {
+	uint32_t handle;
+	uint32_t caching;
+};
+
+struct local_i915_gem_mmap2 {
+	uint32_t handle;
+	uint32_t pad;
+	uint64_t offset;
+	uint64_t size;
+	uint64_t addr_ptr;
+	uint64_t flags;
+#define I915_MMAP_WC 0x1
+};
+
+struct local_i915_gem_get_tiling_v2 {
+	uint32_t handle;
+	uint32_t tiling_mode;
+	uint32_t swizzle_mode;
+	uint32_t phys_swizzle_mode;
+};
+
+#define GEM_NR(x) (DRM_COMMAND_BASE + (x))
+
+struct fake_object {
+	uint64_t offset; /* into the memfd, and our fake GTT address */
+	uint64_t size;
+	void *userptr;
+	unsigned *shared; /* handles onto this range, see GEM_OPEN */
+	uint64_t busy_until;
+	uint32_t tiling, stride, caching;
+	uint32_t madv;
+	int ring;
+	bool used;
+};
+
+static struct fake_gem {
+	pthread_mutex_t lock;
+	int fd;
+	unsigned gen;
+
+	struct fake_object *objects;
+	uint32_t num_objects, max_objects;
+	uint32_t free_handle;
+
+	uint64_t next_offset, file_size;
+	uint64_t ring_tail[3];
+
+	uint64_t latency;
+	uint64_t aperture;
+	bool has_llc, has_wc, has_userptr;
+} fake = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.fd = -1,
+};
+
+static uint64_t fake_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void fake_sleep_until(uint64_t when)
+{
+	uint64_t now = fake_now();
+	struct timespec ts;
+
+	if (when <= now)
+		return;
+
+	when -= now;
+	ts.tv_sec = when / 1000000000;
+	ts.tv_nsec = when % 1000000000;
+	nanosleep(&ts, NULL);
+}
+
+static int fake_memfd(void)
+{
+	char path[] = "/tmp/sna-fake-gem-XXXXXX";
+	int fd;
+
+#ifdef __NR_memfd_create
+	fd = syscall(__NR_memfd_create, "sna-fake-gem", 1 /* MFD_CLOEXEC */);
+	if (fd != -1)
+		return fd;
+#endif
+
+	fd = mkstemp(path);
+	if (fd != -1) {
+		unlink(path);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+	return fd;
+}
+
+static struct fake_object *fake_lookup(uint32_t handle)
+{
+	if (handle == 0 || handle > fake.num_objects)
+		return NULL;
+
+	if (!fake.objects[handle-1].used)
+		return NULL;
+
+	return &fake.objects[handle-1];
+}
+
+static uint32_t fake_alloc_handle(void)
+{
+	uint32_t handle;
+
+	if (fake.free_handle) {
+		handle = fake.free_handle;
+		fake.free_handle = fake.objects[handle-1].offset;
+	} else {
+		if (fake.num_objects == fake.max_objects) {
+			unsigned max = fake.max_objects ? 2*fake.max_objects : 1024;
+			void *ptr;
+
+			ptr = realloc(fake.objects, max*sizeof(struct fake_object));
+			if (ptr == NULL)
+				return 0;
+
+			fake.objects = ptr;
+			fake.max_objects = max;
+		}
+		handle = ++fake.num_objects;
+	}
+
+	memset(&fake.objects[handle-1], 0, sizeof(struct fake_object));
+	fake.objects[handle-1].used = true;
+	fake.objects[handle-1].caching = fake.has_llc;
+	return handle;
+}
+
+static void fake_free_handle(uint32_t handle)
+{
+	struct fake_object *obj = &fake.objects[handle-1];
+
+	if (obj->shared == NULL || --*obj->shared == 0) {
+		free(obj->shared);
+#ifdef FALLOC_FL_PUNCH_HOLE
+		/* Give the pages back, the range itself is never reused */
+		if (obj->userptr == NULL)
+			(void)fallocate(fake.fd,
+					FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+					obj->offset, obj->size);
+#endif
+	}
+
+	obj->used = false;
+	obj->offset = fake.free_handle;
+	fake.free_handle = handle;
+}
+
+static int fake_create(uint64_t size, uint32_t *handle)
+{
+	struct fake_object *obj;
+	uint64_t end;
+
+	if (size == 0)
+		return -EINVAL;
+
+	size = ALIGN(size, FAKE_PAGE_SIZE);
+	end = fake.next_offset + size;
+	if (end > fake.file_size) {
+		uint64_t grow = MAX(2*fake.file_size, end);
+
+		if (ftruncate(fake.fd, grow))
+			return -ENOMEM;
+
+		fake.file_size = grow;
+	}
+
+	*handle = fake_alloc_handle();
+	if (*handle == 0)
+		return -ENOMEM;
+
+	obj = &fake.objects[*handle-1];
+	obj->offset = fake.next_offset;
+	obj->size = size;
+	fake.next_offset = end;
+
+	DBG(("%s: handle=%d, size=%lld, offset=%llx\n", __FUNCTION__,
+	     *handle, (long long)size, (long long)obj->offset));
+	return 0;
+}
+
+static int fake_rw(struct fake_object *obj, uint64_t offset,
+		   void *data, uint64_t len, bool write)
+{
+	ssize_t ret;
+
+	if (offset > obj->size || len > obj->size - offset)
+		return -EINVAL;
+
+	if (obj->userptr) {
+		if (write)
+			memcpy((char *)obj->userptr + offset, data, len);
+		else
+			memcpy(data, (char *)obj->userptr + offset, len);
+		return 0;
+	}
+
+	if (write)
+		ret = pwrite(fake.fd, data, len, obj->offset + offset);
+	else
+		ret = pread(fake.fd, data, len, obj->offset + offset);
+	return ret == (ssize_t)len ? 0 : -EFAULT;
+}
+
+static int fake_mmap(struct fake_object *obj,
+		     uint64_t offset, uint64_t size,
+		     uint64_t *addr_ptr)
+{
+	void *ptr;
+
+	if (obj->userptr)
+		return -EINVAL;
+
+	if (offset > obj->size || size > obj->size - offset)
+		return -EINVAL;
+
+	ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fake.fd, obj->offset + offset);
+	if (ptr == MAP_FAILED)
+		return -errno;
+
+	*addr_ptr = (uintptr_t)ptr;
+	return 0;
+}
+
+static int fake_ring(uint64_t flags)
+{
+	switch (flags & I915_EXEC_RING_MASK) {
+	case I915_EXEC_BSD: return 1;
+	case I915_EXEC_BLT: return 2;
+	default: return 0;
+	}
+}
+
+static int fake_execbuffer2(struct drm_i915_gem_execbuffer2 *execbuf)
+{
+	struct drm_i915_gem_exec_object2 *exec;
+	uint64_t done;
+	unsigned i, j;
+	int ring;
+
+	if (execbuf->buffer_count == 0)
+		return -EINVAL;
+
+	if (execbuf->buffers_ptr == 0)
+		return -EFAULT;
+
+	exec = (struct drm_i915_gem_exec_object2 *)(uintptr_t)execbuf->buffers_ptr;
+	for (i = 0; i < execbuf->buffer_count; i++) {
+		if (fake_lookup(exec[i].handle) == NULL)
+			return -ENOENT;
+	}
+
+	for (i = 0; i < execbuf->buffer_count; i++) {
+		struct drm_i915_gem_relocation_entry *reloc =
+			(struct drm_i915_gem_relocation_entry *)(uintptr_t)exec[i].relocs_ptr;
+		struct fake_object *obj = fake_lookup(exec[i].handle);
+
+		for (j = 0; j < exec[i].relocation_count; j++) {
+			struct fake_object *target;
+			uint64_t value;
+			int ret;
+
+			if (execbuf->flags & LOCAL_I915_EXEC_HANDLE_LUT) {
+				if (reloc[j].target_handle >= execbuf->buffer_count)
+					return -EINVAL;
+				target = fake_lookup(exec[reloc[j].target_handle].handle);
+			} else
+				target = fake_lookup(reloc[j].target_handle);
+			if (target == NULL)
+				return -ENOENT;
+
+			if (execbuf->flags & LOCAL_I915_EXEC_NO_RELOC &&
+			    reloc[j].presumed_offset == target->offset)
+				continue;
+
+			value = target->offset + (int32_t)reloc[j].delta;
+			ret = fake_rw(obj, reloc[j].offset, &value,
+				      fake.gen >= 0100 ? 8 : 4, true);
+			if (ret)
+				return ret;
+
+			reloc[j].presumed_offset = target->offset;
+		}
+	}
+
+	ring = fake_ring(execbuf->flags);
+	done = MAX(fake.ring_tail[ring], fake_now()) + fake.latency;
+	fake.ring_tail[ring] = done;
+
+	for (i = 0; i < execbuf->buffer_count; i++) {
+		struct fake_object *obj = fake_lookup(exec[i].handle);
+
+		obj->busy_until = done;
+		obj->ring = ring;
+		exec[i].offset = obj->offset;
+	}
+
+	DBG(("%s: %d buffers on ring %d, idle in %lldus\n", __FUNCTION__,
+	     execbuf->buffer_count, ring,
+	     (long long)(done - fake_now()) / 1000));
+	return 0;
+}
+
+static int fake_getparam(drm_i915_getparam_t *gp)
+{
+	int v;
+
+	switch (gp->param) {
+	case LOCAL_I915_PARAM_HAS_BLT:
+	case LOCAL_I915_PARAM_HAS_RELAXED_FENCING:
+	case LOCAL_I915_PARAM_HAS_RELAXED_DELTA:
+	case LOCAL_I915_PARAM_HAS_NO_RELOC:
+	case LOCAL_I915_PARAM_HAS_HANDLE_LUT:
+		v = 1;
+		break;
+	case LOCAL_I915_PARAM_HAS_LLC:
+		v = fake.has_llc;
+		break;
+	case LOCAL_I915_PARAM_MMAP_VERSION:
+		v = fake.has_wc;
+		break;
+	case LOCAL_I915_PARAM_HAS_SEMAPHORES:
+	case LOCAL_I915_PARAM_HAS_SECURE_BATCHES:
+	case LOCAL_I915_PARAM_HAS_PINNED_BATCHES:
+	case LOCAL_I915_PARAM_HAS_WT:
+		v = 0;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	*gp->value = v;
+	return 0;
+}
+
+static int fake_ioctl(unsigned long req, void *arg)
+{
+	struct fake_object *obj;
+
+	switch (_IOC_NR(req)) {
+	case _IOC_NR(DRM_IOCTL_GEM_CLOSE): {
+		struct drm_gem_close *close = arg;
+		if (fake_lookup(close->handle) == NULL)
+			return -ENOENT;
+		fake_free_handle(close->handle);
+		return 0;
+	}
+
+	case _IOC_NR(DRM_IOCTL_GEM_FLINK): {
+		struct drm_gem_flink *flink = arg;
+		if (fake_lookup(flink->handle) == NULL)
+			return -ENOENT;
+		flink->name = flink->handle;
+		return 0;
+	}
+
+	case _IOC_NR(DRM_IOCTL_GEM_OPEN): {
+		struct drm_gem_open *open_arg = arg;
+		uint32_t handle;
+
+		if (fake_lookup(open_arg->name) == NULL)
+			return -ENOENT;
+
+		/* As with the kernel, every open is a new handle, which
+		 * shares the pages of the original until both are closed.
+		 */
+		if (fake.objects[open_arg->name-1].shared == NULL) {
+			unsigned *shared = malloc(sizeof(*shared));
+			if (shared == NULL)
+				return -ENOMEM;
+			*shared = 1;
+			fake.objects[open_arg->name-1].shared = shared;
+		}
+
+		handle = fake_alloc_handle();
+		if (handle == 0)
+			return -ENOMEM;
+
+		/* fake_alloc_handle() may have moved the array */
+		obj = &fake.objects[handle-1];
+		*obj = fake.objects[open_arg->name-1];
+		obj->busy_until = 0;
+		++*obj->shared;
+
+		open_arg->handle = handle;
+		open_arg->size = obj->size;
+		return 0;
+	}
+
+	case _IOC_NR(DRM_IOCTL_PRIME_HANDLE_TO_FD): {
+		/* Each export is a new open of the memfd, so that it has
+		 * its own file position in which to remember the handle.
+		 */
+		struct drm_prime_handle *prime = arg;
+		char path[80];
+		int fd;
+
+		if (fake_lookup(prime->handle) == NULL)
+			return -ENOENT;
+
+		sprintf(path, "/proc/self/fd/%d", fake.fd);
+		fd = open(path, O_RDWR | O_CLOEXEC);
+		if (fd == -1)
+			return -errno;
+
+		if (lseek(fd, prime->handle, SEEK_SET) < 0) {
+			close(fd);
+			return -errno;
+		}
+
+		prime->fd = fd;
+		return 0;
+	}
+
+	case _IOC_NR(DRM_IOCTL_PRIME_FD_TO_HANDLE): {
+		struct drm_prime_handle *prime = arg;
+		struct stat a, b;
+		off_t handle;
+
+		if (fstat(prime->fd, &a) || fstat(fake.fd, &b) ||
+		    a.st_ino != b.st_ino || a.st_dev != b.st_dev)
+			return -EINVAL;
+
+		handle = lseek(prime->fd, 0, SEEK_CUR);
+		if (handle <= 0 || fake_lookup(handle) == NULL)
+			return -ENOENT;
+
+		prime->handle = handle;
+		return 0;
+	}
+
+	case GEM_NR(DRM_I915_GETPARAM):
+		return fake_getparam(arg);
+
+	case GEM_NR(DRM_I915_GEM_CREATE): {
+		struct drm_i915_gem_create *create = arg;
+		return fake_create(create->size, &create->handle);
+	}
+
+	case GEM_NR(LOCAL_I915_GEM_CREATE2): {
+		struct local_i915_gem_create2 *create = arg;
+		int ret;
+
+		if (create->placement != 0)
+			return -EINVAL;
+
+		ret = fake_create(create->size, &create->handle);
+		if (ret == 0) {
+			obj = fake_lookup(create->handle);
+			obj->caching = create->caching;
+			obj->tiling = create->tiling_mode;
+			obj->stride = create->stride;
+		}
+		return ret;
+	}
+
+	case GEM_NR(LOCAL_I915_GEM_USERPTR): {
+		struct local_i915_gem_userptr *userptr = arg;
+
+		if (!fake.has_userptr)
+			return -ENODEV;
+
+		if (userptr->user_ptr & (FAKE_PAGE_SIZE - 1) ||
+		    userptr->user_size & (FAKE_PAGE_SIZE - 1))
+			return -EINVAL;
+
+		userptr->handle = fake_alloc_handle();
+		if (userptr->handle == 0)
+			return -ENOMEM;
+
+		obj = fake_lookup(userptr->handle);
+		obj->userptr = (void *)(uintptr_t)userptr->user_ptr;
+		obj->size = userptr->user_size;
+		obj->offset = fake.next_offset;
+		obj->caching = 1;
+		fake.next_offset += obj->size;
+		return 0;
+	}
+
+	case GEM_NR(DRM_I915_GEM_PWRITE):
+	case GEM_NR(DRM_I915_GEM_PREAD): {
+		struct drm_i915_gem_pwrite *rw = arg;
+		if ((obj = fake_lookup(rw->handle)) == NULL)
+			return -ENOENT;
+		fake_sleep_until(obj->busy_until);
+		return fake_rw(obj, rw->offset,
+			       (void *)(uintptr_t)rw->data_ptr, rw->size,
+			       _IOC_NR(req) == GEM_NR(DRM_I915_GEM_PWRITE));
+	}
+
+	case GEM_NR(DRM_I915_GEM_MMAP): {
+		struct local_i915_gem_mmap2 *mmap_arg = arg;
+
+		if ((obj = fake_lookup(mmap_arg->handle)) == NULL)
+			return -ENOENT;
+
+		/* v1 and v2 share the leading fields, only v2 has flags */
+		if (_IOC_SIZE(req) >= sizeof(struct local_i915_gem_mmap2) &&
+		    mmap_arg->flags & ~I915_MMAP_WC)
+			return -EINVAL;
+		if (_IOC_SIZE(req) >= sizeof(struct local_i915_gem_mmap2) &&
+		    mmap_arg->flags & I915_MMAP_WC && !fake.has_wc)
+			return -ENODEV;
+
+		return fake_mmap(obj, mmap_arg->offset, mmap_arg->size,
+				 &mmap_arg->addr_ptr);
+	}
+
+	case GEM_NR(DRM_I915_GEM_MMAP_GTT): {
+		struct drm_i915_gem_mmap_gtt *gtt = arg;
+		if ((obj = fake_lookup(gtt->handle)) == NULL)
+			return -ENOENT;
+		if (obj->userptr)
+			return -EINVAL;
+		gtt->offset = obj->offset;
+		return 0;
+	}
+
+	case GEM_NR(DRM_I915_GEM_SET_DOMAIN): {
+		struct drm_i915_gem_set_domain *domain = arg;
+		if ((obj = fake_lookup(domain->handle)) == NULL)
+			return -ENOENT;
+		fake_sleep_until(obj->busy_until);
+		return 0;
+	}
+
+	case GEM_NR(DRM_I915_GEM_BUSY): {
+		struct drm_i915_gem_busy *busy = arg;
+		if ((obj = fake_lookup(busy->handle)) == NULL)
+			return -ENOENT;
+		busy->busy = 0;
+		if (obj->busy_until > fake_now())
+			busy->busy = 1 | 1 << (16 + obj->ring);
+		return 0;
+	}
+
+	case GEM_NR(DRM_I915_GEM_THROTTLE): {
+		/* As the kernel, wait for requests older than 20ms */
+		uint64_t tail = 0;
+		int i;
+
+		for (i = 0; i < ARRAY_SIZE(fake.ring_tail); i++)
+			tail = MAX(tail, fake.ring_tail[i]);
+		if (tail > 20*1000*1000)
+			fake_sleep_until(tail - 20*1000*1000);
+		return 0;
+	}
+
+	case GEM_NR(DRM_I915_GEM_MADVISE): {
+		struct drm_i915_gem_madvise *madv = arg;
+		if ((obj = fake_lookup(madv->handle)) == NULL)
+			return -ENOENT;
+		obj->madv = madv->madv;
+		madv->retained = 1;
+		return 0;
+	}
+
+	case GEM_NR(DRM_I915_GEM_SET_TILING): {
+		struct drm_i915_gem_set_tiling *tiling = arg;
+		if ((obj = fake_lookup(tiling->handle)) == NULL)
+			return -ENOENT;
+		if (tiling->tiling_mode > I915_TILING_Y)
+			return -EINVAL;
+		obj->tiling = tiling->tiling_mode;
+		obj->stride = tiling->tiling_mode ? tiling->stride : 0;
+		tiling->swizzle_mode = I915_BIT_6_SWIZZLE_NONE;
+		return 0;
+	}
+
+	case GEM_NR(DRM_I915_GEM_GET_TILING): {
+		struct local_i915_gem_get_tiling_v2 *tiling = arg;
+		if ((obj = fake_lookup(tiling->handle)) == NULL)
+			return -ENOENT;
+		tiling->tiling_mode = obj->tiling;
+		tiling->swizzle_mode = I915_BIT_6_SWIZZLE_NONE;
+		if (_IOC_SIZE(req) >= sizeof(*tiling))
+			tiling->phys_swizzle_mode = I915_BIT_6_SWIZZLE_NONE;
+		return 0;
+	}
+
+	case GEM_NR(LOCAL_I915_GEM_SET_CACHING): {
+		struct local_i915_gem_caching *caching = arg;
+		if ((obj = fake_lookup(caching->handle)) == NULL)
+			return -ENOENT;
+		obj->caching = caching->caching;
+		return 0;
+	}
+
+	case GEM_NR(LOCAL_I915_GEM_GET_CACHING): {
+		struct local_i915_gem_caching *caching = arg;
+		if ((obj = fake_lookup(caching->handle)) == NULL)
+			return -ENOENT;
+		caching->caching = obj->caching;
+		return 0;
+	}
+
+	case GEM_NR(DRM_I915_GEM_GET_APERTURE): {
+		struct drm_i915_gem_get_aperture *aperture = arg;
+		aperture->aper_size = fake.aperture;
+		aperture->aper_available_size = fake.aperture;
+		return 0;
+	}
+
+	case GEM_NR(DRM_I915_GEM_EXECBUFFER2):
+		return fake_execbuffer2(arg);
+
+	default:
+		/* No display, no pinning, no contexts */
+		DBG(("%s: unhandled ioctl nr=%x\n", __FUNCTION__, _IOC_NR(req)));
+		return -ENODEV;
+	}
+}
+
+/* Same calling convention as ioctl(2); other fds are passed through */
+int kgem_fake_ioctl(int fd, unsigned long req, void *arg)
+{
+	int ret;
+
+	if (fd != fake.fd)
+		return ioctl(fd, req, arg);
+
+	pthread_mutex_lock(&fake.lock);
+	ret = fake_ioctl(req, arg);
+	pthread_mutex_unlock(&fake.lock);
+	if (ret) {
+		errno = -ret;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void fake_parse_options(const char *options)
+{
+	fake.latency = 50 * 1000;
+	fake.aperture = 256 * 1024 * 1024;
+	fake.has_llc = true;
+	fake.has_wc = true;
+	fake.has_userptr = true;
+
+	while (options && *options) {
+		const char *eq = strchr(options, '=');
+		const char *end = strchr(options, ',');
+		unsigned long v;
+
+		if (end == NULL)
+			end = options + strlen(options);
+
+		if (eq && eq < end) {
+			v = strtoul(eq + 1, NULL, 0);
+			if (strncmp(options, "latency=", 8) == 0)
+				fake.latency = (uint64_t)v * 1000;
+			else if (strncmp(options, "aperture=", 9) == 0)
+				fake.aperture = (uint64_t)v << 20;
+			else if (strncmp(options, "llc=", 4) == 0)
+				fake.has_llc = v;
+			else if (strncmp(options, "wc=", 3) == 0)
+				fake.has_wc = v;
+			else if (strncmp(options, "userptr=", 8) == 0)
+				fake.has_userptr = v;
+		}
+
+		options = *end ? end + 1 : end;
+	}
+}
+
+/* Create the fake device, returning an fd to use with kgem_fake_ioctl() */
+int kgem_fake_open(unsigned gen, const char *options)
+{
+	int fd;
+
+	pthread_mutex_lock(&fake.lock);
+	fd = fake.fd;
+	if (fd == -1) {
+		fake_parse_options(options);
+		fake.gen = gen;
+		fake.fd = fd = fake_memfd();
+	}
+	pthread_mutex_unlock(&fake.lock);
+
+	DBG(("%s: fd=%d, latency=%lldus, aperture=%lldMiB, llc=%d, wc=%d, userptr=%d\n",
+	     __FUNCTION__, fd,
+	     (long long)fake.latency / 1000, (long long)fake.aperture >> 20,
+	     fake.has_llc, fake.has_wc, fake.has_userptr));
+	return fd;
+}
@@ -0,0 +1,367 @@
+/*
+ * Copyright © 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/* Self-test for the software GEM backend in kgem_fake.c.
+ *
+ * This links kgem_fake.c directly and so needs neither a GPU nor an X
+ * server. Each check drives the fake device through the same ioctls, with
+ * the same structures, that kgem.c uses against the kernel:
+ *
+ *   create/rw      CREATE, then PWRITE and PREAD round trip
+ *   mmap           CPU and GTT mmaps see the same pages as PREAD
+ *   flink          every GEM_OPEN is a new handle sharing the pages,
+ *                  which outlive the original handle
+ *   prime          an exported fd imports back to the same handle
+ *   execbuffer     relocations are written with the target's offset, and
+ *                  the objects stay busy for the simulated latency
+ *
+ * One line is written per check, and the exit status is the number of
+ * checks that failed. The single optional argument is passed as the
+ * option string to kgem_fake_open().
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "sna.h"
+#include "kgem_fake.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define SIZE 16384
+
+static int fd;
+
+void ErrorF(const char *f, ...)
+{
+	va_list va;
+
+	va_start(va, f);
+	vfprintf(stderr, f, va);
+	va_end(va);
+}
+
+void LogF(const char *f, ...)
+{
+	(void)f;
+}
+
+static int gem(unsigned long req, void *arg)
+{
+	return kgem_fake_ioctl(fd, req, arg) ? -errno : 0;
+}
+
+static uint32_t gem_create(uint64_t size)
+{
+	struct drm_i915_gem_create create;
+
+	memset(&create, 0, sizeof(create));
+	create.size = size;
+	if (gem(DRM_IOCTL_I915_GEM_CREATE, &create))
+		return 0;
+
+	return create.handle;
+}
+
+static void gem_close(uint32_t handle)
+{
+	struct drm_gem_close close;
+
+	memset(&close, 0, sizeof(close));
+	close.handle = handle;
+	(void)gem(DRM_IOCTL_GEM_CLOSE, &close);
+}
+
+static int gem_rw(uint32_t handle, uint64_t offset,
+		  void *data, uint64_t len, bool write)
+{
+	struct drm_i915_gem_pwrite rw;
+
+	memset(&rw, 0, sizeof(rw));
+	rw.handle = handle;
+	rw.offset = offset;
+	rw.size = len;
+	rw.data_ptr = (uintptr_t)data;
+	return gem(write ? DRM_IOCTL_I915_GEM_PWRITE : DRM_IOCTL_I915_GEM_PREAD,
+		   &rw);
+}
+
+static uint32_t gem_read32(uint32_t handle, uint64_t offset)
+{
+	uint32_t v = 0;
+
+	(void)gem_rw(handle, offset, &v, sizeof(v), false);
+	return v;
+}
+
+static bool gem_busy(uint32_t handle)
+{
+	struct drm_i915_gem_busy busy;
+
+	memset(&busy, 0, sizeof(busy));
+	busy.handle = handle;
+	return gem(DRM_IOCTL_I915_GEM_BUSY, &busy) == 0 && busy.busy;
+}
+
+static uint64_t gem_gtt_offset(uint32_t handle)
+{
+	struct drm_i915_gem_mmap_gtt gtt;
+
+	memset(&gtt, 0, sizeof(gtt));
+	gtt.handle = handle;
+	if (gem(DRM_IOCTL_I915_GEM_MMAP_GTT, &gtt))
+		return -1;
+
+	return gtt.offset;
+}
+
+static bool check_create_rw(void)
+{
+	uint32_t data[SIZE/4], handle;
+	bool ok;
+	int i;
+
+	handle = gem_create(SIZE);
+	if (handle == 0)
+		return false;
+
+	for (i = 0; i < SIZE/4; i++)
+		data[i] = i * 0x9e3779b1;
+	ok = gem_rw(handle, 0, data, SIZE, true) == 0;
+
+	memset(data, 0, sizeof(data));
+	ok = ok && gem_rw(handle, 0, data, SIZE, false) == 0;
+	for (i = 0; ok && i < SIZE/4; i++)
+		ok = data[i] == i * 0x9e3779b1;
+
+	/* out of bounds */
+	ok = ok && gem_rw(handle, SIZE - 4, data, 8, false) == -EINVAL;
+
+	gem_close(handle);
+	return ok;
+}
+
+static bool check_mmap(void)
+{
+	struct drm_i915_gem_mmap arg;
+	uint32_t handle, *cpu, *gtt;
+	uint64_t offset;
+	bool ok;
+
+	handle = gem_create(SIZE);
+	if (handle == 0)
+		return false;
+
+	memset(&arg, 0, sizeof(arg));
+	arg.handle = handle;
+	arg.size = SIZE;
+	if (gem(DRM_IOCTL_I915_GEM_MMAP, &arg)) {
+		gem_close(handle);
+		return false;
+	}
+	cpu = (uint32_t *)(uintptr_t)arg.addr_ptr;
+
+	offset = gem_gtt_offset(handle);
+	gtt = mmap(0, SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+	if (gtt == MAP_FAILED) {
+		munmap(cpu, SIZE);
+		gem_close(handle);
+		return false;
+	}
+
+	cpu[1] = 0xdeadbeef;
+	gtt[2] = 0xcafebabe;
+	ok = gtt[1] == 0xdeadbeef && cpu[2] == 0xcafebabe;
+	ok = ok && gem_read32(handle, 4) == 0xdeadbeef;
+	ok = ok && gem_read32(handle, 8) == 0xcafebabe;
+
+	munmap(gtt, SIZE);
+	munmap(cpu, SIZE);
+	gem_close(handle);
+	return ok;
+}
+
+static bool check_flink(void)
+{
+	struct drm_gem_flink flink;
+	struct drm_gem_open open_arg[2];
+	uint32_t handle, v = 0x12345678;
+	bool ok = true;
+	int n;
+
+	handle = gem_create(SIZE);
+	if (handle == 0)
+		return false;
+
+	memset(&flink, 0, sizeof(flink));
+	flink.handle = handle;
+	if (gem(DRM_IOCTL_GEM_FLINK, &flink) ||
+	    gem_rw(handle, 0, &v, sizeof(v), true)) {
+		gem_close(handle);
+		return false;
+	}
+
+	for (n = 0; n < 2; n++) {
+		memset(&open_arg[n], 0, sizeof(open_arg[n]));
+		open_arg[n].name = flink.name;
+		ok = ok && gem(DRM_IOCTL_GEM_OPEN, &open_arg[n]) == 0;
+	}
+	if (!ok) {
+		gem_close(handle);
+		return false;
+	}
+
+	ok = open_arg[0].handle != handle &&
+		open_arg[1].handle != handle &&
+		open_arg[0].handle != open_arg[1].handle &&
+		open_arg[0].size >= SIZE;
+
+	/* the pages belong to the object, not to the first handle */
+	gem_close(handle);
+	ok = ok && gem_read32(open_arg[0].handle, 0) == 0x12345678;
+	gem_close(open_arg[0].handle);
+	ok = ok && gem_read32(open_arg[1].handle, 0) == 0x12345678;
+	gem_close(open_arg[1].handle);
+
+	return ok;
+}
+
+static bool check_prime(void)
+{
+	struct drm_prime_handle prime;
+	uint32_t handle;
+	bool ok;
+
+	handle = gem_create(SIZE);
+	if (handle == 0)
+		return false;
+
+	memset(&prime, 0, sizeof(prime));
+	prime.handle = handle;
+	prime.flags = O_CLOEXEC;
+	if (gem(DRM_IOCTL_PRIME_HANDLE_TO_FD, &prime)) {
+		gem_close(handle);
+		return false;
+	}
+
+	prime.handle = 0;
+	ok = gem(DRM_IOCTL_PRIME_FD_TO_HANDLE, &prime) == 0 &&
+		prime.handle == handle;
+
+	close(prime.fd);
+	gem_close(handle);
+	return ok;
+}
+
+static bool check_execbuffer(void)
+{
+	struct drm_i915_gem_exec_object2 exec[2];
+	struct drm_i915_gem_relocation_entry reloc;
+	struct drm_i915_gem_execbuffer2 execbuf;
+	struct drm_i915_gem_set_domain domain;
+	uint32_t target, batch;
+	uint64_t offset;
+	bool ok;
+
+	target = gem_create(SIZE);
+	batch = gem_create(4096);
+	if (target == 0 || batch == 0)
+		return false;
+
+	offset = gem_gtt_offset(target);
+
+	memset(&reloc, 0, sizeof(reloc));
+	reloc.offset = 8;
+	reloc.delta = 0x40;
+	reloc.target_handle = 0; /* HANDLE_LUT, so exec[0] */
+	reloc.presumed_offset = -1;
+
+	memset(exec, 0, sizeof(exec));
+	exec[0].handle = target;
+	exec[1].handle = batch;
+	exec[1].relocation_count = 1;
+	exec[1].relocs_ptr = (uintptr_t)&reloc;
+
+	memset(&execbuf, 0, sizeof(execbuf));
+	execbuf.buffers_ptr = (uintptr_t)exec;
+	execbuf.buffer_count = 2;
+	execbuf.flags = I915_EXEC_BLT | 1 << 12; /* HANDLE_LUT */
+
+	ok = gem(DRM_IOCTL_I915_GEM_EXECBUFFER2, &execbuf) == 0;
+	ok = ok && exec[0].offset == offset;
+	ok = ok && reloc.presumed_offset == offset;
+	ok = ok && gem_busy(target) && gem_busy(batch);
+
+	/* waits for the simulated batch to complete */
+	memset(&domain, 0, sizeof(domain));
+	domain.handle = batch;
+	domain.read_domains = I915_GEM_DOMAIN_CPU;
+	ok = ok && gem(DRM_IOCTL_I915_GEM_SET_DOMAIN, &domain) == 0;
+	ok = ok && !gem_busy(batch);
+	ok = ok && gem_read32(batch, 8) == (uint32_t)(offset + 0x40);
+
+	gem_close(batch);
+	gem_close(target);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	static const struct {
+		const char *name;
+		bool (*func)(void);
+	} checks[] = {
+		{ "create/rw", check_create_rw },
+		{ "mmap", check_mmap },
+		{ "flink", check_flink },
+		{ "prime", check_prime },
+		{ "execbuffer", check_execbuffer },
+	};
+	int failed = 0;
+	unsigned n;
+
+	/* a long latency, so that the batch is still busy when we look */
+	fd = kgem_fake_open(0100, argc > 1 ? argv[1] : "latency=100000");
+	if (fd == -1) {
+		fprintf(stderr, "Unable to create the fake device: %s\n",
+			strerror(errno));
+		return 1;
+	}
+
+	for (n = 0; n < ARRAY_SIZE(checks); n++) {
+		bool ok = checks[n].func();
+		printf("%s: %s\n", checks[n].name, ok ? "pass" : "FAIL");
+		failed += !ok;
+	}
+
+	return failed;
+}
@@ -224,6 +224,7 @@ enum {
 	FLUSH_TIMER = 0,
 	THROTTLE_TIMER,
 	EXPIRE_TIMER,
+	STATS_TIMER,
 #if DEBUG_MEMORY
 	DEBUG_MEMORY_TIMER,
 #endif
@@ -264,6 +265,7 @@ struct sna {
 #define SSE4_2 0x40
 #define AVX 0x80
 #define AVX2 0x100
+#define AVX512F 0x200
 
 	bool ignore_copy_area : 1;
 
@@ -274,6 +276,8 @@ struct sna {
 	uint16_t timer_active;
 
 	int vblank_interval;
+	unsigned stats_interval; /* ms between kgem statistics logs, 0 = off */
+	unsigned stats_signal;
 
 	struct list flush_pixmaps;
 	struct list active_pixmaps;
@@ -1111,6 +1115,11 @@ bool sna_write_boxes__xor(struct sna *sna, PixmapPtr dst,
 			  const void *src, int stride, int16_t src_dx, int16_t src_dy,
 			  const BoxRec *box, int nbox,
 			  uint32_t and, uint32_t or);
+bool sna_write_boxes__convert(struct sna *sna, PixmapPtr dst,
+			      struct kgem_bo *dst_bo, int16_t dst_dx, int16_t dst_dy,
+			      const void *src, int stride, int16_t src_dx, int16_t src_dy,
+			      const BoxRec *box, int nbox,
+			      uint32_t src_format, uint32_t dst_format);
 
 bool sna_replace(struct sna *sna,
 		 PixmapPtr pixmap,
@@ -1142,6 +1151,22 @@ memcpy_blt(const void *src, void *dst, int bpp,
 	   int16_t dst_x, int16_t dst_y,
 	   uint16_t width, uint16_t height);
 
+void
+memcpy_blt__from_wc(const void *src, void *dst, int bpp,
+		    int32_t src_stride, int32_t dst_stride,
+		    int16_t src_x, int16_t src_y,
+		    int16_t dst_x, int16_t dst_y,
+		    uint16_t width, uint16_t height);
+
+void
+memcpy_blt__nt(const void *src, void *dst, int bpp,
+	       int32_t src_stride, int32_t dst_stride,
+	       int16_t src_x, int16_t src_y,
+	       int16_t dst_x, int16_t dst_y,
+	       uint16_t width, uint16_t height);
+
+void choose_memcpy_blt(unsigned cpu);
+
 void
 affine_blt(const void *src, void *dst, int bpp,
 	   int16_t src_x, int16_t src_y,
@@ -1152,6 +1177,27 @@ affine_blt(const void *src, void *dst, int bpp,
 	   int32_t dst_stride,
 	   const struct pixman_f_transform *t);
 
+bool
+transform_blt(const void *src, void *dst, int bpp,
+	      int16_t src_x, int16_t src_y,
+	      int16_t src_width, int16_t src_height,
+	      int32_t src_stride,
+	      int16_t dst_x, int16_t dst_y,
+	      uint16_t dst_width, uint16_t dst_height,
+	      int32_t dst_stride,
+	      const struct pixman_f_transform *t,
+	      int filter);
+
+bool
+memcpy_convert(const void *src, void *dst,
+	       uint32_t src_format, uint32_t dst_format,
+	       int dst_tiling, int dst_swizzling,
+	       int32_t src_stride, int32_t dst_stride,
+	       int16_t src_x, int16_t src_y,
+	       int16_t dst_x, int16_t dst_y,
+	       uint16_t width, uint16_t height);
+bool memcpy_convert_supported(uint32_t src_format, uint32_t dst_format);
+
 void
 memmove_box(const void *src, void *dst,
 	    int bpp, int32_t stride,
@@ -673,11 +673,6 @@ struct kgem_bo *sna_pixmap_change_tiling(PixmapPtr pixmap, uint32_t tiling)
 		return NULL;
 	}
 
-	if (wedged(sna)) {
-		DBG(("%s: can't convert bo, wedged\n", __FUNCTION__));
-		return NULL;
-	}
-
 	assert_pixmap_damage(pixmap);
 	assert(!priv->move_to_gpu);
 
@@ -691,6 +686,22 @@ struct kgem_bo *sna_pixmap_change_tiling(PixmapPtr pixmap, uint32_t tiling)
 		return NULL;
 	}
 
+	/* Without the GPU (or with it busy elsewhere), retile directly on
+	 * the CPU from one layout into the other.
+	 */
+	if (kgem_prefer_retile__cpu(&sna->kgem, priv->gpu_bo) &&
+	    kgem_bo_retile__cpu(&sna->kgem, priv->gpu_bo, bo,
+				pixmap->drawable.width,
+				pixmap->drawable.height,
+				pixmap->drawable.bitsPerPixel))
+		goto done;
+
+	if (wedged(sna)) {
+		DBG(("%s: can't convert bo, wedged\n", __FUNCTION__));
+		kgem_bo_destroy(&sna->kgem, bo);
+		return NULL;
+	}
+
 	box.x1 = box.y1 = 0;
 	box.x2 = pixmap->drawable.width;
 	box.y2 = pixmap->drawable.height;
@@ -704,6 +715,7 @@ struct kgem_bo *sna_pixmap_change_tiling(PixmapPtr pixmap, uint32_t tiling)
 		return NULL;
 	}
 
+done:
 	sna_pixmap_unmap(pixmap, priv);
 	kgem_bo_destroy(&sna->kgem, priv->gpu_bo);
 
@@ -3291,6 +3303,11 @@ inline static void sna_pixmap_unclean(struct sna *sna,
 	if (!priv->flush || priv->gpu_bo->exec)
 		return;
 
+	/* Bypassing kgem, so we must first let any batch in flight reach
+	 * the kernel or it will report the bo as idle too early.
+	 */
+	kgem_submit_wait(&sna->kgem);
+
 	busy.handle = priv->gpu_bo->handle;
 	busy.busy = 0;
 	ioctl(sna->kgem.fd, DRM_IOCTL_I915_GEM_BUSY, &busy);
@@ -17280,6 +17297,9 @@ void sna_accel_flush(struct sna *sna)
 
 	if (sna->kgem.flush)
 		kgem_submit(&sna->kgem);
+
+	/* and make sure that the clients see any batch still in flight */
+	kgem_submit_wait(&sna->kgem);
 }
 
 static void
@@ -17308,6 +17328,8 @@ static struct sna_pixmap *sna_accel_scanout(struct sna *sna)
 }
 
 #define TIME currentTime.milliseconds
+#define REAP_BUDGET_US 1000
+#define REDUCE_BUDGET_BOXES 4096
 static void sna_accel_disarm_timer(struct sna *sna, int id)
 {
 	DBG(("%s[%d] (time=%ld)\n", __FUNCTION__, id, (long)TIME));
@@ -17650,6 +17672,57 @@ static void sna_accel_expire(struct sna *sna)
 		sna_accel_disarm_timer(sna, EXPIRE_TIMER);
 }
 
+/* SIGUSR2 asks every screen to log its kgem statistics */
+static volatile sig_atomic_t sna_stats_signal;
+
+static void sna_stats_sighandler(int sig)
+{
+	sna_stats_signal++;
+}
+
+static void sna_accel_stats_init(struct sna *sna)
+{
+	struct sigaction sa;
+	int interval;
+
+	if (xf86GetOptValInteger(sna->Options, OPTION_STATS_INTERVAL, &interval) &&
+	    interval > 0) {
+		xf86DrvMsg(sna->scrn->scrnIndex, X_CONFIG,
+			   "Logging kgem statistics every %d seconds\n",
+			   interval);
+		sna->stats_interval = interval * 1000;
+		sna->timer_expire[STATS_TIMER] =
+			GetTimeInMillis() + sna->stats_interval;
+	}
+
+	sna->stats_signal = sna_stats_signal;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sna_stats_sighandler;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGUSR2, &sa, NULL);
+}
+
+static bool sna_accel_do_stats(struct sna *sna)
+{
+	if (sna->stats_signal != sna_stats_signal) {
+		sna->stats_signal = sna_stats_signal;
+		return true;
+	}
+
+	if (sna->stats_interval) {
+		int32_t delta = sna->timer_expire[STATS_TIMER] - TIME;
+		if (delta <= 3) {
+			DBG(("%s (time=%ld), triggered\n", __FUNCTION__, (long)TIME));
+			sna->timer_expire[STATS_TIMER] = TIME + sna->stats_interval;
+			return true;
+		}
+	}
+
+	return false;
+}
+
 #ifdef DEBUG_MEMORY
 static bool sna_accel_do_debug_memory(struct sna *sna)
 {
@@ -17939,6 +18012,7 @@ bool sna_accel_init(ScreenPtr screen, struct sna *sna)
 
 	AddGeneralSocket(sna->kgem.fd);
 
+	sna_accel_stats_init(sna);
 #ifdef DEBUG_MEMORY
 	sna->timer_expire[DEBUG_MEMORY_TIMER] = GetTimeInMillis()+ 10 * 1000;
 #endif
@@ -18116,10 +18190,15 @@ void sna_accel_close(struct sna *sna)
 	RemoveGeneralSocket(sna->kgem.fd);
 
 	kgem_cleanup_cache(&sna->kgem);
+	kgem_fini_submit_thread(&sna->kgem);
+	kgem_fini_pressure(&sna->kgem);
+	kgem_fini_capture(&sna->kgem);
 }
 
 void sna_accel_block(struct sna *sna, struct timeval **tv)
 {
+	bool reap;
+
 	sigtrap_assert_inactive();
 
 	if (sna->kgem.need_retire)
@@ -18133,6 +18212,7 @@ void sna_accel_block(struct sna *sna, struct timeval **tv)
 	    (sna->kgem.scanout_busy ||
 	     kgem_ring_is_idle(&sna->kgem, sna->kgem.ring))) {
 		DBG(("%s: GPU idle, flushing\n", __FUNCTION__));
+		sna->kgem.submit_reason = SUBMIT_IDLE;
 		_kgem_submit(&sna->kgem);
 	}
 
@@ -18156,6 +18236,14 @@ restart:
 	assert(!sna->kgem.need_expire ||
 	       sna->timer_active & (1<<(EXPIRE_TIMER)));
 
+	/* Close the bo freed since the last wakeup, a slice at a time */
+	reap = kgem_reap(&sna->kgem, REAP_BUDGET_US);
+	/* and likewise fold in the damage still pending */
+	reap |= sna_damage_reduce_idle(REDUCE_BUDGET_BOXES);
+
+	if (sna_accel_do_stats(sna))
+		kgem_dump_stats(&sna->kgem);
+
 	if (sna_accel_do_debug_memory(sna))
 		sna_accel_debug_memory(sna);
 
@@ -18188,6 +18276,19 @@ set_tv:
 		}
 	}
 
+	if (reap) {
+		DBG(("%s: idle work not yet drained, waking in 1ms\n",
+		     __FUNCTION__));
+		if (*tv == NULL) {
+			*tv = &sna->timer_tv;
+			(*tv)->tv_sec = 0;
+			(*tv)->tv_usec = 1000;
+		} else if ((*tv)->tv_sec || (*tv)->tv_usec > 1000) {
+			(*tv)->tv_sec = 0;
+			(*tv)->tv_usec = 1000;
+		}
+	}
+
 	sna->kgem.scanout_busy = false;
 
 	if (FAULT_INJECTION && (rand() % FAULT_INJECTION) == 0) {
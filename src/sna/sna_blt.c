@@ -1648,7 +1648,7 @@ static void blt_composite_copy_boxes__thread(struct sna *sna,
 			rem = kgem_batch_space(kgem);
 			if (8*nbox_this_time > rem)
 				nbox_this_time = rem / 8;
-			if (2*nbox_this_time > KGEM_RELOC_SIZE(kgem) - kgem->nreloc)
+			if (2*nbox_this_time > kgem_reloc_space(kgem, 2*nbox_this_time))
 				nbox_this_time = (KGEM_RELOC_SIZE(kgem) - kgem->nreloc)/2;
 			DBG(("%s: emitting %d boxes out of %d (batch space %d)\n",
 			     __FUNCTION__, nbox_this_time, nbox, rem));
@@ -1704,7 +1704,7 @@ static void blt_composite_copy_boxes__thread(struct sna *sna,
 			rem = kgem_batch_space(kgem);
 			if (8*nbox_this_time > rem)
 				nbox_this_time = rem / 8;
-			if (2*nbox_this_time > KGEM_RELOC_SIZE(kgem) - kgem->nreloc)
+			if (2*nbox_this_time > kgem_reloc_space(kgem, 2*nbox_this_time))
 				nbox_this_time = (KGEM_RELOC_SIZE(kgem) - kgem->nreloc)/2;
 			DBG(("%s: emitting %d boxes out of %d (batch space %d)\n",
 			     __FUNCTION__, nbox_this_time, nbox, rem));
@@ -1784,7 +1784,7 @@ static void blt_composite_copy_boxes__thread64(struct sna *sna,
 			rem = kgem_batch_space(kgem);
 			if (10*nbox_this_time > rem)
 				nbox_this_time = rem / 10;
-			if (2*nbox_this_time > KGEM_RELOC_SIZE(kgem) - kgem->nreloc)
+			if (2*nbox_this_time > kgem_reloc_space(kgem, 2*nbox_this_time))
 				nbox_this_time = (KGEM_RELOC_SIZE(kgem) - kgem->nreloc)/2;
 			DBG(("%s: emitting %d boxes out of %d (batch space %d)\n",
 			     __FUNCTION__, nbox_this_time, nbox, rem));
@@ -1842,7 +1842,7 @@ static void blt_composite_copy_boxes__thread64(struct sna *sna,
 			rem = kgem_batch_space(kgem);
 			if (10*nbox_this_time > rem)
 				nbox_this_time = rem / 10;
-			if (2*nbox_this_time > KGEM_RELOC_SIZE(kgem) - kgem->nreloc)
+			if (2*nbox_this_time > kgem_reloc_space(kgem, 2*nbox_this_time))
 				nbox_this_time = (KGEM_RELOC_SIZE(kgem) - kgem->nreloc)/2;
 			DBG(("%s: emitting %d boxes out of %d (batch space %d)\n",
 			     __FUNCTION__, nbox_this_time, nbox, rem));
@@ -2402,6 +2402,168 @@ blt_put_composite_boxes_with_alpha(struct sna *sna,
 	}
 }
 
+fastcall static void
+blt_put_composite_convert__cpu(struct sna *sna,
+			       const struct sna_composite_op *op,
+			       const struct sna_composite_rectangles *r)
+{
+	PixmapPtr dst = op->dst.pixmap;
+	PixmapPtr src = op->u.blt.src_pixmap;
+	assert(src->devPrivate.ptr);
+	assert(src->devKind);
+	assert(dst->devPrivate.ptr);
+	assert(dst->devKind);
+	memcpy_convert(src->devPrivate.ptr, dst->devPrivate.ptr,
+		       op->src.pict_format, op->dst.format,
+		       I915_TILING_NONE, 0,
+		       src->devKind, dst->devKind,
+		       r->src.x + op->u.blt.sx, r->src.y + op->u.blt.sy,
+		       r->dst.x + op->dst.x, r->dst.y + op->dst.y,
+		       r->width, r->height);
+}
+
+fastcall static void
+blt_put_composite_box_convert__cpu(struct sna *sna,
+				   const struct sna_composite_op *op,
+				   const BoxRec *box)
+{
+	PixmapPtr dst = op->dst.pixmap;
+	PixmapPtr src = op->u.blt.src_pixmap;
+	assert(src->devPrivate.ptr);
+	assert(src->devKind);
+	assert(dst->devPrivate.ptr);
+	assert(dst->devKind);
+	memcpy_convert(src->devPrivate.ptr, dst->devPrivate.ptr,
+		       op->src.pict_format, op->dst.format,
+		       I915_TILING_NONE, 0,
+		       src->devKind, dst->devKind,
+		       box->x1 + op->u.blt.sx, box->y1 + op->u.blt.sy,
+		       box->x1 + op->dst.x, box->y1 + op->dst.y,
+		       box->x2-box->x1, box->y2-box->y1);
+}
+
+static void
+blt_put_composite_boxes_convert__cpu(struct sna *sna,
+				     const struct sna_composite_op *op,
+				     const BoxRec *box, int n)
+{
+	PixmapPtr dst = op->dst.pixmap;
+	PixmapPtr src = op->u.blt.src_pixmap;
+	assert(src->devPrivate.ptr);
+	assert(src->devKind);
+	assert(dst->devPrivate.ptr);
+	assert(dst->devKind);
+	do {
+		memcpy_convert(src->devPrivate.ptr, dst->devPrivate.ptr,
+			       op->src.pict_format, op->dst.format,
+			       I915_TILING_NONE, 0,
+			       src->devKind, dst->devKind,
+			       box->x1 + op->u.blt.sx, box->y1 + op->u.blt.sy,
+			       box->x1 + op->dst.x, box->y1 + op->dst.y,
+			       box->x2-box->x1, box->y2-box->y1);
+		box++;
+	} while (--n);
+}
+
+fastcall static void
+blt_put_composite_convert(struct sna *sna,
+			  const struct sna_composite_op *op,
+			  const struct sna_composite_rectangles *r)
+{
+	PixmapPtr src = op->u.blt.src_pixmap;
+	BoxRec box;
+
+	assert(src->devPrivate.ptr);
+	assert(src->devKind);
+
+	box.x1 = r->dst.x + op->dst.x;
+	box.y1 = r->dst.y + op->dst.y;
+	box.x2 = box.x1 + r->width;
+	box.y2 = box.y1 + r->height;
+
+	sna_write_boxes__convert(sna, op->dst.pixmap,
+				 op->dst.bo, 0, 0,
+				 src->devPrivate.ptr, src->devKind,
+				 r->src.x + op->u.blt.sx - r->dst.x,
+				 r->src.y + op->u.blt.sy - r->dst.y,
+				 &box, 1,
+				 op->src.pict_format, op->dst.format);
+}
+
+fastcall static void
+blt_put_composite_box_convert(struct sna *sna,
+			      const struct sna_composite_op *op,
+			      const BoxRec *box)
+{
+	PixmapPtr src = op->u.blt.src_pixmap;
+
+	DBG(("%s: src=(%d, %d), dst=(%d, %d)\n", __FUNCTION__,
+	     op->u.blt.sx, op->u.blt.sy,
+	     op->dst.x, op->dst.y));
+
+	assert(src->devPrivate.ptr);
+	assert(src->devKind);
+
+	sna_write_boxes__convert(sna, op->dst.pixmap,
+				 op->dst.bo, op->dst.x, op->dst.y,
+				 src->devPrivate.ptr, src->devKind,
+				 op->u.blt.sx, op->u.blt.sy,
+				 box, 1,
+				 op->src.pict_format, op->dst.format);
+}
+
+static void
+blt_put_composite_boxes_convert(struct sna *sna,
+				const struct sna_composite_op *op,
+				const BoxRec *box, int n)
+{
+	PixmapPtr src = op->u.blt.src_pixmap;
+
+	DBG(("%s: src=(%d, %d), dst=(%d, %d), [(%d, %d), (%d, %d) x %d]\n", __FUNCTION__,
+	     op->u.blt.sx, op->u.blt.sy,
+	     op->dst.x, op->dst.y,
+	     box->x1, box->y1, box->x2, box->y2, n));
+
+	assert(src->devPrivate.ptr);
+	assert(src->devKind);
+
+	sna_write_boxes__convert(sna, op->dst.pixmap,
+				 op->dst.bo, op->dst.x, op->dst.y,
+				 src->devPrivate.ptr, src->devKind,
+				 op->u.blt.sx, op->u.blt.sy,
+				 box, n,
+				 op->src.pict_format, op->dst.format);
+}
+
+/* Upload from a CPU source whose format differs from the destination,
+ * converting each pixel as it is copied.
+ */
+static bool
+prepare_blt_put__convert(struct sna *sna,
+			 struct sna_composite_op *op,
+			 uint32_t src_format)
+{
+	DBG(("%s: %08x -> %08x\n", __FUNCTION__, src_format, op->dst.format));
+
+	assert(!sna_pixmap(op->dst.pixmap)->clear);
+	assert(memcpy_convert_supported(src_format, op->dst.format));
+
+	op->src.pict_format = src_format;
+	if (op->dst.bo) {
+		assert(op->dst.bo == sna_pixmap(op->dst.pixmap)->gpu_bo);
+		op->blt   = blt_put_composite_convert;
+		op->box   = blt_put_composite_box_convert;
+		op->boxes = blt_put_composite_boxes_convert;
+	} else {
+		op->blt   = blt_put_composite_convert__cpu;
+		op->box   = blt_put_composite_box_convert__cpu;
+		op->boxes = blt_put_composite_boxes_convert__cpu;
+	}
+	op->done = nop_done;
+
+	return true;
+}
+
 static bool
 prepare_blt_put(struct sna *sna,
 		struct sna_composite_op *op,
@@ -2531,6 +2693,7 @@ sna_blt_composite(struct sna *sna,
 	uint32_t alpha_fixup;
 	uint32_t color, hint;
 	bool was_clear;
+	bool convert;
 	bool ret;
 
 #if DEBUG_NO_BLT || NO_BLT_COMPOSITE
@@ -2752,15 +2915,23 @@ fill:
 	}
 
 	alpha_fixup = 0;
+	convert = false;
 	if (!(dst->format == src_format ||
 	      dst->format == alphaless(src_format) ||
 	      (alphaless(dst->format) == alphaless(src_format) &&
 	       sna_get_pixel_from_rgba(&alpha_fixup,
 				       0, 0, 0, 0xffff,
 				       dst->format)))) {
-		DBG(("%s: incompatible src/dst formats src=%08x, dst=%08x\n",
+		if (src_pixmap == tmp->dst.pixmap ||
+		    !memcpy_convert_supported(src_format, dst->format)) {
+			DBG(("%s: incompatible src/dst formats src=%08x, dst=%08x\n",
+			     __FUNCTION__, (unsigned)src_format, dst->format));
+			return false;
+		}
+
+		DBG(("%s: converting src=%08x to dst=%08x on upload\n",
 		     __FUNCTION__, (unsigned)src_format, dst->format));
-		return false;
+		convert = true;
 	}
 
 	/* XXX tiling? fixup extend none? */
@@ -2808,6 +2979,11 @@ fill:
 	src_box.x2 = x + width;
 	src_box.y2 = y + height;
 	bo = __sna_render_pixmap_bo(sna, src_pixmap, &src_box, true);
+	if (bo && convert) {
+		DBG(("%s: source on GPU, leave the conversion to render\n",
+		     __FUNCTION__));
+		return false;
+	}
 	if (bo && !kgem_bo_can_blt(&sna->kgem, bo)) {
 		DBG(("%s: can not blit from src size=%dx%d, tiling? %d, pitch? %d\n",
 		     __FUNCTION__,
@@ -2904,7 +3080,10 @@ put:
 						     &region, MOVE_READ))
 			return false;
 
-		ret = prepare_blt_put(sna, tmp, alpha_fixup);
+		if (convert)
+			ret = prepare_blt_put__convert(sna, tmp, src_format);
+		else
+			ret = prepare_blt_put(sna, tmp, alpha_fixup);
 	}
 
 	return ret;
@@ -3738,7 +3917,7 @@ bool sna_blt_copy_boxes(struct sna *sna, uint8_t alu,
 				rem = kgem_batch_space(kgem);
 				if (10*nbox_this_time > rem)
 					nbox_this_time = rem / 10;
-				if (2*nbox_this_time > KGEM_RELOC_SIZE(kgem) - kgem->nreloc)
+				if (2*nbox_this_time > kgem_reloc_space(kgem, 2*nbox_this_time))
 					nbox_this_time = (KGEM_RELOC_SIZE(kgem) - kgem->nreloc)/2;
 				DBG(("%s: emitting %d boxes out of %d (batch space %d)\n",
 				     __FUNCTION__, nbox_this_time, nbox, rem));
@@ -3797,7 +3976,7 @@ bool sna_blt_copy_boxes(struct sna *sna, uint8_t alu,
 				rem = kgem_batch_space(kgem);
 				if (8*nbox_this_time > rem)
 					nbox_this_time = rem / 8;
-				if (2*nbox_this_time > KGEM_RELOC_SIZE(kgem) - kgem->nreloc)
+				if (2*nbox_this_time > kgem_reloc_space(kgem, 2*nbox_this_time))
 					nbox_this_time = (KGEM_RELOC_SIZE(kgem) - kgem->nreloc)/2;
 				DBG(("%s: emitting %d boxes out of %d (batch space %d)\n",
 				     __FUNCTION__, nbox_this_time, nbox, rem));
@@ -3856,7 +4035,7 @@ bool sna_blt_copy_boxes(struct sna *sna, uint8_t alu,
 				rem = kgem_batch_space(kgem);
 				if (10*nbox_this_time > rem)
 					nbox_this_time = rem / 10;
-				if (2*nbox_this_time > KGEM_RELOC_SIZE(kgem) - kgem->nreloc)
+				if (2*nbox_this_time > kgem_reloc_space(kgem, 2*nbox_this_time))
 					nbox_this_time = (KGEM_RELOC_SIZE(kgem) - kgem->nreloc)/2;
 				DBG(("%s: emitting %d boxes out of %d (batch space %d)\n",
 				     __FUNCTION__, nbox_this_time, nbox, rem));
@@ -3915,7 +4094,7 @@ bool sna_blt_copy_boxes(struct sna *sna, uint8_t alu,
 				rem = kgem_batch_space(kgem);
 				if (8*nbox_this_time > rem)
 					nbox_this_time = rem / 8;
-				if (2*nbox_this_time > KGEM_RELOC_SIZE(kgem) - kgem->nreloc)
+				if (2*nbox_this_time > kgem_reloc_space(kgem, 2*nbox_this_time))
 					nbox_this_time = (KGEM_RELOC_SIZE(kgem) - kgem->nreloc)/2;
 				DBG(("%s: emitting %d boxes out of %d (batch space %d)\n",
 				     __FUNCTION__, nbox_this_time, nbox, rem));
@@ -30,6 +30,11 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include "sna.h"
 #include "sna_damage.h"
+#include "sna_damage_capture.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
 
 /*
  * sna_damage is a batching layer on top of the regular pixman_region_t.
@@ -46,6 +51,23 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  *
  * Furthermore, we can track whether the whole pixmap is damaged and so
  * cheapy discard no-ops.
+ *
+ * Finally, damage fragmented into many small pieces, e.g. lots of little
+ * updates scattered across a large root pixmap, would otherwise have its
+ * pending boxes reduced into the region on every query made by the
+ * migration code. Above a threshold we keep alongside the exact region a
+ * coarse index of 64x64 cells, recording for each whether it may contain
+ * any damage and whether it is wholly damaged. That answers most
+ * containment queries without a reduction, whilst the region remains the
+ * only source of the actual boxes.
+ *
+ * Nor should a client queueing thousands of small updates leave the next
+ * query to pay for reducing them all at once. The pending boxes are kept
+ * in blocks of bounded size, and as a new block is started the oldest are
+ * merged into the region. The region together with the boxes still pending
+ * always describes the same damage, so the extents and containment remain
+ * exact midway. Whatever is left is reduced a slice at a time whilst the
+ * server is idle, see sna_damage_reduce_idle().
  */
 
 struct sna_damage_box {
@@ -54,6 +76,8 @@ struct sna_damage_box {
 } __attribute__((packed));
 
 static struct sna_damage *__freed_damage;
+static struct list dirty_damage = { &dirty_damage, &dirty_damage };
+static int capture_fd = -1;
 
 static inline bool region_is_singular(const RegionRec *r)
 {
@@ -152,6 +176,129 @@ static const char *_debug_describe_damage(char *buf, int max,
 }
 #endif
 
+bool sna_damage_capture_init(const char *path)
+{
+	struct sna_damage_capture_header header;
+	int fd;
+
+	/* A single trace is shared by every screen (e.g. ZaphodHeads), so
+	 * keep the one opened first rather than truncating it.
+	 */
+	if (capture_fd >= 0)
+		return true;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return false;
+
+	header.magic = SNA_DAMAGE_CAPTURE_MAGIC;
+	header.version = SNA_DAMAGE_CAPTURE_VERSION;
+	if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+		close(fd);
+		return false;
+	}
+
+	capture_fd = fd;
+	return true;
+}
+
+#define CAPTURE(x) do { if (unlikely(capture_fd >= 0)) x; } while (0)
+
+static inline uint64_t capture_id(const struct sna_damage *damage)
+{
+	return (uintptr_t)DAMAGE_PTR(damage);
+}
+
+static void capture_write(const void *ptr, size_t len)
+{
+	if (capture_fd < 0)
+		return;
+
+	if (write(capture_fd, ptr, len) != (ssize_t)len) {
+		ErrorF("sna: failed to write damage capture, errno=%d; capture stopped\n",
+		       errno);
+		close(capture_fd);
+		capture_fd = -1;
+	}
+}
+
+static void capture_op(unsigned type, const struct sna_damage *damage,
+		       uint64_t result, int nbox)
+{
+	struct sna_damage_capture_op op;
+
+	op.damage = capture_id(damage);
+	op.result = result;
+	op.type = type;
+	op.nbox = nbox;
+	capture_write(&op, sizeof(op));
+}
+
+static void capture_boxes(unsigned type, const struct sna_damage *damage,
+			  uint64_t result, const BoxRec *box, int n,
+			  int dx, int dy)
+{
+	BoxRec tmp[256];
+	int i, m;
+
+	capture_op(type, damage, result, n);
+	if (dx == 0 && dy == 0) {
+		capture_write(box, n * sizeof(BoxRec));
+		return;
+	}
+
+	for (; n; n -= m, box += m) {
+		m = MIN(n, ARRAY_SIZE(tmp));
+		for (i = 0; i < m; i++) {
+			tmp[i].x1 = box[i].x1 + dx;
+			tmp[i].x2 = box[i].x2 + dx;
+			tmp[i].y1 = box[i].y1 + dy;
+			tmp[i].y2 = box[i].y2 + dy;
+		}
+		capture_write(tmp, m * sizeof(BoxRec));
+	}
+}
+
+static void capture_rectangles(const struct sna_damage *damage,
+			       uint64_t result, const xRectangle *r, int n,
+			       int dx, int dy)
+{
+	BoxRec tmp[256];
+	int i, m;
+
+	capture_op(DAMAGE_OP_ADD, damage, result, n);
+	for (; n; n -= m, r += m) {
+		m = MIN(n, ARRAY_SIZE(tmp));
+		for (i = 0; i < m; i++) {
+			tmp[i].x1 = r[i].x + dx;
+			tmp[i].x2 = tmp[i].x1 + r[i].width;
+			tmp[i].y1 = r[i].y + dy;
+			tmp[i].y2 = tmp[i].y1 + r[i].height;
+		}
+		capture_write(tmp, m * sizeof(BoxRec));
+	}
+}
+
+static void capture_points(const struct sna_damage *damage,
+			   uint64_t result, const DDXPointRec *p, int n,
+			   int dx, int dy)
+{
+	BoxRec tmp[256];
+	int i, m;
+
+	capture_op(DAMAGE_OP_ADD, damage, result, n);
+	for (; n; n -= m, p += m) {
+		m = MIN(n, ARRAY_SIZE(tmp));
+		for (i = 0; i < m; i++) {
+			tmp[i].x1 = p[i].x + dx;
+			tmp[i].x2 = tmp[i].x1 + 1;
+			tmp[i].y1 = p[i].y + dy;
+			tmp[i].y2 = tmp[i].y1 + 1;
+		}
+		capture_write(tmp, m * sizeof(BoxRec));
+	}
+}
+
 static struct sna_damage_box *
 last_box(struct sna_damage *damage)
 {
@@ -163,6 +310,8 @@ last_box(struct sna_damage *damage)
 static void
 reset_embedded_box(struct sna_damage *damage)
 {
+	if (damage->dirty)
+		list_del(&damage->link);
 	damage->dirty = false;
 	damage->box = damage->embedded_box.box;
 	damage->embedded_box.size =
@@ -170,6 +319,25 @@ reset_embedded_box(struct sna_damage *damage)
 	list_init(&damage->embedded_box.list);
 }
 
+static inline void mark_dirty(struct sna_damage *damage)
+{
+	if (!damage->dirty) {
+		damage->dirty = true;
+		list_add_tail(&damage->link, &dirty_damage);
+	}
+}
+
+static int pending_boxes(struct sna_damage *damage)
+{
+	struct sna_damage_box *iter;
+	int n;
+
+	n = damage->embedded_box.size;
+	list_for_each_entry(iter, &damage->embedded_box.list, list)
+		n += iter->size;
+	return n - damage->remain;
+}
+
 static void reset_extents(struct sna_damage *damage)
 {
 	damage->extents.x1 = damage->extents.y1 = MAXSHORT;
@@ -188,8 +356,10 @@ static struct sna_damage *_sna_damage_create(void)
 		if (damage == NULL)
 			return NULL;
 	}
+	damage->dirty = false;
 	reset_embedded_box(damage);
 	damage->mode = DAMAGE_ADD;
+	damage->tiles = NULL;
 	pixman_region_init(&damage->region);
 	reset_extents(damage);
 
@@ -210,6 +380,256 @@ static void free_list(struct list *head)
 	}
 }
 
+#define TILE_SHIFT 6
+#define TILE_SIZE (1 << TILE_SHIFT)
+#define TILE_ALIGN 16 /* cells, leaving room for the damage to grow */
+#define TILE_THRESHOLD 256 /* rectangles in the reduced region */
+
+struct sna_damage_tiles {
+	int width, height; /* in cells, from the origin */
+	int stride; /* in words */
+	uint32_t *touched; /* the cell may contain damage */
+	uint32_t *full; /* every pixel in the cell is damaged */
+};
+
+static inline uint32_t tiles_mask(int x, int x2)
+{
+	int n = x2 - x;
+	if (n > 32 - (x & 31))
+		n = 32 - (x & 31);
+	return (n == 32 ? ~0U : (1U << n) - 1) << (x & 31);
+}
+
+static void tiles_set(uint32_t *row, int x1, int x2)
+{
+	for (; x1 < x2; x1 = (x1 | 31) + 1)
+		row[x1 >> 5] |= tiles_mask(x1, x2);
+}
+
+static void tiles_clear(uint32_t *row, int x1, int x2)
+{
+	for (; x1 < x2; x1 = (x1 | 31) + 1)
+		row[x1 >> 5] &= ~tiles_mask(x1, x2);
+}
+
+static bool tiles_any(const uint32_t *row, int x1, int x2)
+{
+	for (; x1 < x2; x1 = (x1 | 31) + 1)
+		if (row[x1 >> 5] & tiles_mask(x1, x2))
+			return true;
+	return false;
+}
+
+static bool tiles_all(const uint32_t *row, int x1, int x2)
+{
+	for (; x1 < x2; x1 = (x1 | 31) + 1) {
+		uint32_t mask = tiles_mask(x1, x2);
+		if ((row[x1 >> 5] & mask) != mask)
+			return false;
+	}
+	return true;
+}
+
+static void damage_tiles_fini(struct sna_damage *damage)
+{
+	free(damage->tiles);
+	damage->tiles = NULL;
+}
+
+static void damage_tiles_add_box(struct sna_damage *damage, const BoxRec *box)
+{
+	struct sna_damage_tiles *t = damage->tiles;
+	int x1, x2, y1, y2, y;
+
+	if (t == NULL)
+		return;
+
+	if (box->x1 < 0 || box->x2 > t->width << TILE_SHIFT ||
+	    box->y1 < 0 || box->y2 > t->height << TILE_SHIFT) {
+		DBG(("%s: (%d, %d), (%d, %d) is outside the %dx%d index, discarding\n",
+		     __FUNCTION__, box->x1, box->y1, box->x2, box->y2,
+		     t->width << TILE_SHIFT, t->height << TILE_SHIFT));
+		damage_tiles_fini(damage);
+		return;
+	}
+
+	x1 = box->x1 >> TILE_SHIFT;
+	x2 = (box->x2 + TILE_SIZE - 1) >> TILE_SHIFT;
+	y1 = box->y1 >> TILE_SHIFT;
+	y2 = (box->y2 + TILE_SIZE - 1) >> TILE_SHIFT;
+	for (y = y1; y < y2; y++)
+		tiles_set(t->touched + y * t->stride, x1, x2);
+
+	x1 = (box->x1 + TILE_SIZE - 1) >> TILE_SHIFT;
+	x2 = box->x2 >> TILE_SHIFT;
+	y1 = (box->y1 + TILE_SIZE - 1) >> TILE_SHIFT;
+	y2 = box->y2 >> TILE_SHIFT;
+	if (x1 < x2) {
+		for (y = y1; y < y2; y++)
+			tiles_set(t->full + y * t->stride, x1, x2);
+	}
+}
+
+static void damage_tiles_add_boxes(struct sna_damage *damage,
+				   const BoxRec *box, int n,
+				   int16_t dx, int16_t dy)
+{
+	for (; n-- && damage->tiles; box++) {
+		BoxRec b;
+
+		b.x1 = box->x1 + dx;
+		b.x2 = box->x2 + dx;
+		b.y1 = box->y1 + dy;
+		b.y2 = box->y2 + dy;
+		damage_tiles_add_box(damage, &b);
+	}
+}
+
+static void damage_tiles_subtract_box(struct sna_damage *damage,
+				      const BoxRec *box)
+{
+	struct sna_damage_tiles *t = damage->tiles;
+	int bx1, bx2, by1, by2;
+	int x1, x2, y1, y2, y;
+
+	if (t == NULL)
+		return;
+
+	/* Nothing is ever recorded outside of the index */
+	bx1 = MAX(box->x1, 0);
+	by1 = MAX(box->y1, 0);
+	bx2 = MIN(box->x2, t->width << TILE_SHIFT);
+	by2 = MIN(box->y2, t->height << TILE_SHIFT);
+	if (bx1 >= bx2 || by1 >= by2)
+		return;
+
+	/* Any cell we cut into is no longer full... */
+	x1 = bx1 >> TILE_SHIFT;
+	x2 = (bx2 + TILE_SIZE - 1) >> TILE_SHIFT;
+	y1 = by1 >> TILE_SHIFT;
+	y2 = (by2 + TILE_SIZE - 1) >> TILE_SHIFT;
+	for (y = y1; y < y2; y++)
+		tiles_clear(t->full + y * t->stride, x1, x2);
+
+	/* ...and any cell we cover is now clean */
+	x1 = (bx1 + TILE_SIZE - 1) >> TILE_SHIFT;
+	x2 = bx2 >> TILE_SHIFT;
+	y1 = (by1 + TILE_SIZE - 1) >> TILE_SHIFT;
+	y2 = by2 >> TILE_SHIFT;
+	if (x1 < x2) {
+		for (y = y1; y < y2; y++)
+			tiles_clear(t->touched + y * t->stride, x1, x2);
+	}
+}
+
+static void damage_tiles_subtract_boxes(struct sna_damage *damage,
+					const BoxRec *box, int n,
+					int dx, int dy)
+{
+	for (; n-- && damage->tiles; box++) {
+		BoxRec b;
+
+		b.x1 = box->x1 + dx;
+		b.x2 = box->x2 + dx;
+		b.y1 = box->y1 + dy;
+		b.y2 = box->y2 + dy;
+		damage_tiles_subtract_box(damage, &b);
+	}
+}
+
+/* Returns PIXMAN_REGION_IN, _OUT or _PART if the index alone can tell,
+ * or -1 if the exact region must be consulted.
+ */
+static int damage_tiles_contains_box(const struct sna_damage_tiles *t,
+				     const BoxRec *box)
+{
+	bool any_touched = false, all_touched = true;
+	bool any_full = false, all_full = true;
+	int x1, x2, y1, y2, y;
+
+	x1 = box->x1 >> TILE_SHIFT;
+	x2 = (box->x2 + TILE_SIZE - 1) >> TILE_SHIFT;
+	y1 = box->y1 >> TILE_SHIFT;
+	y2 = (box->y2 + TILE_SIZE - 1) >> TILE_SHIFT;
+	if (x1 < 0 || x2 > t->width || y1 < 0 || y2 > t->height) {
+		all_touched = all_full = false;
+		x1 = MAX(x1, 0);
+		x2 = MIN(x2, t->width);
+		y1 = MAX(y1, 0);
+		y2 = MIN(y2, t->height);
+		if (x1 >= x2 || y1 >= y2)
+			return PIXMAN_REGION_OUT;
+	}
+
+	for (y = y1; y < y2; y++) {
+		const uint32_t *touched = t->touched + y * t->stride;
+		const uint32_t *full = t->full + y * t->stride;
+
+		if (!any_touched)
+			any_touched = tiles_any(touched, x1, x2);
+		if (all_touched)
+			all_touched = tiles_all(touched, x1, x2);
+		if (!any_full)
+			any_full = tiles_any(full, x1, x2);
+		if (all_full)
+			all_full = tiles_all(full, x1, x2);
+	}
+
+	if (!any_touched)
+		return PIXMAN_REGION_OUT;
+	if (all_full)
+		return PIXMAN_REGION_IN;
+	if (any_full && !all_touched)
+		return PIXMAN_REGION_PART;
+
+	return -1;
+}
+
+static void damage_tiles_init(struct sna_damage *damage)
+{
+	struct sna_damage_tiles *t;
+	const BoxRec *box;
+	int width, height, stride, n;
+
+	assert(damage->tiles == NULL);
+	assert(!damage->dirty);
+
+	if (damage->extents.x1 < 0 || damage->extents.y1 < 0)
+		return;
+
+	width = ALIGN((damage->extents.x2 + TILE_SIZE - 1) >> TILE_SHIFT, TILE_ALIGN);
+	height = ALIGN((damage->extents.y2 + TILE_SIZE - 1) >> TILE_SHIFT, TILE_ALIGN);
+	stride = (width + 31) >> 5;
+
+	t = calloc(1, sizeof(*t) + 2 * stride * height * sizeof(uint32_t));
+	if (t == NULL)
+		return;
+
+	t->width = width;
+	t->height = height;
+	t->stride = stride;
+	t->touched = (uint32_t *)(t + 1);
+	t->full = t->touched + stride * height;
+	damage->tiles = t;
+
+	n = region_num_rects(&damage->region);
+	box = region_rects(&damage->region);
+	DBG(("%s: indexing %d boxes into %dx%d cells\n",
+	     __FUNCTION__, n, width, height));
+	damage_tiles_add_boxes(damage, box, n, 0, 0);
+}
+
+/* Only index a freshly reduced region, from the queries: the mutators
+ * may reduce midway through an operation that has already been applied
+ * to the index.
+ */
+static void damage_tiles_check(struct sna_damage *damage)
+{
+	if (damage->tiles == NULL && !damage->dirty &&
+	    region_num_rects(&damage->region) > TILE_THRESHOLD)
+		damage_tiles_init(damage);
+}
+
 static void __sna_damage_reduce(struct sna_damage *damage)
 {
 	int n, nboxes;
@@ -222,17 +642,15 @@ static void __sna_damage_reduce(struct sna_damage *damage)
 
 	DBG(("    reduce: before region.n=%d\n", region_num_rects(region)));
 
-	nboxes = damage->embedded_box.size;
-	list_for_each_entry(iter, &damage->embedded_box.list, list)
-		nboxes += iter->size;
+	nboxes = pending_boxes(damage);
 	DBG(("   nboxes=%d, residual=%d\n", nboxes, damage->remain));
-	nboxes -= damage->remain;
 	if (nboxes == 0)
 		goto done;
 	if (nboxes == 1) {
 		pixman_region16_t tmp;
 
-		tmp.extents = damage->embedded_box.box[0];
+		/* the oldest blocks may already be merged */
+		tmp.extents = damage->box[-1];
 		tmp.data = NULL;
 
 		if (damage->mode == DAMAGE_ADD)
@@ -286,10 +704,11 @@ static void __sna_damage_reduce(struct sna_damage *damage)
 						  list);
 			}
 
-			DBG(("   copying embedded boxes to %d\n", n));
+			DBG(("   copying %d embedded boxes to %d\n",
+			     damage->embedded_box.size, n));
 			memcpy(boxes + n,
 			       damage->embedded_box.box,
-			       sizeof(damage->embedded_box.box));
+			       damage->embedded_box.size*sizeof(BoxRec));
 			n += damage->embedded_box.size;
 		}
 	}
@@ -335,14 +754,98 @@ done:
 	DBG(("    reduce: after region.n=%d\n", region_num_rects(region)));
 }
 
+#define REDUCE_BLOCK 1024 /* boxes, largest block for pending damage */
+#define REDUCE_PENDING 4096 /* boxes left pending before merging blocks */
+
+/* Merge the oldest blocks of pending boxes into the region until at least
+ * budget boxes have been merged, leaving the block currently being filled.
+ * With all, finish by reducing that block as well. Returns the number of
+ * boxes merged.
+ */
+static int __sna_damage_reduce_step(struct sna_damage *damage,
+				    int budget, bool all)
+{
+	struct sna_damage_box *iter;
+	pixman_region16_t tmp;
+	BoxPtr boxes;
+	int n, count = 0;
+
+	assert(damage->mode != DAMAGE_ALL);
+	assert(damage->dirty);
+
+	while (!list_is_empty(&damage->embedded_box.list)) {
+		if (damage->embedded_box.size) {
+			iter = NULL;
+			boxes = damage->embedded_box.box;
+			n = damage->embedded_box.size;
+			damage->embedded_box.size = 0;
+		} else {
+			iter = list_first_entry(&damage->embedded_box.list,
+						struct sna_damage_box,
+						list);
+			if (iter == last_box(damage))
+				break;
+
+			boxes = (BoxPtr)(iter + 1);
+			n = iter->size;
+		}
+
+		DBG(("    %s: merging %d boxes into region.n=%d\n",
+		     __FUNCTION__, n, region_num_rects(&damage->region)));
+		pixman_region_init_rects(&tmp, boxes, n);
+		if (damage->mode == DAMAGE_ADD)
+			pixman_region_union(&damage->region,
+					    &damage->region, &tmp);
+		else
+			pixman_region_subtract(&damage->region,
+					       &damage->region, &tmp);
+		pixman_region_fini(&tmp);
+
+		if (iter) {
+			list_del(&iter->list);
+			free(iter);
+		}
+
+		count += n;
+		if (count >= budget)
+			return count;
+	}
+
+	if (all) {
+		count += pending_boxes(damage);
+		__sna_damage_reduce(damage);
+	}
+
+	return count;
+}
+
+bool sna_damage_reduce_idle(int budget)
+{
+	while (budget > 0 && !list_is_empty(&dirty_damage)) {
+		struct sna_damage *damage;
+
+		damage = list_first_entry(&dirty_damage,
+					  struct sna_damage,
+					  link);
+		budget -= __sna_damage_reduce_step(damage, budget, true);
+	}
+
+	return !list_is_empty(&dirty_damage);
+}
+
 static bool _sna_damage_create_boxes(struct sna_damage *damage,
 				     int count)
 {
 	struct sna_damage_box *box;
 	int n;
 
+	if (pending_boxes(damage) > REDUCE_PENDING)
+		__sna_damage_reduce_step(damage, REDUCE_BLOCK, false);
+
 	box = last_box(damage);
 	n = 4*box->size;
+	if (n > REDUCE_BLOCK)
+		n = REDUCE_BLOCK;
 	if (n < count)
 		n = ALIGN(count, 64);
 
@@ -380,7 +883,7 @@ restart:
 		memcpy(damage->box, boxes, n * sizeof(BoxRec));
 		damage->box += n;
 		damage->remain -= n;
-		damage->dirty = true;
+		mark_dirty(damage);
 
 		count -= n;
 		boxes += n;
@@ -408,7 +911,7 @@ restart:
 	memcpy(damage->box, boxes, count * sizeof(BoxRec));
 	damage->box += count;
 	damage->remain -= count;
-	damage->dirty = true;
+	mark_dirty(damage);
 	assert(damage->remain >= 0);
 
 	return damage;
@@ -437,7 +940,7 @@ restart:
 		}
 		damage->box += n;
 		damage->remain -= n;
-		damage->dirty = true;
+		mark_dirty(damage);
 
 		count -= n;
 		boxes += n;
@@ -470,7 +973,7 @@ restart:
 	}
 	damage->box += count;
 	damage->remain -= count;
-	damage->dirty = true;
+	mark_dirty(damage);
 	assert(damage->remain >= 0);
 
 	return damage;
@@ -500,7 +1003,7 @@ restart:
 		}
 		damage->box += n;
 		damage->remain -= n;
-		damage->dirty = true;
+		mark_dirty(damage);
 
 		count -= n;
 		r += n;
@@ -533,7 +1036,7 @@ restart:
 	}
 	damage->box += count;
 	damage->remain -= count;
-	damage->dirty = true;
+	mark_dirty(damage);
 	assert(damage->remain >= 0);
 
 	return damage;
@@ -563,7 +1066,7 @@ restart:
 		}
 		damage->box += n;
 		damage->remain -= n;
-		damage->dirty = true;
+		mark_dirty(damage);
 
 		count -= n;
 		p += n;
@@ -596,7 +1099,7 @@ restart:
 	}
 	damage->box += count;
 	damage->remain -= count;
-	damage->dirty = true;
+	mark_dirty(damage);
 	assert(damage->remain >= 0);
 
 	return damage;
@@ -658,6 +1161,8 @@ static struct sna_damage *__sna_damage_add_box(struct sna_damage *damage,
 		break;
 	}
 
+	damage_tiles_add_box(damage, box);
+
 	if (region_is_singular_or_empty(&damage->region) ||
 	    box_contains_region(box, &damage->region)) {
 		_pixman_region_union_box(&damage->region, box);
@@ -696,6 +1201,10 @@ inline static struct sna_damage *__sna_damage_add(struct sna_damage *damage,
 	if (region_is_singular(region))
 		return __sna_damage_add_box(damage, &region->extents);
 
+	damage_tiles_add_boxes(damage,
+			       region_rects(region), region_num_rects(region),
+			       0, 0);
+
 	if (region_is_singular_or_empty(&damage->region)) {
 		pixman_region_union(&damage->region, &damage->region, region);
 		assert(damage->region.extents.x2 > damage->region.extents.x1);
@@ -718,6 +1227,7 @@ inline static struct sna_damage *__sna_damage_add(struct sna_damage *damage,
 fastcall struct sna_damage *_sna_damage_add(struct sna_damage *damage,
 					    RegionPtr region)
 {
+	struct sna_damage *in = NULL;
 	char region_buf[120];
 	char damage_buf[1000];
 
@@ -725,7 +1235,11 @@ fastcall struct sna_damage *_sna_damage_add(struct sna_damage *damage,
 	     _debug_describe_damage(damage_buf, sizeof(damage_buf), damage),
 	     _debug_describe_region(region_buf, sizeof(region_buf), region)));
 
+	CAPTURE(in = damage);
 	damage = __sna_damage_add(damage, region);
+	CAPTURE(capture_boxes(DAMAGE_OP_ADD, in, capture_id(damage),
+			      region_rects(region), region_num_rects(region),
+			      0, 0));
 
 	DBG(("  = %s\n",
 	     _debug_describe_damage(damage_buf, sizeof(damage_buf), damage)));
@@ -739,7 +1253,11 @@ fastcall struct sna_damage *_sna_damage_add(struct sna_damage *damage,
 fastcall struct sna_damage *_sna_damage_add(struct sna_damage *damage,
 					    RegionPtr region)
 {
-	return __sna_damage_add(damage, region);
+	struct sna_damage *ret = __sna_damage_add(damage, region);
+	CAPTURE(capture_boxes(DAMAGE_OP_ADD, damage, capture_id(ret),
+			      region_rects(region), region_num_rects(region),
+			      0, 0));
+	return ret;
 }
 #endif
 
@@ -790,6 +1308,8 @@ __sna_damage_add_boxes(struct sna_damage *damage,
 	if (n == 1)
 		return __sna_damage_add_box(damage, &extents);
 
+	damage_tiles_add_boxes(damage, box, n, dx, dy);
+
 	if (pixman_region_contains_rectangle(&damage->region,
 					     &extents) == PIXMAN_REGION_IN)
 		return damage;
@@ -803,13 +1323,17 @@ struct sna_damage *_sna_damage_add_boxes(struct sna_damage *damage,
 					 const BoxRec *b, int n,
 					 int16_t dx, int16_t dy)
 {
+	struct sna_damage *in = NULL;
 	char damage_buf[1000];
 
 	DBG(("%s(%s + [(%d, %d), (%d, %d) ... x %d])\n", __FUNCTION__,
 	     _debug_describe_damage(damage_buf, sizeof(damage_buf), damage),
 	     b->x1, b->y1, b->x2, b->y2, n));
 
+	CAPTURE(in = damage);
 	damage = __sna_damage_add_boxes(damage, b, n, dx, dy);
+	CAPTURE(capture_boxes(DAMAGE_OP_ADD, in, capture_id(damage),
+			      b, n, dx, dy));
 
 	DBG(("  = %s\n",
 	     _debug_describe_damage(damage_buf, sizeof(damage_buf), damage)));
@@ -825,7 +1349,10 @@ struct sna_damage *_sna_damage_add_boxes(struct sna_damage *damage,
 					 const BoxRec *b, int n,
 					 int16_t dx, int16_t dy)
 {
-	return __sna_damage_add_boxes(damage, b, n, dx, dy);
+	struct sna_damage *ret = __sna_damage_add_boxes(damage, b, n, dx, dy);
+	CAPTURE(capture_boxes(DAMAGE_OP_ADD, damage, capture_id(ret),
+			      b, n, dx, dy));
+	return ret;
 }
 #endif
 
@@ -879,6 +1406,16 @@ __sna_damage_add_rectangles(struct sna_damage *damage,
 		break;
 	}
 
+	for (i = 0; i < n && damage->tiles; i++) {
+		BoxRec b;
+
+		b.x1 = r[i].x + dx;
+		b.x2 = b.x1 + r[i].width;
+		b.y1 = r[i].y + dy;
+		b.y2 = b.y1 + r[i].height;
+		damage_tiles_add_box(damage, &b);
+	}
+
 	if (pixman_region_contains_rectangle(&damage->region,
 					     &extents) == PIXMAN_REGION_IN)
 		return damage;
@@ -892,13 +1429,16 @@ struct sna_damage *_sna_damage_add_rectangles(struct sna_damage *damage,
 					      const xRectangle *r, int n,
 					      int16_t dx, int16_t dy)
 {
+	struct sna_damage *in = NULL;
 	char damage_buf[1000];
 
 	DBG(("%s(%s + [(%d, %d)x(%d, %d) ... x %d])\n", __FUNCTION__,
 	     _debug_describe_damage(damage_buf, sizeof(damage_buf), damage),
 	     r->x, r->y, r->width, r->height, n));
 
+	CAPTURE(in = damage);
 	damage = __sna_damage_add_rectangles(damage, r, n, dx, dy);
+	CAPTURE(capture_rectangles(in, capture_id(damage), r, n, dx, dy));
 
 	DBG(("  = %s\n",
 	     _debug_describe_damage(damage_buf, sizeof(damage_buf), damage)));
@@ -914,7 +1454,9 @@ struct sna_damage *_sna_damage_add_rectangles(struct sna_damage *damage,
 					      const xRectangle *r, int n,
 					      int16_t dx, int16_t dy)
 {
-	return __sna_damage_add_rectangles(damage, r, n, dx, dy);
+	struct sna_damage *ret = __sna_damage_add_rectangles(damage, r, n, dx, dy);
+	CAPTURE(capture_rectangles(damage, capture_id(ret), r, n, dx, dy));
+	return ret;
 }
 #endif
 
@@ -963,6 +1505,16 @@ __sna_damage_add_points(struct sna_damage *damage,
 		break;
 	}
 
+	for (i = 0; i < n && damage->tiles; i++) {
+		BoxRec b;
+
+		b.x1 = p[i].x + dx;
+		b.x2 = b.x1 + 1;
+		b.y1 = p[i].y + dy;
+		b.y2 = b.y1 + 1;
+		damage_tiles_add_box(damage, &b);
+	}
+
 	if (pixman_region_contains_rectangle(&damage->region,
 					     &extents) == PIXMAN_REGION_IN)
 		return damage;
@@ -976,13 +1528,16 @@ struct sna_damage *_sna_damage_add_points(struct sna_damage *damage,
 					  const DDXPointRec *p, int n,
 					  int16_t dx, int16_t dy)
 {
+	struct sna_damage *in = NULL;
 	char damage_buf[1000];
 
 	DBG(("%s(%s + [(%d, %d) ... x %d])\n", __FUNCTION__,
 	     _debug_describe_damage(damage_buf, sizeof(damage_buf), damage),
 	     p->x, p->y, n));
 
+	CAPTURE(in = damage);
 	damage = __sna_damage_add_points(damage, p, n, dx, dy);
+	CAPTURE(capture_points(in, capture_id(damage), p, n, dx, dy));
 
 	DBG(("  = %s\n",
 	     _debug_describe_damage(damage_buf, sizeof(damage_buf), damage)));
@@ -998,7 +1553,9 @@ struct sna_damage *_sna_damage_add_points(struct sna_damage *damage,
 					  const DDXPointRec *p, int n,
 					  int16_t dx, int16_t dy)
 {
-	return __sna_damage_add_points(damage, p, n, dx, dy);
+	struct sna_damage *ret = __sna_damage_add_points(damage, p, n, dx, dy);
+	CAPTURE(capture_points(damage, capture_id(ret), p, n, dx, dy));
+	return ret;
 }
 #endif
 
@@ -1006,13 +1563,17 @@ struct sna_damage *_sna_damage_add_points(struct sna_damage *damage,
 fastcall struct sna_damage *_sna_damage_add_box(struct sna_damage *damage,
 						const BoxRec *box)
 {
+	struct sna_damage *in = NULL;
 	char damage_buf[1000];
 
 	DBG(("%s(%s + [(%d, %d), (%d, %d)])\n", __FUNCTION__,
 	     _debug_describe_damage(damage_buf, sizeof(damage_buf), damage),
 	     box->x1, box->y1, box->x2, box->y2));
 
+	CAPTURE(in = damage);
 	damage = __sna_damage_add_box(damage, box);
+	CAPTURE(capture_boxes(DAMAGE_OP_ADD, in, capture_id(damage),
+			      box, 1, 0, 0));
 
 	DBG(("  = %s\n",
 	     _debug_describe_damage(damage_buf, sizeof(damage_buf), damage)));
@@ -1026,7 +1587,10 @@ fastcall struct sna_damage *_sna_damage_add_box(struct sna_damage *damage,
 fastcall struct sna_damage *_sna_damage_add_box(struct sna_damage *damage,
 						const BoxRec *box)
 {
-	return __sna_damage_add_box(damage, box);
+	struct sna_damage *ret = __sna_damage_add_box(damage, box);
+	CAPTURE(capture_boxes(DAMAGE_OP_ADD, damage, capture_id(ret),
+			      box, 1, 0, 0));
+	return ret;
 }
 #endif
 
@@ -1039,6 +1603,7 @@ struct sna_damage *__sna_damage_all(struct sna_damage *damage,
 		pixman_region_fini(&damage->region);
 		free_list(&damage->embedded_box.list);
 		reset_embedded_box(damage);
+		damage_tiles_fini(damage);
 	} else {
 		damage = _sna_damage_create();
 		if (damage == NULL)
@@ -1048,6 +1613,8 @@ struct sna_damage *__sna_damage_all(struct sna_damage *damage,
 	pixman_region_init_rect(&damage->region, 0, 0, width, height);
 	damage->extents = damage->region.extents;
 	damage->mode = DAMAGE_ALL;
+	CAPTURE(capture_boxes(DAMAGE_OP_ALL, damage, capture_id(damage),
+			      &damage->extents, 1, 0, 0));
 
 	return damage;
 }
@@ -1130,6 +1697,10 @@ no_damage:
 		return damage;
 	}
 
+	damage_tiles_subtract_boxes(damage,
+				    region_rects(region), region_num_rects(region),
+				    0, 0);
+
 	if (damage->mode != DAMAGE_SUBTRACT) {
 		if (damage->dirty) {
 			__sna_damage_reduce(damage);
@@ -1165,6 +1736,7 @@ no_damage:
 fastcall struct sna_damage *_sna_damage_subtract(struct sna_damage *damage,
 						 RegionPtr region)
 {
+	struct sna_damage *in = NULL;
 	char damage_buf[1000];
 	char region_buf[120];
 
@@ -1172,7 +1744,11 @@ fastcall struct sna_damage *_sna_damage_subtract(struct sna_damage *damage,
 	       _debug_describe_damage(damage_buf, sizeof(damage_buf), damage),
 	       _debug_describe_region(region_buf, sizeof(region_buf), region)));
 
+	CAPTURE(in = damage);
 	damage = __sna_damage_subtract(damage, region);
+	CAPTURE(capture_boxes(DAMAGE_OP_SUBTRACT, in, capture_id(damage),
+			      region_rects(region), region_num_rects(region),
+			      0, 0));
 
 	DBG(("  = %s\n",
 	     _debug_describe_damage(damage_buf, sizeof(damage_buf), damage)));
@@ -1183,7 +1759,11 @@ fastcall struct sna_damage *_sna_damage_subtract(struct sna_damage *damage,
 fastcall struct sna_damage *_sna_damage_subtract(struct sna_damage *damage,
 						 RegionPtr region)
 {
-	return __sna_damage_subtract(damage, region);
+	struct sna_damage *ret = __sna_damage_subtract(damage, region);
+	CAPTURE(capture_boxes(DAMAGE_OP_SUBTRACT, damage, capture_id(ret),
+			      region_rects(region), region_num_rects(region),
+			      0, 0));
+	return ret;
 }
 #endif
 
@@ -1208,6 +1788,8 @@ inline static struct sna_damage *__sna_damage_subtract_box(struct sna_damage *da
 		return NULL;
 	}
 
+	damage_tiles_subtract_box(damage, box);
+
 	if (damage->mode != DAMAGE_SUBTRACT) {
 		if (damage->dirty) {
 			__sna_damage_reduce(damage);
@@ -1236,13 +1818,17 @@ inline static struct sna_damage *__sna_damage_subtract_box(struct sna_damage *da
 fastcall struct sna_damage *_sna_damage_subtract_box(struct sna_damage *damage,
 						     const BoxRec *box)
 {
+	struct sna_damage *in = NULL;
 	char damage_buf[1000];
 
 	DBG(("%s(%s - (%d, %d), (%d, %d))...\n", __FUNCTION__,
 	     _debug_describe_damage(damage_buf, sizeof(damage_buf), damage),
 	     box->x1, box->y1, box->x2, box->y2));
 
+	CAPTURE(in = damage);
 	damage = __sna_damage_subtract_box(damage, box);
+	CAPTURE(capture_boxes(DAMAGE_OP_SUBTRACT, in, capture_id(damage),
+			      box, 1, 0, 0));
 
 	DBG(("  = %s\n",
 	     _debug_describe_damage(damage_buf, sizeof(damage_buf), damage)));
@@ -1253,7 +1839,10 @@ fastcall struct sna_damage *_sna_damage_subtract_box(struct sna_damage *damage,
 fastcall struct sna_damage *_sna_damage_subtract_box(struct sna_damage *damage,
 						     const BoxRec *box)
 {
-	return __sna_damage_subtract_box(damage, box);
+	struct sna_damage *ret = __sna_damage_subtract_box(damage, box);
+	CAPTURE(capture_boxes(DAMAGE_OP_SUBTRACT, damage, capture_id(ret),
+			      box, 1, 0, 0));
+	return ret;
 }
 #endif
 
@@ -1301,6 +1890,8 @@ static struct sna_damage *__sna_damage_subtract_boxes(struct sna_damage *damage,
 	if (n == 1)
 		return __sna_damage_subtract_box(damage, &extents);
 
+	damage_tiles_subtract_boxes(damage, box, n, dx, dy);
+
 	if (damage->mode != DAMAGE_SUBTRACT) {
 		if (damage->dirty) {
 			__sna_damage_reduce(damage);
@@ -1318,6 +1909,7 @@ fastcall struct sna_damage *_sna_damage_subtract_boxes(struct sna_damage *damage
 						       const BoxRec *box, int n,
 						       int dx, int dy)
 {
+	struct sna_damage *in = NULL;
 	char damage_buf[1000];
 
 	DBG(("%s(%s - [(%d,%d), (%d,%d)...x%d])...\n", __FUNCTION__,
@@ -1326,7 +1918,10 @@ fastcall struct sna_damage *_sna_damage_subtract_boxes(struct sna_damage *damage
 	     box->x2 + dx, box->y2 + dy,
 	     n));
 
+	CAPTURE(in = damage);
 	damage = __sna_damage_subtract_boxes(damage, box, n, dx, dy);
+	CAPTURE(capture_boxes(DAMAGE_OP_SUBTRACT, in, capture_id(damage),
+			      box, n, dx, dy));
 
 	DBG(("  = %s\n",
 	     _debug_describe_damage(damage_buf, sizeof(damage_buf), damage)));
@@ -1338,16 +1933,63 @@ fastcall struct sna_damage *_sna_damage_subtract_boxes(struct sna_damage *damage
 						       const BoxRec *box, int n,
 						       int dx, int dy)
 {
-	return __sna_damage_subtract_boxes(damage, box, n, dx, dy);
+	struct sna_damage *ret = __sna_damage_subtract_boxes(damage, box, n, dx, dy);
+	CAPTURE(capture_boxes(DAMAGE_OP_SUBTRACT, damage, capture_id(ret),
+			      box, n, dx, dy));
+	return ret;
 }
 #endif
 
+static bool box_overlaps(const BoxRec *a, const BoxRec *b)
+{
+	return (a->x1 < b->x2 && a->x2 > b->x1 &&
+		a->y1 < b->y2 && a->y2 > b->y1);
+}
+
+/* Whether a pending box covers box (IN), only overlaps it (PART) or
+ * misses it entirely (OUT).
+ */
+static int pending_contains_box(const struct sna_damage *damage,
+				const BoxRec *box)
+{
+	const struct sna_damage_box *iter;
+	const BoxRec *b;
+	int n, count, ret = PIXMAN_REGION_OUT;
+
+	count = damage->embedded_box.size;
+	if (list_is_empty(&damage->embedded_box.list))
+		count -= damage->remain;
+
+	b = damage->embedded_box.box;
+	for (n = 0; n < count; n++) {
+		if (box_contains(&b[n], box))
+			return PIXMAN_REGION_IN;
+		if (box_overlaps(&b[n], box))
+			ret = PIXMAN_REGION_PART;
+	}
+
+	list_for_each_entry(iter, &damage->embedded_box.list, list) {
+		count = iter->size;
+		if (iter->list.next == &damage->embedded_box.list)
+			count -= damage->remain;
+
+		b = (const BoxRec *)(iter + 1);
+		for (n = 0; n < count; n++) {
+			if (box_contains(&b[n], box))
+				return PIXMAN_REGION_IN;
+			if (box_overlaps(&b[n], box))
+				ret = PIXMAN_REGION_PART;
+		}
+	}
+
+	return ret;
+}
+
 static int __sna_damage_contains_box(struct sna_damage **_damage,
 				     const BoxRec *box)
 {
 	struct sna_damage *damage = *_damage;
-	const BoxRec *b;
-	int n, count, ret;
+	int ret, pending;
 
 	if (damage->mode == DAMAGE_ALL)
 		return PIXMAN_REGION_IN;
@@ -1355,36 +1997,35 @@ static int __sna_damage_contains_box(struct sna_damage **_damage,
 	if (!sna_damage_overlaps_box(damage, box))
 		return PIXMAN_REGION_OUT;
 
+	if (damage->tiles) {
+		ret = damage_tiles_contains_box(damage->tiles, box);
+		if (ret >= 0)
+			return ret;
+	}
+
 	ret = pixman_region_contains_rectangle(&damage->region, (BoxPtr)box);
 	if (!damage->dirty)
 		return ret;
 
+	/* The answer only changes if a pending box overlaps */
 	if (damage->mode == DAMAGE_ADD) {
 		if (ret == PIXMAN_REGION_IN)
 			return ret;
 
-		count = damage->embedded_box.size;
-		if (list_is_empty(&damage->embedded_box.list))
-			count -= damage->remain;
-
-		b = damage->embedded_box.box;
-		for (n = 0; n < count; n++) {
-			if (box_contains(&b[n], box))
-				return PIXMAN_REGION_IN;
-		}
+		pending = pending_contains_box(damage, box);
+		if (pending == PIXMAN_REGION_IN)
+			return PIXMAN_REGION_IN;
+		if (pending == PIXMAN_REGION_OUT)
+			return ret;
 	} else {
 		if (ret == PIXMAN_REGION_OUT)
 			return ret;
 
-		count = damage->embedded_box.size;
-		if (list_is_empty(&damage->embedded_box.list))
-			count -= damage->remain;
-
-		b = damage->embedded_box.box;
-		for (n = 0; n < count; n++) {
-			if (box_contains(&b[n], box))
-				return PIXMAN_REGION_OUT;
-		}
+		pending = pending_contains_box(damage, box);
+		if (pending == PIXMAN_REGION_IN)
+			return PIXMAN_REGION_OUT;
+		if (pending == PIXMAN_REGION_OUT)
+			return ret;
 	}
 
 	__sna_damage_reduce(damage);
@@ -1393,6 +2034,7 @@ static int __sna_damage_contains_box(struct sna_damage **_damage,
 		*_damage = NULL;
 		return PIXMAN_REGION_OUT;
 	}
+	damage_tiles_check(damage);
 
 	return pixman_region_contains_rectangle(&damage->region, (BoxPtr)box);
 }
@@ -1401,6 +2043,7 @@ static int __sna_damage_contains_box(struct sna_damage **_damage,
 int _sna_damage_contains_box(struct sna_damage **damage,
 			     const BoxRec *box)
 {
+	struct sna_damage *in = *damage;
 	char damage_buf[1000];
 	int ret;
 
@@ -1409,6 +2052,7 @@ int _sna_damage_contains_box(struct sna_damage **damage,
 	     box->x1, box->y1, box->x2, box->y2));
 
 	ret = __sna_damage_contains_box(damage, box);
+	CAPTURE(capture_boxes(DAMAGE_OP_CONTAINS, in, ret, box, 1, 0, 0));
 	DBG(("  = %d", ret));
 	if (ret)
 		DBG((" [(%d, %d), (%d, %d)...]",
@@ -1421,26 +2065,28 @@ int _sna_damage_contains_box(struct sna_damage **damage,
 int _sna_damage_contains_box(struct sna_damage **damage,
 			     const BoxRec *box)
 {
-	return __sna_damage_contains_box(damage, box);
+	struct sna_damage *in = *damage;
+	int ret = __sna_damage_contains_box(damage, box);
+	CAPTURE(capture_boxes(DAMAGE_OP_CONTAINS, in, ret, box, 1, 0, 0));
+	return ret;
 }
 #endif
 
-static bool box_overlaps(const BoxRec *a, const BoxRec *b)
-{
-	return (a->x1 < b->x2 && a->x2 > b->x1 &&
-		a->y1 < b->y2 && a->y2 > b->y1);
-}
-
 bool _sna_damage_contains_box__no_reduce(const struct sna_damage *damage,
 					 const BoxRec *box)
 {
-	int n, count;
-	const BoxRec *b;
+	int n;
 
 	assert(damage && damage->mode != DAMAGE_ALL);
 	if (!box_contains(&damage->extents, box))
 		return false;
 
+	if (damage->tiles) {
+		n = damage_tiles_contains_box(damage->tiles, box);
+		if (n >= 0)
+			return n == PIXMAN_REGION_IN;
+	}
+
 	n = pixman_region_contains_rectangle((pixman_region16_t *)&damage->region, (BoxPtr)box);
 	if (!damage->dirty)
 		return n == PIXMAN_REGION_IN;
@@ -1449,32 +2095,12 @@ bool _sna_damage_contains_box__no_reduce(const struct sna_damage *damage,
 		if (n == PIXMAN_REGION_IN)
 			return true;
 
-		count = damage->embedded_box.size;
-		if (list_is_empty(&damage->embedded_box.list))
-			count -= damage->remain;
-
-		b = damage->embedded_box.box;
-		for (n = 0; n < count; n++) {
-			if (box_contains(&b[n], box))
-				return true;
-		}
-
-		return false;
+		return pending_contains_box(damage, box) == PIXMAN_REGION_IN;
 	} else {
 		if (n != PIXMAN_REGION_IN)
 			return false;
 
-		if (!list_is_empty(&damage->embedded_box.list))
-			return false;
-
-		count = damage->embedded_box.size - damage->remain;
-		b = damage->embedded_box.box;
-		for (n = 0; n < count; n++) {
-			if (box_overlaps(&b[n], box))
-				return false;
-		}
-
-		return true;
+		return pending_contains_box(damage, box) == PIXMAN_REGION_OUT;
 	}
 }
 
@@ -1492,11 +2118,17 @@ static bool __sna_damage_intersect(struct sna_damage *damage,
 	    region->extents.y1 >= damage->extents.y2)
 		return false;
 
+	if (damage->tiles &&
+	    damage_tiles_contains_box(damage->tiles,
+				      &region->extents) == PIXMAN_REGION_OUT)
+		return false;
+
 	if (damage->dirty)
 		__sna_damage_reduce(damage);
 
 	if (!pixman_region_not_empty(&damage->region))
 		return false;
+	damage_tiles_check(damage);
 
 	RegionNull(result);
 	RegionIntersect(result, &damage->region, region);
@@ -1517,6 +2149,9 @@ bool _sna_damage_intersect(struct sna_damage *damage,
 	     _debug_describe_region(region_buf, sizeof(region_buf), region)));
 
 	ret = __sna_damage_intersect(damage, region, result);
+	CAPTURE(capture_boxes(DAMAGE_OP_INTERSECT, damage, ret,
+			      region_rects(region), region_num_rects(region),
+			      0, 0));
 	if (ret)
 		DBG(("  = %s\n",
 		     _debug_describe_region(region_buf, sizeof(region_buf), result)));
@@ -1529,7 +2164,11 @@ bool _sna_damage_intersect(struct sna_damage *damage,
 bool _sna_damage_intersect(struct sna_damage *damage,
 			  RegionPtr region, RegionPtr result)
 {
-	return __sna_damage_intersect(damage, region, result);
+	bool ret = __sna_damage_intersect(damage, region, result);
+	CAPTURE(capture_boxes(DAMAGE_OP_INTERSECT, damage, ret,
+			      region_rects(region), region_num_rects(region),
+			      0, 0));
+	return ret;
 }
 #endif
 
@@ -1542,6 +2181,7 @@ static int __sna_damage_get_boxes(struct sna_damage *damage, const BoxRec **boxe
 
 	assert(!damage->dirty);
 	assert(damage->mode == DAMAGE_ADD);
+	damage_tiles_check(damage);
 
 	*boxes = region_rects(&damage->region);
 	return region_num_rects(&damage->region);
@@ -1552,9 +2192,11 @@ struct sna_damage *_sna_damage_reduce(struct sna_damage *damage)
 	DBG(("%s\n", __FUNCTION__));
 
 	__sna_damage_reduce(damage);
+	CAPTURE(capture_op(DAMAGE_OP_REDUCE, damage, 0, 0));
 
 	assert(!damage->dirty);
 	assert(damage->mode == DAMAGE_ADD);
+	damage_tiles_check(damage);
 
 	if (!pixman_region_not_empty(&damage->region)) {
 		__sna_damage_destroy(damage);
@@ -1574,6 +2216,7 @@ int _sna_damage_get_boxes(struct sna_damage *damage, const BoxRec **boxes)
 	     _debug_describe_damage(damage_buf, sizeof(damage_buf), damage)));
 
 	count = __sna_damage_get_boxes(damage, boxes);
+	CAPTURE(capture_op(DAMAGE_OP_GET_BOXES, damage, count, 0));
 	DBG(("  = %d\n", count));
 
 	return count;
@@ -1581,7 +2224,9 @@ int _sna_damage_get_boxes(struct sna_damage *damage, const BoxRec **boxes)
 #else
 int _sna_damage_get_boxes(struct sna_damage *damage, const BoxRec **boxes)
 {
-	return __sna_damage_get_boxes(damage, boxes);
+	int count = __sna_damage_get_boxes(damage, boxes);
+	CAPTURE(capture_op(DAMAGE_OP_GET_BOXES, damage, count, 0));
+	return count;
 }
 #endif
 
@@ -1589,12 +2234,20 @@ struct sna_damage *_sna_damage_combine(struct sna_damage *l,
 				       struct sna_damage *r,
 				       int dx, int dy)
 {
+	struct sna_damage *in;
+
 	if (r->dirty)
 		__sna_damage_reduce(r);
 
 	if (pixman_region_not_empty(&r->region)) {
+		/* r is moved in place, so its index no longer applies */
+		damage_tiles_fini(r);
 		pixman_region_translate(&r->region, dx, dy);
+		in = l;
 		l = __sna_damage_add(l, &r->region);
+		CAPTURE(capture_boxes(DAMAGE_OP_ADD, in, capture_id(l),
+				      region_rects(&r->region),
+				      region_num_rects(&r->region), 0, 0));
 	}
 
 	return l;
@@ -1602,7 +2255,11 @@ struct sna_damage *_sna_damage_combine(struct sna_damage *l,
 
 void __sna_damage_destroy(struct sna_damage *damage)
 {
+	CAPTURE(capture_op(DAMAGE_OP_DESTROY, damage, 0, 0));
+	if (damage->dirty)
+		list_del(&damage->link);
 	free_list(&damage->embedded_box.list);
+	damage_tiles_fini(damage);
 
 	pixman_region_fini(&damage->region);
 	*(void **)damage = __freed_damage;
@@ -1814,17 +2471,14 @@ void _sna_damage_debug_get_region(struct sna_damage *damage, RegionRec *r)
 	if (!damage->dirty)
 		return;
 
-	nboxes = damage->embedded_box.size;
-	list_for_each_entry(iter, &damage->embedded_box.list, list)
-		nboxes += iter->size;
-	nboxes -= damage->remain;
+	nboxes = pending_boxes(damage);
 	if (nboxes == 0)
 		return;
 
 	if (nboxes == 1) {
 		pixman_region16_t tmp;
 
-		tmp.extents = damage->embedded_box.box[0];
+		tmp.extents = damage->box[-1];
 		tmp.data = NULL;
 
 		if (damage->mode == DAMAGE_ADD)
@@ -1867,7 +2521,7 @@ void _sna_damage_debug_get_region(struct sna_damage *damage, RegionRec *r)
 
 		memcpy(boxes + n,
 		       damage->embedded_box.box,
-		       sizeof(damage->embedded_box.box));
+		       damage->embedded_box.size*sizeof(BoxRec));
 		n += damage->embedded_box.size;
 	}
 
@@ -15,6 +15,8 @@ struct sna_damage {
 	} mode;
 	int remain, dirty;
 	BoxPtr box;
+	struct sna_damage_tiles *tiles; /* coarse index, see sna_damage.c */
+	struct list link; /* on the list for idle reduction whilst dirty */
 	struct {
 		struct list list;
 		int size;
@@ -328,6 +330,9 @@ static inline void sna_damage_destroy(struct sna_damage **damage)
 
 void _sna_damage_debug_get_region(struct sna_damage *damage, RegionRec *r);
 
+bool sna_damage_capture_init(const char *path);
+bool sna_damage_reduce_idle(int budget);
+
 #if HAS_DEBUG_FULL && TEST_DAMAGE
 void sna_damage_selftest(void);
 #else
@@ -0,0 +1,68 @@
+/*
+ * Copyright © 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef SNA_DAMAGE_CAPTURE_H
+#define SNA_DAMAGE_CAPTURE_H
+
+#include <stdint.h>
+
+/* With Option "DamageCapture", every call into sna_damage is appended
+ * to a trace file as it returns. The trace is in host byte order:
+ *
+ *   struct sna_damage_capture_header
+ *   for each call:
+ *     struct sna_damage_capture_op
+ *     BoxRec box[nbox]   (already offset by any dx, dy)
+ *
+ * and is replayed by damage-bench, see damage_bench.c.
+ */
+
+#define SNA_DAMAGE_CAPTURE_MAGIC 0x444e5321 /* "!SND" */
+#define SNA_DAMAGE_CAPTURE_VERSION 1
+
+struct sna_damage_capture_header {
+	uint32_t magic;
+	uint32_t version;
+};
+
+enum sna_damage_capture_type {
+	DAMAGE_OP_ADD = 0, /* box[] */
+	DAMAGE_OP_SUBTRACT, /* box[] */
+	DAMAGE_OP_ALL, /* box[0] is the pixmap */
+	DAMAGE_OP_CONTAINS, /* box[0], result is the answer */
+	DAMAGE_OP_INTERSECT, /* box[] of the region, result is the answer */
+	DAMAGE_OP_GET_BOXES, /* result is the number of boxes */
+	DAMAGE_OP_REDUCE,
+	DAMAGE_OP_DESTROY, /* also when an operation frees the damage */
+	NUM_DAMAGE_OPS
+};
+
+struct sna_damage_capture_op {
+	uint64_t damage; /* identifies the damage passed in, 0 for none */
+	uint64_t result; /* the damage returned by a mutator */
+	uint32_t type;
+	uint32_t nbox;
+};
+
+#endif /* SNA_DAMAGE_CAPTURE_H */
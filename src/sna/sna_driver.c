@@ -447,6 +447,127 @@ static void setup_dri(struct sna *sna)
 #endif
 }
 
+static void sna_setup_batch_limits(struct sna *sna)
+{
+	int max_exec = sna->kgem.max_exec;
+	int max_reloc = sna->kgem.max_reloc;
+	MessageType from = X_DEFAULT;
+
+	if (xf86GetOptValInteger(sna->Options, OPTION_BATCH_OBJECTS, &max_exec))
+		from = X_CONFIG;
+	if (xf86GetOptValInteger(sna->Options, OPTION_BATCH_RELOCS, &max_reloc))
+		from = X_CONFIG;
+
+	kgem_set_batch_limits(&sna->kgem, max_exec, max_reloc);
+	xf86DrvMsg(sna->scrn->scrnIndex, from,
+		   "Batches limited to %d objects and %d relocations\n",
+		   sna->kgem.max_exec, sna->kgem.max_reloc);
+}
+
+static void sna_setup_async_submit(struct sna *sna)
+{
+	if (!xf86ReturnOptValBool(sna->Options, OPTION_ASYNC_SUBMIT, FALSE))
+		return;
+
+	if (kgem_init_submit_thread(&sna->kgem))
+		xf86DrvMsg(sna->scrn->scrnIndex, X_CONFIG,
+			   "Submitting batches from a separate thread\n");
+	else
+		xf86DrvMsg(sna->scrn->scrnIndex, X_WARNING,
+			   "Failed to start the submission thread, submitting batches synchronously\n");
+}
+
+static void sna_setup_cache_budget(struct sna *sna)
+{
+	const char *str;
+	int threshold;
+
+	str = xf86GetOptValString(sna->Options, OPTION_CACHE_BUDGET);
+	if (str) {
+		unsigned long long size;
+		unsigned percent = 0;
+		char *end;
+
+		size = strtoull(str, &end, 0);
+		switch (*end) {
+		case '%': percent = size; size = 0; end++; break;
+		case 'G': case 'g': size <<= 10; /* fall through */
+		case 'M': case 'm': size <<= 10; /* fall through */
+		case 'K': case 'k': size <<= 10; end++; break;
+		}
+
+		if (end == str || *end || percent > 100)
+			xf86DrvMsg(sna->scrn->scrnIndex, X_WARNING,
+				   "Ignoring invalid CacheBudget \"%s\"\n", str);
+		else if (!kgem_set_cache_budget(&sna->kgem, size, percent))
+			xf86DrvMsg(sna->scrn->scrnIndex, X_WARNING,
+				   "Unable to determine available memory, ignoring CacheBudget\n");
+		else if (sna->kgem.cache_budget)
+			xf86DrvMsg(sna->scrn->scrnIndex, X_CONFIG,
+				   "Limiting idle buffer caches to %lldMiB\n",
+				   (long long)sna->kgem.cache_budget >> 20);
+	}
+
+	if (xf86GetOptValInteger(sna->Options, OPTION_CACHE_PRESSURE, &threshold) &&
+	    threshold > 0) {
+		if (kgem_init_pressure(&sna->kgem, threshold))
+			xf86DrvMsg(sna->scrn->scrnIndex, X_CONFIG,
+				   "Shrinking idle buffer caches when memory stalls exceed %d%%\n",
+				   threshold);
+		else
+			xf86DrvMsg(sna->scrn->scrnIndex, X_WARNING,
+				   "Memory pressure information (PSI) is not available\n");
+	}
+}
+
+static void sna_setup_upload_ring(struct sna *sna)
+{
+	int size;
+
+	if (!xf86GetOptValInteger(sna->Options, OPTION_UPLOAD_RING, &size) ||
+	    size <= 0)
+		return;
+
+	if (kgem_init_upload_ring(&sna->kgem, size << 10))
+		xf86DrvMsg(sna->scrn->scrnIndex, X_CONFIG,
+			   "Using a %dKiB ring for small uploads\n", size);
+	else
+		xf86DrvMsg(sna->scrn->scrnIndex, X_WARNING,
+			   "Failed to create the upload ring, using individual upload buffers\n");
+}
+
+static void sna_setup_capture(struct sna *sna)
+{
+	const char *path;
+
+	path = xf86GetOptValString(sna->Options, OPTION_BATCH_CAPTURE);
+	if (path == NULL)
+		return;
+
+	if (kgem_init_capture(&sna->kgem, path))
+		xf86DrvMsg(sna->scrn->scrnIndex, X_CONFIG,
+			   "Recording every batch to %s\n", path);
+	else
+		xf86DrvMsg(sna->scrn->scrnIndex, X_WARNING,
+			   "Failed to open %s for batch capture\n", path);
+}
+
+static void sna_setup_damage_capture(struct sna *sna)
+{
+	const char *path;
+
+	path = xf86GetOptValString(sna->Options, OPTION_DAMAGE_CAPTURE);
+	if (path == NULL)
+		return;
+
+	if (sna_damage_capture_init(path))
+		xf86DrvMsg(sna->scrn->scrnIndex, X_CONFIG,
+			   "Recording damage tracking to %s\n", path);
+	else
+		xf86DrvMsg(sna->scrn->scrnIndex, X_WARNING,
+			   "Failed to open %s for damage capture\n", path);
+}
+
 static bool enable_tear_free(struct sna *sna)
 {
 	if (sna->flags & SNA_LINEAR_FB)
@@ -548,6 +669,7 @@ static Bool sna_pre_init(ScrnInfoPtr scrn, int probe)
 		scrn->driverPrivate = sna;
 
 		sna->cpu_features = sna_cpu_detect();
+		choose_memcpy_blt(sna->cpu_features);
 		sna->acpi.fd = sna_acpi_open();
 	}
 	sna = to_sna(scrn);
@@ -618,6 +740,13 @@ static Bool sna_pre_init(ScrnInfoPtr scrn, int probe)
 		  xf86GetPciInfoForEntity(pEnt->index),
 		  sna->info->gen);
 
+	sna_setup_batch_limits(sna);
+	sna_setup_async_submit(sna);
+	sna_setup_cache_budget(sna);
+	sna_setup_upload_ring(sna);
+	sna_setup_capture(sna);
+	sna_setup_damage_capture(sna);
+
 	if (xf86ReturnOptValBool(sna->Options, OPTION_TILING_FB, FALSE))
 		sna->flags |= SNA_LINEAR_FB;
 
@@ -53,6 +53,112 @@ static inline bool must_tile(struct sna *sna, int width, int height)
 		upload_too_large(sna, width, height));
 }
 
+typedef void (*memcpy_func)(const void *src, void *dst, int bpp,
+			    int32_t src_stride, int32_t dst_stride,
+			    int16_t src_x, int16_t src_y,
+			    int16_t dst_x, int16_t dst_y,
+			    uint16_t width, uint16_t height);
+
+struct memcpy_thread {
+	memcpy_func func;
+	const void *src;
+	void *dst;
+	int bpp;
+	int32_t src_stride, dst_stride;
+	int16_t src_x, src_y;
+	int16_t dst_x, dst_y;
+	uint16_t width, height;
+};
+
+static void memcpy_thread(void *arg)
+{
+	struct memcpy_thread *t = arg;
+	t->func(t->src, t->dst, t->bpp,
+		t->src_stride, t->dst_stride,
+		t->src_x, t->src_y,
+		t->dst_x, t->dst_y,
+		t->width, t->height);
+}
+
+/* Large uploads and readbacks through the detiling functions are bound by
+ * the memory bandwidth of a single core, so split the box into bands of
+ * whole tile rows and spread them across the thread pool. The bands are
+ * aligned to the tiled side (tile_y) so that no two threads ever write
+ * into the same cacheline. The workers are stopped should any of them
+ * fault, in which case we report failure to the caller.
+ */
+static bool memcpy_box(memcpy_func func, int tile_height, bool to_tiled,
+		       const void *src, void *dst, int bpp,
+		       int32_t src_stride, int32_t dst_stride,
+		       int16_t src_x, int16_t src_y,
+		       int16_t dst_x, int16_t dst_y,
+		       uint16_t width, uint16_t height)
+{
+	int num_threads;
+
+	assert(src_x >= 0 && src_y >= 0);
+	assert(dst_x >= 0 && dst_y >= 0);
+	assert(8*src_stride >= (src_x+width) * bpp);
+	assert(8*dst_stride >= (dst_x+width) * bpp);
+
+	num_threads = sna_use_threads((width * bpp + 31) / 32, height, 256);
+	if (num_threads > 1) {
+		struct memcpy_thread data[num_threads];
+		int tile_y = to_tiled ? dst_y : src_y;
+		int y, end, n, m;
+
+		DBG(("%s: using %d threads for %dx%d copy\n",
+		     __FUNCTION__, num_threads, width, height));
+
+		for (y = n = m = 0; n < num_threads; n++) {
+			if (n + 1 == num_threads)
+				end = height;
+			else
+				end = ALIGN(tile_y + (n + 1) * height / num_threads,
+					    tile_height) - tile_y;
+			if (end > height)
+				end = height;
+			if (end <= y)
+				continue;
+
+			data[m].func = func;
+			data[m].src = src;
+			data[m].dst = dst;
+			data[m].bpp = bpp;
+			data[m].src_stride = src_stride;
+			data[m].dst_stride = dst_stride;
+			data[m].src_x = src_x;
+			data[m].src_y = src_y + y;
+			data[m].dst_x = dst_x;
+			data[m].dst_y = dst_y + y;
+			data[m].width = width;
+			data[m].height = end - y;
+			m++;
+
+			y = end;
+		}
+		assert(y == height);
+
+		if (sigtrap_get() == 0) {
+			for (n = 1; n < m; n++)
+				sna_threads_run(n, memcpy_thread, &data[n]);
+			memcpy_thread(&data[0]);
+			sna_threads_wait();
+			sigtrap_put();
+		} else {
+			sna_threads_kill();
+			return false;
+		}
+	} else
+		func(src, dst, bpp,
+		     src_stride, dst_stride,
+		     src_x, src_y,
+		     dst_x, dst_y,
+		     width, height);
+
+	return true;
+}
+
 static bool download_inplace__cpu(struct kgem *kgem,
 				  PixmapPtr p, struct kgem_bo *bo,
 				  const BoxRec *box, int nbox)
@@ -63,6 +169,10 @@ static bool download_inplace__cpu(struct kgem *kgem,
 	case I915_TILING_X:
 		if (!kgem->memcpy_from_tiled_x)
 			return false;
+		break;
+	case I915_TILING_Y:
+		if (!kgem->memcpy_from_tiled_y)
+			return false;
 	case I915_TILING_NONE:
 		break;
 	default:
@@ -101,12 +211,13 @@ read_boxes_inplace__cpu(struct kgem *kgem,
 	void *src, *dst = pixmap->devPrivate.ptr;
 	int src_pitch = bo->pitch;
 	int dst_pitch = pixmap->devKind;
+	memcpy_func func;
+	int tile_height;
 
 	if (!download_inplace__cpu(kgem, dst, bo, box, n))
 		return false;
 
 	assert(kgem_bo_can_map__cpu(kgem, bo, false));
-	assert(bo->tiling != I915_TILING_Y);
 
 	src = kgem_bo_map__cpu(kgem, bo);
 	if (src == NULL)
@@ -117,25 +228,35 @@ read_boxes_inplace__cpu(struct kgem *kgem,
 	if (sigtrap_get())
 		return false;
 
-	DBG(("%s x %d\n", __FUNCTION__, n));
+	DBG(("%s x %d, tiling=%d\n", __FUNCTION__, n, bo->tiling));
 
-	if (bo->tiling == I915_TILING_X) {
-		do {
-			memcpy_from_tiled_x(kgem, src, dst, bpp, src_pitch, dst_pitch,
-					    box->x1, box->y1,
-					    box->x1, box->y1,
-					    box->x2 - box->x1, box->y2 - box->y1);
-			box++;
-		} while (--n);
-	} else {
-		do {
-			memcpy_blt(src, dst, bpp, src_pitch, dst_pitch,
-				   box->x1, box->y1,
-				   box->x1, box->y1,
-				   box->x2 - box->x1, box->y2 - box->y1);
-			box++;
-		} while (--n);
+	switch (bo->tiling) {
+	case I915_TILING_X:
+		func = kgem->memcpy_from_tiled_x;
+		tile_height = 8;
+		break;
+	case I915_TILING_Y:
+		func = kgem->memcpy_from_tiled_y;
+		tile_height = 32;
+		break;
+	default:
+		func = memcpy_blt;
+		tile_height = 1;
+		break;
 	}
+	assert(func);
+
+	do {
+		if (!memcpy_box(func, tile_height, false,
+				src, dst, bpp, src_pitch, dst_pitch,
+				box->x1, box->y1,
+				box->x1, box->y1,
+				box->x2 - box->x1, box->y2 - box->y1)) {
+			sigtrap_put();
+			return false;
+		}
+		box++;
+	} while (--n);
 
 	sigtrap_put();
 	return true;
@@ -149,6 +270,7 @@ static void read_boxes_inplace(struct kgem *kgem,
 	void *src, *dst = pixmap->devPrivate.ptr;
 	int src_pitch = bo->pitch;
 	int dst_pitch = pixmap->devKind;
+	bool uncached;
 
 	if (read_boxes_inplace__cpu(kgem, pixmap, bo, box, n))
 		return;
@@ -167,10 +289,13 @@ static void read_boxes_inplace(struct kgem *kgem,
 	if (sigtrap_get())
 		return;
 
+	/* Reads through the GTT or WC are uncached, so use streaming loads */
+	uncached = src == bo->map__gtt || src == bo->map__wc;
+
 	assert(src != dst);
 	do {
-		DBG(("%s: copying box (%d, %d), (%d, %d)\n",
-		     __FUNCTION__, box->x1, box->y1, box->x2, box->y2));
+		DBG(("%s: copying box (%d, %d), (%d, %d), uncached? %d\n",
+		     __FUNCTION__, box->x1, box->y1, box->x2, box->y2, uncached));
 
 		assert(box->x2 > box->x1);
 		assert(box->y2 > box->y1);
@@ -185,11 +310,18 @@ static void read_boxes_inplace(struct kgem *kgem,
 		assert(box->x2 <= pixmap->drawable.width);
 		assert(box->y2 <= pixmap->drawable.height);
 
-		memcpy_blt(src, dst, bpp,
-			   src_pitch, dst_pitch,
-			   box->x1, box->y1,
-			   box->x1, box->y1,
-			   box->x2 - box->x1, box->y2 - box->y1);
+		if (uncached)
+			memcpy_blt__from_wc(src, dst, bpp,
+					    src_pitch, dst_pitch,
+					    box->x1, box->y1,
+					    box->x1, box->y1,
+					    box->x2 - box->x1, box->y2 - box->y1);
+		else
+			memcpy_blt(src, dst, bpp,
+				   src_pitch, dst_pitch,
+				   box->x1, box->y1,
+				   box->x1, box->y1,
+				   box->x2 - box->x1, box->y2 - box->y1);
 		box++;
 	} while (--n);
 
@@ -490,7 +622,7 @@ fallback:
 			rem = kgem_batch_space(kgem);
 			if (10*nbox_this_time > rem)
 				nbox_this_time = rem / 8;
-			if (2*nbox_this_time > KGEM_RELOC_SIZE(kgem) - kgem->nreloc)
+			if (2*nbox_this_time > kgem_reloc_space(kgem, 2*nbox_this_time))
 				nbox_this_time = (KGEM_RELOC_SIZE(kgem) - kgem->nreloc) / 2;
 			assert(nbox_this_time);
 			tmp_nbox -= nbox_this_time;
@@ -550,7 +682,7 @@ fallback:
 			rem = kgem_batch_space(kgem);
 			if (8*nbox_this_time > rem)
 				nbox_this_time = rem / 8;
-			if (2*nbox_this_time > KGEM_RELOC_SIZE(kgem) - kgem->nreloc)
+			if (2*nbox_this_time > kgem_reloc_space(kgem, 2*nbox_this_time))
 				nbox_this_time = (KGEM_RELOC_SIZE(kgem) - kgem->nreloc) / 2;
 			assert(nbox_this_time);
 			tmp_nbox -= nbox_this_time;
@@ -644,7 +776,9 @@ static bool upload_inplace__tiled(struct kgem *kgem, struct kgem_bo *bo)
 	DBG(("%s: tiling=%d\n", __FUNCTION__, bo->tiling));
 	switch (bo->tiling) {
 	case I915_TILING_Y:
-		return false;
+		if (!kgem->memcpy_to_tiled_y)
+			return false;
+		break;
 	case I915_TILING_X:
 		if (!kgem->memcpy_to_tiled_x)
 			return false;
@@ -658,6 +792,23 @@ static bool upload_inplace__tiled(struct kgem *kgem, struct kgem_bo *bo)
 	return kgem_bo_can_map__cpu(kgem, bo, true);
 }
 
+static bool upload_streaming(struct kgem *kgem,
+			     const BoxRec *box, int n, int bpp)
+{
+	uint64_t bytes;
+
+	/* Anything larger than half the cache will only evict itself (and
+	 * everything else) before the GPU gets around to reading it, so
+	 * write around the cache instead.
+	 */
+	bytes = 0;
+	while (n--) {
+		bytes += (box->x2 - box->x1) * (box->y2 - box->y1);
+		box++;
+	}
+	return (bytes * bpp >> 15) >= kgem->half_cpu_cache_pages;
+}
+
 static bool
 write_boxes_inplace__tiled(struct kgem *kgem,
                            const uint8_t *src, int stride, int bpp, int16_t src_dx, int16_t src_dy,
@@ -665,9 +816,11 @@ write_boxes_inplace__tiled(struct kgem *kgem,
                            const BoxRec *box, int n)
 {
 	uint8_t *dst;
+	memcpy_func func;
+	int tile_height;
+	bool streaming;
 
 	assert(kgem->has_wc_mmap || kgem_bo_can_map__cpu(kgem, bo, true));
-	assert(bo->tiling != I915_TILING_Y);
 
 	if (kgem_bo_can_map__cpu(kgem, bo, true)) {
 		dst = kgem_bo_map__cpu(kgem, bo);
@@ -683,26 +836,39 @@ write_boxes_inplace__tiled(struct kgem *kgem,
 		kgem_bo_sync__gtt(kgem, bo);
 	}
 
+	streaming = upload_streaming(kgem, box, n, bpp);
+	DBG(("%s: streaming? %d\n", __FUNCTION__, streaming));
+
 	if (sigtrap_get())
 		return false;
 
-	if (bo->tiling) {
-		do {
-			memcpy_to_tiled_x(kgem, src, dst, bpp, stride, bo->pitch,
-					  box->x1 + src_dx, box->y1 + src_dy,
-					  box->x1 + dst_dx, box->y1 + dst_dy,
-					  box->x2 - box->x1, box->y2 - box->y1);
-			box++;
-		} while (--n);
-	} else {
-		do {
-			memcpy_blt(src, dst, bpp, stride, bo->pitch,
-				   box->x1 + src_dx, box->y1 + src_dy,
-				   box->x1 + dst_dx, box->y1 + dst_dy,
-				   box->x2 - box->x1, box->y2 - box->y1);
-			box++;
-		} while (--n);
+	switch (bo->tiling) {
+	case I915_TILING_X:
+		func = streaming ? kgem->memcpy_to_tiled_x__nt : kgem->memcpy_to_tiled_x;
+		tile_height = 8;
+		break;
+	case I915_TILING_Y:
+		func = streaming ? kgem->memcpy_to_tiled_y__nt : kgem->memcpy_to_tiled_y;
+		tile_height = 32;
+		break;
+	default:
+		func = streaming ? memcpy_blt__nt : memcpy_blt;
+		tile_height = 1;
+		break;
 	}
+	assert(func);
+
+	do {
+		if (!memcpy_box(func, tile_height, true,
+				src, dst, bpp, stride, bo->pitch,
+				box->x1 + src_dx, box->y1 + src_dy,
+				box->x1 + dst_dx, box->y1 + dst_dy,
+				box->x2 - box->x1, box->y2 - box->y1)) {
+			sigtrap_put();
+			return false;
+		}
+		box++;
+	} while (--n);
 
 	sigtrap_put();
 	return true;
@@ -714,6 +880,7 @@ static bool write_boxes_inplace(struct kgem *kgem,
 				const BoxRec *box, int n)
 {
 	void *dst;
+	bool streaming;
 
 	DBG(("%s x %d, handle=%d, tiling=%d\n",
 	     __FUNCTION__, n, bo->handle, bo->tiling));
@@ -734,6 +901,8 @@ static bool write_boxes_inplace(struct kgem *kgem,
 
 	assert(dst != src);
 
+	streaming = upload_streaming(kgem, box, n, bpp);
+
 	if (sigtrap_get())
 		return false;
 
@@ -756,11 +925,11 @@ static bool write_boxes_inplace(struct kgem *kgem,
 		assert((box->x2 + src_dx)*bpp <= 8*stride);
 		assert(box->y1 + src_dy >= 0);
 
-		memcpy_blt(src, dst, bpp,
-			   stride, bo->pitch,
-			   box->x1 + src_dx, box->y1 + src_dy,
-			   box->x1 + dst_dx, box->y1 + dst_dy,
-			   box->x2 - box->x1, box->y2 - box->y1);
+		(streaming ? memcpy_blt__nt : memcpy_blt)(src, dst, bpp,
+							  stride, bo->pitch,
+							  box->x1 + src_dx, box->y1 + src_dy,
+							  box->x1 + dst_dx, box->y1 + dst_dy,
+							  box->x2 - box->x1, box->y2 - box->y1);
 		box++;
 	} while (--n);
 
@@ -1048,7 +1217,7 @@ tile:
 			rem = kgem_batch_space(kgem);
 			if (10*nbox_this_time > rem)
 				nbox_this_time = rem / 8;
-			if (2*nbox_this_time > KGEM_RELOC_SIZE(kgem) - kgem->nreloc)
+			if (2*nbox_this_time > kgem_reloc_space(kgem, 2*nbox_this_time))
 				nbox_this_time = (KGEM_RELOC_SIZE(kgem) - kgem->nreloc) / 2;
 			assert(nbox_this_time);
 			nbox -= nbox_this_time;
@@ -1142,7 +1311,7 @@ tile:
 			rem = kgem_batch_space(kgem);
 			if (8*nbox_this_time > rem)
 				nbox_this_time = rem / 8;
-			if (2*nbox_this_time > KGEM_RELOC_SIZE(kgem) - kgem->nreloc)
+			if (2*nbox_this_time > kgem_reloc_space(kgem, 2*nbox_this_time))
 				nbox_this_time = (KGEM_RELOC_SIZE(kgem) - kgem->nreloc) / 2;
 			assert(nbox_this_time);
 			nbox -= nbox_this_time;
@@ -1240,6 +1409,67 @@ fallback:
 				   box, nbox);
 }
 
+static bool upload_inplace__xor__tiled(struct kgem *kgem, struct kgem_bo *bo)
+{
+	DBG(("%s: tiling=%d\n", __FUNCTION__, bo->tiling));
+
+	/* Only X-tiling has a detiling xor function, and linear bo are
+	 * already handled through a direct map.
+	 */
+	if (bo->tiling != I915_TILING_X)
+		return false;
+
+	if (!kgem->memcpy_xor_to_tiled_x)
+		return false;
+
+	if (kgem->has_wc_mmap)
+		return true;
+
+	return kgem_bo_can_map__cpu(kgem, bo, true);
+}
+
+static bool
+write_boxes_inplace__xor__tiled(struct kgem *kgem,
+				const uint8_t *src, int stride, int bpp, int16_t src_dx, int16_t src_dy,
+				struct kgem_bo *bo, int16_t dst_dx, int16_t dst_dy,
+				const BoxRec *box, int n,
+				uint32_t and, uint32_t or)
+{
+	uint8_t *dst;
+
+	assert(bo->tiling == I915_TILING_X);
+	assert(kgem->has_wc_mmap || kgem_bo_can_map__cpu(kgem, bo, true));
+
+	if (kgem_bo_can_map__cpu(kgem, bo, true)) {
+		dst = kgem_bo_map__cpu(kgem, bo);
+		if (dst == NULL)
+			return false;
+
+		kgem_bo_sync__cpu(kgem, bo);
+	} else {
+		dst = kgem_bo_map__wc(kgem, bo);
+		if (dst == NULL)
+			return false;
+
+		kgem_bo_sync__gtt(kgem, bo);
+	}
+
+	if (sigtrap_get())
+		return false;
+
+	do {
+		memcpy_xor_to_tiled_x(kgem, src, dst, bpp, stride, bo->pitch,
+				      box->x1 + src_dx, box->y1 + src_dy,
+				      box->x1 + dst_dx, box->y1 + dst_dy,
+				      box->x2 - box->x1, box->y2 - box->y1,
+				      and, or);
+		box++;
+	} while (--n);
+
+	sigtrap_put();
+	return true;
+}
+
 static bool
 write_boxes_inplace__xor(struct kgem *kgem,
 			 const void *src, int stride, int bpp, int16_t src_dx, int16_t src_dy,
@@ -1251,6 +1481,12 @@ write_boxes_inplace__xor(struct kgem *kgem,
 
 	DBG(("%s x %d, tiling=%d\n", __FUNCTION__, n, bo->tiling));
 
+	if (upload_inplace__xor__tiled(kgem, bo) &&
+	    write_boxes_inplace__xor__tiled(kgem, src, stride, bpp, src_dx, src_dy,
+					    bo, dst_dx, dst_dy, box, n,
+					    and, or))
+		return true;
+
 	if (!kgem_bo_can_map(kgem, bo))
 		return false;
 
@@ -1303,7 +1539,7 @@ static bool upload_inplace__xor(struct kgem *kgem,
 	if (unlikely(kgem->wedged))
 		return true;
 
-	if (!kgem_bo_can_map(kgem, bo))
+	if (!kgem_bo_can_map(kgem, bo) && !upload_inplace__xor__tiled(kgem, bo))
 		return false;
 
 	return __upload_inplace(kgem, bo, box, n, bpp);
@@ -1551,7 +1787,7 @@ tile:
 			rem = kgem_batch_space(kgem);
 			if (10*nbox_this_time > rem)
 				nbox_this_time = rem / 8;
-			if (2*nbox_this_time > KGEM_RELOC_SIZE(kgem) - kgem->nreloc)
+			if (2*nbox_this_time > kgem_reloc_space(kgem, 2*nbox_this_time))
 				nbox_this_time = (KGEM_RELOC_SIZE(kgem) - kgem->nreloc) / 2;
 			assert(nbox_this_time);
 			nbox -= nbox_this_time;
@@ -1649,7 +1885,7 @@ tile:
 			rem = kgem_batch_space(kgem);
 			if (8*nbox_this_time > rem)
 				nbox_this_time = rem / 8;
-			if (2*nbox_this_time > KGEM_RELOC_SIZE(kgem) - kgem->nreloc)
+			if (2*nbox_this_time > kgem_reloc_space(kgem, 2*nbox_this_time))
 				nbox_this_time = (KGEM_RELOC_SIZE(kgem) - kgem->nreloc) / 2;
 			assert(nbox_this_time);
 			nbox -= nbox_this_time;
@@ -1749,6 +1985,174 @@ fallback:
 					and, or);
 }
 
+static bool
+write_boxes_inplace__convert(struct kgem *kgem,
+			     const void *src, int stride, int16_t src_dx, int16_t src_dy,
+			     struct kgem_bo *bo, int16_t dst_dx, int16_t dst_dy,
+			     const BoxRec *box, int n,
+			     uint32_t src_format, uint32_t dst_format)
+{
+	void *dst;
+	int tiling;
+
+	DBG(("%s x %d, tiling=%d\n", __FUNCTION__, n, bo->tiling));
+
+	/* Write directly into the tiles if we know the swizzling, otherwise
+	 * let a fenced GTT map do the tiling for us.
+	 */
+	if (kgem_can_retile(kgem, bo->tiling) &&
+	    (kgem->has_wc_mmap || kgem_bo_can_map__cpu(kgem, bo, true))) {
+		if (kgem_bo_can_map__cpu(kgem, bo, true)) {
+			dst = kgem_bo_map__cpu(kgem, bo);
+			if (dst == NULL)
+				return false;
+
+			kgem_bo_sync__cpu(kgem, bo);
+		} else {
+			dst = kgem_bo_map__wc(kgem, bo);
+			if (dst == NULL)
+				return false;
+
+			kgem_bo_sync__gtt(kgem, bo);
+		}
+		tiling = bo->tiling;
+	} else {
+		if (!kgem_bo_can_map(kgem, bo))
+			return false;
+
+		kgem_bo_submit(kgem, bo);
+
+		dst = kgem_bo_map(kgem, bo);
+		if (dst == NULL)
+			return false;
+
+		tiling = I915_TILING_NONE;
+	}
+
+	if (sigtrap_get())
+		return false;
+
+	do {
+		DBG(("%s: (%d, %d) -> (%d, %d) x (%d, %d) [src_pitch=%d, dst_pitch=%d]\n", __FUNCTION__,
+		     box->x1 + src_dx, box->y1 + src_dy,
+		     box->x1 + dst_dx, box->y1 + dst_dy,
+		     box->x2 - box->x1, box->y2 - box->y1,
+		     stride, bo->pitch));
+
+		assert(box->x1 + src_dx >= 0);
+		assert(box->y1 + src_dy >= 0);
+		assert(box->x1 + dst_dx >= 0);
+		assert(box->y1 + dst_dy >= 0);
+		assert((box->x2 + dst_dx)*4 <= bo->pitch);
+
+		memcpy_convert(src, dst, src_format, dst_format,
+			       tiling, kgem->swizzling[tiling],
+			       stride, bo->pitch,
+			       box->x1 + src_dx, box->y1 + src_dy,
+			       box->x1 + dst_dx, box->y1 + dst_dy,
+			       box->x2 - box->x1, box->y2 - box->y1);
+		box++;
+	} while (--n);
+
+	sigtrap_put();
+	return true;
+}
+
+/* As sna_write_boxes(), but the source pixels are in src_format and are
+ * expanded to dst_format (see memcpy_convert_supported()) as they are
+ * written, without first converting the whole source.
+ */
+bool sna_write_boxes__convert(struct sna *sna, PixmapPtr dst,
+			      struct kgem_bo *dst_bo, int16_t dst_dx, int16_t dst_dy,
+			      const void *src, int stride, int16_t src_dx, int16_t src_dy,
+			      const BoxRec *box, int nbox,
+			      uint32_t src_format, uint32_t dst_format)
+{
+	struct kgem *kgem = &sna->kgem;
+	struct kgem_bo *src_bo;
+	DrawableRec tmp;
+	BoxRec extents;
+	void *ptr;
+	bool ok;
+	int n;
+
+	DBG(("%s x %d, format %08x -> %08x\n",
+	     __FUNCTION__, nbox, src_format, dst_format));
+	assert(memcpy_convert_supported(src_format, dst_format));
+	assert(dst->drawable.bitsPerPixel == 32);
+
+	if (upload_inplace(kgem, dst_bo, box, nbox, 32) &&
+	    write_boxes_inplace__convert(kgem,
+					 src, stride, src_dx, src_dy,
+					 dst_bo, dst_dx, dst_dy,
+					 box, nbox,
+					 src_format, dst_format))
+		return true;
+
+	if (wedged(sna))
+		return false;
+
+	extents = box[0];
+	for (n = 1; n < nbox; n++) {
+		if (box[n].x1 < extents.x1)
+			extents.x1 = box[n].x1;
+		if (box[n].x2 > extents.x2)
+			extents.x2 = box[n].x2;
+
+		if (box[n].y1 < extents.y1)
+			extents.y1 = box[n].y1;
+		if (box[n].y2 > extents.y2)
+			extents.y2 = box[n].y2;
+	}
+
+	tmp.width  = extents.x2 - extents.x1;
+	tmp.height = extents.y2 - extents.y1;
+	tmp.depth  = dst->drawable.depth;
+	tmp.bitsPerPixel = dst->drawable.bitsPerPixel;
+
+	if (must_tile(sna, tmp.width, tmp.height))
+		goto fallback;
+
+	src_bo = kgem_create_buffer_2d(kgem,
+				       tmp.width, tmp.height,
+				       tmp.bitsPerPixel,
+				       KGEM_BUFFER_WRITE_INPLACE,
+				       &ptr);
+	if (!src_bo)
+		goto fallback;
+
+	ok = false;
+	if (sigtrap_get() == 0) {
+		for (n = 0; n < nbox; n++)
+			memcpy_convert(src, ptr, src_format, dst_format,
+				       I915_TILING_NONE, 0,
+				       stride, src_bo->pitch,
+				       box[n].x1 + src_dx,
+				       box[n].y1 + src_dy,
+				       box[n].x1 - extents.x1,
+				       box[n].y1 - extents.y1,
+				       box[n].x2 - box[n].x1,
+				       box[n].y2 - box[n].y1);
+
+		ok = sna->render.copy_boxes(sna, GXcopy,
+					    &tmp, src_bo, -extents.x1, -extents.y1,
+					    &dst->drawable, dst_bo, dst_dx, dst_dy,
+					    box, nbox, 0);
+		sigtrap_put();
+	}
+
+	kgem_bo_destroy(kgem, src_bo);
+	if (ok)
+		return true;
+
+fallback:
+	return write_boxes_inplace__convert(kgem,
+					    src, stride, src_dx, src_dy,
+					    dst_bo, dst_dx, dst_dy,
+					    box, nbox,
+					    src_format, dst_format);
+}
+
 static bool
 indirect_replace(struct sna *sna,
 		 PixmapPtr pixmap,
@@ -1907,6 +2311,7 @@ sna_replace__xor(struct sna *sna, PixmapPtr pixmap,
 {
 	struct sna_pixmap *priv = sna_pixmap(pixmap);
 	struct kgem_bo *bo = priv->gpu_bo;
+	BoxRec box;
 	void *dst;
 
 	DBG(("%s(handle=%d, %dx%d, bpp=%d, tiling=%d)\n",
@@ -1920,7 +2325,12 @@ sna_replace__xor(struct sna *sna, PixmapPtr pixmap,
 
 	kgem_bo_undo(&sna->kgem, bo);
 
-	if (!kgem_bo_can_map(&sna->kgem, bo) ||
+	box.x1 = box.y1 = 0;
+	box.x2 = pixmap->drawable.width;
+	box.y2 = pixmap->drawable.height;
+
+	if ((!kgem_bo_can_map(&sna->kgem, bo) &&
+	     !upload_inplace__xor__tiled(&sna->kgem, bo)) ||
 	    __kgem_bo_is_busy(&sna->kgem, bo)) {
 		struct kgem_bo *new_bo;
 
@@ -1934,9 +2344,16 @@ sna_replace__xor(struct sna *sna, PixmapPtr pixmap,
 			bo = new_bo;
 	}
 
-	if (kgem_bo_can_map(&sna->kgem, bo) &&
-	    (dst = kgem_bo_map(&sna->kgem, bo)) != NULL &&
-	    sigtrap_get() == 0) {
+	if (upload_inplace__xor__tiled(&sna->kgem, bo) &&
+	    write_boxes_inplace__xor__tiled(&sna->kgem,
+					    src, stride, pixmap->drawable.bitsPerPixel, 0, 0,
+					    bo, 0, 0,
+					    &box, 1,
+					    and, or)) {
+		DBG(("%s: replaced through detiling\n", __FUNCTION__));
+	} else if (kgem_bo_can_map(&sna->kgem, bo) &&
+		   (dst = kgem_bo_map(&sna->kgem, bo)) != NULL &&
+		   sigtrap_get() == 0) {
 		memcpy_xor(src, dst, pixmap->drawable.bitsPerPixel,
 			   stride, bo->pitch,
 			   0, 0,
@@ -1946,17 +2363,11 @@ sna_replace__xor(struct sna *sna, PixmapPtr pixmap,
 			   and, or);
 		sigtrap_put();
 	} else {
-		BoxRec box;
-
 		if (bo != priv->gpu_bo) {
 			kgem_bo_destroy(&sna->kgem, bo);
 			bo = priv->gpu_bo;
 		}
 
-		box.x1 = box.y1 = 0;
-		box.x2 = pixmap->drawable.width;
-		box.y2 = pixmap->drawable.height;
-
 		if (!sna_write_boxes__xor(sna, pixmap,
 					  bo, 0, 0,
 					  src, stride, 0, 0,
@@ -1863,14 +1863,6 @@ sna_render_picture_convert(struct sna *sna,
 		if (!sna_pixmap_move_to_cpu(pixmap, MOVE_READ))
 			return 0;
 
-		src = pixman_image_create_bits((pixman_format_code_t)picture->format,
-					       pixmap->drawable.width,
-					       pixmap->drawable.height,
-					       pixmap->devPrivate.ptr,
-					       pixmap->devKind);
-		if (!src)
-			return 0;
-
 		if (PICT_FORMAT_RGB(picture->format) == 0) {
 			channel->pict_format = PIXMAN_a8;
 			DBG(("%s: converting to a8 from %08x\n",
@@ -1885,29 +1877,55 @@ sna_render_picture_convert(struct sna *sna,
 						    w, h, PIXMAN_FORMAT_BPP(channel->pict_format),
 						    KGEM_BUFFER_WRITE_INPLACE,
 						    &ptr);
-		if (!channel->bo) {
-			pixman_image_unref(src);
+		if (!channel->bo)
 			return 0;
-		}
 
-		dst = pixman_image_create_bits(channel->pict_format,
-					       w, h, ptr, channel->bo->pitch);
-		if (!dst) {
-			kgem_bo_destroy(&sna->kgem, channel->bo);
-			pixman_image_unref(src);
-			return 0;
-		}
+		if (memcpy_convert_supported(picture->format,
+					     channel->pict_format)) {
+			DBG(("%s: converting with memcpy_convert\n",
+			     __FUNCTION__));
+			if (sigtrap_get() == 0) {
+				memcpy_convert(pixmap->devPrivate.ptr, ptr,
+					       picture->format,
+					       channel->pict_format,
+					       I915_TILING_NONE, 0,
+					       pixmap->devKind,
+					       channel->bo->pitch,
+					       box.x1, box.y1,
+					       0, 0,
+					       w, h);
+				sigtrap_put();
+			}
+		} else {
+			src = pixman_image_create_bits((pixman_format_code_t)picture->format,
+						       pixmap->drawable.width,
+						       pixmap->drawable.height,
+						       pixmap->devPrivate.ptr,
+						       pixmap->devKind);
+			if (!src) {
+				kgem_bo_destroy(&sna->kgem, channel->bo);
+				return 0;
+			}
 
-		if (sigtrap_get() == 0) {
-			sna_image_composite(PictOpSrc, src, NULL, dst,
-					    box.x1, box.y1,
-					    0, 0,
-					    0, 0,
-					    w, h);
-			sigtrap_put();
+			dst = pixman_image_create_bits(channel->pict_format,
+						       w, h, ptr, channel->bo->pitch);
+			if (!dst) {
+				kgem_bo_destroy(&sna->kgem, channel->bo);
+				pixman_image_unref(src);
+				return 0;
+			}
+
+			if (sigtrap_get() == 0) {
+				sna_image_composite(PictOpSrc, src, NULL, dst,
+						    box.x1, box.y1,
+						    0, 0,
+						    0, 0,
+						    w, h);
+				sigtrap_put();
+			}
+			pixman_image_unref(dst);
+			pixman_image_unref(src);
 		}
-		pixman_image_unref(dst);
-		pixman_image_unref(src);
 	}
 
 	channel->width  = w;
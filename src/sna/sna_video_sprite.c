@@ -348,6 +348,7 @@ sna_video_sprite_show(struct sna *sna,
 	     s.crtc_x, s.crtc_y, s.crtc_w, s.crtc_h,
 	     s.src_x >> 16, s.src_y >> 16, s.src_w >> 16, s.src_h >> 16));
 
+	kgem_submit_wait(&sna->kgem);
 	if (drmIoctl(sna->kgem.fd, LOCAL_IOCTL_MODE_SETPLANE, &s)) {
 		DBG(("SET_PLANE failed: ret=%d\n", errno));
 		memset(&s, 0, sizeof(s));
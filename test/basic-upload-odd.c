@@ -0,0 +1,146 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <X11/Xutil.h> /* for XDestroyImage */
+#include <pixman.h> /* for pixman blt functions */
+
+#include "test.h"
+
+/* Small images of odd height are uploaded with their padding row trimmed
+ * from the upload buffer. Upload many of them, copying each to the target
+ * and reading back a pixel every few copies so that the uploads straddle
+ * several batches, whilst freeing and recreating sources at random so
+ * that the upload storage is recycled. Sources are copied again long
+ * after they were first uploaded, to catch upload storage that was reused
+ * whilst still in use.
+ */
+
+#define NSOURCE 64
+
+struct source {
+	Pixmap pixmap;
+	int width, height;
+	uint32_t fg;
+};
+
+static void source_create(struct test_display *dpy,
+			  struct test_target *tt,
+			  struct source *src)
+{
+	XImage image;
+	GC gc;
+
+	if (src->pixmap)
+		XFreePixmap(dpy->dpy, src->pixmap);
+
+	src->width = 1 + rand() % 32;
+	src->height = 2 * (rand() % 16) + 1;
+	src->fg = color(rand() % 0xff, rand() % 0xff, rand() % 0xff, 0xff);
+	src->pixmap = XCreatePixmap(dpy->dpy, tt->draw,
+				    src->width, src->height, tt->depth);
+
+	test_init_image(&image, &dpy->shm, tt->format,
+			src->width, src->height);
+	pixman_fill((uint32_t*)image.data,
+		    image.bytes_per_line/sizeof(uint32_t),
+		    image.bits_per_pixel,
+		    0, 0, src->width, src->height, src->fg);
+
+	gc = XCreateGC(dpy->dpy, src->pixmap, 0, NULL);
+	XPutImage(dpy->dpy, src->pixmap, gc, &image,
+		  0, 0, 0, 0, src->width, src->height);
+	XFreeGC(dpy->dpy, gc);
+}
+
+static void clear(struct test_display *dpy, struct test_target *tt)
+{
+	XRenderColor render_color = {0};
+	XRenderFillRectangle(dpy->dpy, PictOpClear, tt->picture, &render_color,
+			     0, 0, tt->width, tt->height);
+}
+
+static void upload_tests(struct test *t, int reps, int sets, enum target target)
+{
+	struct source src[NSOURCE] = {};
+	struct test_target tt;
+	XImage image;
+	uint32_t *cells = calloc(sizeof(uint32_t), t->out.width*t->out.height);
+	int r, s, x, y, i;
+
+	printf("Testing odd-height uploads (%s): ", test_target_name(target));
+	fflush(stdout);
+
+	test_target_create_render(&t->out, target, &tt);
+	clear(&t->out, &tt);
+
+	for (s = 0; s < sets; s++) {
+		for (r = 0; r < reps; r++) {
+			i = rand() % NSOURCE;
+			if (src[i].pixmap == 0 || rand() % 4 == 0)
+				source_create(&t->out, &tt, &src[i]);
+
+			x = rand() % (tt.width - src[i].width + 1);
+			y = rand() % (tt.height - src[i].height + 1);
+			XCopyArea(t->out.dpy, src[i].pixmap, tt.draw, tt.gc,
+				  0, 0, src[i].width, src[i].height, x, y);
+			pixman_fill(cells, tt.width, 32,
+				    x, y, src[i].width, src[i].height,
+				    src[i].fg);
+
+			/* force the batch out between uploads */
+			if (r % 8 == 7) {
+				test_init_image(&image, &t->out.shm, tt.format, 1, 1);
+				XShmGetImage(t->out.dpy, tt.draw, &image,
+					     x, y, AllPlanes);
+			}
+		}
+
+		test_init_image(&image, &t->out.shm, tt.format, tt.width, tt.height);
+		XShmGetImage(t->out.dpy, tt.draw, &image, 0, 0, AllPlanes);
+
+		for (y = 0; y < tt.height; y++) {
+			for (x = 0; x < tt.width; x++) {
+				uint32_t result =
+					*(uint32_t *)(image.data +
+						      y*image.bytes_per_line +
+						      image.bits_per_pixel*x/8);
+				if (!pixel_equal(image.depth, result, cells[y*tt.width+x])) {
+					uint32_t mask = depth_mask(image.depth);
+
+					die("failed to upload pixel (%d,%d) as %08x, found %08x instead\n",
+					    x, y,
+					    cells[y*tt.width+x] & mask,
+					    result & mask);
+				}
+			}
+		}
+	}
+
+	printf("passed [%d iterations x %d]\n", reps, sets);
+
+	for (i = 0; i < NSOURCE; i++) {
+		if (src[i].pixmap)
+			XFreePixmap(t->out.dpy, src[i].pixmap);
+	}
+	test_target_destroy_render(&t->out, &tt);
+	free(cells);
+}
+
+int main(int argc, char **argv)
+{
+	struct test test;
+	int i;
+
+	test_init(&test, argc, argv);
+
+	for (i = 0; i <= DEFAULT_ITERATIONS; i++) {
+		int reps = REPS(i), sets = SETS(i);
+		enum target t;
+
+		for (t = TARGET_FIRST; t <= TARGET_LAST; t++)
+			upload_tests(&test, reps, sets, t);
+	}
+
+	return 0;
+}
@@ -0,0 +1,299 @@
+/*
+ * Copyright © 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/* Mimic a compositing manager redrawing many windows every frame.
+ *
+ * Each "window" is a separate ARGB32 pixmap with its own A8 shadow mask,
+ * so every frame references 2*N distinct buffers. The time per frame is
+ * reported along with, given the server pid, the X server CPU time per
+ * frame and, with SNA, the number of batches per frame. The batch count
+ * is read back from the driver statistics that are appended to the
+ * server log given with -l when the server receives SIGUSR2.
+ *
+ * Compare the default with Option "MaxBatchObjects" "384" to see the
+ * effect of the growable exec/reloc arrays.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/Xrender.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+
+static double elapsed(const struct timespec *start,
+		      const struct timespec *end)
+{
+	return 1e6*(end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec)/1000;
+}
+
+static double server_cpu(pid_t pid)
+{
+	char path[80], buf[1024], *s;
+	unsigned long utime, stime;
+	FILE *file;
+	int i;
+
+	if (pid <= 0)
+		return -1;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+	file = fopen(path, "r");
+	if (file == NULL)
+		return -1;
+
+	s = fgets(buf, sizeof(buf), file);
+	fclose(file);
+	if (s == NULL)
+		return -1;
+
+	/* skip past "pid (comm)" as comm may contain spaces */
+	s = strrchr(buf, ')');
+	if (s == NULL)
+		return -1;
+
+	/* utime and stime are fields 14 and 15 */
+	for (i = 2; i < 14 && s; i++)
+		s = strchr(s + 1, ' ');
+	if (s == NULL || sscanf(s, "%lu %lu", &utime, &stime) != 2)
+		return -1;
+
+	return 1e6 * (utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static long long server_batches(Display *dpy, pid_t pid, const char *log)
+{
+	long long render, bsd, blt;
+	char buf[4096];
+	struct stat st;
+	int retry;
+
+	if (pid <= 0 || log == NULL)
+		return -1;
+
+	/* only look at what the server writes in response to our signal */
+	if (stat(log, &st))
+		return -1;
+
+	if (kill(pid, SIGUSR2))
+		return -1;
+
+	/* wake the server up so that it dumps its stats in the block handler,
+	 * and then wait for the dump to reach the log
+	 */
+	for (retry = 0; retry < 500; retry++) {
+		FILE *file;
+
+		XSync(dpy, False);
+
+		file = fopen(log, "r");
+		if (file == NULL)
+			return -1;
+
+		if (fseek(file, st.st_size, SEEK_SET) == 0) {
+			while (fgets(buf, sizeof(buf), file)) {
+				const char *s = strstr(buf, "kgem: batches render ");
+				if (s == NULL)
+					continue;
+
+				if (sscanf(s, "kgem: batches render %lld, bsd %lld, blt %lld",
+					   &render, &bsd, &blt) == 3) {
+					fclose(file);
+					return render + bsd + blt;
+				}
+			}
+		}
+		fclose(file);
+
+		usleep(10 * 1000);
+	}
+
+	return -1;
+}
+
+static Picture create_picture(Display *dpy, Window root,
+			      int width, int height, int depth,
+			      XRenderPictFormat *format,
+			      const XRenderColor *color)
+{
+	Pixmap pixmap;
+	Picture picture;
+
+	pixmap = XCreatePixmap(dpy, root, width, height, depth);
+	picture = XRenderCreatePicture(dpy, pixmap, format, 0, NULL);
+	XFreePixmap(dpy, pixmap);
+
+	XRenderFillRectangle(dpy, PictOpSrc, picture, color,
+			     0, 0, width, height);
+	return picture;
+}
+
+static void position(int i, int size, int width, int height, int *x, int *y)
+{
+	int step = size / 2, cols = (width - size) / step + 1;
+
+	*x = i % cols * step;
+	*y = i / cols * step % (height - size + 1);
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"usage: %s [-n windows] [-s size] [-f frames] [-p xserver-pid] [-l logfile]\n",
+		argv0);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *log = NULL;
+	int nwindows = 512, size = 64, frames = 200;
+	XRenderPictFormat *argb, *a8, *format;
+	XSetWindowAttributes attr;
+	Picture *src, *mask, dst;
+	struct timespec start, end;
+	long long batches[2];
+	double cpu[2];
+	Display *dpy;
+	Window root, win;
+	int width, height;
+	pid_t pid = 0;
+	int i, n, c;
+
+	while ((c = getopt(argc, argv, "n:s:f:p:l:")) != -1) {
+		switch (c) {
+		case 'n': nwindows = atoi(optarg); break;
+		case 's': size = atoi(optarg); break;
+		case 'f': frames = atoi(optarg); break;
+		case 'p': pid = atoi(optarg); break;
+		case 'l': log = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (nwindows <= 0 || size <= 1 || frames <= 0)
+		usage(argv[0]);
+
+	dpy = XOpenDisplay(NULL);
+	if (dpy == NULL)
+		return 77;
+
+	if (!XRenderQueryExtension(dpy, &c, &c))
+		return 77;
+
+	root = DefaultRootWindow(dpy);
+	width = DisplayWidth(dpy, DefaultScreen(dpy));
+	height = DisplayHeight(dpy, DefaultScreen(dpy));
+	if (size > width || size > height)
+		usage(argv[0]);
+
+	attr.override_redirect = 1;
+	win = XCreateWindow(dpy, root, 0, 0, width, height, 0,
+			    DefaultDepth(dpy, DefaultScreen(dpy)),
+			    InputOutput,
+			    DefaultVisual(dpy, DefaultScreen(dpy)),
+			    CWOverrideRedirect, &attr);
+	XMapWindow(dpy, win);
+
+	format = XRenderFindVisualFormat(dpy, DefaultVisual(dpy, DefaultScreen(dpy)));
+	dst = XRenderCreatePicture(dpy, win, format, 0, NULL);
+
+	argb = XRenderFindStandardFormat(dpy, PictStandardARGB32);
+	a8 = XRenderFindStandardFormat(dpy, PictStandardA8);
+
+	src = malloc(sizeof(Picture) * nwindows);
+	mask = malloc(sizeof(Picture) * nwindows);
+	if (src == NULL || mask == NULL)
+		return 1;
+
+	for (i = 0; i < nwindows; i++) {
+		XRenderColor color;
+
+		color.red = (i * 0x3131) & 0xffff;
+		color.green = (i * 0x5757) & 0xffff;
+		color.blue = (i * 0x7979) & 0xffff;
+		color.alpha = 0xffff;
+		src[i] = create_picture(dpy, root, size, size, 32, argb, &color);
+
+		color.alpha = 0x8000 + (i & 0x7fff);
+		mask[i] = create_picture(dpy, root, size, size, 8, a8, &color);
+	}
+
+	/* one untimed frame to move everything onto the GPU */
+	for (i = 0; i < nwindows; i++) {
+		int x, y;
+
+		position(i, size, width, height, &x, &y);
+		XRenderComposite(dpy, PictOpOver, src[i], mask[i], dst,
+				 0, 0, 0, 0, x, y, size, size);
+	}
+	XSync(dpy, False);
+
+	batches[0] = server_batches(dpy, pid, log);
+	cpu[0] = server_cpu(pid);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (n = 0; n < frames; n++) {
+		for (i = 0; i < nwindows; i++) {
+			int j = (i + n) % nwindows;
+			int x, y;
+
+			position(i, size, width, height, &x, &y);
+			XRenderComposite(dpy, PictOpOver, src[j], mask[j], dst,
+					 0, 0, 0, 0, x, y, size, size);
+		}
+		XSync(dpy, False);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	cpu[1] = server_cpu(pid);
+	batches[1] = server_batches(dpy, pid, log);
+
+	printf("%d windows of %dx%d, %d frames: %.1fus per frame",
+	       nwindows, size, size, frames, elapsed(&start, &end) / frames);
+	if (cpu[0] >= 0 && cpu[1] >= 0)
+		printf(", server CPU %.1fus per frame", (cpu[1] - cpu[0]) / frames);
+	if (batches[0] >= 0 && batches[1] >= 0)
+		printf(", %.2f batches per frame",
+		       (double)(batches[1] - batches[0]) / frames);
+	printf("\n");
+
+	for (i = 0; i < nwindows; i++) {
+		XRenderFreePicture(dpy, src[i]);
+		XRenderFreePicture(dpy, mask[i]);
+	}
+	XRenderFreePicture(dpy, dst);
+	XDestroyWindow(dpy, win);
+	XCloseDisplay(dpy);
+
+	return 0;
+}